@@ -0,0 +1,63 @@
+#include "alloc_counter.hpp"
+
+#include <atomic>
+#include <cstdlib>
+
+extern "C"
+{
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t num, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void  __libc_free(void* ptr);
+}
+
+namespace
+{
+    std::atomic<size_t> alloc_count{0};
+    std::atomic<size_t> alloc_bytes{0};
+
+    void count(size_t size)
+    {
+        alloc_count.fetch_add(1, std::memory_order_relaxed);
+        alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+    }
+}
+
+
+extern "C"
+{
+void* malloc(size_t size) noexcept
+{
+    count(size);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t num, size_t size) noexcept
+{
+    count(num * size);
+    return __libc_calloc(num, size);
+}
+
+void* realloc(void* ptr, size_t size) noexcept
+{
+    count(size);
+    return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr) noexcept
+{
+    __libc_free(ptr);
+}
+}
+
+
+size_t bench::allocations()
+{
+    return alloc_count.load(std::memory_order_relaxed);
+}
+
+
+size_t bench::allocated_bytes()
+{
+    return alloc_bytes.load(std::memory_order_relaxed);
+}
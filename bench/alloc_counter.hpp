@@ -0,0 +1,25 @@
+/**
+ * @file alloc_counter.hpp
+ * @author Domnikov Ivan
+ * @brief Counter of heap allocations made by benchmark process.
+ *
+ */
+#pragma once
+
+#include <cstddef>
+
+namespace bench
+{
+
+/**
+ * @brief Number of malloc/calloc/realloc calls since process start.
+ * @details Counts allocations made by operator new and by C libraries (OpenSSL) as well.
+ */
+size_t allocations();
+
+/**
+ * @brief Number of bytes requested by malloc/calloc/realloc calls since process start.
+ */
+size_t allocated_bytes();
+
+} // namespace bench
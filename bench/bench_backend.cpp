@@ -0,0 +1,189 @@
+#include "../src/hash_server.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+/** Lines sent by each connection per iteration*/
+constexpr size_t LINES = 512;
+
+/** Each benchmark run listens its own port*/
+uint16_t next_port()
+{
+    static uint16_t port = 56200;
+    return port++;
+}
+
+
+int connect_to(uint16_t port)
+{
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    // Server is started by another thread
+    for (int attempts = 100; attempts; --attempts)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (0 == connect(fd, (sockaddr*)&addr, sizeof(addr)))
+        {
+            return fd;
+        }
+        close(fd);
+        usleep(10000);
+    }
+    return -1;
+}
+
+
+/**
+ * @brief Lines per second of whole server over loopback with epoll or io_uring pool
+ * @details Each iteration every connection sends LINES lines and reads all results.
+ * @details Argument is number of connections.
+ */
+template <template <class> class Pool>
+void BM_backend(benchmark::State& state)
+{
+    if constexpr (std::is_same_v<Pool<net::hash_ev_manager_t>, net::uring_pool_t<net::hash_ev_manager_t>>)
+    {
+        if (!net::uring_t::is_supported())
+        {
+            state.SkipWithError("io_uring is not supported by kernel");
+            return;
+        }
+    }
+
+    auto port = next_port();
+    net::server_t<net::tcp_soct_t, net::hash_ev_manager_t, Pool> server(2);
+    std::thread thr([&]{server.run(port);});
+
+    std::vector<int> clients;
+    for (int i = 0; i < state.range(0); ++i)
+    {
+        clients.push_back(connect_to(port));
+        if (-1 == clients.back())
+        {
+            state.SkipWithError("Cannot connect to server");
+            break;
+        }
+    }
+
+    std::string payload;
+    for (size_t i = 0; i < LINES; ++i)
+    {
+        payload += std::to_string(i * 7919) + "-hash-server-benchmark-line\n";
+    }
+    const size_t result_size = LINES * 33;
+    std::vector<char> buf(result_size);
+
+    for (auto _ : state)
+    {
+        for (auto fd : clients)
+        {
+            if (write(fd, payload.data(), payload.size()) != static_cast<ssize_t>(payload.size()))
+            {
+                state.SkipWithError("Send failed");
+            }
+        }
+        for (auto fd : clients)
+        {
+            for (size_t received = 0; received < result_size;)
+            {
+                auto count = read(fd, buf.data() + received, result_size - received);
+                if (count <= 0)
+                {
+                    state.SkipWithError("Receive failed");
+                    break;
+                }
+                received += count;
+            }
+        }
+    }
+
+    for (auto fd : clients)
+    {
+        close(fd);
+    }
+    server.kill();
+    thr.join();
+
+    state.SetItemsProcessed(state.iterations() * LINES * clients.size());
+}
+
+
+/**
+ * @brief Bytes per second of one connection uploading many lines at once
+ * @details Argument is number of hash threads. 0 - lines are hashed by event loop thread.
+ */
+void BM_bulk_upload(benchmark::State& state)
+{
+    net::pipeline_options_t pipeline;
+    pipeline.workers = state.range(0);
+    pipeline.bulk_threshold = 0;
+
+    auto port = next_port();
+    net::server_t<net::tcp_soct_t, net::hash_ev_manager_t> server(1, pipeline);
+    std::thread thr([&]{server.run(port);});
+
+    std::string payload;
+    for (size_t i = 0; payload.size() < (16 << 20); ++i)
+    {
+        payload += std::to_string(i * 7919) + std::string(i % 200, 'x') + "\n";
+    }
+    const size_t lines = std::count(payload.begin(), payload.end(), '\n');
+    std::vector<char> buf(64 * 1024);
+
+    for (auto _ : state)
+    {
+        int fd = connect_to(port);
+        if (-1 == fd)
+        {
+            state.SkipWithError("Cannot connect to server");
+            break;
+        }
+
+        // Client writes and reads at the same time as cat file | nc
+        std::thread writer([&]{
+            if (write(fd, payload.data(), payload.size()) != static_cast<ssize_t>(payload.size()))
+            {
+                state.SkipWithError("Send failed");
+            }
+            shutdown(fd, SHUT_WR);
+        });
+        size_t received = 0;
+        for (ssize_t count; (count = read(fd, buf.data(), buf.size())) > 0;)
+        {
+            received += count;
+        }
+        writer.join();
+        close(fd);
+
+        if (received != lines * 33)
+        {
+            state.SkipWithError("Results were lost");
+            break;
+        }
+    }
+
+    server.kill();
+    thr.join();
+
+    state.SetBytesProcessed(state.iterations() * payload.size());
+}
+
+
+} // namespace
+
+BENCHMARK(BM_bulk_upload)->Arg(0)->Arg(1)->Arg(2)->Arg(4)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_backend, net::connection_pool_t)->Name("BM_backend/epoll")->Arg(1)->Arg(16)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_backend, net::uring_pool_t     )->Name("BM_backend/uring")->Arg(1)->Arg(16)->UseRealTime();
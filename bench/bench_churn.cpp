@@ -0,0 +1,194 @@
+#include "../src/connection_pool.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+using manager_t = net::hash_ev_manager_t;
+using allocator_t = net::connection_pool_t<manager_t>::allocator_t;
+
+constexpr size_t BATCH = 256;
+
+
+/** Create connection object with heap or with slab*/
+template <bool SLAB>
+epoll_event create(allocator_t& slab, int fd = -1)
+{
+    if constexpr (SLAB) return manager_t::create_event(fd, slab);
+    else                return manager_t::create_event(fd);
+}
+
+/** Delete connection object with heap or with slab*/
+template <bool SLAB>
+void destroy(epoll_event& event, allocator_t& slab)
+{
+    if constexpr (SLAB) manager_t::delete_event(event, slab);
+    else                manager_t::delete_event(event);
+}
+
+
+/** Connection objects created and deleted by the same thread*/
+template <bool SLAB>
+void BM_churn_local(benchmark::State& state)
+{
+    allocator_t slab;
+    std::vector<epoll_event> events(BATCH);
+
+    for (auto _ : state)
+    {
+        for (auto& event : events)
+        {
+            event = create<SLAB>(slab);
+        }
+        for (auto& event : events)
+        {
+            destroy<SLAB>(event, slab);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * BATCH);
+}
+
+
+/** Connection objects created by accepting thread and deleted by event loop thread*/
+template <bool SLAB>
+void BM_churn_cross_thread(benchmark::State& state)
+{
+    allocator_t slab;
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::vector<epoll_event> pending;
+    bool done = false;
+
+    std::thread deleter([&]{
+        std::vector<epoll_event> events;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!done || !pending.empty())
+        {
+            cond.wait(lock, [&]{return done || !pending.empty();});
+            events.swap(pending);
+            lock.unlock();
+            cond.notify_all();
+            for (auto& event : events)
+            {
+                destroy<SLAB>(event, slab);
+            }
+            events.clear();
+            lock.lock();
+        }
+    });
+
+    std::vector<epoll_event> events(BATCH);
+    for (auto _ : state)
+    {
+        for (auto& event : events)
+        {
+            event = create<SLAB>(slab);
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [&]{return pending.size() < 4 * BATCH;});
+        pending.insert(pending.end(), events.begin(), events.end());
+        cond.notify_all();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+    }
+    cond.notify_all();
+    deleter.join();
+
+    state.SetItemsProcessed(state.iterations() * BATCH);
+    if constexpr (SLAB)
+    {
+        auto stats = slab.stats();
+        state.counters["reuse_ratio"] = static_cast<double>(stats.reuses) / stats.allocations;
+        state.counters["remote_frees"] = stats.remote_frees;
+    }
+}
+
+
+
+/**
+ * @brief Connections accepted and closed over loopback
+ * @details Each iteration is served by new thread, as by event loop thread which elastic pool
+ * @details starts and retires: it accepts BATCH connections with their own listening socket
+ * @details and closes them. Client resets connection, so ports aren't left in TIME_WAIT.
+ */
+template <bool SLAB>
+void BM_churn_accept(benchmark::State& state)
+{
+    allocator_t slab;
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    int listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (0 != bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) || 0 != listen(listen_fd, BATCH) ||
+        0 != getsockname(listen_fd, (sockaddr*)&addr, &len))
+    {
+        state.SkipWithError("Cannot listen");
+        close(listen_fd);
+        return;
+    }
+
+    for (auto _ : state)
+    {
+        bool failed = false;
+        std::thread([&]{
+            std::vector<epoll_event> events;
+            for (size_t i = 0; i < BATCH && !failed; ++i)
+            {
+                int client = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+                linger reset{1, 0};
+                setsockopt(client, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+                int fd = -1;
+                if (0 == connect(client, (sockaddr*)&addr, sizeof(addr)))
+                {
+                    fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                }
+                close(client);
+                failed = -1 == fd;
+                if (!failed)
+                {
+                    events.push_back(create<SLAB>(slab, fd));
+                }
+            }
+            for (auto& event : events)
+            {
+                destroy<SLAB>(event, slab);
+            }
+        }).join();
+
+        if (failed)
+        {
+            state.SkipWithError("Cannot connect");
+            break;
+        }
+    }
+    close(listen_fd);
+
+    state.SetItemsProcessed(state.iterations() * BATCH);
+    if constexpr (SLAB)
+    {
+        state.counters["chunks"] = slab.stats().chunks;
+    }
+}
+
+} // namespace
+
+BENCHMARK_TEMPLATE(BM_churn_local, false)->Name("BM_churn_local/heap");
+BENCHMARK_TEMPLATE(BM_churn_local, true )->Name("BM_churn_local/slab");
+BENCHMARK_TEMPLATE(BM_churn_cross_thread, false)->Name("BM_churn_cross_thread/heap")->UseRealTime();
+BENCHMARK_TEMPLATE(BM_churn_cross_thread, true )->Name("BM_churn_cross_thread/slab")->UseRealTime();
+BENCHMARK_TEMPLATE(BM_churn_accept, false)->Name("BM_churn_accept/heap")->UseRealTime();
+BENCHMARK_TEMPLATE(BM_churn_accept, true )->Name("BM_churn_accept/slab")->UseRealTime();
@@ -0,0 +1,171 @@
+#include "../src/hash_calc.hpp"
+#include "../src/md5_mb.hpp"
+#include "alloc_counter.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+/** Lines of fixed length with random printable content*/
+struct lines_t
+{
+    lines_t(size_t count, size_t len)
+    {
+        std::mt19937 gen(42);
+        data.resize(count * len);
+        for (auto& ch : data)
+        {
+            ch = static_cast<char>('!' + gen() % 90);
+        }
+        for (size_t i = 0; i < count; ++i)
+        {
+            views.emplace_back(data.data() + i * len, len);
+        }
+    }
+
+    std::string data;
+    std::vector<std::string_view> views;
+};
+
+constexpr size_t LINES = net::processors::md5_mb_t::BATCH_SIZE;
+
+
+/** Line by line with any Processor. Reports heap allocations and time per line*/
+template <class Processor>
+void BM_hash_line(benchmark::State& state)
+{
+    lines_t lines(LINES, state.range(0));
+    Processor hash;
+
+    auto allocs = bench::allocations();
+    for (auto _ : state)
+    {
+        for (auto line : lines.views)
+        {
+            hash.process(line);
+            benchmark::DoNotOptimize(hash.get_result().data());
+        }
+    }
+    allocs = bench::allocations() - allocs;
+
+    auto total = state.iterations() * LINES;
+    state.SetItemsProcessed(total);
+    state.SetBytesProcessed(total * state.range(0));
+    state.counters["allocs_per_line"] = static_cast<double>(allocs) / total;
+    state.counters["time_per_line"] = benchmark::Counter(total, benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+
+/** Multi-buffer engine with given kernel. Digests only*/
+void BM_md5_mb_kernel(benchmark::State& state, net::processors::md5::mb_engine_t::kernel_t kernel)
+{
+    using engine_t = net::processors::md5::mb_engine_t;
+    if (!engine_t::is_supported(kernel))
+    {
+        state.SkipWithError("Kernel is not supported by CPU");
+        return;
+    }
+
+    lines_t lines(LINES, state.range(0));
+    engine_t engine(kernel);
+    net::processors::md5::digest_t digests[LINES];
+
+    for (auto _ : state)
+    {
+        engine.hash(lines.views.data(), LINES, digests);
+        benchmark::DoNotOptimize(digests);
+    }
+    state.SetItemsProcessed(state.iterations() * LINES);
+    state.SetBytesProcessed(state.iterations() * LINES * state.range(0));
+}
+
+
+/** md5_mb_t batch with hex output, as it is used by event_manager_t*/
+void BM_md5_mb_batch(benchmark::State& state)
+{
+    lines_t lines(LINES, state.range(0));
+    net::processors::md5_mb_t hash;
+    char out[LINES * net::processors::md5_mb_t::RESULT_LEN];
+
+    for (auto _ : state)
+    {
+        hash.process_batch(lines.views.data(), LINES, out);
+        benchmark::DoNotOptimize(out);
+    }
+    state.SetItemsProcessed(state.iterations() * LINES);
+    state.SetBytesProcessed(state.iterations() * LINES * state.range(0));
+}
+
+
+/** Hex encoding of results. Argument is digest size*/
+void BM_to_hex(benchmark::State& state)
+{
+    const size_t len = state.range(0);
+    lines_t digests(LINES, len);
+    std::vector<char> out(LINES * 2 * len);
+
+    for (auto _ : state)
+    {
+        auto dst = out.data();
+        for (auto digest : digests.views)
+        {
+            dst = net::processors::to_hex(reinterpret_cast<const unsigned char*>(digest.data()), len, dst);
+        }
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetItemsProcessed(state.iterations() * LINES);
+    state.SetBytesProcessed(state.iterations() * LINES * len);
+}
+
+/**
+ * @brief Result lines of batch of digests written by formatter kernel
+ * @details Arguments are digest size and kernel (see hex::formatter_t::kernel_t).
+ */
+void BM_hex_lines(benchmark::State& state)
+{
+    using formatter_t = net::hex::formatter_t<>;
+    const size_t len = state.range(0);
+    auto kernel = static_cast<formatter_t::kernel_t>(state.range(1));
+    if (!formatter_t::is_supported(kernel))
+    {
+        state.SkipWithError("kernel is not supported by CPU");
+        return;
+    }
+    state.SetLabel(formatter_t::name(kernel));
+
+    formatter_t formatter(kernel);
+    lines_t digests(LINES, len);
+    std::vector<char> out(LINES * (2 * len + 1));
+
+    for (auto _ : state)
+    {
+        formatter.lines(reinterpret_cast<const unsigned char*>(digests.data.data()), LINES, len, out.data());
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetItemsProcessed(state.iterations() * LINES);
+    state.SetBytesProcessed(state.iterations() * LINES * len);
+}
+
+using kernel_t = net::processors::md5::mb_engine_t::kernel_t;
+namespace algo = net::processors::algo;
+
+} // namespace
+
+BENCHMARK_TEMPLATE(BM_hash_line, net::processors::hash_t )->Name("BM_md5_evp"   )->RangeMultiplier(4)->Range(8, 2048);
+BENCHMARK_TEMPLATE(BM_hash_line, net::processors::md5_t<>)->Name("BM_md5_native")->RangeMultiplier(4)->Range(8, 2048);
+BENCHMARK_TEMPLATE(BM_hash_line, net::processors::evp_hash_t<algo::sha1      >)->Name("BM_sha1"      )->RangeMultiplier(4)->Range(8, 2048);
+BENCHMARK_TEMPLATE(BM_hash_line, net::processors::evp_hash_t<algo::sha256    >)->Name("BM_sha256"    )->RangeMultiplier(4)->Range(8, 2048);
+BENCHMARK_TEMPLATE(BM_hash_line, net::processors::evp_hash_t<algo::sha512    >)->Name("BM_sha512"    )->RangeMultiplier(4)->Range(8, 2048);
+BENCHMARK_TEMPLATE(BM_hash_line, net::processors::evp_hash_t<algo::blake2s256>)->Name("BM_blake2s256")->RangeMultiplier(4)->Range(8, 2048);
+BENCHMARK_CAPTURE(BM_md5_mb_kernel, generic_x4, kernel_t::generic_x4)->RangeMultiplier(4)->Range(8, 2048);
+BENCHMARK_CAPTURE(BM_md5_mb_kernel, sse41_x4,   kernel_t::sse41_x4  )->RangeMultiplier(4)->Range(8, 2048);
+BENCHMARK_CAPTURE(BM_md5_mb_kernel, avx2_x8,    kernel_t::avx2_x8   )->RangeMultiplier(4)->Range(8, 2048);
+BENCHMARK_CAPTURE(BM_md5_mb_kernel, avx512_x16, kernel_t::avx512_x16)->RangeMultiplier(4)->Range(8, 2048);
+BENCHMARK(BM_md5_mb_batch)->RangeMultiplier(4)->Range(8, 2048);
+BENCHMARK(BM_to_hex)->Arg(16)->Arg(32)->Arg(64);
+BENCHMARK(BM_hex_lines)->ArgsProduct({{16, 20, 32, 64}, {0, 1, 2}});
@@ -0,0 +1,77 @@
+#include "../src/event_manager.hpp"
+#include "alloc_counter.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <sys/socket.h>
+#include <fcntl.h>
+
+#include <vector>
+
+namespace
+{
+
+using manager_t = net::hash_ev_manager_t;
+
+
+/**
+ * @brief Memory per idle connection
+ * @details Each connection gets part of line without newline, so it keeps unfinished hash state.
+ * @details Heap bytes allocated for connection objects are reported per connection, buffers
+ * @details shared by event loop thread are reported separately.
+ */
+void BM_connection_memory(benchmark::State& state)
+{
+    const size_t conn_num = state.range(0);
+    auto buffers = std::make_unique<manager_t::buffers_t>();
+
+    size_t bytes = 0;
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        std::vector<int> clients(conn_num);
+        std::vector<int> servers(conn_num);
+        for (size_t i = 0; i < conn_num; ++i)
+        {
+            int sv[2];
+            if (-1 == socketpair(AF_UNIX, SOCK_STREAM, 0, sv))
+            {
+                state.SkipWithError("socketpair failed");
+                return;
+            }
+            fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK);
+            if (-1 == write(sv[1], "unfinished line", 15))
+            {
+                state.SkipWithError("write failed");
+                return;
+            }
+            servers[i] = sv[0];
+            clients[i] = sv[1];
+        }
+        std::vector<epoll_event> events(conn_num);
+        state.ResumeTiming();
+
+        auto before = bench::allocated_bytes();
+        for (size_t i = 0; i < conn_num; ++i)
+        {
+            events[i] = manager_t::create_event(servers[i]);
+            static_cast<manager_t*>(events[i].data.ptr)->process_data(*buffers);
+        }
+        bytes = bench::allocated_bytes() - before;
+
+        state.PauseTiming();
+        for (size_t i = 0; i < conn_num; ++i)
+        {
+            manager_t::delete_event(events[i]);
+            close(clients[i]);
+        }
+        state.ResumeTiming();
+    }
+
+    state.counters["bytes_per_connection"] = static_cast<double>(bytes) / conn_num;
+    state.counters["thread_buffers_bytes"] = sizeof(manager_t::buffers_t);
+}
+
+} // namespace
+
+BENCHMARK(BM_connection_memory)->Arg(1000)->Arg(4000)->Iterations(1);
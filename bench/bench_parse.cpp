@@ -0,0 +1,248 @@
+#include "../src/event_manager.hpp"
+#include "../src/file_hasher.hpp"
+#include "alloc_counter.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+
+namespace
+{
+
+using manager_t = net::hash_ev_manager_t;
+
+
+/** Lines of given length with newline symbols, as client sends them*/
+std::string make_stream(size_t bytes, size_t len)
+{
+    std::mt19937 gen(42);
+    std::string data;
+    data.reserve(bytes + len + 1);
+    while (data.size() < bytes)
+    {
+        for (size_t i = 0; i < len; ++i)
+        {
+            data += static_cast<char>('!' + gen() % 90);
+        }
+        data += '\n';
+    }
+    return data;
+}
+
+
+/** Connected pair of Unix sockets. First one is non-blocking and given to connection*/
+struct socket_pair_t
+{
+    socket_pair_t()
+    {
+        if (0 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds))
+        {
+            fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+        }
+    }
+
+    int fds[2] = {-1, -1};
+};
+
+
+/**
+ * @brief Search of newline symbols in read buffer by memchr loop. Baseline of BM_line_index
+ * @details Argument is line length.
+ */
+void BM_newline_scan(benchmark::State& state)
+{
+    auto data = make_stream(manager_t::READ_BUF_SIZE, state.range(0));
+
+    size_t lines = 0;
+    for (auto _ : state)
+    {
+        const char* begin = data.data();
+        auto size = data.size();
+        while (auto end = (const char*)std::memchr(begin, '\n', size))
+        {
+            ++lines;
+            size -= end + 1 - begin;
+            begin = end + 1;
+        }
+        benchmark::DoNotOptimize(lines);
+    }
+    state.SetItemsProcessed(lines);
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+
+
+/**
+ * @brief Index of newline symbols of read buffer built by splitter kernel
+ * @details Arguments are line length and kernel (see split::splitter_t::kernel_t).
+ */
+void BM_line_index(benchmark::State& state)
+{
+    using splitter_t = net::split::splitter_t;
+    auto kernel = static_cast<splitter_t::kernel_t>(state.range(1));
+    if (!splitter_t::is_supported(kernel))
+    {
+        state.SkipWithError("kernel is not supported by CPU");
+        return;
+    }
+    state.SetLabel(splitter_t::name(kernel));
+
+    splitter_t splitter(kernel);
+    auto data = make_stream(manager_t::READ_BUF_SIZE, state.range(0));
+    std::vector<uint32_t> offsets(data.size());
+
+    size_t lines = 0;
+    for (auto _ : state)
+    {
+        lines += splitter.index(data.data(), data.size(), offsets.data(), false);
+        benchmark::DoNotOptimize(offsets.data());
+    }
+    state.SetItemsProcessed(lines);
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+
+
+/**
+ * @brief Parsing and hashing of stream which comes in parts of given size
+ * @details Arguments are line length and size of part. Lines cross parts, so processor
+ * @details continues them as it does for read buffers.
+ */
+void BM_parse_lines(benchmark::State& state)
+{
+    const size_t split = state.range(1);
+    auto data = make_stream(manager_t::READ_BUF_SIZE, state.range(0));
+    data.resize(data.size() / split * split);
+
+    socket_pair_t pair;
+    auto event = manager_t::create_event(pair.fds[0]);
+    auto manager = static_cast<manager_t*>(event.data.ptr);
+    std::vector<char> out;
+
+    size_t results = 0;
+    auto allocs = bench::allocations();
+    for (auto _ : state)
+    {
+        for (size_t pos = 0; pos < data.size(); pos += split)
+        {
+            manager->process_received({data.data() + pos, split});
+            manager->take_output(out);
+            results += out.size();
+        }
+        benchmark::DoNotOptimize(out.data());
+    }
+    allocs = bench::allocations() - allocs;
+
+    manager_t::delete_event(event);
+    close(pair.fds[1]);
+
+    auto lines = results / net::processors::md5_mb_t::RESULT_LEN;
+    state.SetItemsProcessed(lines);
+    state.SetBytesProcessed(state.iterations() * data.size());
+    state.counters["allocs_per_line"] = lines ? static_cast<double>(allocs) / lines : 0;
+}
+
+
+/**
+ * @brief Whole cycle of connection: read from socket, parse, hash and send results
+ * @details Client writes read buffer of lines of given length and reads all results back.
+ */
+void BM_parse_hash_write(benchmark::State& state)
+{
+    auto data = make_stream(manager_t::READ_BUF_SIZE / 2, state.range(0));
+    const size_t expected = data.size() / (state.range(0) + 1) * net::processors::md5_mb_t::RESULT_LEN;
+
+    socket_pair_t pair;
+    int sndbuf = 4 * manager_t::READ_BUF_SIZE;
+    setsockopt(pair.fds[1], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    setsockopt(pair.fds[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+    auto buffers = std::make_unique<manager_t::buffers_t>();
+    auto event = manager_t::create_event(pair.fds[0]);
+    auto manager = static_cast<manager_t*>(event.data.ptr);
+    std::vector<char> results(expected);
+
+    auto allocs = bench::allocations();
+    for (auto _ : state)
+    {
+        if (static_cast<ssize_t>(data.size()) != write(pair.fds[1], data.data(), data.size()))
+        {
+            state.SkipWithError("write failed");
+            break;
+        }
+        manager->process_data(*buffers);
+        for (size_t got = 0; got < expected;)
+        {
+            // Results which didn't fit into socket are sent as client reads them
+            auto count = recv(pair.fds[1], results.data() + got, expected - got, MSG_DONTWAIT);
+            if (-1 == count && EAGAIN == errno && manager->pending_output())
+            {
+                manager->process_output(*buffers);
+                continue;
+            }
+            if (count <= 0)
+            {
+                state.SkipWithError("read failed");
+                break;
+            }
+            got += count;
+        }
+    }
+    allocs = bench::allocations() - allocs;
+
+    manager_t::delete_event(event);
+    close(pair.fds[1]);
+
+    auto lines = state.iterations() * (data.size() / (state.range(0) + 1));
+    state.SetItemsProcessed(lines);
+    state.SetBytesProcessed(state.iterations() * data.size());
+    state.counters["allocs_per_line"] = lines ? static_cast<double>(allocs) / lines : 0;
+}
+
+
+/**
+ * @brief Offline hashing of 64 MB file of 32 byte lines by given number of threads to /dev/null
+ * @details File is in page cache after the first iteration, so it's limited by hashing and memory.
+ */
+void BM_hash_file(benchmark::State& state)
+{
+    char path[] = "/tmp/hash_server_bench_XXXXXX";
+    int fd = mkstemp(path);
+    auto data = make_stream(64 << 20, 32);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (-1 == fd || -1 == null_fd || static_cast<ssize_t>(data.size()) != write(fd, data.data(), data.size()))
+    {
+        state.SkipWithError("file cannot be created");
+    }
+    close(fd);
+
+    net::file_options_t options;
+    options.threads = state.range(0);
+    net::file_hasher_t<net::processors::md5_mb_t> hasher(options);
+    for (auto _ : state)
+    {
+        if (-1 == null_fd)
+        {
+            break;
+        }
+        benchmark::DoNotOptimize(hasher.run(path, null_fd));
+    }
+    unlink(path);
+    close(null_fd);
+
+    state.SetItemsProcessed(state.iterations() * (data.size() / 33));
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+
+} // namespace
+
+BENCHMARK(BM_newline_scan)->RangeMultiplier(4)->Range(8, 2048);
+BENCHMARK(BM_line_index)->ArgsProduct({{8, 32, 128, 2048}, {0, 1, 2, 3}});
+BENCHMARK(BM_parse_lines)->ArgsProduct({{16, 64, 256, 1024}, {512, 4096, 65536}});
+BENCHMARK(BM_parse_hash_write)->RangeMultiplier(4)->Range(8, 2048);
+BENCHMARK(BM_hash_file)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->UseRealTime()->Unit(benchmark::kMillisecond);
@@ -0,0 +1,85 @@
+#!/usr/bin/env python3
+"""Compare Google Benchmark JSON output with stored baseline.
+
+Benchmark regresses if its time per iteration grows more than tolerance or if any of its
+allocation counters (e.g. allocs_per_line) grows by more than ALLOCS_SLACK. Baseline is written
+from results if it doesn't exist or --update is given. Exit status is 1 if something regressed.
+
+    ./bench/hash_server_microbench --benchmark_out=result.json --benchmark_out_format=json
+    check_baseline.py result.json baseline.json --tolerance 0.1
+"""
+
+import argparse
+import json
+import os
+import shutil
+import sys
+
+UNITS = {"ns": 1.0, "us": 1e3, "ms": 1e6, "s": 1e9}
+
+# Allocations of setup and buffer growth are spread over iterations, so counters differ a bit
+ALLOCS_SLACK = 0.01
+
+
+def load(path):
+    with open(path) as f:
+        data = json.load(f)
+    result = {}
+    for bench in data.get("benchmarks", []):
+        if bench.get("error_occurred"):
+            continue
+
+        # Repetitions are compared by their mean only
+        if bench.get("repetitions", 1) > 1 and bench.get("aggregate_name") != "mean":
+            continue
+        name = bench.get("run_name", bench["name"])
+        result[name] = bench
+    return result
+
+
+def time_ns(bench):
+    return bench["real_time"] * UNITS.get(bench.get("time_unit", "ns"), 1.0)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("result", help="JSON output of benchmark")
+    parser.add_argument("baseline", help="JSON output stored as baseline")
+    parser.add_argument("--tolerance", type=float, default=0.1, help="allowed relative growth of time (0.1)")
+    parser.add_argument("--update", action="store_true", help="store result as new baseline")
+    args = parser.parse_args()
+
+    if args.update or not os.path.exists(args.baseline):
+        shutil.copyfile(args.result, args.baseline)
+        print("Baseline stored to %s" % args.baseline)
+        return 0
+
+    result = load(args.result)
+    baseline = load(args.baseline)
+
+    regressions = 0
+    print("%-48s %14s %14s %8s" % ("Benchmark", "Baseline ns", "Current ns", "Change"))
+    for name, bench in result.items():
+        base = baseline.get(name)
+        if base is None:
+            print("%-48s %14s %14.1f %8s" % (name, "-", time_ns(bench), "new"))
+            continue
+
+        change = time_ns(bench) / time_ns(base) - 1
+        marks = []
+        if change > args.tolerance:
+            marks.append("SLOWER")
+        for counter, value in bench.items():
+            if "allocs" in counter and counter in base and value > base[counter] + ALLOCS_SLACK:
+                marks.append("%s %.3g > %.3g" % (counter, value, base[counter]))
+        regressions += bool(marks)
+        print("%-48s %14.1f %14.1f %+7.1f%% %s" % (name, time_ns(base), time_ns(bench), change * 100, " ".join(marks)))
+
+    if regressions:
+        print("%d benchmarks regressed against %s" % (regressions, args.baseline))
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,894 @@
+/**
+ * @file load_generator.cpp
+ * @author Domnikov Ivan
+ * @brief End-to-end load generator of hash server.
+ * @details Epoll client which opens connections in several threads, sends lines of configured
+ * @details sizes in closed loop (each connection keeps --depth lines in flight) or open loop
+ * @details (--rate lines per second for all connections) and checks every result. Latency of
+ * @details open loop is measured from time when line had to be sent, so stalls of server are not
+ * @details hidden by client which waits for them.
+ */
+#include "../src/algorithms.hpp"
+#include "../src/stats.hpp"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+using clock_type = std::chrono::steady_clock;
+
+/**
+ * @brief Command line options
+ */
+struct options_t
+{
+    std::string host = "127.0.0.1";
+    uint16_t port = 0;
+    std::string algo = "md5";
+
+    /** steady, many-idle, churn, bulk or mixed*/
+    std::string scenario = "steady";
+    size_t connections = 64;
+    size_t threads = 4;
+    double duration = 5;
+
+    /** Lines per second of all connections. Zero is closed loop*/
+    double rate = 0;
+
+    /** Lines in flight per connection in closed loop*/
+    size_t depth = 1;
+
+    /** Line sizes are uniform in [min_line, max_line]*/
+    size_t min_line = 64;
+    size_t max_line = 64;
+
+    /** many-idle: connections which send. By default 1% of them*/
+    size_t active = 0;
+
+    /** churn: lines of connection before it reconnects*/
+    size_t requests_per_conn = 1;
+
+    /** bulk and mixed: bytes uploaded by bulk connection*/
+    size_t bulk_bytes = size_t(256) << 20;
+
+    /** Server which is measured. Started by load generator if command is given*/
+    pid_t server_pid = 0;
+    std::string server_cmd;
+
+    bool json = false;
+};
+
+
+/**
+ * @brief Line with its newline symbol and expected result
+ */
+struct sample_t
+{
+    std::string line;
+    std::string result;
+};
+
+
+/**
+ * @brief Connections of small requests and of bulk upload are measured separately
+ */
+enum class_t : size_t
+{
+    small_class,
+    bulk_class,
+    class_count
+};
+
+constexpr const char* class_names[class_count] = {"small", "bulk"};
+
+
+/**
+ * @brief Results of connections of one class in one thread
+ */
+struct class_stats_t
+{
+    net::latency_histogram_t latency;
+    uint64_t lines = 0;
+    uint64_t bytes = 0;
+    uint64_t errors = 0;
+    uint64_t connects = 0;
+    size_t connections = 0;
+};
+
+
+struct connection_t
+{
+    int fd = -1;
+    class_t cls = small_class;
+
+    /** Connection sends nothing (many-idle)*/
+    bool idle = false;
+    bool connecting = false;
+
+    /** Data to send from out_pos*/
+    std::string out;
+    size_t out_pos = 0;
+
+    /** Lines sent and not answered: sample and time when line had to be sent*/
+    std::deque<std::pair<uint32_t, clock_type::time_point>> pending;
+
+    /** Results received and not checked yet*/
+    std::string in;
+
+    /** Lines answered since connect*/
+    uint64_t answered = 0;
+
+    /** Bytes of bulk upload not given to out yet*/
+    uint64_t bulk_left = 0;
+};
+
+
+/**
+ * @brief Thread of load generator with its own epoll and connections
+ */
+class worker_t
+{
+public:
+    worker_t(const options_t& options, const std::vector<sample_t>& samples, const sockaddr_in& addr, size_t id)
+        :m_options(options), m_samples(samples), m_addr(addr), m_random(id + 1), m_epollfd(epoll_create1(EPOLL_CLOEXEC))
+    {
+    }
+
+    ~worker_t()
+    {
+        for (auto& conn : m_connections)
+        {
+            if (-1 != conn->fd)
+            {
+                close(conn->fd);
+            }
+        }
+        close(m_epollfd);
+    }
+
+    worker_t(const worker_t&) = delete;
+    worker_t& operator=(const worker_t&) = delete;
+
+
+    void add(class_t cls, bool idle)
+    {
+        m_connections.push_back(std::make_unique<connection_t>());
+        auto& conn = *m_connections.back();
+        conn.cls = cls;
+        conn.idle = idle;
+        ++m_stats[cls].connections;
+        if (!idle && cls == small_class)
+        {
+            m_active.push_back(&conn);
+        }
+    }
+
+
+    /**
+     * @brief Connect all connections. Connections of many-idle scenario are opened before load
+     * @return false if server is not reachable
+     */
+    bool connect_all()
+    {
+        for (auto& conn : m_connections)
+        {
+            if (!open(*conn))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+
+    /**
+     * @brief Send and check lines until end or until bulk upload is finished
+     * @param[in] start Time when load starts
+     * @param[in] end Time when load stops
+     * @param[in] rate Lines per second of this thread in open loop
+     */
+    void run(clock_type::time_point start, clock_type::time_point end, double rate)
+    {
+        m_start = start;
+        std::this_thread::sleep_until(start);
+        for (auto& conn : m_connections)
+        {
+            if (conn->cls == bulk_class)
+            {
+                conn->bulk_left = m_options.bulk_bytes;
+            }
+            fill(*conn, start);
+            flush(*conn);
+        }
+
+        uint64_t issued = 0;
+        std::array<epoll_event, 64> events;
+        while (true)
+        {
+            auto now = clock_type::now();
+            if (now >= end || (m_options.scenario == "bulk" && bulk_done()))
+            {
+                break;
+            }
+
+            // Open loop: lines are given to connections one by one when their time comes
+            if (rate > 0 && !m_active.empty())
+            {
+                auto due = static_cast<uint64_t>(std::chrono::duration<double>(now - start).count() * rate);
+                for (; issued < due; ++issued)
+                {
+                    auto& conn = *m_active[issued % m_active.size()];
+                    auto scheduled = start + std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(issued / rate));
+                    enqueue(conn, scheduled);
+                    flush(conn);
+                }
+            }
+
+            int timeout = rate > 0 ? 1 : 10;
+            auto n = epoll_wait(m_epollfd, events.data(), events.size(), timeout);
+            now = clock_type::now();
+            for (int i = 0; i < n; ++i)
+            {
+                auto& conn = *static_cast<connection_t*>(events[i].data.ptr);
+                if (conn.connecting && !finish_connect(conn))
+                {
+                    continue;
+                }
+                if (events[i].events & (EPOLLERR | EPOLLHUP | EPOLLIN))
+                {
+                    receive(conn, now);
+                }
+                if (-1 != conn.fd)
+                {
+                    if (rate <= 0)
+                    {
+                        fill(conn, now);
+                    }
+                    flush(conn);
+                }
+            }
+        }
+    }
+
+
+    const class_stats_t& stats(class_t cls) const
+    {
+        return m_stats[cls];
+    }
+
+private:
+    /**
+     * @brief Start non-blocking connect and register connection in epoll
+     */
+    bool open(connection_t& conn)
+    {
+        conn.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (-1 == conn.fd)
+        {
+            perror("socket");
+            return false;
+        }
+        int enable = 1;
+        setsockopt(conn.fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+        // Ports of closed connections in TIME_WAIT don't prevent servers from listening them later
+        setsockopt(conn.fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+        conn.connecting = true;
+        if (-1 == connect(conn.fd, (const sockaddr*)&m_addr, sizeof(m_addr)) && EINPROGRESS != errno)
+        {
+            perror("connect");
+            close(conn.fd);
+            conn.fd = -1;
+            return false;
+        }
+
+        epoll_event event;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        event.data.ptr = &conn;
+        epoll_ctl(m_epollfd, EPOLL_CTL_ADD, conn.fd, &event);
+        ++m_stats[conn.cls].connects;
+        return true;
+    }
+
+
+    bool finish_connect(connection_t& conn)
+    {
+        int error = 0;
+        socklen_t len = sizeof(error);
+        getsockopt(conn.fd, SOL_SOCKET, SO_ERROR, &error, &len);
+        if (EINPROGRESS == error)
+        {
+            return false;
+        }
+        conn.connecting = false;
+        if (error)
+        {
+            fail(conn);
+            return false;
+        }
+        return true;
+    }
+
+
+    /**
+     * @brief Connection is closed by server or failed. Its lines are errors, it connects again
+     */
+    void fail(connection_t& conn)
+    {
+        m_stats[conn.cls].errors += conn.pending.size();
+        reopen(conn);
+    }
+
+
+    void reopen(connection_t& conn)
+    {
+        close(conn.fd);
+        conn.fd = -1;
+        conn.out.clear();
+        conn.out_pos = 0;
+        conn.pending.clear();
+        conn.in.clear();
+        conn.answered = 0;
+        open(conn);
+    }
+
+
+    /**
+     * @brief Closed loop: keep depth lines in flight. Bulk connection keeps output buffer full
+     */
+    void fill(connection_t& conn, clock_type::time_point now)
+    {
+        if (conn.idle || conn.connecting || -1 == conn.fd)
+        {
+            return;
+        }
+
+        if (conn.cls == bulk_class)
+        {
+            while (conn.bulk_left && conn.out.size() - conn.out_pos < (size_t(256) << 10))
+            {
+                enqueue(conn, now);
+                auto size = m_samples[conn.pending.back().first].line.size();
+                conn.bulk_left -= std::min<uint64_t>(conn.bulk_left, size);
+            }
+        }
+        else if (m_options.rate <= 0)
+        {
+            while (conn.pending.size() < m_options.depth)
+            {
+                enqueue(conn, now);
+            }
+        }
+    }
+
+
+    void enqueue(connection_t& conn, clock_type::time_point scheduled)
+    {
+        auto index = static_cast<uint32_t>(m_random() % m_samples.size());
+        conn.out += m_samples[index].line;
+        conn.pending.emplace_back(index, scheduled);
+    }
+
+
+    void flush(connection_t& conn)
+    {
+        if (conn.connecting || -1 == conn.fd)
+        {
+            return;
+        }
+        while (conn.out_pos < conn.out.size())
+        {
+            auto count = send(conn.fd, conn.out.data() + conn.out_pos, conn.out.size() - conn.out_pos, MSG_NOSIGNAL);
+            if (count <= 0)
+            {
+                if (-1 == count && (EAGAIN == errno || EWOULDBLOCK == errno))
+                {
+                    break;
+                }
+                if (-1 == count && EINTR == errno)
+                {
+                    continue;
+                }
+                fail(conn);
+                return;
+            }
+            conn.out_pos += count;
+        }
+
+        // Sent data is dropped at once when it's all sent, otherwise when it grows big
+        if (conn.out_pos == conn.out.size())
+        {
+            conn.out.clear();
+            conn.out_pos = 0;
+        }
+        else if (conn.out_pos > (size_t(1) << 20))
+        {
+            conn.out.erase(0, conn.out_pos);
+            conn.out_pos = 0;
+        }
+    }
+
+
+    /**
+     * @brief Read results and check each of them with line which is the oldest in flight
+     */
+    void receive(connection_t& conn, clock_type::time_point now)
+    {
+        auto& stats = m_stats[conn.cls];
+        char buf[64 * 1024];
+        while (true)
+        {
+            auto count = read(conn.fd, buf, sizeof(buf));
+            if (-1 == count && EINTR == errno)
+            {
+                continue;
+            }
+            if (-1 == count && (EAGAIN == errno || EWOULDBLOCK == errno))
+            {
+                break;
+            }
+            if (count <= 0)
+            {
+                fail(conn);
+                return;
+            }
+            conn.in.append(buf, count);
+        }
+
+        size_t pos = 0;
+        auto result_len = m_samples.front().result.size();
+        while (conn.in.size() - pos >= result_len && !conn.pending.empty())
+        {
+            auto [index, scheduled] = conn.pending.front();
+            conn.pending.pop_front();
+            auto& sample = m_samples[index];
+            if (0 != memcmp(conn.in.data() + pos, sample.result.data(), result_len))
+            {
+                ++stats.errors;
+            }
+            pos += result_len;
+
+            // Load is measured from its start, connections opened before it have no lines earlier
+            if (scheduled >= m_start)
+            {
+                stats.latency.record(now - scheduled);
+                ++stats.lines;
+                stats.bytes += sample.line.size();
+            }
+            ++conn.answered;
+        }
+        conn.in.erase(0, pos);
+
+        // Results which nobody waits for
+        if (conn.pending.empty() && !conn.in.empty())
+        {
+            ++stats.errors;
+            conn.in.clear();
+        }
+
+        if (m_options.scenario == "churn" && conn.cls == small_class && conn.pending.empty() &&
+            conn.answered >= m_options.requests_per_conn)
+        {
+            reopen(conn);
+        }
+    }
+
+
+    bool bulk_done() const
+    {
+        for (auto& conn : m_connections)
+        {
+            if (conn->cls == bulk_class && (conn->bulk_left || !conn->pending.empty()))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+
+    const options_t& m_options;
+    const std::vector<sample_t>& m_samples;
+    sockaddr_in m_addr;
+    std::minstd_rand m_random;
+    int m_epollfd;
+    clock_type::time_point m_start;
+
+    std::vector<std::unique_ptr<connection_t>> m_connections;
+
+    /** Small connections which send lines in open loop*/
+    std::vector<connection_t*> m_active;
+    std::array<class_stats_t, class_count> m_stats;
+};
+
+
+/**
+ * @brief Random lines of configured sizes and their results
+ */
+std::vector<sample_t> make_samples(const options_t& options, bool& known)
+{
+    constexpr size_t count = 4096;
+    std::vector<sample_t> samples(count);
+    std::mt19937 random(42);
+    std::uniform_int_distribution<size_t> size(options.min_line, options.max_line);
+    std::uniform_int_distribution<int> symbol('a', 'z');
+    for (auto& sample : samples)
+    {
+        sample.line.resize(size(random));
+        for (auto& c : sample.line)
+        {
+            c = static_cast<char>(symbol(random));
+        }
+    }
+
+    known = net::processors::with_algorithm(options.algo, [&](auto tag)
+    {
+        typename decltype(tag)::type processor;
+        for (auto& sample : samples)
+        {
+            processor.process(sample.line);
+            sample.result = processor.get_result();
+            sample.line += '\n';
+        }
+    });
+    return samples;
+}
+
+
+/**
+ * @brief CPU time of process in seconds. -1 if it's unknown
+ */
+double process_cpu(pid_t pid)
+{
+    if (!pid)
+    {
+        return -1;
+    }
+    std::ifstream file("/proc/" + std::to_string(pid) + "/stat");
+    std::string stat;
+    std::getline(file, stat);
+
+    // Fields after command name which can have spaces. utime and stime are 14th and 15th fields
+    auto paren = stat.rfind(')');
+    if (paren == std::string::npos)
+    {
+        return -1;
+    }
+    std::vector<std::string> fields;
+    size_t pos = paren + 2;
+    while (pos < stat.size())
+    {
+        auto space = stat.find(' ', pos);
+        fields.push_back(stat.substr(pos, space - pos));
+        pos = space == std::string::npos ? stat.size() : space + 1;
+    }
+    if (fields.size() < 13)
+    {
+        return -1;
+    }
+    return (std::atof(fields[11].c_str()) + std::atof(fields[12].c_str())) / sysconf(_SC_CLK_TCK);
+}
+
+
+/**
+ * @brief Start server by shell command
+ * @details Output of server goes to stderr, so stdout has report only.
+ */
+pid_t spawn_server(const std::string& cmd)
+{
+    fflush(stdout);
+    auto pid = fork();
+    if (0 == pid)
+    {
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+        auto exec = "exec " + cmd;
+        execl("/bin/sh", "sh", "-c", exec.c_str(), static_cast<char*>(nullptr));
+        _exit(127);
+    }
+    return pid;
+}
+
+
+/**
+ * @brief Wait until server accepts connections
+ * @return false if server doesn't accept them in 5 seconds or started server exited
+ */
+bool wait_server(const sockaddr_in& addr, pid_t spawned)
+{
+    for (int attempts = 500; attempts; --attempts)
+    {
+        if (spawned && spawned == waitpid(spawned, nullptr, WNOHANG))
+        {
+            return false;
+        }
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        bool connected = 0 == connect(fd, (const sockaddr*)&addr, sizeof(addr));
+        close(fd);
+        if (connected)
+        {
+            return true;
+        }
+        usleep(10000);
+    }
+    return false;
+}
+
+
+void print_report(const options_t& options, const std::vector<std::unique_ptr<worker_t>>& workers,
+                  double seconds, double server_cpu)
+{
+    auto us = [](uint64_t ns){return ns / 1e3;};
+    if (options.json)
+    {
+        printf("{\"scenario\":\"%s\",\"algo\":\"%s\",\"connections\":%zu,\"threads\":%zu,\"rate\":%.0f,"
+               "\"min_line\":%zu,\"max_line\":%zu,\"duration_s\":%.3f,\"server_cpu_pct\":%.1f,\"classes\":[",
+               options.scenario.c_str(), options.algo.c_str(), options.connections, options.threads, options.rate,
+               options.min_line, options.max_line, seconds, server_cpu);
+    }
+    else
+    {
+        printf("Scenario %s, %s, lines %zu-%zu bytes, %zu threads, %.2f s\n", options.scenario.c_str(),
+               options.algo.c_str(), options.min_line, options.max_line, options.threads, seconds);
+    }
+
+    bool first = true;
+    for (size_t cls = 0; cls < class_count; ++cls)
+    {
+        class_stats_t total;
+        net::histogram_snapshot_t latency;
+        for (auto& worker : workers)
+        {
+            auto& stats = worker->stats(static_cast<class_t>(cls));
+            total.lines += stats.lines;
+            total.bytes += stats.bytes;
+            total.errors += stats.errors;
+            total.connects += stats.connects;
+            total.connections += stats.connections;
+            stats.latency.add_to(latency);
+        }
+        if (!total.connections)
+        {
+            continue;
+        }
+
+        if (options.json)
+        {
+            printf("%s{\"class\":\"%s\",\"connections\":%zu,\"lines\":%lu,\"lines_per_s\":%.1f,\"mb_per_s\":%.3f,"
+                   "\"p50_us\":%.1f,\"p99_us\":%.1f,\"p999_us\":%.1f,\"max_us\":%.1f,\"errors\":%lu,\"connects\":%lu}",
+                   first ? "" : ",", class_names[cls], total.connections, total.lines, total.lines / seconds,
+                   total.bytes / seconds / (1 << 20), us(latency.quantile(0.5)), us(latency.quantile(0.99)),
+                   us(latency.quantile(0.999)), us(latency.quantile(1)), total.errors, total.connects);
+        }
+        else
+        {
+            printf("%-5s: %zu connections, %lu lines, %.0f lines/s, %.1f MB/s, latency p50 %.1f us, p99 %.1f us, "
+                   "p999 %.1f us, max %.1f us, errors %lu, connects %lu\n",
+                   class_names[cls], total.connections, total.lines, total.lines / seconds,
+                   total.bytes / seconds / (1 << 20), us(latency.quantile(0.5)), us(latency.quantile(0.99)),
+                   us(latency.quantile(0.999)), us(latency.quantile(1)), total.errors, total.connects);
+        }
+        first = false;
+    }
+
+    if (options.json)
+    {
+        printf("]}\n");
+    }
+    else if (server_cpu >= 0)
+    {
+        printf("Server CPU: %.1f%%\n", server_cpu);
+    }
+}
+
+} // namespace
+
+
+int main(int argc, char** argv)
+{
+    std::string usage = "Use: hash_server_bench [OPTIONS] --port PORT\n"
+                        "\t--host ADDR         - server address (127.0.0.1)\n"
+                        "\t--algo NAME         - digest algorithm of server port (md5): " + net::processors::algorithm_names() + "\n"
+                        "\t--scenario NAME     - steady, many-idle, churn, bulk or mixed (steady)\n"
+                        "\t--connections N     - connections of small requests (64)\n"
+                        "\t--threads N         - client threads (4)\n"
+                        "\t--duration SEC      - time of load (5)\n"
+                        "\t--rate N            - open loop: lines per second of all connections. Closed loop by default\n"
+                        "\t--depth N           - closed loop: lines in flight per connection (1)\n"
+                        "\t--line-size A[-B]   - line sizes uniform from A to B bytes (64)\n"
+                        "\t--active N          - many-idle: connections which send (1% of connections)\n"
+                        "\t--requests N        - churn: lines of connection before it reconnects (1)\n"
+                        "\t--bulk-mb N         - bulk, mixed: megabytes uploaded by bulk connection (256)\n"
+                        "\t--server-pid PID    - report CPU of running server\n"
+                        "\t--server CMD        - start server by command, report its CPU and stop it\n"
+                        "\t--json              - one JSON line for regression tracking\n";
+
+    const option long_options[] =
+    {
+        {"host",        required_argument, nullptr, 'H'},
+        {"port",        required_argument, nullptr, 'p'},
+        {"algo",        required_argument, nullptr, 'a'},
+        {"scenario",    required_argument, nullptr, 's'},
+        {"connections", required_argument, nullptr, 'c'},
+        {"threads",     required_argument, nullptr, 't'},
+        {"duration",    required_argument, nullptr, 'd'},
+        {"rate",        required_argument, nullptr, 'r'},
+        {"depth",       required_argument, nullptr, 'D'},
+        {"line-size",   required_argument, nullptr, 'l'},
+        {"active",      required_argument, nullptr, 'A'},
+        {"requests",    required_argument, nullptr, 'R'},
+        {"bulk-mb",     required_argument, nullptr, 'b'},
+        {"server-pid",  required_argument, nullptr, 'P'},
+        {"server",      required_argument, nullptr, 'S'},
+        {"json",        no_argument,       nullptr, 'j'},
+        {nullptr,       0,                 nullptr,  0 }
+    };
+
+    options_t options;
+    int opt;
+    while (-1 != (opt = getopt_long(argc, argv, "", long_options, nullptr)))
+    {
+        switch (opt)
+        {
+            case 'H': options.host              = optarg;            break;
+            case 'p': options.port              = std::atoi(optarg); break;
+            case 'a': options.algo              = optarg;            break;
+            case 's': options.scenario          = optarg;            break;
+            case 'c': options.connections       = std::atoi(optarg); break;
+            case 't': options.threads           = std::max(1, std::atoi(optarg)); break;
+            case 'd': options.duration          = std::atof(optarg); break;
+            case 'r': options.rate              = std::atof(optarg); break;
+            case 'D': options.depth             = std::max(1, std::atoi(optarg)); break;
+            case 'A': options.active            = std::atoi(optarg); break;
+            case 'R': options.requests_per_conn = std::max(1, std::atoi(optarg)); break;
+            case 'b': options.bulk_bytes        = size_t(std::atoll(optarg)) << 20; break;
+            case 'P': options.server_pid        = std::atoi(optarg); break;
+            case 'S': options.server_cmd        = optarg;            break;
+            case 'j': options.json              = true;              break;
+            case 'l':
+            {
+                char* end;
+                options.min_line = options.max_line = std::strtoul(optarg, &end, 10);
+                if ('-' == *end)
+                {
+                    options.max_line = std::strtoul(end + 1, nullptr, 10);
+                }
+                break;
+            }
+            default:
+                fprintf(stderr, "%s", usage.c_str());
+                return -1;
+        }
+    }
+
+    const std::vector<std::string> scenarios = {"steady", "many-idle", "churn", "bulk", "mixed"};
+    if (!options.port || options.max_line < options.min_line ||
+        std::find(scenarios.begin(), scenarios.end(), options.scenario) == scenarios.end())
+    {
+        fprintf(stderr, "%s", usage.c_str());
+        return -1;
+    }
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(options.port);
+    if (1 != inet_pton(AF_INET, options.host.c_str(), &addr.sin_addr))
+    {
+        fprintf(stderr, "Wrong address %s\n", options.host.c_str());
+        return -1;
+    }
+
+    bool known;
+    auto samples = make_samples(options, known);
+    if (!known)
+    {
+        fprintf(stderr, "Unknown algorithm '%s'\n%s", options.algo.c_str(), usage.c_str());
+        return -1;
+    }
+
+    if (!options.server_cmd.empty())
+    {
+        options.server_pid = spawn_server(options.server_cmd);
+    }
+    if (!wait_server(addr, options.server_cmd.empty() ? 0 : options.server_pid))
+    {
+        fprintf(stderr, "Server %s:%d doesn't accept connections\n", options.host.c_str(), options.port);
+        if (!options.server_cmd.empty())
+        {
+            kill(options.server_pid, SIGKILL);
+            waitpid(options.server_pid, nullptr, 0);
+        }
+        return -1;
+    }
+
+    // Connections are spread over threads. Bulk connection has its own thread if there are more
+    std::vector<std::unique_ptr<worker_t>> workers;
+    for (size_t i = 0; i < options.threads; ++i)
+    {
+        workers.push_back(std::make_unique<worker_t>(options, samples, addr, i));
+    }
+    bool bulk = options.scenario == "bulk" || options.scenario == "mixed";
+    size_t small = options.scenario == "bulk" ? 0 : options.connections;
+    size_t active = options.scenario != "many-idle" ? small
+                  : options.active ? std::min(options.active, small) : std::max<size_t>(1, small / 100);
+    size_t first_small = bulk && options.threads > 1 ? 1 : 0;
+    if (bulk)
+    {
+        workers[0]->add(bulk_class, false);
+    }
+    std::vector<size_t> thread_active(workers.size());
+    for (size_t i = 0; i < small; ++i)
+    {
+        auto thread = first_small + i % (workers.size() - first_small);
+        workers[thread]->add(small_class, i >= active);
+        thread_active[thread] += i < active;
+    }
+    for (auto& worker : workers)
+    {
+        if (!worker->connect_all())
+        {
+            return -1;
+        }
+    }
+
+    auto cpu_before = process_cpu(options.server_pid);
+    auto start = clock_type::now() + std::chrono::milliseconds(100);
+    auto end = start + std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(options.duration));
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < workers.size(); ++i)
+    {
+        double rate = active ? options.rate * thread_active[i] / active : 0;
+        threads.emplace_back([&, i, rate]{workers[i]->run(start, end, rate);});
+    }
+    for (auto& thr : threads)
+    {
+        thr.join();
+    }
+    auto seconds = std::chrono::duration<double>(std::min(clock_type::now(), end) - start).count();
+    auto cpu_after = process_cpu(options.server_pid);
+
+    double server_cpu = cpu_before >= 0 && cpu_after >= 0 ? (cpu_after - cpu_before) / seconds * 100 : -1;
+    print_report(options, workers, seconds, server_cpu);
+
+    uint64_t errors = 0;
+    for (auto& worker : workers)
+    {
+        errors += worker->stats(small_class).errors + worker->stats(bulk_class).errors;
+    }
+    workers.clear();
+
+    if (!options.server_cmd.empty())
+    {
+        kill(options.server_pid, SIGINT);
+        waitpid(options.server_pid, nullptr, 0);
+    }
+    return errors ? 1 : 0;
+}
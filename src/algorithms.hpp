@@ -0,0 +1,265 @@
+/**
+ * @file algorithms.hpp
+ * @author Domnikov Ivan
+ * @brief Selection of digest algorithm by name and optional non-OpenSSL processors.
+ *
+ */
+#pragma once
+
+#include "cpu_features.hpp"
+#include "hash_calc.hpp"
+#include "line_index.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#if __has_include(<xxhash.h>)
+#define XXH_INLINE_ALL
+#include <xxhash.h>
+#define HASH_SERVER_WITH_XXHASH 1
+#endif
+
+#if defined(HASH_SERVER_WITH_BLAKE3)
+#include <blake3.h>
+#endif
+
+namespace net
+{
+namespace processors
+{
+
+#if defined(HASH_SERVER_WITH_XXHASH)
+/**
+* @brief xxh3_hash_t class
+* @details Non-cryptographic XXH3 processor for deduplication. WIDE selects xxh128 instead of xxh3 64 bit.
+* @details XXH3 state is stored inside object. Result is canonical (big-endian) hash as hex.
+*/
+template <bool WIDE>
+class xxh3_hash_t
+{
+public:
+    /** Length of raw digest*/
+    constexpr static size_t DIGEST_LEN = WIDE ? sizeof(XXH128_canonical_t) : sizeof(XXH64_canonical_t);
+
+    /** Length of result string for one line*/
+    constexpr static size_t RESULT_LEN = 2 * DIGEST_LEN + 1;
+
+    void process(std::string_view buffer)
+    {
+        if (!buffer.size())
+        {
+            return;
+        }
+
+        if (!m_started)
+        {
+            reset();
+        }
+        update(buffer);
+    }
+
+    std::string_view get_result()
+    {
+        get_digest();
+        *to_hex(m_digest, DIGEST_LEN, out_buf) = '\n';
+        return {out_buf, RESULT_LEN};
+    }
+
+    std::string_view get_digest()
+    {
+        if (!m_started)
+        {
+            reset();
+        }
+        m_started = false;
+
+        if constexpr (WIDE)
+        {
+            XXH128_canonicalFromHash(reinterpret_cast<XXH128_canonical_t*>(m_digest), XXH3_128bits_digest(&m_state));
+        }
+        else
+        {
+            XXH64_canonicalFromHash(reinterpret_cast<XXH64_canonical_t*>(m_digest), XXH3_64bits_digest(&m_state));
+        }
+        return {reinterpret_cast<const char*>(m_digest), DIGEST_LEN};
+    }
+
+    bool has_pending() const
+    {
+        return m_started;
+    }
+
+private:
+    void reset()
+    {
+        if constexpr (WIDE) XXH3_128bits_reset(&m_state);
+        else                XXH3_64bits_reset (&m_state);
+        m_started = true;
+    }
+
+    void update(std::string_view buffer)
+    {
+        if constexpr (WIDE) XXH3_128bits_update(&m_state, buffer.data(), buffer.size());
+        else                XXH3_64bits_update (&m_state, buffer.data(), buffer.size());
+    }
+
+    XXH3_state_t m_state;
+    bool m_started = false;
+    unsigned char m_digest[DIGEST_LEN];
+    char out_buf[RESULT_LEN];
+};
+#endif
+
+
+#if defined(HASH_SERVER_WITH_BLAKE3)
+/**
+* @brief blake3_hash_t class
+* @details BLAKE3 processor. Library selects SSE4.1/AVX2/AVX-512 implementation at runtime.
+*/
+class blake3_hash_t
+{
+public:
+    /** Length of raw digest*/
+    constexpr static size_t DIGEST_LEN = BLAKE3_OUT_LEN;
+
+    /** Length of result string for one line*/
+    constexpr static size_t RESULT_LEN = 2 * DIGEST_LEN + 1;
+
+    void process(std::string_view buffer)
+    {
+        if (!buffer.size())
+        {
+            return;
+        }
+
+        if (!m_started)
+        {
+            blake3_hasher_init(&m_state);
+            m_started = true;
+        }
+        blake3_hasher_update(&m_state, buffer.data(), buffer.size());
+    }
+
+    std::string_view get_result()
+    {
+        get_digest();
+        *to_hex(m_digest, DIGEST_LEN, out_buf) = '\n';
+        return {out_buf, RESULT_LEN};
+    }
+
+    std::string_view get_digest()
+    {
+        if (!m_started)
+        {
+            blake3_hasher_init(&m_state);
+        }
+        m_started = false;
+
+        blake3_hasher_finalize(&m_state, m_digest, DIGEST_LEN);
+        return {reinterpret_cast<const char*>(m_digest), DIGEST_LEN};
+    }
+
+    bool has_pending() const
+    {
+        return m_started;
+    }
+
+private:
+    blake3_hasher m_state;
+    bool m_started = false;
+    unsigned char m_digest[DIGEST_LEN];
+    char out_buf[RESULT_LEN];
+};
+#endif
+
+
+/** Type holder for passing processor type to generic lambda*/
+template <class Processor>
+struct processor_tag_t
+{
+    using type = Processor;
+};
+
+
+/** Check if Processor has is_available (see evp_hash_t)*/
+template <class Processor, class = void>
+struct has_availability : std::false_type {};
+
+template <class Processor>
+struct has_availability<Processor, std::void_t<decltype(&Processor::is_available)>> : std::true_type {};
+
+
+/**
+* @brief Check if processor can hash on this host
+* @details EVP processors depend on digests of OpenSSL providers, others are always available.
+*/
+template <class Processor>
+bool is_available()
+{
+    if constexpr (has_availability<Processor>::value) return Processor::is_available();
+    else return true;
+}
+
+
+/**
+* @brief Call func with processor_tag_t of processor for algorithm with given name
+* @details Each algorithm has its own processor type, so everything what func instantiates with it
+* @details (event_manager_t, server_t) is specialized for algorithm at compile time.
+* @param[in] name Algorithm name. See algorithm_names()
+* @param[in] func Generic callable
+* @return false if algorithm is unknown or not compiled in
+*/
+template <class Func>
+bool with_algorithm(std::string_view name, Func&& func)
+{
+    if      (name == algo::md5::NAME)        func(processor_tag_t<md5_mb_t>{});
+    else if (name == algo::sha1::NAME)       func(processor_tag_t<evp_hash_t<algo::sha1>>{});
+    else if (name == algo::sha256::NAME)     func(processor_tag_t<evp_hash_t<algo::sha256>>{});
+    else if (name == algo::sha512::NAME)     func(processor_tag_t<evp_hash_t<algo::sha512>>{});
+    else if (name == algo::blake2s256::NAME) func(processor_tag_t<evp_hash_t<algo::blake2s256>>{});
+#if defined(HASH_SERVER_WITH_XXHASH)
+    else if (name == "xxh3")                 func(processor_tag_t<xxh3_hash_t<false>>{});
+    else if (name == "xxh128")               func(processor_tag_t<xxh3_hash_t<true>>{});
+#endif
+#if defined(HASH_SERVER_WITH_BLAKE3)
+    else if (name == "blake3")               func(processor_tag_t<blake3_hash_t>{});
+#endif
+    else return false;
+
+    return true;
+}
+
+
+/**
+* @brief Names of all algorithms compiled in, separated by space
+*/
+inline std::string algorithm_names()
+{
+    std::string names = std::string(algo::md5::NAME) + " " + algo::sha1::NAME + " " + algo::sha256::NAME +
+                        " " + algo::sha512::NAME + " " + algo::blake2s256::NAME;
+#if defined(HASH_SERVER_WITH_XXHASH)
+    names += " xxh3 xxh128";
+#endif
+#if defined(HASH_SERVER_WITH_BLAKE3)
+    names += " blake3";
+#endif
+    return names;
+}
+
+
+/**
+* @brief Print kernels selected for host CPU
+*/
+inline void print_kernels(FILE* out)
+{
+    const auto& cpu = cpu_features_t::get();
+    fprintf(out, "md5 kernel: %s\n", md5::mb_engine_t::name(md5::mb_engine_t::instance().kernel()));
+    fprintf(out, "sha kernel: %s (OpenSSL)\n", cpu.sha_ni ? "SHA-NI" : cpu.avx2 ? "AVX2" : "generic");
+    fprintf(out, "line split kernel: %s\n", split::splitter_t::name(split::splitter_t::instance().kernel()));
+}
+
+} // namespace processors
+} // namespace net
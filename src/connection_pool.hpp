@@ -6,16 +6,34 @@
  */
 #pragma once
 
+#include "cpu_layout.hpp"
 #include "event_manager.hpp"
+#include "intrusive_list.hpp"
+#include "placement.hpp"
+#include "slab_allocator.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+#include "timer_wheel.hpp"
 
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include <fcntl.h>
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 #include <thread>
 #include <vector>
 #include <atomic>
+#include <memory>
+#include <cerrno>
 #include <cstring>
+#include <stdexcept>
 #include <string_view>
 
 namespace net
@@ -24,35 +42,113 @@ namespace net
 /**
 * @brief connection_pool_t class
 * @details Contains vector of threads. Each thread hash epoll event loop.
-* @details Epoll event loop trigger every second even if there's no events to monitor m_rum status.
+* @details Epoll event loop waits until event or nearest timer of its timer wheel without timeout.
+* @details Each thread has eventfd in its epoll, so stop and other threads wake it at once.
+* @details With timeouts each connection which waits for client has deadline in wheel of its thread:
+* @details idle, read or write (see timeout_options_t). Connection which misses it is closed.
+* @details Connections which used their read budget wait in ready queue of thread and are resumed
+* @details round-robin, one budget per loop iteration, between epoll events of other connections.
 * @details To push new connection need to call method 'add_connection' with new file descriptor
+* @details or give thread its own listening socket with 'add_listener'
+* @details Thread for new connection is selected by placement policy (see placement_t) by load
+* @details counters which each thread keeps for itself: connections and bytes in flight.
+* @details With rebalancing each thread checks once a second if it has more connections than others
+* @details and gives its connections which become idle to the thread with least connections.
 * @details When connection is closed it will be deleted and buffer cleaned by method itself
+* @details Each thread owns read and output buffers which are lent to connection for processing
+* @details Connection objects are taken from per-thread slabs of m_slabs (see slab_allocator_t)
+* @details With affinity each thread is pinned to its CPU before it allocates its buffers, so they
+* @details are in memory of its NUMA node. Connection objects are taken from allocator of that node
+* @details whatever thread accepts them. With incoming CPU connection goes to thread which runs on
+* @details CPU that received its packets, and listener of thread gets connections received by its CPU.
+* @details Elastic pool has thread slots up to max_threads. Controller thread measures utilization of
+* @details running threads (time out of epoll_wait) and starts thread in next slot or retires the last
+* @details one (see elastic_options_t). Retired thread takes no new connections, moves the ones it has
+* @details to other threads when they are not processed and stops when it has none. Threads with own
+* @details listening socket are never retired.
+* @details With pipeline options lines are hashed by separate hash workers (see hash_pipeline_t).
+* @details Each thread waits jobs finished by workers as one more event of its epoll, and resumes
+* @details connections which waited for free job after finished jobs are given back.
+* @details With cache options each thread keeps results of repeated short lines in its own digest
+* @details cache (see digest_cache_t), which is lent to connections with buffers.
 * @details event_manager is manager for single connection. See event_manager_t for details
 * @details must have following methods:
-* @code static epoll_event create_event(int fd)
-* @code static void delete_event(epoll_event* event)
-* @code void process_data()
+* @code static epoll_event create_event(int fd, allocator_t& allocator)
+* @code static void delete_event(epoll_event* event, allocator_t& allocator)
+* @code struct buffers_t
+* @code bool process_data(buffers_t&)
+* @code bool process_output(buffers_t&)
+* @code bool is_ready()
 * @code bool is_eof()
+* @code void abort()
+* @code using pipeline_t
+* @code using cache_t
+* @code bool complete_job(job_t*, buffers_t&)
+* @code bool resume(buffers_t&)
+* @code std::ptrdiff_t load_delta()
+* @code size_t accounted_load()
+* @code bool is_idle()
+* @code bool update_deadline(timeout_kind_t&)
+* @code timer_node_t& timer()
+* @code bool is_movable()
+* @code list_hook_t& pool_hook()
 */
 template <class event_manager>
 class connection_pool_t
 {
 public:
+    /** Allocator of connection objects*/
+    using allocator_t = slab_allocator_t<sizeof(event_manager)>;
+
+    /** Hash workers*/
+    using pipeline_t = typename event_manager::pipeline_t;
+
     /**
     * @brief Connection_pool_t constructor.
     * @details Creates vector of threads with size thread_num. In each thread register epoll event loop.
+    * @details If pipeline has workers then they are started and each thread gets its port.
     * @param[in] Number of threads.
+    * @details Function will throw an exception if placement policy is unknown
+    * @param[in] pipeline Hash workers options. By default lines are hashed by event loop threads
+    * @param[in] placement Placement policy and rebalancing. By default round-robin
+    * @param[in] timeouts Connection timeouts. By default connections have no deadlines
+    * @param[in] affinity CPUs of threads. By default threads are not pinned
+    * @param[in] elastic Thread limits and thresholds of resizing. By default pool has thread_num threads
+    * @param[in] cache Digest cache of each thread. By default lines are always hashed
     */
-    connection_pool_t(size_t thread_num)
-        :m_thread_num(thread_num), m_run(true)
+    connection_pool_t(size_t thread_num, const pipeline_options_t& pipeline = {}, const placement_options_t& placement = {},
+                      const timeout_options_t& timeouts = {}, const affinity_options_t& affinity = {},
+                      const elastic_options_t& elastic = {}, const cache_options_t& cache = {})
+        :m_placement(make_placement(placement.policy)), m_rebalance(placement.rebalance),
+         m_timeouts(timeouts),
+         m_incoming_cpu(affinity.incoming_cpu && !affinity.cpus.empty()), m_elastic(elastic), m_cache(cache),
+         m_thread_num(elastic.enabled() ? elastic.max_threads : thread_num),
+         m_loads(new thread_load_t[m_thread_num]), m_stats(new thread_stats_t[m_thread_num]), m_run(true)
     {
-        // Reserve vector data
-        m_pool.reserve(m_thread_num);
+        if (!m_placement)
+        {
+            throw std::runtime_error("Unknown placement policy '" + placement.policy + "'");
+        }
 
-        // Creating threads for thread pool in loop
+        // Allocator for each NUMA node of threads. Without affinity one for all
+        auto topology = affinity.cpus.empty() ? std::vector<cpu_info_t>{} : cpu_layout_t::detect();
+        auto slab_of = [&](int cpu) -> allocator_t*
+        {
+            auto node = cpu < 0 ? -1 : cpu_layout_t::node_of(topology, cpu);
+            for (auto& slab : m_slabs)
+            {
+                if (slab.first == node)
+                {
+                    return slab.second.get();
+                }
+            }
+            m_slabs.emplace_back(node, std::make_unique<allocator_t>(node));
+            return m_slabs.back().second.get();
+        };
+
+        // Creating event loops
         for (size_t  i = 0; i < m_thread_num; i++)
         {
-            // Creating new event loop
             auto epollfd = epoll_create1(0);
             if (-1 == epollfd)
             {
@@ -60,37 +156,62 @@ public:
                 continue;
             }
 
-            // Creating thread
-            thread_data_t pool_elem{epollfd, std::thread([this, epollfd, i]{
-                std::array<struct epoll_event, max_events> ev_arr;
+            // Other threads wake this one to stop or to check balance
+            auto wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            epoll_event event;
+            event.events = EPOLLIN;
+            if (-1 == wake_fd)
+            {
+                fprintf(stderr, "[E] thread pool[%ld] eventfd failed\n", i);
+                close(epollfd);
+                continue;
+            }
+
+            auto id = m_pool.size();
+            m_pool.push_back(std::make_unique<thread_data_t>(epollfd, wake_fd, id, m_loads[id], m_stats[id]));
+            if (!affinity.cpus.empty())
+            {
+                m_pool.back()->cpu = affinity.cpus[id % affinity.cpus.size()];
+            }
+            m_pool.back()->slab = slab_of(m_pool.back()->cpu);
+            event.data.ptr = &m_pool.back()->wake_fd;
+            if (-1 == epoll_ctl(epollfd, EPOLL_CTL_ADD, wake_fd, &event))
+            {
+                perror("[E] epoll_ctl failed\n");
+            }
+        }
 
-                // Event loop
-                while (m_run)
+        if (pipeline.workers)
+        {
+            m_pipeline = std::make_unique<pipeline_t>(m_pool.size(), pipeline);
+            for (size_t i = 0; i < m_pool.size(); ++i)
+            {
+                auto& data = *m_pool[i];
+                data.port = &m_pipeline->port(i);
+
+                epoll_event event;
+                event.data.ptr = data.port;
+                event.events = EPOLLIN;
+                if (-1 == epoll_ctl(data.epollfd, EPOLL_CTL_ADD, data.port->get_fd(), &event))
                 {
-                    auto n = epoll_wait(epollfd, ev_arr.data(), max_events, 1000);
-                    for (int i = 0; i < n; ++i)
-                    {
-                        //Close and clean if Error or disconnected
-                        if (ev_arr[i].events & EPOLLERR || ev_arr[i].events & EPOLLHUP )
-                        {
-                            event_manager::delete_event(ev_arr[i]);
-                        }
-                        // New data available to read
-                        else if (ev_arr[i].events & EPOLLIN)
-                        {
-                            auto manager = static_cast<event_manager*>(ev_arr[i].data.ptr);
-                            manager->process_data();
-                            if(manager->is_eof())
-                            {
-                                event_manager::delete_event(ev_arr[i]);
-                            }
-                        }
-                    }
+                    perror("[E] epoll_ctl failed\n");
                 }
-            })};
+            }
+        }
 
-            m_pool.emplace_back(std::move(pool_elem));
+        // Creating threads for thread pool in loop. Elastic pool starts them from min_threads to max_threads
+        auto running = m_elastic.enabled() ? std::clamp(thread_num, std::max<size_t>(m_elastic.min_threads, 1), m_elastic.max_threads)
+                                           : thread_num;
+        running = std::min(running, m_pool.size());
+        m_active = running;
+        for (size_t i = 0; i < running; ++i)
+        {
+            start_thread(*m_pool[i]);
+        }
 
+        if (m_elastic.enabled())
+        {
+            m_controller = std::thread([this]{control_loop();});
         }
     }
 
@@ -98,8 +219,7 @@ public:
 
     /**
     * @brief Connection_pool_t destructor
-    * @details Setup m_run flag to false and join all threads.
-    * @details If epoll_wait will be changed to infinite timeout then despructor must be changed as well
+    * @details Stop threads if they were not stopped yet
     */
     virtual ~connection_pool_t()
     {
@@ -113,38 +233,278 @@ public:
 
     /**
     * @brief Stop event pool and destroy all threads
-    * @details Setup m_run flag to false and join all threads.
-    * @details If epoll_wait will be changed to infinite timeout then despructor must be changed as well
+    * @details Setup m_run flag to false, wake threads by their eventfd and join them.
     * @details After this method there's no way to start it again. Need to create new connection_pool
     */
     void stop()
     {
         // Finishing threads
         m_run = false;
+        if (m_controller.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_control_mutex);
+            }
+            m_control_cv.notify_all();
+            m_controller.join();
+        }
         for (auto& thr : m_pool)
         {
-            thr.thr.join();
+            wake(*thr);
         }
+        for (auto& thr : m_pool)
+        {
+            if (thr->thr.joinable())
+            {
+                thr->thr.join();
+            }
+            close(thr->epollfd);
+            close(thr->wake_fd);
+        }
+
+        // Workers are stopped after threads which give them jobs
+        m_pipeline.reset();
     }
 
 
     /**
     * @brief Function to add new connection to event loop
     * @details Function get connection file descroptor.
-    * @details To manage server load used "peek next" algoritm.
+    * @details Thread is selected by placement policy or by CPU which received connection packets.
+    * @details Descriptor is switched to non-blocking mode if it's not yet.
     * @param[in] New file descriptor to open
     * @return Returns 0 in case of success, S-1 in case of error
     */
     int add_connection(int fd) const
     {
-        // Get next thread id
-        static int counter = 0;
-        int thread_id = counter++ % m_thread_num;
+        // Connection reads until EAGAIN
+        auto flags = fcntl(fd, F_GETFL);
+        if (!(flags & O_NONBLOCK) && -1 == fcntl(fd, F_SETFL, flags | O_NONBLOCK))
+        {
+            perror("[E] fcntl failed\n");
+        }
+
+        while (true)
+        {
+            auto thread_id = incoming_thread(fd);
+            if (thread_id >= size())
+            {
+                thread_id = m_placement->select(m_loads.get(), size());
+            }
+            auto& data = *m_pool[thread_id];
+
+            // Thread which was retired meanwhile and stopped can't take connection
+            std::unique_lock<std::mutex> lock(data.state_mutex, std::defer_lock);
+            if (m_elastic.enabled())
+            {
+                lock.lock();
+                if (thread_state_t::stopped == data.state)
+                {
+                    continue;
+                }
+            }
+
+            auto event = event_manager::create_event(fd, *data.slab);
+
+            // register connection to thread event loop
+            // Counted before event loop can delete it
+            data.load.connections.fetch_add(1, std::memory_order_relaxed);
+            auto result = epoll_ctl(data.epollfd, EPOLL_CTL_ADD, fd, &event);
+            if (-1 == result)
+            {
+                data.load.connections.fetch_sub(1, std::memory_order_relaxed);
+                event_manager::delete_event(event, *data.slab);
+            }
+            else
+            {
+                data.stats.counters[connections_opened].fetch_add(1, std::memory_order_relaxed);
+            }
+            return result;
+        }
+    }
+
+
+    /**
+    * @brief Let event loop thread accept connections from its own listening socket
+    * @details Socket must be non-blocking, for example one of SO_REUSEPORT sockets of the same
+    * @details port. Thread accepts connections in batches and adds them to its own event loop.
+    * @details Socket is owned by caller. After it's shutdown thread removes it from event loop.
+    * @details With incoming CPU kernel prefers listener of thread which runs on CPU that received connection.
+    * @param[in] thread_id Event loop thread index
+    * @param[in] listen_fd Listening socket
+    * @return Returns 0 in case of success, -1 in case of error
+    */
+    int add_listener(size_t thread_id, int listen_fd)
+    {
+        auto& data = *m_pool.at(thread_id);
+        data.listen_fd = listen_fd;
+
+        if (m_incoming_cpu && -1 == setsockopt(listen_fd, SOL_SOCKET, SO_INCOMING_CPU, &data.cpu, sizeof(data.cpu)))
+        {
+            perror("[E] SO_INCOMING_CPU failed\n");
+        }
+
+        epoll_event event;
+        event.data.ptr = &data;
+        event.events = EPOLLIN;
+        return epoll_ctl(data.epollfd, EPOLL_CTL_ADD, listen_fd, &event);
+    }
+
+
+    /**
+    * @brief Number of running event loop threads. Retired threads are not counted
+    */
+    size_t size() const
+    {
+        return m_active.load(std::memory_order_acquire);
+    }
+
+
+    /**
+    * @brief Number of thread slots. Elastic pool never has more threads
+    */
+    size_t max_size() const
+    {
+        return m_pool.size();
+    }
+
+
+    /**
+    * @brief Start thread in next slot of elastic pool
+    * @details Other threads give it their idle connections if they have more than average.
+    * @details If thread of slot was retired and still moves its connections, it continues to run.
+    * @return false if pool is not elastic or has max_threads already
+    */
+    bool add_thread()
+    {
+        std::lock_guard<std::mutex> resize(m_resize_mutex);
+        auto id = size();
+        if (!m_elastic.enabled() || id >= m_pool.size())
+        {
+            return false;
+        }
+
+        auto& data = *m_pool[id];
+        bool stopped;
+        {
+            std::lock_guard<std::mutex> lock(data.state_mutex);
+            stopped = thread_state_t::stopped == data.state;
+            data.state = thread_state_t::running;
+        }
+        if (stopped)
+        {
+            if (data.thr.joinable())
+            {
+                data.thr.join();
+            }
+            start_thread(data);
+        }
+        m_active.store(id + 1, std::memory_order_release);
+
+        for (size_t i = 0; i < id; ++i)
+        {
+            m_pool[i]->balance = true;
+            wake(*m_pool[i]);
+        }
+        return true;
+    }
+
+
+    /**
+    * @brief Retire the last running thread of elastic pool
+    * @details Thread takes no new connections and stops after it moved its connections to others.
+    * @return false if pool is not elastic, has min_threads or thread has own listening socket
+    */
+    bool retire_thread()
+    {
+        std::lock_guard<std::mutex> resize(m_resize_mutex);
+        auto active = size();
+        if (!m_elastic.enabled() || active <= std::max<size_t>(m_elastic.min_threads, 1))
+        {
+            return false;
+        }
+
+        auto& data = *m_pool[active - 1];
+        if (-1 != data.listen_fd)
+        {
+            return false;
+        }
+
+        m_active.store(active - 1, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lock(data.state_mutex);
+            data.state = thread_state_t::draining;
+        }
+        wake(data);
+        return true;
+    }
+
+
+    /**
+    * @brief Load counters of thread
+    */
+    const thread_load_t& load(size_t thread_id) const
+    {
+        return m_loads[thread_id];
+    }
 
-        auto event = event_manager::create_event(fd);
 
-        // register connection to thread event loop
-        return epoll_ctl(m_pool[thread_id].epollfd, EPOLL_CTL_ADD, fd, &event);
+    /**
+    * @brief Counters and histograms of thread of slot
+    */
+    const thread_stats_t& stats(size_t thread_id) const
+    {
+        return m_stats[thread_id];
+    }
+
+
+    /**
+    * @brief Add stats of all thread slots and of pool to group
+    */
+    void collect_stats(stats_group_t& group) const
+    {
+        size_t connections = 0;
+        for (size_t i = 0; i < m_pool.size(); ++i)
+        {
+            group.threads.push_back(&m_stats[i]);
+            connections += m_loads[i].connections.load(std::memory_order_relaxed);
+        }
+
+        auto slab = slab_stats();
+        group.metrics.push_back({"hash_server_connections", "Open connections", "gauge", connections});
+        group.metrics.push_back({"hash_server_threads", "Running event loop threads", "gauge", size()});
+        group.metrics.push_back({"hash_server_allocations_total", "Connection objects allocated", "counter", slab.allocations});
+        group.metrics.push_back({"hash_server_allocator_chunks", "Chunks of connection objects allocator", "gauge", slab.chunks});
+        group.metrics.push_back({"hash_server_cache_bytes", "Memory of digest caches of running threads", "gauge",
+                                 m_cache.enabled() ? size() * event_manager::cache_t::memory_of(m_cache) : 0});
+    }
+
+
+    /**
+    * @brief Counters of connection objects allocator
+    */
+    typename allocator_t::stats_t slab_stats() const
+    {
+        typename allocator_t::stats_t result;
+        for (auto& slab : m_slabs)
+        {
+            auto stats = slab.second->stats();
+            result.allocations  += stats.allocations;
+            result.reuses       += stats.reuses;
+            result.remote_frees += stats.remote_frees;
+            result.chunks       += stats.chunks;
+            result.in_use       += stats.in_use;
+        }
+        return result;
+    }
+
+
+    /**
+    * @brief CPU of thread. -1 if thread is not pinned
+    */
+    int cpu(size_t thread_id) const
+    {
+        return m_pool.at(thread_id)->cpu;
     }
 
 
@@ -153,20 +513,662 @@ private:
     /** how many maximum events to wait*/
     constexpr static int max_events = 32;
 
-    /** thread data. socket file descriptor and thread object*/
+    /** how many connections to accept from listener per event*/
+    constexpr static int max_accept = 64;
+
+    /** how often threads check if they have to give connections to others*/
+    constexpr static std::chrono::milliseconds rebalance_period{1000};
+
+    /** Thread of slot runs, moves its connections to other threads before it stops or stopped*/
+    enum class thread_state_t
+    {
+        running,
+        draining,
+        stopped
+    };
+
+    /** thread data. epoll file descriptor, load, own listening socket, pipeline port and thread object*/
     struct thread_data_t
     {
+        thread_data_t(int fd, int wake, size_t thread_id, thread_load_t& thread_load, thread_stats_t& thread_stats)
+            : epollfd(fd), wake_fd(wake), id(thread_id), load(thread_load), stats(thread_stats) {}
+
         int epollfd;
+        int wake_fd;
+        size_t id;
+        thread_load_t& load;
+        thread_stats_t& stats;
+
+        /** Connections which used read budget. Owned by queue until they are not ready*/
+        std::deque<event_manager*> ready;
+
+        /** Connections to give to other threads. Used by own thread only*/
+        size_t shed = 0;
+
+        /** Deadlines of connections and rebalance timer. Used by own thread only*/
+        timer_wheel_t timers;
+        timer_node_t rebalance;
+
+        /** Time when epoll_wait returned. Deadlines are counted from it*/
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+        /** CPU of thread and allocator of its NUMA node*/
+        int cpu = -1;
+        allocator_t* slab = nullptr;
+
+        /** Connections of thread. Kept by elastic pool only to move them when thread retires*/
+        intrusive_list_t connections;
+
+        /** Changed under state_mutex. Connection is not added to thread which stopped*/
+        std::atomic<thread_state_t> state{thread_state_t::stopped};
+        std::mutex state_mutex;
+
+        /** Thread has to check if it gives connections to new thread*/
+        std::atomic_bool balance{false};
+
+        std::atomic_int listen_fd{-1};
+        typename pipeline_t::port_t* port = nullptr;
         std::thread thr;
     };
 
 
-    /** Thread pool*/
-    std::vector<thread_data_t> m_pool;
+    /**
+    * @brief Start thread of slot
+    */
+    void start_thread(thread_data_t& data)
+    {
+        data.state = thread_state_t::running;
+        data.shed = 0;
+        data.thr = std::thread([this, &data]{event_loop(data);});
+    }
+
+
+    /**
+    * @brief Event loop of one thread
+    * @details Listener event is told apart from connection events by data pointer: for listener
+    * @details it points to thread data, for pipeline port to port, for connection to event_manager.
+    * @details Finished jobs are taken after all events, so events never point to deleted connections.
+    */
+    void event_loop(thread_data_t& data)
+    {
+        // Pinned before buffers are allocated, so they are taken from memory of its node
+        if (-1 != data.cpu && !cpu_layout_t::pin_thread(data.cpu))
+        {
+            fprintf(stderr, "[E] thread pool[%zu] cannot be pinned to CPU %d\n", data.id, data.cpu);
+        }
+
+        std::array<struct epoll_event, max_events> ev_arr;
+
+        // Buffers lent to connections while they process data
+        auto buffers = std::make_unique<typename event_manager::buffers_t>();
+        buffers->port = data.port;
+        buffers->stats = &data.stats;
+
+        std::unique_ptr<typename event_manager::cache_t> cache;
+        if (m_cache.enabled())
+        {
+            cache = std::make_unique<typename event_manager::cache_t>(m_cache, &data.stats);
+            buffers->cache = cache.get();
+        }
+
+        auto& ready = data.ready;
+        bool draining = false;
+        data.now = std::chrono::steady_clock::now();
+        if (m_rebalance)
+        {
+            data.rebalance.owner = &data;
+            data.timers.schedule(data.rebalance, data.now + rebalance_period);
+        }
+
+        // Event loop
+        while (m_run)
+        {
+            // Resume each ready connection once. Connections which are ready again go to the end.
+            // It's done before epoll_wait, so returned events never point to deleted connections
+            for (auto count = ready.size(); count; --count)
+            {
+                auto manager = ready.front();
+                ready.pop_front();
+                manager->process_data(*buffers);
+                finish_processing(data, manager);
+            }
+
+            // Don't sleep while some connections wait in ready queue
+            bool sleep = ready.empty();
+            auto wait_start = std::chrono::steady_clock::now();
+            data.load.busy_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(wait_start - data.now).count(),
+                                        std::memory_order_relaxed);
+            data.stats.loop_time.record(wait_start - data.now);
+            data.stats.add(epoll_waits, 1);
+            auto timeout = sleep ? data.timers.next_timeout(wait_start) : 0;
+            HASH_SERVER_PROBE1(epoll_wait_start, timeout);
+            int n;
+            {
+                HASH_SERVER_TRACE_SCOPE(epoll_wait);
+                n = epoll_wait(data.epollfd, ev_arr.data(), max_events, timeout);
+            }
+            HASH_SERVER_PROBE1(epoll_wait_done, n);
+            data.now = std::chrono::steady_clock::now();
+
+            bool jobs_done = false;
+            bool woken = false;
+            for (int i = 0; i < n; ++i)
+            {
+                // New connections on own listening socket
+                if (ev_arr[i].data.ptr == &data)
+                {
+                    accept_connections(data);
+                    continue;
+                }
+
+                // Hash workers finished some jobs
+                if (data.port && ev_arr[i].data.ptr == data.port)
+                {
+                    jobs_done = true;
+                    continue;
+                }
+
+                // Other thread asks to stop or to check balance
+                if (ev_arr[i].data.ptr == &data.wake_fd)
+                {
+                    woken = true;
+                    continue;
+                }
+
+                auto manager = static_cast<event_manager*>(ev_arr[i].data.ptr);
+
+                // Elastic pool knows connections of thread from their first event
+                if (m_elastic.enabled() && !manager->pool_hook().is_linked())
+                {
+                    manager->pool_hook().owner = manager;
+                    data.connections.push_back(manager->pool_hook());
+                }
+
+                // Connection in ready queue reads until error or eof when its turn comes
+                if (manager->is_ready())
+                {
+                    continue;
+                }
+
+                //Close and clean if Error or disconnected. Jobs given to workers are waited for
+                if (ev_arr[i].events & EPOLLERR || ev_arr[i].events & EPOLLHUP )
+                {
+                    manager->abort();
+                    finish_processing(data, manager);
+                    continue;
+                }
+
+                // Client reads results again. Send the rest of them
+                if (ev_arr[i].events & EPOLLOUT)
+                {
+                    manager->process_output(*buffers);
+                }
+
+                // New data available to read
+                if (ev_arr[i].events & EPOLLIN && !manager->is_ready())
+                {
+                    manager->process_data(*buffers);
+                }
+
+                finish_processing(data, manager);
+            }
+
+            if (woken)
+            {
+                uint64_t value;
+                while (-1 == read(data.wake_fd, &value, sizeof(value)) && EINTR == errno);
+                if (data.balance.exchange(false))
+                {
+                    check_balance(data);
+                }
+            }
+            if (jobs_done)
+            {
+                complete_jobs(data, *buffers);
+            }
+            if (data.port)
+            {
+                resume_waiting(data, *buffers);
+            }
+
+            data.timers.advance(data.now, [&](timer_node_t& node)
+            {
+                expire(data, node);
+            });
+
+            // Retired thread stops when it has no connections
+            if (thread_state_t::draining == data.state.load(std::memory_order_relaxed))
+            {
+                draining = true;
+                if (drain(data))
+                {
+                    return;
+                }
+            }
+            else if (draining)
+            {
+                draining = false;
+                data.shed = 0;
+            }
+        }
+    }
+
+
+    /**
+    * @brief Move connections of retired thread which are not processed to running threads
+    * @details Connections which are processed are moved by next calls.
+    * @return true if thread has no connections and is stopped
+    */
+    bool drain(thread_data_t& data)
+    {
+        data.shed = SIZE_MAX;
+        data.connections.for_each([&](list_hook_t& hook)
+        {
+            auto manager = static_cast<event_manager*>(hook.owner);
+            if (manager->is_movable())
+            {
+                migrate(data, manager);
+            }
+        });
+
+        std::lock_guard<std::mutex> lock(data.state_mutex);
+        if (thread_state_t::draining != data.state || data.load.connections.load(std::memory_order_relaxed))
+        {
+            return false;
+        }
+        data.state = thread_state_t::stopped;
+        return true;
+    }
+
+
+    /**
+    * @brief Resize elastic pool by utilization of running threads
+    * @details Utilization is time out of epoll_wait per time of all running threads.
+    */
+    void control_loop()
+    {
+        std::vector<uint64_t> busy(m_pool.size());
+        auto last = std::chrono::steady_clock::now();
+        unsigned above = 0;
+        unsigned below = 0;
+
+        std::unique_lock<std::mutex> lock(m_control_mutex);
+        while (!m_control_cv.wait_for(lock, m_elastic.period, [this]{return !m_run;}))
+        {
+            auto now = std::chrono::steady_clock::now();
+            auto active = size();
+            uint64_t total = 0;
+            for (size_t i = 0; i < m_pool.size(); ++i)
+            {
+                auto value = m_loads[i].busy_ns.load(std::memory_order_relaxed);
+                if (i < active)
+                {
+                    total += value - busy[i];
+                }
+                busy[i] = value;
+            }
+            auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count();
+            last = now;
+            auto utilization = double(total) / (double(elapsed) * active);
+
+            above = utilization > m_elastic.grow_above   ? above + 1 : 0;
+            below = utilization < m_elastic.shrink_below ? below + 1 : 0;
+            if (above >= m_elastic.grow_periods && add_thread())
+            {
+                fprintf(stdout, "Thread pool grows to %zu threads, utilization %.0f%%\n", size(), utilization * 100);
+                above = 0;
+            }
+            else if (below >= m_elastic.shrink_periods && retire_thread())
+            {
+                fprintf(stdout, "Thread pool shrinks to %zu threads, utilization %.0f%%\n", size(), utilization * 100);
+                below = 0;
+            }
+        }
+    }
+
+
+    /**
+    * @brief Handle expired timer: check balance or close connection which missed its deadline
+    * @details Connection in wheel has no work in event loop or hash workers, so it's closed at once.
+    */
+    void expire(thread_data_t& data, timer_node_t& node)
+    {
+        if (node.owner == &data)
+        {
+            check_balance(data);
+            data.timers.schedule(data.rebalance, data.now + rebalance_period);
+            return;
+        }
+
+        auto manager = static_cast<event_manager*>(node.owner);
+        manager->abort();
+        finish_processing(data, manager);
+    }
+
+
+    /**
+    * @brief Send results of jobs finished by workers
+    * @details Connection in ready queue is not deleted here. It's deleted when its turn comes.
+    */
+    void complete_jobs(thread_data_t& data, typename event_manager::buffers_t& buffers)
+    {
+        data.port->drain([&](typename pipeline_t::job_t* job)
+        {
+            auto manager = static_cast<event_manager*>(job->owner);
+            manager->complete_job(job, buffers);
+            account(data, manager);
+            if (manager->is_ready())
+            {
+                return;
+            }
+            if (manager->is_eof())
+            {
+                close_connection(data, manager);
+                return;
+            }
+            update_timer(data, manager);
+        });
+    }
+
+
+    /**
+    * @brief Resume connections which waited for free job while port has them
+    */
+    void resume_waiting(thread_data_t& data, typename event_manager::buffers_t& buffers)
+    {
+        while (!buffers.waiting.empty() && data.port->has_free())
+        {
+            auto manager = buffers.waiting.front();
+            buffers.waiting.pop_front();
+            manager->resume(buffers);
+            finish_processing(data, manager);
+        }
+    }
+
+
+    /**
+    * @brief Delete connection if it's closed or put it to ready queue if it used its read budget
+    * @details Idle connection is given to other thread if this one has too many of them.
+    */
+    void finish_processing(thread_data_t& data, event_manager* manager)
+    {
+        account(data, manager);
+        if (manager->is_eof())
+        {
+            close_connection(data, manager);
+            return;
+        }
+
+        if (manager->is_ready())
+        {
+            data.ready.push_back(manager);
+        }
+        else if (data.shed && manager->is_idle())
+        {
+            migrate(data, manager);
+            return;
+        }
+        update_timer(data, manager);
+    }
+
+
+    /**
+    * @brief Set connection deadline from now if client moved since it was set or stop it
+    */
+    void update_timer(thread_data_t& data, event_manager* manager)
+    {
+        if (!m_timeouts.enabled())
+        {
+            return;
+        }
+
+        timeout_kind_t kind;
+        bool changed = manager->update_deadline(kind);
+        auto& node = manager->timer();
+        auto timeout = m_timeouts.of(kind);
+        if (!timeout.count())
+        {
+            data.timers.cancel(node);
+        }
+        else if (changed || !node.is_linked())
+        {
+            node.owner = manager;
+            data.timers.schedule(node, data.now + timeout);
+        }
+    }
+
+
+    static void wake(thread_data_t& data)
+    {
+        uint64_t one = 1;
+        if (sizeof(one) != write(data.wake_fd, &one, sizeof(one)))
+        {
+            perror("[E] eventfd write failed\n");
+        }
+    }
+
+
+    /**
+    * @brief Add change of connection bytes in flight to thread load and its counters to thread stats
+    */
+    static void account(thread_data_t& data, event_manager* manager)
+    {
+        data.load.bytes.fetch_add(static_cast<size_t>(manager->load_delta()), std::memory_order_relaxed);
+        data.stats.add(manager->counters());
+    }
+
+
+    void close_connection(thread_data_t& data, event_manager* manager)
+    {
+        data.load.connections.fetch_sub(1, std::memory_order_relaxed);
+        data.timers.cancel(manager->timer());
+        data.connections.remove(manager->pool_hook());
+        data.stats.add(connections_closed, 1);
+
+        epoll_event event;
+        event.data.ptr = manager;
+        event_manager::delete_event(event, *data.slab);
+    }
+
+
+    /**
+    * @brief Decide how many connections thread gives to others
+    * @details Thread gives connections if it has a quarter more than average.
+    */
+    void check_balance(thread_data_t& data)
+    {
+        size_t total = 0;
+        auto active = size();
+        for (size_t i = 0; i < active; ++i)
+        {
+            total += m_loads[i].connections.load(std::memory_order_relaxed);
+        }
+        auto average = total / active;
+        auto own = data.load.connections.load(std::memory_order_relaxed);
+        data.shed = own > average + average / 4 + 1 ? own - average : 0;
+    }
+
+
+    /**
+    * @brief Move idle connection to epoll of thread with least connections
+    * @details Connection is not used by this thread after it's added to other epoll.
+    * @details Its deadline is stopped. Target sets it again when it gets first EPOLLOUT of socket.
+    */
+    void migrate(thread_data_t& data, event_manager* manager)
+    {
+        auto& target = *m_pool[m_least.select(m_loads.get(), size())];
+        if (&target == &data)
+        {
+            data.shed = 0;
+            return;
+        }
+
+        // Target which was retired meanwhile and stopped doesn't run its event loop
+        std::unique_lock<std::mutex> lock(target.state_mutex, std::defer_lock);
+        if (m_elastic.enabled())
+        {
+            lock.lock();
+            if (thread_state_t::stopped == target.state)
+            {
+                return;
+            }
+        }
+
+        auto fd = manager->get_fd();
+        if (-1 == epoll_ctl(data.epollfd, EPOLL_CTL_DEL, fd, NULL))
+        {
+            return;
+        }
+        // Bytes in flight go with connection, target accounts their change from now on
+        auto bytes = manager->accounted_load();
+        data.load.connections.fetch_sub(1, std::memory_order_relaxed);
+        target.load.connections.fetch_add(1, std::memory_order_relaxed);
+        data.load.bytes.fetch_sub(bytes, std::memory_order_relaxed);
+        target.load.bytes.fetch_add(bytes, std::memory_order_relaxed);
+        data.timers.cancel(manager->timer());
+        data.connections.remove(manager->pool_hook());
+        --data.shed;
+
+        epoll_event event;
+        event.data.ptr = manager;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        if (-1 == epoll_ctl(target.epollfd, EPOLL_CTL_ADD, fd, &event))
+        {
+            perror("[E] epoll_ctl failed\n");
+            target.load.connections.fetch_sub(1, std::memory_order_relaxed);
+            data.load.connections.fetch_add(1, std::memory_order_relaxed);
+            target.load.bytes.fetch_sub(bytes, std::memory_order_relaxed);
+            data.load.bytes.fetch_add(bytes, std::memory_order_relaxed);
+            epoll_ctl(data.epollfd, EPOLL_CTL_ADD, fd, &event);
+        }
+    }
+
+
+    /**
+    * @brief Thread pinned to CPU which received packets of connection
+    * @return Thread index or size() if there's no such thread
+    */
+    size_t incoming_thread(int fd) const
+    {
+        int cpu = -1;
+        socklen_t len = sizeof(cpu);
+        if (!m_incoming_cpu || -1 == getsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) || cpu < 0)
+        {
+            return size();
+        }
+
+        auto active = size();
+        size_t found = active;
+        for (size_t i = 0; i < active; ++i)
+        {
+            // Less loaded of threads of this CPU
+            auto& data = *m_pool[i];
+            if (data.cpu == cpu && (found == active ||
+                data.load.connections.load(std::memory_order_relaxed) < m_pool[found]->load.connections.load(std::memory_order_relaxed)))
+            {
+                found = i;
+            }
+        }
+        return found;
+    }
+
 
-    /** How many threads*/
+    /**
+    * @brief Accept up to max_accept connections from thread listening socket
+    * @details Listener is level triggered, so connections left in queue trigger next event.
+    * @details If listener was shutdown it is removed from event loop.
+    */
+    void accept_connections(thread_data_t& data)
+    {
+        for (int n = 0; n < max_accept; ++n)
+        {
+            HASH_SERVER_TRACE_SCOPE(accept);
+            int fd = accept4(data.listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            HASH_SERVER_PROBE1(accept, fd);
+            if (-1 == fd)
+            {
+                if (errno == EAGAIN      || errno == EWOULDBLOCK)
+                {
+                    return;
+                }
+                else if (errno == EINTR       || errno == ECONNABORTED || errno == EPROTO    ||
+                         errno == ENONET      || errno == ENOPROTOOPT  || errno == EOPNOTSUPP ||
+                         errno == ENETDOWN    || errno == ENETUNREACH  || errno == EHOSTDOWN  ||
+                         errno == EHOSTUNREACH)
+                {
+                    continue;
+                }
+                else if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+                {
+                    fprintf(stderr, "Connection accept error: %s\n", strerror(errno));
+                    return;
+                }
+
+                // Server shutdown
+                epoll_ctl(data.epollfd, EPOLL_CTL_DEL, data.listen_fd, NULL);
+                data.listen_fd = -1;
+                return;
+            }
+
+            auto event = event_manager::create_event(fd, *data.slab);
+            data.load.connections.fetch_add(1, std::memory_order_relaxed);
+            if (-1 == epoll_ctl(data.epollfd, EPOLL_CTL_ADD, fd, &event))
+            {
+                perror("[E] epoll_ctl failed\n");
+                data.load.connections.fetch_sub(1, std::memory_order_relaxed);
+                event_manager::delete_event(event, *data.slab);
+                continue;
+            }
+            data.stats.counters[connections_opened].fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+
+
+    /** Connection objects allocators by NUMA node. Accepting thread allocates, event loop threads delete*/
+    std::vector<std::pair<int, std::unique_ptr<allocator_t>>> m_slabs;
+
+    /** Policy of add_connection and target of rebalancing*/
+    std::unique_ptr<placement_t> m_placement;
+    least_connections_placement_t m_least;
+    bool m_rebalance;
+
+    /** Deadlines of connections*/
+    timeout_options_t m_timeouts;
+
+    /** Connection is given to thread of CPU which received it*/
+    bool m_incoming_cpu;
+
+    /** Limits and thresholds of resizing. Disabled if pool has fixed size*/
+    elastic_options_t m_elastic;
+
+    /** Digest cache of each thread. Disabled by default*/
+    cache_options_t m_cache;
+
+    /** How many thread slots*/
     size_t m_thread_num;
 
+    /** Loads of threads. Thread data keeps reference to its own*/
+    std::unique_ptr<thread_load_t[]> m_loads;
+
+    /** Counters and histograms of threads. Thread data keeps reference to its own*/
+    std::unique_ptr<thread_stats_t[]> m_stats;
+
+    /** Thread pool. Thread data must not be moved when threads are running*/
+    std::vector<std::unique_ptr<thread_data_t>> m_pool;
+
+    /** Threads of first m_active slots are running. Others are retired or not started*/
+    std::atomic_size_t m_active{0};
+    std::mutex m_resize_mutex;
+
+    /** Thread which resizes elastic pool*/
+    std::thread m_controller;
+    std::mutex m_control_mutex;
+    std::condition_variable m_control_cv;
+
+    /** Hash workers. Empty if lines are hashed by event loop threads*/
+    std::unique_ptr<pipeline_t> m_pipeline;
+
     /** Run flag. setup to true when object created and to false when object is destroying*/
     std::atomic_bool m_run;
 };
@@ -0,0 +1,59 @@
+/**
+ * @file cpu_features.hpp
+ * @author Domnikov Ivan
+ * @brief CPU features used to select hash kernels at startup.
+ *
+ */
+#pragma once
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
+namespace net
+{
+
+/**
+ * @brief Instruction set extensions available on host CPU
+ * @details Detected once on first call of get(). On other than x86-64 all flags are false.
+ */
+struct cpu_features_t
+{
+    bool sse41    = false;
+    bool avx2     = false;
+    bool avx512f  = false;
+    bool avx512bw = false;
+    bool sha_ni   = false;
+
+    /**
+     * @brief Features of host CPU
+     */
+    static const cpu_features_t& get()
+    {
+        static const cpu_features_t features = detect();
+        return features;
+    }
+
+private:
+    static cpu_features_t detect()
+    {
+        cpu_features_t features;
+#if defined(__x86_64__)
+        __builtin_cpu_init();
+        features.sse41    = __builtin_cpu_supports("sse4.1");
+        features.avx2     = __builtin_cpu_supports("avx2");
+        features.avx512f  = __builtin_cpu_supports("avx512f");
+        features.avx512bw = __builtin_cpu_supports("avx512bw");
+
+        // SHA extensions: CPUID.(EAX=7,ECX=0):EBX bit 29
+        unsigned int eax, ebx, ecx, edx;
+        if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+        {
+            features.sha_ni = ebx & (1u << 29);
+        }
+#endif
+        return features;
+    }
+};
+
+} // namespace net
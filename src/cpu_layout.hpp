@@ -0,0 +1,286 @@
+/**
+ * @file cpu_layout.hpp
+ * @author Domnikov Ivan
+ * @brief CPU topology of host and pinning of event loop threads.
+ *
+ */
+#pragma once
+
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace net
+{
+
+/**
+ * @brief Options of event loop threads layout
+ */
+struct affinity_options_t
+{
+    /** Thread i is pinned to cpus[i % cpus.size()]. Empty - threads are not pinned*/
+    std::vector<int> cpus;
+
+    /** Thread for connection is one which runs on CPU that received its packets (SO_INCOMING_CPU)*/
+    bool incoming_cpu = false;
+};
+
+
+/**
+ * @brief Logical CPU of host
+ */
+struct cpu_info_t
+{
+    int cpu;
+    int core;
+    int package;
+    int node;
+};
+
+
+/**
+ * @brief Topology of host CPUs read from sysfs
+ */
+class cpu_layout_t
+{
+public:
+    /**
+     * @brief Parse list of CPUs like "0-3,8,10-11"
+     * @return false if list is wrong
+     */
+    static bool parse_list(std::string_view str, std::vector<int>& cpus)
+    {
+        cpus.clear();
+        while (!str.empty())
+        {
+            auto comma = str.find(',');
+            auto item = str.substr(0, comma);
+            str = comma == std::string_view::npos ? std::string_view{} : str.substr(comma + 1);
+
+            auto dash = item.find('-');
+            int first, last;
+            if (!parse_int(item.substr(0, dash), first))
+            {
+                return false;
+            }
+            last = first;
+            if (dash != std::string_view::npos && !parse_int(item.substr(dash + 1), last))
+            {
+                return false;
+            }
+            if (last < first)
+            {
+                return false;
+            }
+            for (int cpu = first; cpu <= last; ++cpu)
+            {
+                cpus.push_back(cpu);
+            }
+        }
+        return !cpus.empty();
+    }
+
+
+    /**
+     * @brief Online CPUs of host with their core, package and NUMA node
+     * @details If sysfs is not available then each CPU is its own core of node 0.
+     */
+    static std::vector<cpu_info_t> detect()
+    {
+        std::vector<int> online;
+        if (!parse_list(read_line("/sys/devices/system/cpu/online"), online))
+        {
+            for (long cpu = 0; cpu < sysconf(_SC_NPROCESSORS_ONLN); ++cpu)
+            {
+                online.push_back(cpu);
+            }
+        }
+
+        std::vector<cpu_info_t> result;
+        for (auto cpu : online)
+        {
+            auto dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+            cpu_info_t info{cpu, cpu, 0, 0};
+            parse_int(read_line(dir + "/topology/core_id"), info.core);
+            parse_int(read_line(dir + "/topology/physical_package_id"), info.package);
+            info.node = cpu_node(dir);
+            result.push_back(info);
+        }
+        return result;
+    }
+
+
+    /**
+     * @brief First logical CPU of each physical core, ordered by CPU number
+     */
+    static std::vector<int> physical_cores(const std::vector<cpu_info_t>& cpus)
+    {
+        std::set<std::pair<int, int>> cores;
+        std::vector<int> result;
+        for (auto& info : cpus)
+        {
+            if (cores.emplace(info.package, info.core).second)
+            {
+                result.push_back(info.cpu);
+            }
+        }
+        return result;
+    }
+
+
+    /**
+     * @brief CPUs which handle interrupts of network interface
+     * @details Interrupts are found in /proc/interrupts by interface name, e.g. eth0-TxRx-0 queues.
+     * @param[in] iface Network interface name
+     */
+    static std::vector<int> irq_cpus(std::string_view iface)
+    {
+        std::set<int> cpus;
+        std::ifstream interrupts("/proc/interrupts");
+        std::string line;
+        while (std::getline(interrupts, line))
+        {
+            if (line.find(iface) == std::string::npos)
+            {
+                continue;
+            }
+
+            auto colon = line.find(':');
+            int irq;
+            if (colon == std::string::npos || !parse_int(trim(std::string_view(line).substr(0, colon)), irq))
+            {
+                continue;
+            }
+
+            std::vector<int> list;
+            auto dir = "/proc/irq/" + std::to_string(irq);
+            if (parse_list(read_line(dir + "/effective_affinity_list"), list) ||
+                parse_list(read_line(dir + "/smp_affinity_list"), list))
+            {
+                cpus.insert(list.begin(), list.end());
+            }
+        }
+        return {cpus.begin(), cpus.end()};
+    }
+
+
+    /**
+     * @brief NUMA node of CPU. 0 if it's unknown
+     */
+    static int node_of(const std::vector<cpu_info_t>& cpus, int cpu)
+    {
+        for (auto& info : cpus)
+        {
+            if (info.cpu == cpu)
+            {
+                return info.node;
+            }
+        }
+        return 0;
+    }
+
+
+    /**
+     * @brief Pin calling thread to CPU
+     * @return false if CPU can't be used
+     */
+    static bool pin_thread(int cpu)
+    {
+        if (cpu < 0 || cpu >= CPU_SETSIZE)
+        {
+            return false;
+        }
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        return 0 == pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+
+    /**
+     * @brief Prefer memory of NUMA node for pages of range which are not touched yet
+     * @details Range must be aligned to page size. Pages touched already are moved if they can be.
+     * @return false if kernel doesn't support NUMA policy
+     */
+    static bool bind_memory(void* addr, size_t len, int node)
+    {
+        if (node < 0 || node >= static_cast<int>(sizeof(unsigned long) * 8))
+        {
+            return false;
+        }
+        unsigned long mask = 1ul << node;
+        return 0 == syscall(SYS_mbind, addr, len, MPOL_PREFERRED, &mask, sizeof(mask) * 8, MPOL_MF_MOVE);
+    }
+
+private:
+    static bool parse_int(std::string_view str, int& value)
+    {
+        str = trim(str);
+        if (str.empty() || str.size() > 9 || !std::all_of(str.begin(), str.end(), [](char c){return c >= '0' && c <= '9';}))
+        {
+            return false;
+        }
+        value = std::atoi(std::string(str).c_str());
+        return true;
+    }
+
+
+    static std::string_view trim(std::string_view str)
+    {
+        while (!str.empty() && (str.front() == ' ' || str.front() == '\n'))
+        {
+            str.remove_prefix(1);
+        }
+        while (!str.empty() && (str.back() == ' ' || str.back() == '\n'))
+        {
+            str.remove_suffix(1);
+        }
+        return str;
+    }
+
+
+    static std::string read_line(const std::string& path)
+    {
+        std::ifstream file(path);
+        std::string line;
+        std::getline(file, line);
+        return line;
+    }
+
+
+    /**
+     * @brief NUMA node of CPU from nodeN link in its sysfs directory
+     */
+    static int cpu_node(const std::string& dir)
+    {
+        int node = 0;
+        if (auto handle = opendir(dir.c_str()))
+        {
+            while (auto entry = readdir(handle))
+            {
+                if (0 == strncmp(entry->d_name, "node", 4) && parse_int(entry->d_name + 4, node))
+                {
+                    break;
+                }
+            }
+            closedir(handle);
+        }
+        return node;
+    }
+};
+
+} // namespace net
@@ -0,0 +1,264 @@
+/**
+ * @file digest_cache.hpp
+ * @author Domnikov Ivan
+ * @brief Bounded cache of results of repeated short lines.
+ *
+ */
+#pragma once
+
+#include "stats.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string_view>
+
+#if __has_include(<xxhash.h>)
+#define XXH_INLINE_ALL
+#include <xxhash.h>
+#define HASH_SERVER_CACHE_XXH3 1
+#endif
+
+namespace net
+{
+
+/**
+ * @brief Options of digest cache
+ * @details Each event loop thread has its own cache of memory bytes, so it's used without locks.
+ * @details Lines longer than max_line are always hashed.
+ */
+struct cache_options_t
+{
+    /** Bytes of cache of one thread. Cache is disabled if it's zero*/
+    size_t memory = 0;
+
+    /** The longest line which is cached*/
+    size_t max_line = 64;
+
+    bool enabled() const
+    {
+        return memory && max_line;
+    }
+};
+
+
+/**
+ * @brief Set-associative map from line to its result with CLOCK eviction
+ * @details Line is found by 64 bit fingerprint (XXH3 if it's available) and compared in full, so
+ * @details collision of fingerprints never gives result of other line. Set of line is selected by
+ * @details fingerprint, its WAYS slots are replaced by CLOCK: slot which was hit since hand passed
+ * @details it gets second chance. Cache belongs to one thread, its counters are added to stats
+ * @details of that thread by record.
+ * @param RESULT_LEN Length of result of processor
+ */
+template <size_t RESULT_LEN>
+class digest_cache_t
+{
+public:
+    /** Slots of one set*/
+    constexpr static size_t WAYS = 8;
+
+    /**
+     * @param[in] options Memory and the longest line
+     * @param[in] stats Stats of owner thread. Counters aren't kept if it's null
+     */
+    explicit digest_cache_t(const cache_options_t& options, thread_stats_t* stats = nullptr)
+        :m_max_line(std::min<size_t>(options.max_line, UINT16_MAX)), m_stride(m_max_line + RESULT_LEN), m_stats(stats)
+    {
+        // Number of sets is power of two, so set is taken by mask
+        size_t sets = std::max<size_t>(1, options.memory / (WAYS * slot_bytes(m_max_line)));
+        m_mask = (size_t(1) << (63 - __builtin_clzll(sets))) - 1;
+        m_meta.reset(new meta_t[capacity()]());
+        m_hands.reset(new uint8_t[m_mask + 1]());
+        m_data.reset(new char[capacity() * m_stride]);
+    }
+
+    digest_cache_t(const digest_cache_t&) = delete;
+    digest_cache_t& operator=(const digest_cache_t&) = delete;
+
+
+    /**
+     * @brief Bytes used by cache of options
+     */
+    static size_t memory_of(const cache_options_t& options)
+    {
+        size_t max_line = std::min<size_t>(options.max_line, UINT16_MAX);
+        size_t sets = std::max<size_t>(1, options.memory / (WAYS * slot_bytes(max_line)));
+        sets = size_t(1) << (63 - __builtin_clzll(sets));
+        return sets * (WAYS * slot_bytes(max_line) + 1);
+    }
+
+
+    /**
+     * @brief Slots of all sets
+     */
+    size_t capacity() const
+    {
+        return (m_mask + 1) * WAYS;
+    }
+
+
+    size_t max_line() const
+    {
+        return m_max_line;
+    }
+
+
+    /**
+     * @brief Copy result of line to dst
+     * @return false if line is not cached
+     */
+    bool find(std::string_view line, char* dst)
+    {
+        if (line.size() > m_max_line)
+        {
+            return false;
+        }
+
+        auto print = fingerprint(line);
+        auto first = (print >> 32 & m_mask) * WAYS;
+        for (auto slot = first; slot < first + WAYS; ++slot)
+        {
+            auto& meta = m_meta[slot];
+            if (meta.print == print && meta.len == line.size() &&
+                0 == memcmp(key(slot), line.data(), line.size()))
+            {
+                meta.referenced = true;
+                memcpy(dst, result(slot), RESULT_LEN);
+                return true;
+            }
+        }
+        return false;
+    }
+
+
+    /**
+     * @brief Keep result of line. Line which is too long is skipped
+     */
+    void insert(std::string_view line, const char* line_result)
+    {
+        if (line.size() > m_max_line)
+        {
+            return;
+        }
+
+        auto print = fingerprint(line);
+        auto set = print >> 32 & m_mask;
+        auto first = set * WAYS;
+
+        // Hand goes over slots of set and clears their references until it finds not referenced one
+        auto& hand = m_hands[set];
+        while (m_meta[first + hand].referenced)
+        {
+            m_meta[first + hand].referenced = false;
+            hand = (hand + 1) % WAYS;
+        }
+        auto slot = first + hand;
+        hand = (hand + 1) % WAYS;
+
+        auto& meta = m_meta[slot];
+        m_evictions += 0 != meta.print;
+        meta.print = print;
+        meta.len = static_cast<uint16_t>(line.size());
+        meta.referenced = false;
+        memcpy(key(slot), line.data(), line.size());
+        memcpy(result(slot), line_result, RESULT_LEN);
+    }
+
+
+    /**
+     * @brief Add results of lookups to stats of owner thread
+     * @param[in] hits Lines found in cache
+     * @param[in] misses Lines which could be cached and were hashed
+     * @param[in] saved_ns Estimated time of hashing of lines which were found
+     */
+    void record(uint64_t hits, uint64_t misses, uint64_t saved_ns)
+    {
+        if (m_stats)
+        {
+            m_stats->add(cache_hits, hits);
+            m_stats->add(cache_misses, misses);
+            m_stats->add(cache_saved_ns, saved_ns);
+            m_stats->add(cache_evictions, m_evictions);
+        }
+        m_evictions = 0;
+    }
+
+
+    /**
+     * @brief Average time of hashing of line
+     * @details Kept as moving average of batches hashed with cache, so time saved by hit is known.
+     */
+    uint64_t& hash_ns()
+    {
+        return m_hash_ns;
+    }
+
+private:
+    struct meta_t
+    {
+        /** Fingerprint of line. Slot is empty if it's zero*/
+        uint64_t print;
+        uint16_t len;
+        bool referenced;
+    };
+
+    static size_t slot_bytes(size_t max_line)
+    {
+        return sizeof(meta_t) + max_line + RESULT_LEN;
+    }
+
+    static uint64_t fingerprint(std::string_view line)
+    {
+#ifdef HASH_SERVER_CACHE_XXH3
+        uint64_t print = XXH3_64bits(line.data(), line.size());
+#else
+        // FNV-1a over 8 byte words with final mixing of murmur3
+        uint64_t print = 0xcbf29ce484222325ull ^ line.size();
+        size_t i = 0;
+        for (; i + 8 <= line.size(); i += 8)
+        {
+            uint64_t word;
+            memcpy(&word, line.data() + i, 8);
+            print = (print ^ word) * 0x100000001b3ull;
+        }
+        for (; i < line.size(); ++i)
+        {
+            print = (print ^ static_cast<unsigned char>(line[i])) * 0x100000001b3ull;
+        }
+        print ^= print >> 33;
+        print *= 0xff51afd7ed558ccdull;
+        print ^= print >> 33;
+#endif
+        return print | 1;
+    }
+
+    char* key(size_t slot)
+    {
+        return m_data.get() + slot * m_stride;
+    }
+
+    char* result(size_t slot)
+    {
+        return key(slot) + m_max_line;
+    }
+
+    size_t m_max_line;
+    size_t m_stride;
+    size_t m_mask;
+    std::unique_ptr<meta_t[]> m_meta;
+
+    /** CLOCK hand of each set*/
+    std::unique_ptr<uint8_t[]> m_hands;
+
+    /** Lines and their results. Slot has place for the longest line*/
+    std::unique_ptr<char[]> m_data;
+
+    thread_stats_t* m_stats;
+    uint64_t m_evictions = 0;
+    uint64_t m_hash_ns = 0;
+};
+
+} // namespace net
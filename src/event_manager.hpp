@@ -6,14 +6,30 @@
  */
 #pragma once
 
+#include "digest_cache.hpp"
 #include "fd_holder.hpp"
+#include "frame_parser.hpp"
 #include "hash_calc.hpp"
+#include "hash_pipeline.hpp"
+#include "intrusive_list.hpp"
+#include "line_hasher.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+#include "timer_wheel.hpp"
 
 #include <sys/epoll.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <new>
 #include <thread>
+#include <type_traits>
 #include <vector>
 #include <atomic>
 #include <cstring>
@@ -31,12 +47,80 @@ namespace net
  * @details Processor is any class with folliwing methods:
  * @code void process(std::string_view);
  * @code std::string_view get_result();
+ * @details Processor can also hash complete lines in batches. Then it must have:
+ * @code constexpr static size_t BATCH_SIZE, RESULT_LEN;
+ * @code bool has_pending() const;
+ * @code void process_batch(const std::string_view* lines, size_t count, char* out);
  * @details parameter IS_TCP  will choose write(fifo, pipe) or send(socket) method
+ * @details Results are collected in output buffer and sent once per read buffer. If socket
+ * @details cannot take all of them then the rest is kept until EPOLLOUT (see process_output)
+ * @details and reading is paused while more than HIGH_WATER bytes wait to be sent.
+ * @details Read and output buffers (buffers_t) belong to event loop thread and are lent to
+ * @details connection only while it processes data. Connection itself keeps file descriptor,
+ * @details processor state of unfinished line and results which client didn't take yet.
+ * @details If event loop has hash pipeline then complete lines of bulk upload are hashed by its
+ * @details workers in parallel, job by job, and connection keeps jobs given to them until
+ * @details results are sent in order (see complete_job).
+ * @details Protocol selects wire protocol of connection: text_protocol_t (lines and hex results),
+ * @details crlf_protocol_t (the same, but "\r\n" ends line too), binary_protocol_t (frames of records and raw digests, see frame_parser_t) or
+ * @details auto_protocol_t which is binary only if connection starts with frame_parser_t::MAGIC.
+ * @details Binary protocol needs Processor with DIGEST_LEN and get_digest. Records are hashed
+ * @details by event loop thread, without pipeline and digest cache.
  */
-template <class Processor, bool IS_TCP>
+template <class Processor, bool IS_TCP, class Protocol = text_protocol_t>
 class event_manager_t
 {
 public:
+    /** Connection may use binary protocol*/
+    constexpr static bool FRAMED = std::is_same_v<Protocol, binary_protocol_t> || std::is_same_v<Protocol, auto_protocol_t>;
+
+    /** Lines may end with "\r\n"*/
+    constexpr static bool CRLF = std::is_same_v<Protocol, crlf_protocol_t>;
+
+    /** Read buffer size*/
+    static const size_t READ_BUF_SIZE = 64 * 1024;
+
+    /** Maximum bytes read by one process_data call*/
+    static const size_t READ_BUDGET = 4 * READ_BUF_SIZE;
+
+    /** Pause reading when more output than this waits to be sent*/
+    static const size_t HIGH_WATER = 64 * 1024;
+
+    /** Resume reading when output is less than this*/
+    static const size_t LOW_WATER = 16 * 1024;
+
+    /** Hash workers which take complete lines from event loop threads (see hash_pipeline_t)*/
+    using pipeline_t = hash_pipeline_t<Processor>;
+    using job_t = typename pipeline_t::job_t;
+    static_assert(pipeline_t::JOB_SIZE >= READ_BUF_SIZE, "Pipeline job is smaller than read buffer");
+
+    /** Results of repeated short lines kept by event loop thread*/
+    using cache_t = digest_cache_t<Processor::RESULT_LEN>;
+
+    /**
+     * @brief Buffers shared by all connections of one event loop thread
+     */
+    struct buffers_t
+    {
+        /** Read buffer*/
+        std::array<char, READ_BUF_SIZE> rd_buf;
+
+        /** Results of current read buffer*/
+        std::vector<char> out;
+
+        /** Port of hash pipeline. If it's set then data is read into jobs and hashed by workers*/
+        typename pipeline_t::port_t* port = nullptr;
+
+        /** Connections which wait for free job of port*/
+        std::deque<event_manager_t*> waiting;
+
+        /** Stats of event loop thread. Latency of lines is measured only if it's set*/
+        thread_stats_t* stats = nullptr;
+
+        /** Digest cache of event loop thread. Lines are always hashed if it's not set*/
+        cache_t* cache = nullptr;
+    };
+
     /**
      * @brief Static method to create event for given file descriptor
      * @param[in] File descriptor
@@ -47,7 +131,26 @@ public:
         // create event for accepted connection
         epoll_event event;
         event.data.ptr = new event_manager_t(fd);
-        event.events = EPOLLIN | EPOLLET;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+
+        return event;
+    }
+
+    /**
+     * @brief Same as create_event but event_manager is placed into memory from allocator
+     * @details Event created this way must be deleted with the same allocator
+     * @param[in] File descriptor
+     * @param[in] allocator Allocator of fixed size slots (see slab_allocator_t)
+     * @result epoll_event object with event_manager as raw pointer in event.data.ptr
+     */
+    template <class Allocator>
+    static epoll_event create_event(int fd, Allocator& allocator)
+    {
+        static_assert(Allocator::SLOT_SIZE >= sizeof(event_manager_t), "Allocator slot is too small");
+
+        epoll_event event;
+        event.data.ptr = new (allocator.allocate()) event_manager_t(fd);
+        event.events = EPOLLIN | EPOLLOUT | EPOLLET;
 
         return event;
     }
@@ -68,23 +171,302 @@ public:
     }
 
     /**
-     * @brief Read all available data from file descriptor, process it and sent result to socket
+     * @brief Static deleter for event created by create_event with allocator
+     * @param epoll_event as raw poiner
+     * @param[in] allocator Allocator given to create_event
+     */
+    template <class Allocator>
+    static void delete_event(epoll_event& event, Allocator& allocator)
+    {
+        if(event.data.ptr)
+        {
+            auto manager = static_cast<event_manager_t*>(event.data.ptr);
+            manager->~event_manager_t();
+            allocator.deallocate(manager);
+            event.data.ptr = nullptr;
+        }
+    }
+
+    /**
+     * @brief Read available data from file descriptor, process it and sent result to socket
+     * @details Descriptor must be non-blocking. At most READ_BUDGET bytes are read per call, so one
+     * @details bulk client doesn't hold event loop thread. If budget is used and data may remain
+     * @details then connection is ready (see is_ready) and must be resumed with next call
+     * @details because edge triggered epoll will not report this data again.
+     * @details Kept output is sent first: EPOLLOUT which came while connection was ready is skipped.
      * @details After calling this method need to check is_eof is descriptor is closed a
      * @details And delete closed descriptors with calling  delete_event static method
+     * @param[in] buffers Event loop thread buffers
+     * @return true if connection is ready
+     */
+    bool process_data(buffers_t& buffers)
+    {
+        size_t budget = READ_BUDGET;
+        m_ready = false;
+        if (pending_output())
+        {
+            if (!flush_output())
+            {
+                return false;
+            }
+            if (m_paused && pending_output() < LOW_WATER)
+            {
+                m_paused = false;
+            }
+        }
+        while(!m_paused && !m_eof && !m_waiting && read_data(buffers, budget))
+        {
+            if (!budget)
+            {
+                m_ready = true;
+                break;
+            }
+        }
+        return m_ready;
+    }
+
+    /**
+     * @brief Send output kept after previous short write. Called when descriptor is writable again
+     * @details If reading was paused and output dropped below LOW_WATER then reading is resumed.
+     * @details After calling this method need to check is_eof as after process_data.
+     * @param[in] buffers Event loop thread buffers
+     * @return true if connection is ready (see process_data)
+     */
+    bool process_output(buffers_t& buffers)
+    {
+        if (!flush_output())
+        {
+            return false;
+        }
+
+        if (m_paused && pending_output() < LOW_WATER)
+        {
+            m_paused = false;
+            return process_data(buffers);
+        }
+        return false;
+    }
+
+    /**
+     * @brief Continue reading after waiting for free job of pipeline port
+     * @details Called by event loop for connections of buffers_t::waiting when port has free jobs.
+     * @param[in] buffers Event loop thread buffers
+     * @return true if connection is ready (see process_data)
+     */
+    bool resume(buffers_t& buffers)
+    {
+        m_waiting = false;
+        return process_data(buffers);
+    }
+
+    /**
+     * @brief Send results of job which came back from pipeline worker
+     * @details Results are sent in order of jobs, so they wait until all previous jobs are done.
+     * @details Jobs are given back to port as soon as their results are taken.
+     * @details After calling this method need to check is_eof as after process_data.
+     * @param[in] job Finished job of this connection
+     * @param[in] buffers Event loop thread buffers
+     * @return false if sending failed
      */
-    void process_data()
+    bool complete_job(job_t* job, buffers_t& buffers)
     {
-        while(read_data()){}
+        job->done = true;
+
+        bool result = true;
+        while (m_jobs_head && m_jobs_head->done)
+        {
+            auto head = m_jobs_head;
+            m_jobs_head = head->next;
+            if (!m_jobs_head)
+            {
+                m_jobs_tail = nullptr;
+            }
+            m_jobs_bytes -= head->end - head->begin;
+
+            if (!m_error && result)
+            {
+                result = send_output({head->results.data(), head->results.size()});
+                count_lines(buffers, head->results.size(), head->read_time);
+            }
+            buffers.port->release(head);
+        }
+
+        if (pending_output() > HIGH_WATER)
+        {
+            m_paused = true;
+        }
+        return result;
+    }
+
+    /**
+     * @brief Drop results and finish connection after socket error or hangup
+     * @details Connection can be deleted when is_eof is true. Until then jobs of pipeline are in work.
+     */
+    void abort()
+    {
+        close_on_error();
+    }
+
+    /**
+     * @brief Hash data received by caller and keep results in connection until caller sends them
+     * @details Used by completion based backends (see uring_pool_t) which read and send by themselves.
+     * @details Line without following newline symbol is continued by next call as in process_data.
+     * @param[in] data Received data
+     */
+    void process_received(std::string_view data)
+    {
+        collect_results(data, m_out);
+    }
+
+    /**
+     * @brief Move results kept in connection to dst
+     * @details dst is cleared and its memory is reused for next results
+     * @param[in,out] dst Buffer which caller sends
+     */
+    void take_output(std::vector<char>& dst)
+    {
+        dst.clear();
+        dst.swap(m_out);
+        dst.erase(dst.begin(), dst.begin() + m_out_sent);
+        m_out_sent = 0;
+    }
+
+    /**
+     * @brief Return if read budget was used and data may remain unread
+     */
+    bool is_ready()
+    {
+        return m_ready;
+    }
+
+    /**
+     * @brief Return if reading is paused because client doesn't read results
+     */
+    bool is_paused()
+    {
+        return m_paused;
+    }
+
+    /**
+     * @brief Bytes of results waiting to be sent
+     */
+    size_t pending_output()
+    {
+        return m_out.size() - m_out_sent;
+    }
+
+    /**
+     * @brief Bytes of work queued in connection
+     * @details Results not sent, data given to hash workers and READ_BUDGET if connection used its
+     * @details budget and waits for next turn with data in socket.
+     */
+    size_t in_flight()
+    {
+        return pending_output() + m_jobs_bytes + (m_ready ? READ_BUDGET : 0);
+    }
+
+    /**
+     * @brief Change of in_flight since previous call. Event loop adds it to load of its thread
+     */
+    std::ptrdiff_t load_delta()
+    {
+        auto now = in_flight();
+        std::ptrdiff_t delta = now - m_load;
+        m_load = now;
+        return delta;
+    }
+
+    /**
+     * @brief in_flight which was added to load of thread by the last load_delta
+     * @details Connection which moves to other thread takes it from its old thread to the new one.
+     */
+    size_t accounted_load() const
+    {
+        return m_load;
+    }
+
+    /**
+     * @brief Counters of connection since event loop took them last time (see thread_stats_t::add)
+     */
+    io_counters_t& counters()
+    {
+        return m_counters;
+    }
+
+    /**
+     * @brief Return if connection has no work and can be moved to other event loop
+     */
+    bool is_idle()
+    {
+        return !m_ready && !m_waiting && !m_paused && !m_eof && !m_jobs_head && !pending_output();
+    }
+
+    /**
+     * @brief Return if connection can be moved to other event loop with results it didn't send yet
+     * @details Connection which is processed, waits for its turn or has jobs of hash workers stays.
+     */
+    bool is_movable()
+    {
+        return !m_ready && !m_waiting && !m_jobs_head;
+    }
+
+    /**
+     * @brief Check if deadline of connection has to be set again
+     * @details Connection which has work for event loop or hash workers has no deadline. Otherwise
+     * @details it waits for client: to read results (write), to finish line (read) or to send next
+     * @details request (idle). Deadline is set again when its kind changes or data was read or sent
+     * @details since previous call, so client which doesn't move isn't saved by more events.
+     * @param[out] kind Kind of deadline
+     * @return true if deadline has to be set from now
+     */
+    bool update_deadline(timeout_kind_t& kind)
+    {
+        if (m_ready || m_waiting || m_jobs_head || m_eof)
+        {
+            kind = timeout_kind_t::none;
+        }
+        else if (pending_output())
+        {
+            kind = timeout_kind_t::write;
+        }
+        else
+        {
+            kind = m_line_open ? timeout_kind_t::read : timeout_kind_t::idle;
+        }
+
+        auto progress = m_received + m_sent;
+        bool changed = kind != m_deadline || progress != m_progress;
+        m_deadline = kind;
+        m_progress = progress;
+        return changed;
+    }
+
+    /**
+     * @brief Timer of connection deadline. Used by event loop which owns connection
+     */
+    timer_node_t& timer()
+    {
+        return m_timer;
+    }
+
+    /**
+     * @brief Hook of list of connections of event loop which owns connection
+     */
+    list_hook_t& pool_hook()
+    {
+        return m_pool_hook;
     }
 
     /**
      * @brief Return if end of file was reached or descriptor was closed.
      * @details This method only return eof flag. But the flag itself setup be void process_data()
+     * @details If client closed its side but didn't get all results yet, then eof will be
+     * @details returned after the rest of results is sent by process_output().
      * @return
      */
     bool is_eof()
     {
-        return m_eof;
+        return m_eof && !pending_output() && !m_jobs_head && !m_waiting;
     }
 
     /**
@@ -113,15 +495,59 @@ protected:
      * @details Symbol will be given. If connection is closed and EOF is reached it will
      * @details setup EOF flag. After this method is_eof must be checked and event_manager must be
      * @details deleted with static deleter delete_event(epoll_event* event)
+     * @details If buffers have pipeline port and connection is bulk upload (received more than
+     * @details bulk threshold of port) then data is read into job instead of read buffer and
+     * @details hashed by workers (see submit_lines). Without free job connection waits in
+     * @details buffers_t::waiting. Short requests are hashed here without handoff to workers.
+     * @param[in] buffers Event loop thread buffers
+     * @param[in,out] budget Bytes which can be read yet. Decreased by bytes read
      * @return true if more data to read exist and false in opposite
      */
-    bool read_data()
+    bool read_data(buffers_t& buffers, size_t& budget)
     {
+        auto dst = buffers.rd_buf.data();
+        job_t* job = nullptr;
+        if (buffers.port && m_received >= buffers.port->bulk_threshold() && is_text())
+        {
+            job = buffers.port->take();
+            if (!job)
+            {
+                m_waiting = true;
+                buffers.waiting.push_back(this);
+                return false;
+            }
+            dst = job->data.data();
+        }
+
+        ssize_t count;
+        {
+            HASH_SERVER_TRACE_SCOPE(read);
+            count = read(m_file_desc.get(), dst, std::min(buffers.rd_buf.size(), budget));
+        }
+        HASH_SERVER_PROBE2(read, m_file_desc.get(), count);
+        ++m_counters.reads;
 
-        auto count = read(m_file_desc.get(), rd_buf, READ_BUF_SIZE);
+        if (count <= 0 && job)
+        {
+            buffers.port->release(job);
+        }
 
-        if (-1 == count) // All data was read
+        if (-1 == count)
         {
+            if (EINTR == errno)
+            {
+                return true;
+            }
+
+            // Connection is broken (reset by peer etc.). Otherwise all data was read
+            if (EAGAIN != errno && EWOULDBLOCK != errno)
+            {
+                close_on_error();
+            }
+            else
+            {
+                ++m_counters.eagains;
+            }
             return false;
         }
         else if (0 == count) // EOF - remote closed connection
@@ -129,9 +555,53 @@ protected:
             m_eof = true;
             return false;
         }
+        budget -= count;
+        m_received += count;
+        m_counters.bytes_received += count;
+        m_line_open = '\n' != dst[count - 1];
+        auto read_time = buffers.stats ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point{};
 
         // New data available
-        return parse_lines({rd_buf, static_cast<std::string_view::size_type>(count)});
+        if (job)
+        {
+            job->read_time = read_time;
+            if (!submit_lines(job, count, buffers))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            bool sent = parse_lines({buffers.rd_buf.data(), static_cast<std::string_view::size_type>(count)}, buffers.out, buffers.cache);
+            count_lines(buffers, buffers.out.size(), read_time);
+            if (!sent)
+            {
+                return false;
+            }
+        }
+
+        if constexpr (FRAMED)
+        {
+            if (!is_text())
+            {
+                m_line_open = m_frames.is_open();
+            }
+
+            // Protocol error. Connection is closed when results of previous records are sent
+            if (m_frames.failed())
+            {
+                m_eof = true;
+                return false;
+            }
+        }
+
+        // Client doesn't read results fast enough. Wait for EPOLLOUT
+        if (pending_output() > HIGH_WATER)
+        {
+            m_paused = true;
+            return false;
+        }
+        return true;
     }
 
 
@@ -139,71 +609,425 @@ protected:
      * @brief Parsing data and process it line by line and send result to file descriptor
      * @details If some data will be without following newline symbol ('\n')
      * @details It will be processed but result will be read during next session when newline
-     * @details Symbol will be given.
+     * @details Symbol will be given. Results of all lines are sent together at the end.
      * @param buffer as string_view
+     * @param out Buffer for results. Results which are not sent stay in connection
+     * @param cache Digest cache of event loop thread or nullptr
      * @return true is sending data was success or there was nothing to send. False is sending data failed
      */
-    bool parse_lines(std::string_view buffer)
+    bool parse_lines(std::string_view buffer, std::vector<char>& out, cache_t* cache = nullptr)
     {
-        auto begin = buffer.data();
-        auto size = buffer.size();
-        while (auto end = (char*)std::memchr(begin,'\n',size)) // Checking end of line. By task no need to check \r
+        out.clear();
         {
-            std::string_view::size_type len = end-begin;
+            HASH_SERVER_TRACE_SCOPE(parse);
+            collect_results(buffer, out, cache);
+        }
+        HASH_SERVER_PROBE2(parse, buffer.size(), out.size() / result_len());
+        return send_output({out.data(), out.size()});
+    }
 
-            // Calculating hash
-            m_processor.process({begin, len});
 
-            auto result = m_processor.get_result();
-            if (result.size() && !write_data(result))
+    /**
+     * @brief Process data line by line and append results to out
+     * @details If some data will be without following newline symbol ('\n')
+     * @details It will be processed and its result will be given with following data.
+     * @details Line continued from previous data is finished alone, other complete lines are
+     * @details given to hash_lines, so batch processors get them in batches. With cache results of
+     * @details short complete lines are taken from it if they are there.
+     * @details Data of binary connection is given to frame parser.
+     * @param buffer as string_view
+     * @param out Buffer for results
+     * @param cache Digest cache of event loop thread or nullptr
+     */
+    void collect_results(std::string_view buffer, std::vector<char>& out, cache_t* cache = nullptr)
+    {
+        if constexpr (FRAMED)
+        {
+            if (!m_frames.is_text())
             {
-                fprintf(stderr, "%s\n", strerror(errno));
-                return false;
+                buffer = m_frames.collect(m_processor, buffer, out);
+                if (!m_frames.is_text())
+                {
+                    return;
+                }
+
+                // Connection didn't start with preamble. Its matched part begins first line
+                m_processor.process(m_frames.preamble());
+            }
+        }
+
+        // All newline symbols of buffer are found before lines are hashed
+        auto& index = line_index_t::local();
+        index.build(buffer, CRLF);
+        size_t first = 0;
+
+        bool pending = true;
+        if constexpr (is_batch_processor<Processor>::value)
+        {
+            pending = m_processor.has_pending() || m_cr_held;
+        }
+
+        if (pending)
+        {
+            if (!index.count())
+            {
+                continue_line(buffer);
+                return;
+            }
+
+            finish_line(buffer.substr(0, index.end(0)), index.crlf(0), out);
+            first = 1;
+        }
+
+        if (first < index.count())
+        {
+            HASH_SERVER_TRACE_SCOPE(digest);
+            if (cache)
+            {
+                hash_lines(m_processor, index.lines(first), out, *cache);
+            }
+            else
+            {
+                hash_lines(m_processor, index.lines(first), out);
+            }
+        }
+
+        // Rest of buffer is continued in next one
+        continue_line(index.tail());
+    }
+
+
+    /**
+     * @brief Finish line continued from previous data and append its result to out
+     * @details With CRLF '\r' kept from previous data is hashed only if it isn't followed by newline.
+     * @param part The last part of line without newline symbol
+     * @param crlf Part ends with '\r' which is not hashed
+     * @param out Buffer for results
+     */
+    void finish_line(std::string_view part, bool crlf, std::vector<char>& out)
+    {
+        if constexpr (CRLF)
+        {
+            if (m_cr_held && !part.empty())
+            {
+                m_processor.process("\r");
+            }
+            m_cr_held = false;
+            part.remove_suffix(crlf);
+        }
+
+        m_processor.process(part);
+        auto result = m_processor.get_result();
+        out.insert(out.end(), result.begin(), result.end());
+    }
+
+
+    /**
+     * @brief Process part of line which is continued in next data
+     * @details With CRLF trailing '\r' is kept until it's known if newline follows it.
+     * @param part Data after the last newline symbol
+     */
+    void continue_line(std::string_view part)
+    {
+        if constexpr (CRLF)
+        {
+            if (part.empty())
+            {
+                return;
+            }
+            if (m_cr_held)
+            {
+                m_processor.process("\r");
+            }
+            m_cr_held = '\r' == part.back();
+            part.remove_suffix(m_cr_held);
+        }
+        m_processor.process(part);
+    }
+
+
+    /**
+     * @brief Count lines by size of their results and record their latency
+     * @details Lines are counted per read buffer or job, so hashing of lines isn't slowed down.
+     * @param[in] buffers Event loop thread buffers
+     * @param[in] results Bytes of results
+     * @param[in] read_time Time when data of lines was read
+     */
+    void count_lines(buffers_t& buffers, size_t results, std::chrono::steady_clock::time_point read_time)
+    {
+        auto lines = results / result_len();
+        m_counters.lines += lines;
+        if (buffers.stats && lines)
+        {
+            buffers.stats->line_latency.record(std::chrono::steady_clock::now() - read_time, lines);
+        }
+    }
+
+
+    /**
+     * @brief Return if connection uses text protocol
+     */
+    bool is_text() const
+    {
+        if constexpr (FRAMED)
+        {
+            return m_frames.is_text();
+        }
+        else
+        {
+            return true;
+        }
+    }
+
+
+    /**
+     * @brief Length of result of one line or record
+     */
+    size_t result_len() const
+    {
+        if constexpr (FRAMED)
+        {
+            if (!is_text())
+            {
+                return Processor::DIGEST_LEN;
             }
+        }
+        return Processor::RESULT_LEN;
+    }
+
+
+    /**
+     * @brief Give complete lines of job to pipeline workers
+     * @details Line continued from previous data and the rest of data after last newline symbol
+     * @details are processed by connection processor at once. Result of continued line is put to
+     * @details job before results of worker. Job without other lines is finished at once.
+     * @param job Job with data read
+     * @param count Bytes read
+     * @param[in] buffers Event loop thread buffers
+     * @return false if sending failed
+     */
+    bool submit_lines(job_t* job, size_t count, buffers_t& buffers)
+    {
+        auto begin = job->data.data();
+        auto first = (char*)std::memchr(begin, '\n', count);
+        if (!first)
+        {
+            continue_line({begin, count});
+            buffers.port->release(job);
+            return true;
+        }
+        auto last = (char*)memrchr(first, '\n', begin + count - first);
+
+        std::string_view::size_type len = first-begin;
+        job->results.clear();
+        finish_line({begin, len}, CRLF && len && '\r' == first[-1], job->results);
+
+        job->begin = len+1;
+        job->end = last+1-begin;
+        job->crlf = CRLF;
+        continue_line({last+1, count - job->end});
 
-            begin = end+1;
-            size -= len+1;
+        job->owner = this;
+        if (m_jobs_tail)
+        {
+            m_jobs_tail->next = job;
+        }
+        else
+        {
+            m_jobs_head = job;
         }
+        m_jobs_tail = job;
 
-        // Calc hash to the rest of buffer
-        m_processor.process({begin, size});
+        m_jobs_bytes += job->end - job->begin;
 
+        if (job->begin == job->end)
+        {
+            return complete_job(job, buffers);
+        }
+        buffers.port->submit(job);
         return true;
     }
 
 
+    /**
+     * @brief Send results of read buffer
+     * @details If connection still has results which were not sent before then new ones are
+     * @details queued after them. What descriptor doesn't take now is kept until process_output.
+     * @param out Results
+     * @return false if sending failed
+     */
+    bool send_output(std::string_view out)
+    {
+        if (pending_output())
+        {
+            m_out.insert(m_out.end(), out.begin(), out.end());
+            return flush_output();
+        }
+
+        auto count = send_some(out);
+        if (-1 == count)
+        {
+            return close_on_error();
+        }
+
+        m_out.assign(out.begin() + count, out.end());
+        return true;
+    }
+
+
+    /**
+     * @brief Send results kept in connection after previous short write
+     * @details Memory of kept results is released when all of them are sent.
+     * @return false if sending failed
+     */
+    bool flush_output()
+    {
+        auto count = send_some({m_out.data() + m_out_sent, pending_output()});
+        if (-1 == count)
+        {
+            return close_on_error();
+        }
+
+        m_out_sent += count;
+        if (!pending_output())
+        {
+            std::vector<char>().swap(m_out);
+            m_out_sent = 0;
+        }
+        return true;
+    }
+
+
+    /**
+     * @brief Send as much of buffer as descriptor takes without blocking
+     * @param Buffer to send as string_view
+     * @return Number of bytes sent or -1 in case of error except EAGAIN
+     */
+    ssize_t send_some(std::string_view buffer)
+    {
+        size_t sent = 0;
+        while (sent < buffer.size())
+        {
+            auto count = write_data(buffer.substr(sent));
+            ++m_counters.sends;
+            if (-1 == count)
+            {
+                if (EINTR == errno)
+                {
+                    continue;
+                }
+                if (EAGAIN == errno || EWOULDBLOCK == errno)
+                {
+                    ++m_counters.eagains;
+                    break;
+                }
+
+                fprintf(stderr, "%s\n", strerror(errno));
+                return -1;
+            }
+            sent += count;
+        }
+        m_sent += sent;
+        m_counters.bytes_sent += sent;
+        return sent;
+    }
+
+
+    /**
+     * @brief Drop results and setup EOF flag after sending error
+     * @return false
+     */
+    bool close_on_error()
+    {
+        std::vector<char>().swap(m_out);
+        m_out_sent = 0;
+        m_eof = true;
+        m_error = true;
+        return false;
+    }
+
+
     /**
      * @brief Send data to file descriptor
+     * @details Socket is never blocked by sending. Pipe is blocked if it's in blocking mode.
      * @param Buffer to send as string_view
-     * @return True if sending succeed and false in otherwise
+     * @return Number of bytes sent or -1 in case of error
      */
-    bool write_data(std::string_view buffer)
+    ssize_t write_data(std::string_view buffer)
     {
+        HASH_SERVER_TRACE_SCOPE(send);
+        ssize_t count;
         if constexpr (IS_TCP)
         {
-            return (-1 != send(m_file_desc.get(), buffer.data(), buffer.size(), MSG_NOSIGNAL));
+            count = send(m_file_desc.get(), buffer.data(), buffer.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
         }
         else
         {
-            return write(m_file_desc.get(), buffer.data(), buffer.size());
+            count = write(m_file_desc.get(), buffer.data(), buffer.size());
         }
-
+        HASH_SERVER_PROBE2(send, m_file_desc.get(), count);
+        return count;
     }
 
     /** Socket connection file descriptor wrapped with std::unique_ptr with custom deleter*/
     std::unique_ptr<fd_holder_t, fd_deleter_t> m_file_desc;
     Processor m_processor;
+
+    /** Frames of binary connection. Parser negotiates protocol if it's auto_protocol_t*/
+    struct no_frames_t {explicit no_frames_t(bool){}};
+    [[no_unique_address]] std::conditional_t<FRAMED, frame_parser_t<Processor>, no_frames_t> m_frames{std::is_same_v<Protocol, auto_protocol_t>};
     bool m_eof = false;
 
-    /** Read buffer size*/
-    static const int READ_BUF_SIZE = 8192;
+    /** Reading is paused until output drops below LOW_WATER*/
+    bool m_paused = false;
+
+    /** Read budget was used. Connection waits in ready queue of event loop*/
+    bool m_ready = false;
+
+    /** Connection waits for free job of pipeline port*/
+    bool m_waiting = false;
+
+    /** Sending failed. Results of pipeline jobs are dropped*/
+    bool m_error = false;
+
+    /** Bytes received. Connection gives lines to pipeline after bulk threshold*/
+    size_t m_received = 0;
+
+    /** Bytes sent*/
+    size_t m_sent = 0;
+
+    /** Last data received doesn't end with newline symbol*/
+    bool m_line_open = false;
+
+    /** '\r' at the end of last data. It's hashed only if newline doesn't follow it*/
+    bool m_cr_held = false;
+
+    /** Deadline and bytes moved when it was set. See update_deadline*/
+    timeout_kind_t m_deadline = timeout_kind_t::none;
+    size_t m_progress = 0;
+    timer_node_t m_timer;
+
+    /** Connection is in list of its event loop*/
+    list_hook_t m_pool_hook;
+
+    /** Counters not taken by event loop yet*/
+    io_counters_t m_counters;
+
+    /** Pipeline jobs in order of data. Results are sent from head when it's done*/
+    job_t* m_jobs_head = nullptr;
+    job_t* m_jobs_tail = nullptr;
+    size_t m_jobs_bytes = 0;
+
+    /** in_flight reported by load_delta*/
+    size_t m_load = 0;
 
-    /** Read buffer*/
-    char rd_buf[READ_BUF_SIZE];
+    /** Results which client didn't take yet start from m_out_sent. Empty most of the time*/
+    std::vector<char> m_out;
+    size_t m_out_sent = 0;
 };
 
-/** Alias for using with hash_t as Processor*/
-using hash_ev_manager_t = event_manager_t<processors::hash_t, true>;
+/** Alias for using with md5_mb_t as Processor*/
+using hash_ev_manager_t = event_manager_t<processors::md5_mb_t, true>;
 
 } // namespace net
 
@@ -0,0 +1,352 @@
+/**
+ * @file file_hasher.hpp
+ * @author Domnikov Ivan
+ * @brief Offline hashing of lines of local file by thread pool.
+ *
+ */
+#pragma once
+
+#include "line_hasher.hpp"
+#include "fd_holder.hpp"
+#include "hex_format.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace net
+{
+
+/**
+ * @brief Options of file hashing
+ */
+struct file_options_t
+{
+    /** Hash threads. 0 - one per CPU*/
+    size_t threads = 0;
+
+    /** Bytes of file given to thread at once, up to 256 MB. Chunk is extended to the end of its last line*/
+    size_t chunk = 1 << 20;
+
+    /** Lines end with "\r\n" or '\n' as in crlf protocol*/
+    bool crlf = false;
+};
+
+
+/**
+ * @brief Counters of hashed file
+ */
+struct file_stats_t
+{
+    uint64_t bytes = 0;
+    uint64_t lines = 0;
+};
+
+
+/**
+ * @brief Hashing of lines of file with the same results as server gives for them
+ * @details File is mapped to memory and divided into chunks of options.chunk bytes. Each chunk
+ * @details has lines which start inside it, so threads find borders of their chunks themselves
+ * @details (by newline symbol before chunk start) and take chunks by atomic counter without any
+ * @details split pass before hashing. Lines of chunk are found by line_index_t and hashed by
+ * @details hash_lines with processor of thread, results of chunk are kept in slot of window.
+ * @details Calling thread writes slots in order of chunks, one write per chunk, and frees slot
+ * @details for chunk which is window size ahead. So threads may be ahead of output by window,
+ * @details and memory is bounded by window of results.
+ * @details Unlike connection, last line of file without newline symbol is hashed too.
+ * @details Chunk which grows much over options.chunk because of long lines is hashed line by
+ * @details line without index, so index memory of thread stays small.
+ * @details Prefix of result lines (e.g. hex::line_number_t) is written by calling thread, since
+ * @details number of line is known only when results of previous chunks are written.
+ * @param Processor Processor which can be given to hash_lines
+ * @param Prefix Prefix policy of result lines (see hex::no_prefix_t)
+ */
+template <class Processor, class Prefix = hex::no_prefix_t>
+class file_hasher_t
+{
+public:
+    /**
+     * @param[in] options
+     */
+    explicit file_hasher_t(const file_options_t& options = {})
+        : m_options(options)
+    {
+        if (!m_options.threads)
+        {
+            m_options.threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        m_options.chunk = std::clamp<size_t>(m_options.chunk, 1, 256 << 20);
+    }
+
+
+    /**
+     * @brief Hash lines of file and write results to descriptor
+     * @details Throws std::runtime_error if file cannot be read or results cannot be written
+     * @param[in] path File of lines
+     * @param[in] out_fd Descriptor for results (file, pipe, terminal)
+     * @return Counters of hashed file
+     */
+    file_stats_t run(const std::string& path, int out_fd)
+    {
+        std::unique_ptr<fd_holder_t, fd_deleter_t> fd{open(path.c_str(), O_RDONLY | O_CLOEXEC)};
+        struct stat st;
+        if (-1 == fd.get() || 0 != fstat(fd.get(), &st))
+        {
+            throw std::runtime_error("Cannot open file " + path + ": " + strerror(errno));
+        }
+
+        file_stats_t stats;
+        stats.bytes = st.st_size;
+        if (!st.st_size)
+        {
+            return stats;
+        }
+
+        auto data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd.get(), 0);
+        if (MAP_FAILED == data)
+        {
+            throw std::runtime_error("Cannot map file " + path + ": " + strerror(errno));
+        }
+        madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+        m_data = static_cast<const char*>(data);
+        m_size = st.st_size;
+        m_chunks = (m_size + m_options.chunk - 1) / m_options.chunk;
+        m_next = 0;
+        m_stop = false;
+        m_prefix = {};
+        m_slots = std::vector<slot_t>(std::min(2 * m_options.threads, m_chunks));
+        for (size_t i = 0; i < m_slots.size(); ++i)
+        {
+            m_slots[i].chunk = i;
+        }
+
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < std::min(m_options.threads, m_chunks); ++i)
+        {
+            threads.emplace_back([this]{work();});
+        }
+
+        bool written = write_results(out_fd, stats);
+        if (!written)
+        {
+            std::lock_guard lock(m_mutex);
+            m_stop = true;
+            m_cond.notify_all();
+        }
+
+        for (auto& thr : threads)
+        {
+            thr.join();
+        }
+        munmap(data, st.st_size);
+
+        if (!written)
+        {
+            throw std::runtime_error(std::string("Cannot write results: ") + strerror(errno));
+        }
+        return stats;
+    }
+
+private:
+    /**
+     * @brief Results of chunk. Slot is filled by thread which took chunk and written by calling thread
+     */
+    struct slot_t
+    {
+        std::vector<char> out;
+
+        /** Chunk which may use slot*/
+        size_t chunk;
+
+        /** Results of chunk are ready to be written*/
+        bool ready = false;
+    };
+
+
+    /**
+     * @brief Offset of first line which starts in [pos, limit)
+     * @return limit if no line starts there
+     */
+    size_t line_start(size_t pos, size_t limit) const
+    {
+        limit = std::min(limit, m_size);
+        if (0 == pos || pos >= limit)
+        {
+            return std::min(pos, limit);
+        }
+        auto newline = static_cast<const char*>(memchr(m_data + pos - 1, '\n', limit - pos));
+        return newline ? newline - m_data + 1 : limit;
+    }
+
+
+    /**
+     * @brief Hash chunks until all are taken
+     */
+    void work()
+    {
+        Processor processor;
+        for (size_t chunk; (chunk = m_next.fetch_add(1, std::memory_order_relaxed)) < m_chunks;)
+        {
+            auto& slot = m_slots[chunk % m_slots.size()];
+            {
+                std::unique_lock lock(m_mutex);
+                m_cond.wait(lock, [&]{return m_stop || slot.chunk == chunk;});
+                if (m_stop)
+                {
+                    return;
+                }
+            }
+
+            // Only the chunk where line starts searches its end, so long line is scanned once
+            slot.out.clear();
+            auto next = (chunk + 1) * m_options.chunk;
+            auto begin = line_start(chunk * m_options.chunk, next);
+            if (begin < std::min(next, m_size))
+            {
+                auto end = line_start(next, m_size);
+                hash_chunk(processor, {m_data + begin, end - begin}, slot.out);
+            }
+
+            std::lock_guard lock(m_mutex);
+            slot.ready = true;
+            m_cond.notify_all();
+        }
+    }
+
+
+    /**
+     * @brief Hash lines of chunk. The last line of file may have no newline symbol
+     */
+    void hash_chunk(Processor& processor, std::string_view chunk, std::vector<char>& out) const
+    {
+        std::string_view tail;
+        if (chunk.size() <= 4 * m_options.chunk)
+        {
+            auto& index = line_index_t::local();
+            index.build(chunk, m_options.crlf);
+            hash_lines(processor, index.lines(), out);
+            tail = index.tail();
+        }
+        else
+        {
+            // Long lines. Search by memchr is as fast as index for them
+            for (const char* newline; (newline = static_cast<const char*>(memchr(chunk.data(), '\n', chunk.size())));)
+            {
+                size_t len = newline - chunk.data();
+                processor.process(chunk.substr(0, m_options.crlf && len && '\r' == newline[-1] ? len - 1 : len));
+                auto result = processor.get_result();
+                out.insert(out.end(), result.begin(), result.end());
+                chunk.remove_prefix(len + 1);
+            }
+            tail = chunk;
+        }
+
+        if (!tail.empty())
+        {
+            processor.process(tail);
+            auto result = processor.get_result();
+            out.insert(out.end(), result.begin(), result.end());
+        }
+    }
+
+
+    /**
+     * @brief Write results of chunks in order as they are ready
+     * @return false if write failed
+     */
+    bool write_results(int out_fd, file_stats_t& stats)
+    {
+        for (size_t chunk = 0; chunk < m_chunks; ++chunk)
+        {
+            auto& slot = m_slots[chunk % m_slots.size()];
+            {
+                std::unique_lock lock(m_mutex);
+                m_cond.wait(lock, [&]{return slot.ready;});
+            }
+
+            auto lines = slot.out.size() / Processor::RESULT_LEN;
+            bool written = false;
+            if constexpr (0 == Prefix::MAX_LEN)
+            {
+                written = write_all(out_fd, slot.out.data(), slot.out.size());
+            }
+            else
+            {
+                // Number of line is known only here, as results of previous chunks are counted
+                m_prefixed.resize(lines * (Prefix::MAX_LEN + Processor::RESULT_LEN));
+                auto dst = m_prefixed.data();
+                for (size_t i = 0; i < lines; ++i)
+                {
+                    dst = m_prefix.write(dst);
+                    memcpy(dst, slot.out.data() + i * Processor::RESULT_LEN, Processor::RESULT_LEN);
+                    dst += Processor::RESULT_LEN;
+                }
+                written = write_all(out_fd, m_prefixed.data(), dst - m_prefixed.data());
+            }
+            if (!written)
+            {
+                return false;
+            }
+            stats.lines += lines;
+
+            std::lock_guard lock(m_mutex);
+            slot.ready = false;
+            slot.chunk += m_slots.size();
+            m_cond.notify_all();
+        }
+        return true;
+    }
+
+
+    /**
+     * @brief Write whole buffer to descriptor
+     * @return false if write failed
+     */
+    static bool write_all(int fd, const char* data, size_t size)
+    {
+        for (size_t pos = 0; pos < size;)
+        {
+            auto count = write(fd, data + pos, size - pos);
+            if (count < 0 && EINTR != errno)
+            {
+                return false;
+            }
+            pos += std::max<ssize_t>(count, 0);
+        }
+        return true;
+    }
+
+
+    file_options_t m_options;
+
+    /** Prefix of result lines and buffer of prefixed results. Used by writing thread only*/
+    Prefix m_prefix;
+    std::vector<char> m_prefixed;
+
+    const char* m_data = nullptr;
+    size_t m_size = 0;
+    size_t m_chunks = 0;
+
+    /** Next chunk to be taken by thread*/
+    std::atomic_size_t m_next{0};
+
+    /** Window of results. Chunk uses slot chunk % size*/
+    std::vector<slot_t> m_slots;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_stop = false;
+};
+
+} // namespace net
@@ -0,0 +1,362 @@
+/**
+ * @file frame_parser.hpp
+ * @author Domnikov Ivan
+ * @brief Binary length-prefixed protocol: frames of records and raw digest replies.
+ *
+ */
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace net
+{
+
+/** Newline separated lines, hex result per line. Default protocol of listener*/
+struct text_protocol_t {};
+
+/** Text protocol where lines end with "\r\n" or '\n'. '\r' before '\n' isn't part of line*/
+struct crlf_protocol_t {};
+
+/** Length-prefixed records, raw digest per record (see frame_parser_t)*/
+struct binary_protocol_t {};
+
+/** Binary protocol if connection starts with frame_parser_t preamble, text protocol otherwise*/
+struct auto_protocol_t {};
+
+
+/** Check if Processor can write raw digests of complete records in batches (see processors::md5_mb_t)*/
+template <class Processor, class = void>
+struct is_digest_batch_processor : std::false_type {};
+
+template <class Processor>
+struct is_digest_batch_processor<Processor, std::void_t<decltype(&Processor::digest_batch)>> : std::true_type {};
+
+
+/**
+ * @brief Parser of binary protocol of one connection
+ * @details Client sends frames one after another:
+ * @code record := 0x01 len:u32le payload[len]
+ * @code batch  := 0x02 count:u32le (len:varint payload[len]){count}
+ * @details where varint is unsigned LEB128 of at most 5 bytes. Every record is hashed as one line
+ * @details and server replies with raw digest of each record in order, Processor::DIGEST_LEN
+ * @details bytes each, without any framing: client knows how many records it sent.
+ * @details Frames may be split between reads at any byte. Records which are wholly inside read
+ * @details buffer are hashed together by batch processors, record which crosses buffers is
+ * @details streamed through process and finished by get_digest when its last byte comes.
+ * @details Unknown frame type or too long varint is a protocol error: parser fails and ignores
+ * @details the rest of data, connection is closed after results of previous records are sent.
+ * @details With negotiation connection is binary if it starts with MAGIC. Otherwise parser
+ * @details switches to text and gives back data to be parsed as lines.
+ * @param Processor Processor with DIGEST_LEN and get_digest
+ */
+template <class Processor>
+class frame_parser_t
+{
+public:
+    /** Frame of one record*/
+    constexpr static uint8_t RECORD = 0x01;
+
+    /** Frame of many records*/
+    constexpr static uint8_t BATCH = 0x02;
+
+    /** Preamble of binary connection of listener which negotiates protocol*/
+    constexpr static std::string_view MAGIC{"\0HSB", 4};
+
+    /** Frame type and u32 length or count*/
+    constexpr static size_t HEADER_LEN = 5;
+
+    /**
+     * @param[in] negotiate Expect MAGIC and fall back to text without it
+     */
+    explicit frame_parser_t(bool negotiate = false)
+        :m_state(negotiate ? state_t::magic : state_t::header){}
+
+
+    /**
+     * @brief Parse frames of buffer and append digests of complete records to out
+     * @param processor Processor of connection
+     * @param buffer Received data
+     * @param out Buffer for results
+     * @return Rest of buffer which must be parsed as text. Empty if connection is binary
+     */
+    std::string_view collect(Processor& processor, std::string_view buffer, std::vector<char>& out)
+    {
+        auto data = reinterpret_cast<const unsigned char*>(buffer.data());
+        auto size = buffer.size();
+        size_t pos = 0;
+        batch_t batch{processor, out};
+
+        while (pos < size || (state_t::payload == m_state && !m_len))
+        {
+            switch (m_state)
+            {
+            case state_t::magic:
+            {
+                auto len = std::min(size - pos, MAGIC.size() - m_pos);
+                if (0 != memcmp(data + pos, MAGIC.data() + m_pos, len))
+                {
+                    // Matched part of preamble is kept by m_pos and given back by preamble()
+                    m_state = state_t::text;
+                    return buffer.substr(pos);
+                }
+                pos += len;
+                m_pos += len;
+                if (MAGIC.size() == m_pos)
+                {
+                    m_pos = 0;
+                    m_state = state_t::header;
+                }
+                break;
+            }
+
+            case state_t::header:
+            {
+                auto len = std::min(size - pos, HEADER_LEN - m_pos);
+                memcpy(m_header + m_pos, data + pos, len);
+                pos += len;
+                m_pos += len;
+                if (HEADER_LEN == m_pos)
+                {
+                    m_pos = 0;
+                    start_frame();
+                }
+                break;
+            }
+
+            case state_t::length:
+            {
+                uint8_t byte = data[pos++];
+                m_len |= uint32_t(byte & 0x7F) << m_shift;
+                if (!(byte & 0x80))
+                {
+                    m_state = state_t::payload;
+                }
+                else if ((m_shift += 7) > 28)
+                {
+                    m_state = state_t::failed;
+                }
+                break;
+            }
+
+            case state_t::payload:
+            {
+                auto len = std::min<size_t>(size - pos, m_len);
+                std::string_view part{buffer.data() + pos, len};
+                pos += len;
+                m_len -= len;
+                if (!m_streaming && !m_len)
+                {
+                    batch.add(part);
+                }
+                else
+                {
+                    // Record crosses buffers. Digests of previous records go first
+                    batch.flush();
+                    processor.process(part);
+                    m_streaming = true;
+                    if (!m_len)
+                    {
+                        auto digest = processor.get_digest();
+                        out.insert(out.end(), digest.begin(), digest.end());
+                        m_streaming = false;
+                    }
+                }
+
+                if (!m_len)
+                {
+                    end_record();
+                }
+                break;
+            }
+
+            case state_t::text:
+            case state_t::failed:
+                return {};
+            }
+
+            if (state_t::failed == m_state)
+            {
+                break;
+            }
+        }
+        batch.flush();
+        return {};
+    }
+
+
+    /**
+     * @brief Connection turned out to be text
+     */
+    bool is_text() const
+    {
+        return state_t::text == m_state;
+    }
+
+
+    /**
+     * @brief Protocol error happened. Further data is ignored
+     */
+    bool failed() const
+    {
+        return state_t::failed == m_state;
+    }
+
+
+    /**
+     * @brief Frame or preamble is received partially. Client has to finish it
+     */
+    bool is_open() const
+    {
+        switch (m_state)
+        {
+        case state_t::magic:
+        case state_t::header:  return m_pos;
+        case state_t::length:
+        case state_t::payload: return true;
+        default:               return false;
+        }
+    }
+
+
+    /**
+     * @brief Part of MAGIC which text connection started with. It's the beginning of its first line
+     */
+    std::string_view preamble() const
+    {
+        return is_text() ? MAGIC.substr(0, m_pos) : std::string_view{};
+    }
+
+private:
+    enum class state_t : uint8_t
+    {
+        magic,
+        header,
+        length,
+        payload,
+        text,
+        failed,
+    };
+
+
+    /**
+     * @brief Complete records waiting to be hashed together
+     */
+    struct batch_t
+    {
+        constexpr static size_t SIZE = []
+        {
+            if constexpr (is_digest_batch_processor<Processor>::value) return Processor::BATCH_SIZE;
+            else return size_t(1);
+        }();
+
+        void add(std::string_view record)
+        {
+            records[count++] = record;
+            if (SIZE == count)
+            {
+                flush();
+            }
+        }
+
+        void flush()
+        {
+            if (!count)
+            {
+                return;
+            }
+
+            auto pos = out.size();
+            out.resize(pos + count * Processor::DIGEST_LEN);
+            if constexpr (is_digest_batch_processor<Processor>::value)
+            {
+                processor.digest_batch(records.data(), count, out.data() + pos);
+            }
+            else
+            {
+                for (size_t i = 0; i < count; ++i)
+                {
+                    processor.process(records[i]);
+                    memcpy(out.data() + pos + i * Processor::DIGEST_LEN, processor.get_digest().data(), Processor::DIGEST_LEN);
+                }
+            }
+            count = 0;
+        }
+
+        Processor& processor;
+        std::vector<char>& out;
+        std::array<std::string_view, SIZE> records;
+        size_t count = 0;
+    };
+
+
+    void start_frame()
+    {
+        uint32_t value = m_header[1] | uint32_t(m_header[2]) << 8 | uint32_t(m_header[3]) << 16 | uint32_t(m_header[4]) << 24;
+        if (RECORD == m_header[0])
+        {
+            m_count = 0;
+            m_len = value;
+            m_state = state_t::payload;
+        }
+        else if (BATCH == m_header[0])
+        {
+            m_count = value;
+            if (m_count)
+            {
+                start_length();
+            }
+        }
+        else
+        {
+            m_state = state_t::failed;
+        }
+    }
+
+
+    void start_length()
+    {
+        m_len = 0;
+        m_shift = 0;
+        m_state = state_t::length;
+    }
+
+
+    void end_record()
+    {
+        if (m_count && --m_count)
+        {
+            start_length();
+        }
+        else
+        {
+            m_state = state_t::header;
+        }
+    }
+
+
+    state_t m_state;
+
+    /** Bytes of header or preamble received*/
+    uint8_t m_pos = 0;
+    uint8_t m_header[HEADER_LEN];
+
+    /** Shift of next byte of varint*/
+    uint8_t m_shift = 0;
+
+    /** Record is continued from previous buffer and given to processor by parts*/
+    bool m_streaming = false;
+
+    /** Bytes of record not received yet*/
+    uint32_t m_len = 0;
+
+    /** Records of batch frame not finished yet*/
+    uint32_t m_count = 0;
+};
+
+} // namespace net
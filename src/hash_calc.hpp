@@ -1,11 +1,17 @@
 /**
  * @file hash_calc.h
  * @author Domnikov Ivan
- * @brief Wrapper over openssl EVP hash to provide C++ style interface
+ * @brief Hash processors: wrapper over openssl EVP hash and native MD5 implementations
  *
  */
 #pragma once
 
+#include "hex_format.hpp"
+#include "md5_mb.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
 #include <memory>
 #include <string_view>
 
@@ -17,15 +23,72 @@ namespace processors
 {
 
 /**
-* @brief hash_t class
-* @details Must be created for each connection. When new data had come call calc_hash.
-* @details When need to get result call get_hex_str. To continue
+* @brief Write digest as hex string. Uppercase unless server is built with HEX_LOWERCASE
+* @param[in] digest Raw digest
+* @param[in] len Digest length
+* @param[out] dst Must have space for 2*len chars
+* @return Pointer to char after written hex
+*/
+inline char* to_hex(const unsigned char* digest, size_t len, char* dst)
+{
+    return hex::encode(digest, len, dst);
+}
+
+
+namespace algo
+{
+
+/**
+* @brief Fetch EVP_MD by name
+* @details With OpenSSL 3 implicit fetch by EVP_md5() and others is done on each EVP_DigestInit_ex,
+* @details so processors fetch digest once.
+*/
+inline const EVP_MD* fetch_md(const char* name)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    return EVP_MD_fetch(nullptr, name, nullptr);
+#else
+    return EVP_get_digestbyname(name);
+#endif
+}
+
+/**
+* @brief Digest algorithms available through OpenSSL EVP
+* @details Each algorithm has name, digest size and md() which fetches EVP_MD.
+* @details OpenSSL selects SHA-NI/AVX2/AVX-512 implementation for host CPU by itself.
 */
-class hash_t
+struct md5        {constexpr static const char* NAME = "md5";        constexpr static size_t DIGEST_SIZE = 16; static const EVP_MD* md() {return fetch_md("MD5");}        };
+struct sha1       {constexpr static const char* NAME = "sha1";       constexpr static size_t DIGEST_SIZE = 20; static const EVP_MD* md() {return fetch_md("SHA1");}       };
+struct sha256     {constexpr static const char* NAME = "sha256";     constexpr static size_t DIGEST_SIZE = 32; static const EVP_MD* md() {return fetch_md("SHA256");}     };
+struct sha512     {constexpr static const char* NAME = "sha512";     constexpr static size_t DIGEST_SIZE = 64; static const EVP_MD* md() {return fetch_md("SHA512");}     };
+struct blake2s256 {constexpr static const char* NAME = "blake2s256"; constexpr static size_t DIGEST_SIZE = 32; static const EVP_MD* md() {return fetch_md("BLAKE2S-256");}};
+
+} // namespace algo
+
+
+/**
+* @brief evp_hash_t class
+* @details Must be created for each connection. When new data had come call process.
+* @details When need to get result call get_result. Algo is one of algo:: algorithms.
+* @details EVP context is created with first data and reused for next lines.
+* @details Complete lines are hashed by process_batch one by one, but their results are formatted
+* @details together (see hex::formatter_t).
+*/
+template <class Algo>
+class evp_hash_t
 {
 public:
-    hash_t():m_hash(nullptr, &EVP_MD_CTX_free){}
-    virtual ~hash_t() = default;
+    /** Length of raw digest*/
+    constexpr static size_t DIGEST_LEN = Algo::DIGEST_SIZE;
+
+    /** Length of result hash string*/
+    constexpr static size_t RESULT_LEN = 2 * DIGEST_LEN + 1;
+
+    /** Maximum lines in one batch*/
+    constexpr static size_t BATCH_SIZE = 32;
+
+    evp_hash_t():m_hash(nullptr, &EVP_MD_CTX_free){}
+    virtual ~evp_hash_t() = default;
 
 
     /**
@@ -40,46 +103,124 @@ public:
             return;
         }
 
-        if (!m_hash)
+        if (!m_started && !m_failed)
         {
             init();
         }
 
-        EVP_DigestUpdate(m_hash.get(), buffer.data(), buffer.size());
+        if (m_started && !EVP_DigestUpdate(m_hash.get(), buffer.data(), buffer.size()))
+        {
+            m_failed = true;
+        }
     }
 
 
     /**
     * @brief Function to get calculated hash
-    * @details Function to finalize hash calculation, clean EVP_MD_CTX object and store hash as hex string
+    * @details Function to finalize hash calculation and store hash as hex string
     * @details string_view will be invalid after deleting abject or relculated another hash.
     * @return Calculated hash as string_view
     */
     std::string_view get_result()
     {
-        unsigned int hash_len;
-        char hash_str[EVP_MAX_MD_SIZE];
-        EVP_DigestFinal_ex(m_hash.get(), (unsigned char*)hash_str, &hash_len);
-        m_hash.reset();
+        auto digest = get_digest();
+        *to_hex(reinterpret_cast<const unsigned char*>(digest.data()), digest.size(), out_buf) = '\n';
+        return {out_buf, RESULT_LEN};
+    }
+
+
+    /**
+    * @brief Function to get calculated hash as raw bytes
+    * @details Finalizes hash calculation as get_result does, but digest isn't converted to hex.
+    * @return DIGEST_LEN bytes of digest
+    */
+    std::string_view get_digest()
+    {
+        finish(m_digest);
+        return {reinterpret_cast<const char*>(m_digest), DIGEST_LEN};
+    }
+
 
-        const char hex[] = {"0123456789ABCDEF"};
-        char* dst = out_buf;
-        for(unsigned int i = 0; i < hash_len; i++)
+    /**
+    * @brief Hash complete lines. Result lines are written one after another
+    * @param[in] lines Lines without newline symbol. Not more than BATCH_SIZE
+    * @param[in] count Number of lines
+    * @param[out] out Buffer for count*RESULT_LEN chars
+    */
+    void process_batch(const std::string_view* lines, size_t count, char* out)
+    {
+        unsigned char digests[BATCH_SIZE * DIGEST_LEN];
+        for (size_t i = 0; i < count; ++i)
         {
-            *dst++ = hex[0XF & hash_str[i] >>  4];
-            *dst++ = hex[0XF & hash_str[i]      ];
+            process(lines[i]);
+            finish(digests + i * DIGEST_LEN);
         }
-        *dst = '\n';
-        return {out_buf, HAST_STR_LEN};
+        hex::formatter_t<>::instance().lines(digests, count, DIGEST_LEN, out);
+    }
+
+
+    /**
+    * @brief Check if some data was given by process and not finalized yet
+    */
+    bool has_pending() const
+    {
+        return m_started || m_failed;
+    }
+
+
+    /**
+    * @brief Check if OpenSSL provides digest of Algo
+    * @details Digest may be missing in restricted providers (e.g. BLAKE2S-256 or SHA1 under FIPS).
+    * @details Listener of such algorithm must not be started.
+    */
+    static bool is_available()
+    {
+        return nullptr != md();
     }
 
 private:
     /**
-    * @brief Clean old EVP_MD_CTX and initialize new
+    * @brief Digest of Algo fetched once. nullptr if OpenSSL doesn't provide it
+    */
+    static const EVP_MD* md()
+    {
+        static const EVP_MD* md = Algo::md();
+        return md;
+    }
+
+
+    /**
+    * @brief Finalize hash calculation and write raw digest to dst
+    * @details If EVP failed for this line, digest is zeroed, so no stack garbage goes to client.
+    */
+    void finish(unsigned char* dst)
+    {
+        // Empty line. Nothing was processed
+        if (!m_started && !m_failed)
+        {
+            init();
+        }
+
+        unsigned int hash_len;
+        if (!m_started || !EVP_DigestFinal_ex(m_hash.get(), dst, &hash_len))
+        {
+            fprintf(stderr, "[E] %s digest cannot be calculated\n", Algo::NAME);
+            memset(dst, 0, DIGEST_LEN);
+        }
+        m_started = false;
+        m_failed = false;
+    }
+
+
+    /**
+    * @brief Create EVP_MD_CTX if it's first line and initialize it for new line
     */
     void init()
     {
-        m_hash.reset(EVP_MD_CTX_create());
+        if (!m_hash)
+        {
+            m_hash.reset(EVP_MD_CTX_create());
+        }
 
         if(!m_hash)
         {
@@ -87,19 +228,240 @@ private:
         }
         else
         {
-            EVP_DigestInit_ex(m_hash.get(), EVP_md5(), NULL);
+            m_started = md() && EVP_DigestInit_ex(m_hash.get(), md(), NULL);
         }
+        m_failed = !m_started;
     }
 
 
     /** hash object*/
     std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> m_hash;
 
-    /** Length of result hash string*/
-    const static size_t HAST_STR_LEN = 33;
+    /** EVP_DigestInit_ex was called for current line*/
+    bool m_started = false;
+
+    /** EVP failed for current line. The rest of line is ignored and its digest is zeroed*/
+    bool m_failed = false;
+
+    /** Raw digest of last line*/
+    unsigned char m_digest[EVP_MAX_MD_SIZE];
 
     /** Output buffer for storing hash*/
-    char out_buf[HAST_STR_LEN];
+    char out_buf[RESULT_LEN];
+};
+
+
+/** MD5 through EVP*/
+using hash_t = evp_hash_t<algo::md5>;
+
+
+/**
+* @brief md5_t class
+* @details Native MD5 processor with the same interface and output as hash_t.
+* @details Whole hash state is stored inside object, so there's no heap allocation and no EVP
+* @details dispatching for each line. Compress is compression function selected at compile time
+* @details (see md5::scalar_compress_t).
+*/
+template <class Compress = md5::scalar_compress_t>
+class md5_t
+{
+public:
+    /** Length of raw digest*/
+    constexpr static size_t DIGEST_LEN = md5::DIGEST_SIZE;
+
+    /** Length of result string for one line*/
+    constexpr static size_t RESULT_LEN = 2 * DIGEST_LEN + 1;
+
+
+    /**
+    * @brief Function to process new data to hash function
+    * @param[in] buffer with new data
+    */
+    void process(std::string_view buffer)
+    {
+        if (!buffer.size())
+        {
+            return;
+        }
+
+        auto data = reinterpret_cast<const unsigned char*>(buffer.data());
+        auto size = buffer.size();
+        auto used = m_len % md5::BLOCK_SIZE;
+        m_len += size;
+
+        // Complete block started by previous call
+        if (used)
+        {
+            auto len = std::min(size, md5::BLOCK_SIZE - used);
+            std::memcpy(m_block + used, data, len);
+            data += len;
+            size -= len;
+            if (used + len < md5::BLOCK_SIZE)
+            {
+                return;
+            }
+            Compress::blocks(m_state, m_block, 1);
+        }
+
+        Compress::blocks(m_state, data, size / md5::BLOCK_SIZE);
+
+        if (size % md5::BLOCK_SIZE)
+        {
+            std::memcpy(m_block, data + size - size % md5::BLOCK_SIZE, size % md5::BLOCK_SIZE);
+        }
+    }
+
+
+    /**
+    * @brief Function to get calculated hash and reset state for next line
+    * @details string_view will be invalid after deleting abject or relculated another hash.
+    * @return Calculated hash as string_view
+    */
+    std::string_view get_result()
+    {
+        get_digest();
+        *to_hex(m_digest, sizeof(m_digest), out_buf) = '\n';
+        return {out_buf, RESULT_LEN};
+    }
+
+
+    /**
+    * @brief Function to get calculated hash as raw bytes and reset state for next line
+    * @return DIGEST_LEN bytes of digest
+    */
+    std::string_view get_digest()
+    {
+        unsigned char tail[2 * md5::BLOCK_SIZE];
+        auto blocks = md5::pad(tail, m_block, m_len % md5::BLOCK_SIZE, m_len);
+        Compress::blocks(m_state, tail, blocks);
+
+        for (int i = 0; i < 4; ++i)
+        {
+            md5::store_le32(m_digest + 4 * i, m_state[i]);
+        }
+
+        std::memcpy(m_state, md5::IV, sizeof(m_state));
+        m_len = 0;
+
+        return {reinterpret_cast<const char*>(m_digest), DIGEST_LEN};
+    }
+
+
+    /**
+    * @brief Check if some data was given by process and not finalized yet
+    */
+    bool has_pending() const
+    {
+        return m_len;
+    }
+
+private:
+    /** A, B, C, D words*/
+    uint32_t m_state[4] = {md5::IV[0], md5::IV[1], md5::IV[2], md5::IV[3]};
+
+    /** Bytes processed since last result*/
+    uint64_t m_len = 0;
+
+    /** Incomplete block*/
+    unsigned char m_block[md5::BLOCK_SIZE];
+
+    /** Raw digest of last line*/
+    unsigned char m_digest[DIGEST_LEN];
+
+    /** Output buffer for storing hash*/
+    char out_buf[RESULT_LEN];
+};
+
+
+/**
+* @brief md5_mb_t class
+* @details MD5 processor for batches of complete lines. Lines given to process_batch are hashed
+* @details together by multi-buffer engine in SIMD lanes (see md5::mb_engine_t).
+* @details Line which started in previous read buffer is finished with scalar md5_t through
+* @details process and get_result, as for any other processor. event_manager_t uses
+* @details process_batch for all other complete lines if processor has it.
+*/
+class md5_mb_t
+{
+public:
+    /** Maximum lines in one batch*/
+    constexpr static size_t BATCH_SIZE = 64;
+
+    /** Length of raw digest*/
+    constexpr static size_t DIGEST_LEN = md5::DIGEST_SIZE;
+
+    /** Length of result string for one line*/
+    constexpr static size_t RESULT_LEN = 2 * DIGEST_LEN + 1;
+
+
+    /**
+    * @brief Process part of line which will be continued in next buffer
+    * @param[in] buffer with new data
+    */
+    void process(std::string_view buffer)
+    {
+        m_carry.process(buffer);
+    }
+
+
+    /**
+    * @brief Finalize line given by process calls
+    * @return Calculated hash as string_view
+    */
+    std::string_view get_result()
+    {
+        return m_carry.get_result();
+    }
+
+
+    /**
+    * @brief Finalize line given by process calls
+    * @return DIGEST_LEN bytes of digest
+    */
+    std::string_view get_digest()
+    {
+        return m_carry.get_digest();
+    }
+
+
+    /**
+    * @brief Check if some data was given by process and not finalized yet
+    */
+    bool has_pending() const
+    {
+        return m_carry.has_pending();
+    }
+
+
+    /**
+    * @brief Hash complete lines. Result lines are written one after another
+    * @param[in] lines Lines without newline symbol. Not more than BATCH_SIZE
+    * @param[in] count Number of lines
+    * @param[out] out Buffer for count*RESULT_LEN chars
+    */
+    void process_batch(const std::string_view* lines, size_t count, char* out)
+    {
+        md5::digest_t digests[BATCH_SIZE];
+        md5::mb_engine_t::instance().hash(lines, count, digests);
+        hex::formatter_t<>::instance().lines(digests[0], count, md5::DIGEST_SIZE, out);
+    }
+
+
+    /**
+    * @brief Hash complete lines. Raw digests are written one after another
+    * @param[in] lines Lines without newline symbol. Not more than BATCH_SIZE
+    * @param[in] count Number of lines
+    * @param[out] out Buffer for count*DIGEST_LEN bytes
+    */
+    void digest_batch(const std::string_view* lines, size_t count, char* out)
+    {
+        static_assert(sizeof(md5::digest_t) == DIGEST_LEN);
+        md5::mb_engine_t::instance().hash(lines, count, reinterpret_cast<md5::digest_t*>(out));
+    }
+
+private:
+    /** Scalar hash for line continued between buffers*/
+    md5_t<> m_carry;
 };
 
 
@@ -0,0 +1,460 @@
+/**
+ * @file hash_pipeline.hpp
+ * @author Domnikov Ivan
+ * @brief File with hash_pipeline_t class. Hash workers separated from event loop threads.
+ *
+ */
+#pragma once
+
+#include "line_hasher.hpp"
+#include "ring_queue.hpp"
+#include "trace.hpp"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace net
+{
+
+/**
+ * @brief Options of hash pipeline
+ */
+struct pipeline_options_t
+{
+    /** Hash worker threads. 0 - lines are hashed by event loop threads themselves*/
+    size_t workers = 0;
+
+    /** Memory of data given to workers and not finished yet, bytes. Shared by all event loop threads*/
+    size_t memory = 64 << 20;
+
+    /** Connection gives lines to workers after it received this many bytes. 0 - from the start*/
+    size_t bulk_threshold = 256 * 1024;
+};
+
+
+/**
+ * @brief Pool of hash workers fed by event loop threads
+ * @details Event loop thread reads data into job taken from its port and gives complete lines
+ * @details of it to workers. Jobs are given round-robin through SPSC ring of each (port, worker)
+ * @details pair, and finished jobs come back through MPSC ring of port and its eventfd, which
+ * @details event loop waits with connections. Connection keeps its jobs in order and sends
+ * @details results only from the first unfinished job, so results are in order of lines.
+ * @details Each port has jobs for memory/JOB_SIZE/ports bytes. When all of them are given to
+ * @details workers, connections of port wait until some job comes back. Rings are not smaller
+ * @details than number of jobs, so pushing to them never fails.
+ * @details One bulk upload is spread over all workers: its jobs go round-robin, so single
+ * @details connection is hashed by all workers in parallel. Connections which received less than
+ * @details bulk threshold are hashed by event loop thread as without pipeline.
+ * @details Workers spin for a while when rings are empty and then sleep on their own eventfd.
+ * @details Processor is any class which can be given to hash_lines. Each worker has its own.
+ */
+template <class Processor>
+class hash_pipeline_t
+{
+public:
+    /** Data size of one job*/
+    static const size_t JOB_SIZE = 64 * 1024;
+
+    /**
+     * @brief Data read from connection and results of its complete lines
+     */
+    struct job_t
+    {
+        /** Connection which gave job*/
+        void* owner = nullptr;
+
+        /** Next job of the same connection*/
+        job_t* next = nullptr;
+
+        /** Job came back from worker. Used by event loop thread only*/
+        bool done = false;
+
+        /** Complete lines for worker are data[begin, end)*/
+        size_t begin = 0;
+        size_t end = 0;
+
+        /** Lines may end with "\r\n" (see crlf_protocol_t)*/
+        bool crlf = false;
+        std::array<char, JOB_SIZE> data;
+
+        /** Results. Event loop thread can put here result of line finished before worker's ones*/
+        std::vector<char> results;
+
+        /** Time when data was read. Latency of lines is measured from it*/
+        std::chrono::steady_clock::time_point read_time;
+    };
+
+
+    /**
+     * @brief Jobs and completion ring of one event loop thread
+     * @details All methods except of internal ones are called by owner thread only.
+     */
+    class port_t
+    {
+    public:
+        port_t(hash_pipeline_t& pipeline, size_t id, size_t limit, size_t bulk_threshold)
+            :m_pipeline(pipeline), m_id(id), m_limit(limit), m_bulk_threshold(bulk_threshold), m_done(limit),
+             m_event_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+        {
+            if (-1 == m_event_fd)
+            {
+                throw std::runtime_error(std::string("Pipeline eventfd error[") + strerror(errno) + "]");
+            }
+            m_free.reserve(limit);
+        }
+
+        ~port_t()
+        {
+            close(m_event_fd);
+        }
+
+        // rule of five - delete all copy/move methods
+        port_t(const port_t& ) = delete;
+        port_t(      port_t&&) = delete;
+        port_t& operator=(const port_t& ) = delete;
+        port_t& operator=(      port_t&&) = delete;
+
+
+        /**
+         * @brief Bytes which connection receives before it gives lines to workers
+         */
+        size_t bulk_threshold() const
+        {
+            return m_bulk_threshold;
+        }
+
+
+        /**
+         * @brief Check if job can be taken
+         */
+        bool has_free() const
+        {
+            return !m_free.empty() || m_jobs.size() < m_limit;
+        }
+
+
+        /**
+         * @brief Take free job. Jobs are allocated when they are needed first time
+         * @return nullptr if all jobs of port are used
+         */
+        job_t* take()
+        {
+            if (m_free.empty())
+            {
+                if (m_jobs.size() == m_limit)
+                {
+                    return nullptr;
+                }
+                m_jobs.push_back(std::make_unique<job_t>());
+                return m_jobs.back().get();
+            }
+            auto job = m_free.back();
+            m_free.pop_back();
+            return job;
+        }
+
+
+        /**
+         * @brief Give job back to port. Memory of results is kept for next job
+         */
+        void release(job_t* job)
+        {
+            job->owner = nullptr;
+            job->next = nullptr;
+            job->done = false;
+            job->results.clear();
+            m_free.push_back(job);
+        }
+
+
+        /**
+         * @brief Give job to next worker
+         */
+        void submit(job_t* job)
+        {
+            m_pipeline.submit(m_id, job);
+        }
+
+
+        /**
+         * @brief Call func for each job which came back from workers
+         * @details Called when eventfd (get_fd) is readable
+         * @param func Callable with parameter job_t*
+         */
+        template <class Func>
+        void drain(Func&& func)
+        {
+            uint64_t value;
+            while (-1 == read(m_event_fd, &value, sizeof(value)) && EINTR == errno);
+
+            // Workers which pushed after this write eventfd again
+            m_notified.store(false);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            job_t* job;
+            while (m_done.pop(job))
+            {
+                func(job);
+            }
+        }
+
+
+        /**
+         * @brief eventfd which is readable when finished jobs are waiting for drain
+         */
+        int get_fd() const
+        {
+            return m_event_fd;
+        }
+
+    private:
+        friend class hash_pipeline_t;
+
+        /**
+         * @brief Called by worker when job is finished
+         */
+        void complete(job_t* job)
+        {
+            m_done.push(job);
+            if (!m_notified.exchange(true))
+            {
+                uint64_t one = 1;
+                if (sizeof(one) != write(m_event_fd, &one, sizeof(one)))
+                {
+                    perror("[E] pipeline eventfd write failed\n");
+                }
+            }
+        }
+
+        hash_pipeline_t& m_pipeline;
+        const size_t m_id;
+        const size_t m_limit;
+        const size_t m_bulk_threshold;
+
+        /** All jobs of port and the free ones*/
+        std::vector<std::unique_ptr<job_t>> m_jobs;
+        std::vector<job_t*> m_free;
+
+        /** Finished jobs*/
+        mpsc_ring_t<job_t*> m_done;
+        int m_event_fd;
+        std::atomic_bool m_notified{false};
+    };
+
+
+    /**
+     * @brief Create ports and start workers
+     * @details Function will throw an exception if eventfd can't be created
+     * @param[in] ports Number of event loop threads
+     * @param[in] options Number of workers and memory
+     */
+    hash_pipeline_t(size_t ports, const pipeline_options_t& options)
+        :m_run(true)
+    {
+        auto limit = std::max<size_t>(2, options.memory / sizeof(job_t) / std::max<size_t>(1, ports));
+        for (size_t i = 0; i < ports; ++i)
+        {
+            m_ports.push_back(std::make_unique<port_t>(*this, i, limit, options.bulk_threshold));
+        }
+
+        for (size_t i = 0; i < std::max<size_t>(1, options.workers); ++i)
+        {
+            auto wake_fd = eventfd(0, EFD_CLOEXEC);
+            if (-1 == wake_fd)
+            {
+                fprintf(stderr, "[E] hash worker[%ld] eventfd failed\n", i);
+                continue;
+            }
+            auto worker = std::make_unique<worker_t>(wake_fd);
+            for (size_t port = 0; port < ports; ++port)
+            {
+                worker->rings.push_back(std::make_unique<spsc_ring_t<job_t*>>(limit));
+            }
+            m_workers.push_back(std::move(worker));
+        }
+        if (m_workers.empty())
+        {
+            throw std::runtime_error("Pipeline has no workers");
+        }
+
+        for (auto& worker : m_workers)
+        {
+            worker->thr = std::thread([this, &worker = *worker]{work(worker);});
+        }
+    }
+
+
+    /**
+     * @brief Stop and join workers. Event loop threads must be stopped before
+     */
+    virtual ~hash_pipeline_t()
+    {
+        m_run = false;
+        for (auto& worker : m_workers)
+        {
+            wake(*worker);
+        }
+        for (auto& worker : m_workers)
+        {
+            worker->thr.join();
+            close(worker->wake_fd);
+        }
+    }
+
+    // rule of five - delete all copy/move methods
+    hash_pipeline_t(const hash_pipeline_t& ) = delete;
+    hash_pipeline_t(      hash_pipeline_t&&) = delete;
+    hash_pipeline_t& operator=(const hash_pipeline_t& ) = delete;
+    hash_pipeline_t& operator=(      hash_pipeline_t&&) = delete;
+
+
+    /**
+     * @brief Port of event loop thread
+     */
+    port_t& port(size_t id)
+    {
+        return *m_ports.at(id);
+    }
+
+
+    /**
+     * @brief Number of workers
+     */
+    size_t workers() const
+    {
+        return m_workers.size();
+    }
+
+
+private:
+
+    /** Empty polls of rings before worker sleeps*/
+    constexpr static int spin_count = 64;
+
+    /** Worker thread, its submission rings (one per port) and eventfd to wake it*/
+    struct worker_t
+    {
+        worker_t(int fd) : wake_fd(fd) {}
+
+        int wake_fd;
+        std::atomic_bool sleeping{false};
+        std::vector<std::unique_ptr<spsc_ring_t<job_t*>>> rings;
+        std::thread thr;
+    };
+
+
+    /**
+     * @brief Push job to ring of next worker and wake worker if it sleeps
+     */
+    void submit(size_t port, job_t* job)
+    {
+        auto& worker = *m_workers[m_next_worker++ % m_workers.size()];
+        worker.rings[port]->push(job);
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (worker.sleeping.load(std::memory_order_relaxed))
+        {
+            wake(worker);
+        }
+    }
+
+
+    /**
+     * @brief Worker thread function
+     */
+    void work(worker_t& worker)
+    {
+        Processor processor;
+        int idle = 0;
+        while (m_run)
+        {
+            if (poll(worker, processor))
+            {
+                idle = 0;
+                continue;
+            }
+
+            if (++idle < spin_count)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+
+            // Submitter checks flag after push, so job pushed before flag is found by last poll
+            worker.sleeping.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!poll(worker, processor) && m_run)
+            {
+                uint64_t value;
+                while (-1 == read(worker.wake_fd, &value, sizeof(value)) && EINTR == errno);
+            }
+            worker.sleeping.store(false, std::memory_order_relaxed);
+            idle = 0;
+        }
+    }
+
+
+    /**
+     * @brief Hash all jobs waiting in worker rings
+     * @return true if some job was found
+     */
+    bool poll(worker_t& worker, Processor& processor)
+    {
+        bool found = false;
+        for (size_t port = 0; port < worker.rings.size(); ++port)
+        {
+            job_t* job;
+            while (worker.rings[port]->pop(job))
+            {
+                {
+                    HASH_SERVER_TRACE_SCOPE(digest);
+                    auto& index = line_index_t::local();
+                    index.build({job->data.data() + job->begin, job->end - job->begin}, job->crlf);
+                    hash_lines(processor, index.lines(), job->results);
+                }
+                m_ports[port]->complete(job);
+                found = true;
+            }
+        }
+        return found;
+    }
+
+
+    static void wake(worker_t& worker)
+    {
+        uint64_t one = 1;
+        if (sizeof(one) != write(worker.wake_fd, &one, sizeof(one)))
+        {
+            perror("[E] hash worker eventfd write failed\n");
+        }
+    }
+
+
+    /** Ports of event loop threads*/
+    std::vector<std::unique_ptr<port_t>> m_ports;
+
+    /** Workers. Worker data must not be moved when threads are running*/
+    std::vector<std::unique_ptr<worker_t>> m_workers;
+
+    /** Round-robin counter of workers. Ports submit from different threads*/
+    std::atomic_size_t m_next_worker{0};
+
+    /** Run flag. setup to true when object created and to false when object is destroying*/
+    std::atomic_bool m_run;
+};
+
+} // namespace net
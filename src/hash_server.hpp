@@ -8,8 +8,10 @@
 
 #include "hash_socket.hpp"
 #include "connection_pool.hpp"
+#include "uring_pool.hpp"
 
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 
 #include <unistd.h>
@@ -20,6 +22,10 @@
 #include <cstdio>
 #include <cstring>
 #include <cerrno>
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <vector>
 
 namespace net
 {
@@ -29,12 +35,26 @@ namespace net
  * @details Class itself just use Connection, connection_pool with Processor.
  * @details Function run use create and wait_new methods of Connection and if new connection then it put
  * @details new file descriptor into connection pool
+ * @details In reuse_port mode each connection_pool thread gets its own listening Connection and accepts by itself
+ * @details Pool is connection_pool_t (epoll) or uring_pool_t (io_uring)
  */
-template <class Connection, class Processor>
+template <class Connection, class Processor, template <class> class Pool = connection_pool_t>
 class server_t
 {
 public:
-    server_t(int thread_num):m_pool(thread_num){}
+    /**
+     * @param[in] thread_num Number of pool threads
+     * @param[in] pool_args Other arguments of Pool constructor, e.g. pipeline_options_t
+     */
+    template <class... PoolArgs>
+    server_t(int thread_num, PoolArgs&&... pool_args)
+        :m_pool(thread_num, std::forward<PoolArgs>(pool_args)...), m_stop_fd(eventfd(0, EFD_CLOEXEC))
+    {
+        if (m_stop_fd == nullptr)
+        {
+            throw std::runtime_error(std::string("Server eventfd error[") + strerror(errno) + "]");
+        }
+    }
     virtual ~server_t() = default;
 
 
@@ -44,10 +64,18 @@ public:
      * @details If eny error during runnig server happaned then exception will be generated and it
      * @details must be caught.
      * @param[in] TCP port to listen
+     * @param[in] Listening options
      */
-    void run(int port)
+    void run(int port, const listen_options_t& options = {})
     {
-        m_conct.create(port);
+        if (options.reuse_port)
+        {
+            m_reuse_port = true;
+            run_reuse_port(port, options);
+            return;
+        }
+
+        m_conct.create(port, options);
 
         int new_fd = -1;
         while (m_conct.wait_new(new_fd))
@@ -61,20 +89,74 @@ public:
     }
 
 
+    /**
+     * @brief Pool of server, e.g. to collect its stats
+     */
+    const Pool<Processor>& pool() const
+    {
+        return m_pool;
+    }
+
+
     /**
      * @brief Killing server and connection_pool
+     * @details Can be called from signal handler
      */
     void kill()
     {
-        m_conct.kill();
+        if (!m_reuse_port)
+        {
+            m_conct.kill();
+        }
+
+        uint64_t one = 1;
+        if (-1 == write(m_stop_fd.get(), &one, sizeof(one)))
+        {
+            fprintf(stderr, "Server stop notification failure!: %s\n", strerror(errno));
+        }
     }
 
 private:
+    /**
+     * @brief Create listening socket for each thread of pool and wait for kill
+     * @details Threads accept connections from their own sockets, so this thread only waits.
+     */
+    void run_reuse_port(int port, const listen_options_t& options)
+    {
+        std::vector<std::unique_ptr<Connection>> listeners;
+        for (size_t i = 0; i < m_pool.size(); ++i)
+        {
+            listeners.push_back(std::make_unique<Connection>());
+            listeners.back()->create(port, options);
+            if (-1 == m_pool.add_listener(i, listeners.back()->get_fd()))
+            {
+                throw std::runtime_error(std::string("Listener registration error[") + strerror(errno) + "]");
+            }
+        }
+
+        uint64_t value;
+        while (-1 == read(m_stop_fd.get(), &value, sizeof(value)) && errno == EINTR){}
+
+        // Threads remove shut down listeners from their event loops. Pool is stopped before sockets are closed
+        for (auto& listener : listeners)
+        {
+            listener->kill();
+        }
+        m_pool.stop();
+    }
+
+
     /** Instance for managing connections*/
     Connection m_conct;
 
     /** Connection pool object. Creating by conscructor*/
-    connection_pool_t<Processor> m_pool;
+    Pool<Processor> m_pool;
+
+    /** Written by kill to wake up run in reuse_port mode*/
+    std::unique_ptr<fd_holder_t, fd_deleter_t> m_stop_fd;
+
+    /** Server runs in reuse_port mode*/
+    std::atomic_bool m_reuse_port{false};
 };
 
 
@@ -9,9 +9,12 @@
 #include "fd_holder.hpp"
 #include "hash_calc.hpp"
 #include "connection_pool.hpp"
+#include "trace.hpp"
 
 #include <sys/epoll.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 
 #include <unistd.h>
 #include <fcntl.h>
@@ -21,10 +24,28 @@
 #include <cstdio>
 #include <cstring>
 #include <cerrno>
+#include <stdexcept>
+#include <string>
 
 namespace net
 {
 
+/**
+ * @brief Options of listening socket
+ */
+struct listen_options_t
+{
+    /** Connections queue size (listen backlog). Kernel limits it by net.core.somaxconn*/
+    int backlog = SOMAXCONN;
+
+    /** Listen with SO_REUSEPORT socket per connection_pool_t thread instead of single accept loop*/
+    bool reuse_port = false;
+
+    /** TCP_DEFER_ACCEPT timeout in seconds. Connection is accepted when first data came. 0 - disabled*/
+    int defer_accept = 0;
+};
+
+
 /**
  * @brief The class proides interface woth with TCP sockets in blocking mode.
  * @details Methods create for creating and start listening, wait_new - waiting new connection and
@@ -59,9 +80,11 @@ public:
      * @brief Create server on this port and start listen it
      * @details If creation and starting listening success then function will finish normally.
      * @details Function will throw an exception if creating is failed
+     * @details With reuse_port option socket is non-blocking and can be bound to the same port many times
      * @param TCP port
+     * @param Listening options
      */
-    void create(uint16_t port)
+    void create(uint16_t port, const listen_options_t& options = {})
     {
         // Creating socket descriptor
         m_file_desc.reset(socket( AF_INET, SOCK_STREAM, IPPROTO_TCP ));
@@ -77,6 +100,32 @@ public:
             fprintf(stderr, "Reuse address option cannot be used\n");
         }
 
+        // Each thread binds its own socket to the same port. Kernel balances connections between them
+        if (options.reuse_port)
+        {
+            if (-1 == setsockopt(m_file_desc.get(), SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable) ))
+            {
+                throw std::runtime_error(std::string("Reuse port option error[") + strerror(errno) + "]");
+            }
+
+            if (-1 == fcntl(m_file_desc.get(), F_SETFL, fcntl(m_file_desc.get(), F_GETFL) | O_NONBLOCK))
+            {
+                throw std::runtime_error(std::string("Socket non-blocking mode error[") + strerror(errno) + "]");
+            }
+        }
+
+        // Results are coalesced by server itself. Don't let Nagle hold the tail of them. Accepted sockets inherit it
+        if (-1 == setsockopt(m_file_desc.get(), IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable) ))
+        {
+            fprintf(stderr, "No delay option cannot be used\n");
+        }
+
+        if (options.defer_accept &&
+            -1 == setsockopt(m_file_desc.get(), IPPROTO_TCP, TCP_DEFER_ACCEPT, &options.defer_accept, sizeof(options.defer_accept)))
+        {
+            fprintf(stderr, "Defer accept option cannot be used\n");
+        }
+
         // Binding socket to file descriptor
         sockaddr_in addr;
         memset( &addr , 0, sizeof(addr) );
@@ -90,7 +139,7 @@ public:
 
 
         // Start listening socket
-        if (-1 == listen( m_file_desc.get(), max_events))
+        if (-1 == listen( m_file_desc.get(), options.backlog))
         {
             throw std::runtime_error(std::string("Socket start listen error[") + strerror(errno) + "]");
         }
@@ -106,7 +155,7 @@ public:
      */
     bool wait_new(int& file_descr)
     {
-        while ( (file_descr = accept (m_file_desc.get(), NULL, 0)) < 0)
+        while ( (file_descr = accept4(m_file_desc.get(), NULL, 0, SOCK_NONBLOCK | SOCK_CLOEXEC)) < 0)
         {
             if (errno == EWOULDBLOCK  || errno == EAGAIN      || errno == ENONET     ||
                 errno == EPROTO       || errno == ENOPROTOOPT || errno == EOPNOTSUPP ||
@@ -125,13 +174,23 @@ public:
                 throw std::runtime_error(std::string("Socket Listening error[") + strerror(errno) + "]");
             }
         }
+
+        // Accept itself waits for connection, so only its moment is traced
+        HASH_SERVER_PROBE1(accept, file_descr);
+        HASH_SERVER_TRACE_MARK(accept);
         return true;
     }
 
-private:
 
-    /** Maximum connections queue size */
-    constexpr static int max_events = 32;
+    /**
+     * @brief Listening socket file descriptor
+     */
+    int get_fd() const
+    {
+        return m_file_desc.get();
+    }
+
+private:
 
     /** Opened socket file descriptor wrapped with std::unique_ptr with custom deleter*/
     std::unique_ptr<fd_holder_t, fd_deleter_t> m_file_desc;
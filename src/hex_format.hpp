@@ -0,0 +1,381 @@
+/**
+ * @file hex_format.hpp
+ * @author Domnikov Ivan
+ * @brief Hex encoding of digests and formatting of result lines by SIMD kernels.
+ *
+ */
+#pragma once
+
+#include "cpu_features.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace net
+{
+namespace hex
+{
+
+/** Case of hex digits of results. Build option HEX_LOWERCASE selects lowercase*/
+#if defined(HASH_SERVER_HEX_LOWERCASE)
+constexpr bool UPPERCASE = false;
+#else
+constexpr bool UPPERCASE = true;
+#endif
+
+
+template <bool UPPER>
+constexpr const char* digits()
+{
+    return UPPER ? "0123456789ABCDEF" : "0123456789abcdef";
+}
+
+
+/**
+ * @brief Scalar encoding by lookup table
+ * @param[in] src Raw bytes
+ * @param[in] len Number of bytes
+ * @param[out] dst Must have space for 2*len chars
+ * @return Pointer to char after written hex
+ */
+template <bool UPPER>
+inline char* encode_scalar(const unsigned char* src, size_t len, char* dst)
+{
+    for (size_t i = 0; i < len; ++i)
+    {
+        *dst++ = digits<UPPER>()[0xF & src[i] >> 4];
+        *dst++ = digits<UPPER>()[0xF & src[i]];
+    }
+    return dst;
+}
+
+#if defined(__x86_64__)
+/**
+ * @brief 16 bytes to 32 hex chars by SSE2 arithmetic: nibble + '0', and + 7 ('A') or + 39 ('a') above 9
+ * @details SSE2 is part of x86-64, so this is used for single digests without dispatching.
+ */
+template <bool UPPER>
+__attribute__((always_inline)) inline void encode16_sse2(const unsigned char* src, char* dst)
+{
+    auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    auto mask = _mm_set1_epi8(0x0F);
+    auto lo = _mm_and_si128(bytes, mask);
+    auto hi = _mm_and_si128(_mm_srli_epi16(bytes, 4), mask);
+
+    auto to_chars = [](__m128i nibbles)
+    {
+        auto letters = _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)), _mm_set1_epi8(UPPER ? 7 : 39));
+        return _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')), letters);
+    };
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), to_chars(_mm_unpacklo_epi8(hi, lo)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst) + 1, to_chars(_mm_unpackhi_epi8(hi, lo)));
+}
+
+
+/**
+ * @brief SSE2 encoding of 16 byte blocks, the rest by table
+ */
+template <bool UPPER>
+inline char* encode_sse2(const unsigned char* src, size_t len, char* dst)
+{
+    for (; len >= 16; len -= 16, src += 16, dst += 32)
+    {
+        encode16_sse2<UPPER>(src, dst);
+    }
+    return encode_scalar<UPPER>(src, len, dst);
+}
+
+
+/**
+ * @brief 32 bytes to 64 hex chars by AVX2: nibbles are looked up in table by byte shuffle
+ */
+template <bool UPPER>
+__attribute__((target("avx2"), always_inline)) inline void encode32_avx2(const unsigned char* src, char* dst)
+{
+    auto table = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(digits<UPPER>())));
+    auto bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+    auto mask = _mm256_set1_epi8(0x0F);
+    auto lo = _mm256_shuffle_epi8(table, _mm256_and_si256(bytes, mask));
+    auto hi = _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(bytes, 4), mask));
+
+    // Unpack works inside 128 bit lanes: first has chars of bytes 0-7 and 16-23, second of 8-15 and 24-31
+    auto first = _mm256_unpacklo_epi8(hi, lo);
+    auto second = _mm256_unpackhi_epi8(hi, lo);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), _mm256_permute2x128_si256(first, second, 0x20));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst) + 1, _mm256_permute2x128_si256(first, second, 0x31));
+}
+
+
+/**
+ * @brief 16 bytes to 32 hex chars by SSSE3 byte shuffle. Used by AVX2 kernel for 16 byte blocks
+ */
+template <bool UPPER>
+__attribute__((target("avx2"), always_inline)) inline void encode16_shuffle(const unsigned char* src, char* dst)
+{
+    auto table = _mm_loadu_si128(reinterpret_cast<const __m128i*>(digits<UPPER>()));
+    auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    auto mask = _mm_set1_epi8(0x0F);
+    auto lo = _mm_shuffle_epi8(table, _mm_and_si128(bytes, mask));
+    auto hi = _mm_shuffle_epi8(table, _mm_and_si128(_mm_srli_epi16(bytes, 4), mask));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_unpacklo_epi8(hi, lo));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst) + 1, _mm_unpackhi_epi8(hi, lo));
+}
+#endif
+
+
+/**
+ * @brief Encode digest the fastest way available without dispatching
+ * @param[in] src Raw digest
+ * @param[in] len Digest length
+ * @param[out] dst Must have space for 2*len chars
+ * @return Pointer to char after written hex
+ */
+template <bool UPPER = UPPERCASE>
+inline char* encode(const unsigned char* src, size_t len, char* dst)
+{
+#if defined(__x86_64__)
+    return encode_sse2<UPPER>(src, len, dst);
+#else
+    return encode_scalar<UPPER>(src, len, dst);
+#endif
+}
+
+
+/**
+ * @brief Lines of digests by table: hex of each digest and newline symbol
+ * @param[in] digests Digests one after another
+ * @param[in] count Number of digests
+ * @param[in] len Length of one digest
+ * @param[out] out Must have space for count*(2*len+1) chars
+ * @return Pointer to char after written lines
+ */
+template <bool UPPER>
+inline char* lines_scalar(const unsigned char* digests, size_t count, size_t len, char* out)
+{
+    for (size_t i = 0; i < count; ++i, digests += len)
+    {
+        out = encode_scalar<UPPER>(digests, len, out);
+        *out++ = '\n';
+    }
+    return out;
+}
+
+#if defined(__x86_64__)
+/**
+ * @brief SSE2 kernel of lines
+ */
+template <bool UPPER>
+inline char* lines_sse2(const unsigned char* digests, size_t count, size_t len, char* out)
+{
+    for (size_t i = 0; i < count; ++i, digests += len)
+    {
+        out = encode_sse2<UPPER>(digests, len, out);
+        *out++ = '\n';
+    }
+    return out;
+}
+
+
+/**
+ * @brief AVX2 kernel of lines
+ * @details Digests of 16 bytes (MD5) are encoded two at once. Longer ones are encoded by 32 byte
+ * @details blocks, then by 16 byte block, the rest by table.
+ */
+template <bool UPPER>
+__attribute__((target("avx2")))
+inline char* lines_avx2(const unsigned char* digests, size_t count, size_t len, char* out)
+{
+    size_t i = 0;
+    if (16 == len)
+    {
+        for (; i + 2 <= count; i += 2, digests += 32)
+        {
+            alignas(32) char hex[64];
+            encode32_avx2<UPPER>(digests, hex);
+            __builtin_memcpy(out, hex, 32);
+            out[32] = '\n';
+            __builtin_memcpy(out + 33, hex + 32, 32);
+            out[65] = '\n';
+            out += 66;
+        }
+    }
+
+    for (; i < count; ++i, digests += len)
+    {
+        auto src = digests;
+        auto rest = len;
+        for (; rest >= 32; rest -= 32, src += 32, out += 64)
+        {
+            encode32_avx2<UPPER>(src, out);
+        }
+        if (rest >= 16)
+        {
+            encode16_shuffle<UPPER>(src, out);
+            rest -= 16;
+            src += 16;
+            out += 32;
+        }
+        out = encode_scalar<UPPER>(src, rest, out);
+        *out++ = '\n';
+    }
+    return out;
+}
+#endif
+
+
+/** No prefix before hex of line*/
+struct no_prefix_t
+{
+    constexpr static size_t MAX_LEN = 0;
+    char* write(char* dst) {return dst;}
+};
+
+
+/** Line number starting from 1 and space before hex of line*/
+struct line_number_t
+{
+    constexpr static size_t MAX_LEN = 21;
+
+    /** Write at most MAX_LEN chars: decimal number and space*/
+    char* write(char* dst)
+    {
+        char digits[MAX_LEN];
+        size_t len = 0;
+        auto value = ++number;
+        do
+        {
+            digits[len++] = '0' + value % 10;
+            value /= 10;
+        } while (value);
+
+        while (len)
+        {
+            *dst++ = digits[--len];
+        }
+        *dst++ = ' ';
+        return dst;
+    }
+
+    uint64_t number = 0;
+};
+
+
+/**
+ * @brief Formatter of result lines with kernel selected for current CPU
+ * @details Formatter has no state except kernel, so one instance is shared by all threads.
+ * @param UPPER Case of hex digits
+ */
+template <bool UPPER = UPPERCASE>
+class formatter_t
+{
+public:
+    /** Available kernels*/
+    enum class kernel_t
+    {
+        scalar,
+        sse2,
+        avx2
+    };
+
+    /** Kernel function type. Returns pointer after written lines*/
+    using lines_fn_t = char* (*)(const unsigned char*, size_t, size_t, char*);
+
+    /**
+     * @brief Create formatter with given kernel
+     * @details If kernel is not supported by CPU then scalar kernel will be used
+     * @param[in] kernel
+     */
+    explicit formatter_t(kernel_t kernel = best_kernel())
+        : m_kernel(is_supported(kernel) ? kernel : kernel_t::scalar)
+    {
+        switch (m_kernel)
+        {
+#if defined(__x86_64__)
+            case kernel_t::sse2: m_lines = &lines_sse2<UPPER>; break;
+            case kernel_t::avx2: m_lines = &lines_avx2<UPPER>; break;
+#endif
+            default:             m_lines = &lines_scalar<UPPER>; break;
+        }
+    }
+
+
+    /**
+     * @brief Get formatter for current CPU. Kernel is detected once on first call
+     */
+    static const formatter_t& instance()
+    {
+        static const formatter_t formatter;
+        return formatter;
+    }
+
+
+    /**
+     * @brief Check if CPU can run given kernel
+     */
+    static bool is_supported(kernel_t kernel)
+    {
+        switch (kernel)
+        {
+#if defined(__x86_64__)
+            case kernel_t::sse2: return true;
+            case kernel_t::avx2: return cpu_features_t::get().avx2;
+#endif
+            case kernel_t::scalar: return true;
+            default:               return false;
+        }
+    }
+
+
+    /**
+     * @brief Widest kernel supported by CPU
+     */
+    static kernel_t best_kernel()
+    {
+        return is_supported(kernel_t::avx2) ? kernel_t::avx2 : is_supported(kernel_t::sse2) ? kernel_t::sse2 : kernel_t::scalar;
+    }
+
+
+    /**
+     * @brief Write line of each digest: hex and newline symbol
+     * @param[in] digests Digests one after another
+     * @param[in] count Number of digests
+     * @param[in] len Length of one digest
+     * @param[out] out Must have space for count*(2*len+1) chars
+     * @return Pointer to char after written lines
+     */
+    char* lines(const unsigned char* digests, size_t count, size_t len, char* out) const
+    {
+        return m_lines(digests, count, len, out);
+    }
+
+
+    /**
+     * @brief Kernel used by formatter
+     */
+    kernel_t kernel() const {return m_kernel;}
+
+
+    /**
+     * @brief Kernel name for logging
+     */
+    static const char* name(kernel_t kernel)
+    {
+        switch (kernel)
+        {
+            case kernel_t::sse2: return "sse2";
+            case kernel_t::avx2: return "avx2";
+            default:             return "scalar";
+        }
+    }
+
+private:
+    kernel_t m_kernel;
+    lines_fn_t m_lines;
+};
+
+} // namespace hex
+} // namespace net
@@ -0,0 +1,101 @@
+/**
+ * @file intrusive_list.hpp
+ * @author Domnikov Ivan
+ * @brief Doubly linked list of objects which keep their own hooks.
+ *
+ */
+#pragma once
+
+#include <cstddef>
+
+namespace net
+{
+
+/**
+ * @brief Hook of intrusive_list_t. Kept inside of object which is in list
+ */
+struct list_hook_t
+{
+    list_hook_t* prev = nullptr;
+    list_hook_t* next = nullptr;
+
+    /** Object of hook. List doesn't use it*/
+    void* owner = nullptr;
+
+    bool is_linked() const
+    {
+        return next != nullptr;
+    }
+};
+
+
+/**
+ * @brief List of hooks. Push and remove are O(1) and never allocate
+ * @details Hook can be in one list at a time. List is used by one thread only.
+ */
+class intrusive_list_t
+{
+public:
+    intrusive_list_t()
+    {
+        m_head.prev = m_head.next = &m_head;
+    }
+
+    // rule of five - delete all copy/move methods. Head points to itself
+    intrusive_list_t(const intrusive_list_t& ) = delete;
+    intrusive_list_t(      intrusive_list_t&&) = delete;
+    intrusive_list_t& operator=(const intrusive_list_t& ) = delete;
+    intrusive_list_t& operator=(      intrusive_list_t&&) = delete;
+
+
+    void push_back(list_hook_t& hook)
+    {
+        hook.prev = m_head.prev;
+        hook.next = &m_head;
+        m_head.prev->next = &hook;
+        m_head.prev = &hook;
+        ++m_size;
+    }
+
+
+    /**
+     * @brief Remove hook if it's linked. Hook must be in this list
+     */
+    void remove(list_hook_t& hook)
+    {
+        if (hook.is_linked())
+        {
+            hook.prev->next = hook.next;
+            hook.next->prev = hook.prev;
+            hook.prev = hook.next = nullptr;
+            --m_size;
+        }
+    }
+
+
+    /**
+     * @brief Call function for each hook. Function can remove hook it's called for
+     */
+    template <class Function>
+    void for_each(Function&& function)
+    {
+        for (auto hook = m_head.next; hook != &m_head;)
+        {
+            auto next = hook->next;
+            function(*hook);
+            hook = next;
+        }
+    }
+
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+private:
+    list_hook_t m_head;
+    size_t m_size = 0;
+};
+
+} // namespace net
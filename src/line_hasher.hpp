@@ -0,0 +1,197 @@
+/**
+ * @file line_hasher.hpp
+ * @author Domnikov Ivan
+ * @brief Hashing of complete lines by any processor.
+ *
+ */
+#pragma once
+
+#include "line_index.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace net
+{
+
+/** Check if Processor can hash complete lines in batches (see processors::md5_mb_t)*/
+template <class Processor, class = void>
+struct is_batch_processor : std::false_type {};
+
+template <class Processor>
+struct is_batch_processor<Processor, std::void_t<decltype(&Processor::process_batch)>> : std::true_type {};
+
+
+/**
+ * @brief Hash lines of index and append their results to out
+ * @details Processor must have no unfinished line. Number of lines is known from index, so output
+ * @details buffer grows once. Batch processors get lines in batches of BATCH_SIZE and write
+ * @details results straight into output buffer.
+ * @param processor Processor without unfinished line
+ * @param lines Complete lines (see line_index_t)
+ * @param out Buffer for results
+ */
+template <class Processor>
+void hash_lines(Processor& processor, const lines_t& lines, std::vector<char>& out)
+{
+    auto dst = out.size();
+    out.resize(dst + lines.count * Processor::RESULT_LEN);
+
+    if constexpr (is_batch_processor<Processor>::value)
+    {
+        std::array<std::string_view, Processor::BATCH_SIZE> batch;
+        size_t count = 0;
+
+        auto flush = [&]
+        {
+            processor.process_batch(batch.data(), count, out.data() + dst);
+            dst += count * Processor::RESULT_LEN;
+            count = 0;
+        };
+
+        lines.for_each([&](std::string_view line)
+        {
+            batch[count++] = line;
+            if (count == batch.size())
+            {
+                flush();
+            }
+        });
+
+        if (count)
+        {
+            flush();
+        }
+    }
+    else
+    {
+        lines.for_each([&](std::string_view line)
+        {
+            // Calculating hash
+            processor.process(line);
+            memcpy(out.data() + dst, processor.get_result().data(), Processor::RESULT_LEN);
+            dst += Processor::RESULT_LEN;
+        });
+    }
+}
+
+
+/**
+ * @brief Hash complete lines and append their results to out
+ * @details Every line of buffer must end with newline symbol ('\n'). Lines are found by index
+ * @details of calling thread.
+ * @param processor Processor without unfinished line
+ * @param buffer Complete lines
+ * @param out Buffer for results
+ */
+template <class Processor>
+void hash_lines(Processor& processor, std::string_view buffer, std::vector<char>& out)
+{
+    auto& index = line_index_t::local();
+    index.build(buffer);
+    hash_lines(processor, index.lines(), out);
+}
+
+
+/**
+ * @brief Same as hash_lines but results of short lines are taken from cache and kept in it
+ * @details Place of each result in output buffer is taken in order of lines. Lines which are not
+ * @details in cache are hashed in batches (batch processor) or one by one and their results are
+ * @details put into their places. Time of hashing of lines is measured per batch, so time
+ * @details saved by hits is estimated by average time of hashed line.
+ * @param processor Processor without unfinished line
+ * @param lines Complete lines (see line_index_t)
+ * @param out Buffer for results
+ * @param cache Cache of event loop thread (see digest_cache_t)
+ */
+template <class Processor, class Cache>
+void hash_lines(Processor& processor, const lines_t& lines, std::vector<char>& out, Cache& cache)
+{
+    constexpr size_t RESULT_LEN = Processor::RESULT_LEN;
+    constexpr size_t BATCH_SIZE = [] {
+        if constexpr (is_batch_processor<Processor>::value) return Processor::BATCH_SIZE;
+        else return size_t(16);
+    }();
+
+    std::array<std::string_view, BATCH_SIZE> batch;
+    std::array<size_t, BATCH_SIZE> places;
+    char results[BATCH_SIZE * RESULT_LEN];
+    size_t count = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    auto& hash_ns = cache.hash_ns();
+
+    auto flush = [&]
+    {
+        auto start = std::chrono::steady_clock::now();
+        if constexpr (is_batch_processor<Processor>::value)
+        {
+            processor.process_batch(batch.data(), count, results);
+        }
+        else
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                processor.process(batch[i]);
+                memcpy(results + i * RESULT_LEN, processor.get_result().data(), RESULT_LEN);
+            }
+        }
+        uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        hash_ns = hash_ns ? (7 * hash_ns + ns / count) / 8 : ns / count;
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            memcpy(out.data() + places[i], results + i * RESULT_LEN, RESULT_LEN);
+            if (batch[i].size() <= cache.max_line())
+            {
+                cache.insert(batch[i], results + i * RESULT_LEN);
+                ++misses;
+            }
+        }
+        count = 0;
+    };
+
+    auto place = out.size();
+    out.resize(place + lines.count * RESULT_LEN);
+    lines.for_each([&](std::string_view line)
+    {
+        if (cache.find(line, out.data() + place))
+        {
+            ++hits;
+        }
+        else
+        {
+            batch[count] = line;
+            places[count++] = place;
+            if (count == batch.size())
+            {
+                flush();
+            }
+        }
+        place += RESULT_LEN;
+    });
+
+    if (count)
+    {
+        flush();
+    }
+    cache.record(hits, misses, hits * hash_ns);
+}
+
+
+/**
+ * @brief Same as hash_lines with cache for buffer of complete lines
+ */
+template <class Processor, class Cache>
+void hash_lines(Processor& processor, std::string_view buffer, std::vector<char>& out, Cache& cache)
+{
+    auto& index = line_index_t::local();
+    index.build(buffer);
+    hash_lines(processor, index.lines(), out, cache);
+}
+
+} // namespace net
@@ -0,0 +1,424 @@
+/**
+ * @file line_index.hpp
+ * @author Domnikov Ivan
+ * @brief Positions of newline symbols of buffer found by SIMD kernels in one pass.
+ *
+ */
+#pragma once
+
+#include "cpu_features.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string_view>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace net
+{
+namespace split
+{
+
+/** Flag of newline offset: line ends with "\r\n". '\r' isn't part of line*/
+constexpr uint32_t CR = 1u << 31;
+
+/** Bytes scanned by kernels at once. Each byte gives one bit of mask*/
+constexpr size_t BLOCK_SIZE = 64;
+
+
+/**
+ * @brief Write offsets of newline symbols of one block
+ * @details With CRLF newline which follows '\r' gets CR flag. '\r' in the last byte of previous
+ * @details block is given by carry.
+ * @param[in] newlines Mask of '\n' bytes of block
+ * @param[in] crs Mask of '\r' bytes of block
+ * @param[in] base Offset of block
+ * @param[out] offsets Place for next offsets
+ * @param[in,out] carry '\r' in the last byte of block
+ * @return Place after written offsets
+ */
+template <bool CRLF>
+__attribute__((always_inline)) inline uint32_t* emit(uint64_t newlines, uint64_t crs, uint32_t base, uint32_t* offsets, uint64_t& carry)
+{
+    uint64_t crlf = 0;
+    if constexpr (CRLF)
+    {
+        crlf = (crs << 1 | carry) & newlines;
+        carry = crs >> 63;
+    }
+
+    while (newlines)
+    {
+        auto bit = __builtin_ctzll(newlines);
+        uint32_t offset = base + bit;
+        if constexpr (CRLF)
+        {
+            offset |= uint32_t(crlf >> bit & 1) << 31;
+        }
+        *offsets++ = offset;
+        newlines &= newlines - 1;
+    }
+    return offsets;
+}
+
+
+/**
+ * @brief Scalar kernel: memchr for each newline symbol
+ */
+template <bool CRLF>
+inline size_t index_generic(const char* data, size_t size, uint32_t* offsets)
+{
+    auto first = offsets;
+    for (auto pos = data; auto end = (const char*)std::memchr(pos, '\n', data + size - pos); pos = end + 1)
+    {
+        uint32_t offset = end - data;
+        if (CRLF && end != data && '\r' == end[-1])
+        {
+            offset |= CR;
+        }
+        *offsets++ = offset;
+    }
+    return offsets - first;
+}
+
+
+/**
+ * @brief Run kernel for blocks and copy of tail padded by zeroes
+ * @details Kernel gives masks of newline and '\r' bytes of one block.
+ */
+template <bool CRLF, class Masks>
+__attribute__((always_inline)) inline size_t index_blocks(const char* data, size_t size, uint32_t* offsets, Masks&& masks)
+{
+    auto first = offsets;
+    uint64_t carry = 0;
+    uint64_t newlines, crs;
+    size_t pos = 0;
+    for (; pos + BLOCK_SIZE <= size; pos += BLOCK_SIZE)
+    {
+        masks(data + pos, newlines, crs);
+        offsets = emit<CRLF>(newlines, crs, pos, offsets, carry);
+    }
+
+    if (pos < size)
+    {
+        alignas(BLOCK_SIZE) char tail[BLOCK_SIZE] = {};
+        memcpy(tail, data + pos, size - pos);
+        masks(tail, newlines, crs);
+        offsets = emit<CRLF>(newlines, crs, pos, offsets, carry);
+    }
+    return offsets - first;
+}
+
+#if defined(__x86_64__)
+/**
+ * @brief SSE2 kernel: 4 compares of 16 bytes per block
+ */
+template <bool CRLF>
+inline size_t index_sse2(const char* data, size_t size, uint32_t* offsets)
+{
+    return index_blocks<CRLF>(data, size, offsets, [](const char* block, uint64_t& newlines, uint64_t& crs)
+    {
+        newlines = crs = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block) + i);
+            newlines |= uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n'))))) << 16 * i;
+            if constexpr (CRLF)
+            {
+                crs |= uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\r'))))) << 16 * i;
+            }
+        }
+    });
+}
+
+
+/**
+ * @brief AVX2 kernel: 2 compares of 32 bytes per block
+ */
+template <bool CRLF>
+__attribute__((target("avx2")))
+inline size_t index_avx2(const char* data, size_t size, uint32_t* offsets)
+{
+    return index_blocks<CRLF>(data, size, offsets, [](const char* block, uint64_t& newlines, uint64_t& crs) __attribute__((target("avx2")))
+    {
+        auto lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block));
+        auto hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block) + 1);
+        auto mask = [&](char symbol) __attribute__((target("avx2")))
+        {
+            auto target = _mm256_set1_epi8(symbol);
+            return uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, target)))) |
+                   uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, target)))) << 32;
+        };
+        newlines = mask('\n');
+        crs = CRLF ? mask('\r') : 0;
+    });
+}
+
+
+/**
+ * @brief AVX-512BW kernel: one compare of 64 bytes per block
+ */
+template <bool CRLF>
+__attribute__((target("avx512f,avx512bw")))
+inline size_t index_avx512(const char* data, size_t size, uint32_t* offsets)
+{
+    return index_blocks<CRLF>(data, size, offsets, [](const char* block, uint64_t& newlines, uint64_t& crs) __attribute__((target("avx512f,avx512bw")))
+    {
+        auto bytes = _mm512_loadu_si512(block);
+        newlines = _mm512_cmpeq_epi8_mask(bytes, _mm512_set1_epi8('\n'));
+        crs = CRLF ? _mm512_cmpeq_epi8_mask(bytes, _mm512_set1_epi8('\r')) : 0;
+    });
+}
+#endif
+
+
+/**
+ * @brief Splitter with kernel selected for current CPU
+ * @details Splitter has no state except kernels, so one instance is shared by all threads.
+ */
+class splitter_t
+{
+public:
+    /** Available kernels*/
+    enum class kernel_t
+    {
+        generic,
+        sse2,
+        avx2,
+        avx512
+    };
+
+    /** Kernel function type. Returns number of offsets written*/
+    using index_fn_t = size_t (*)(const char*, size_t, uint32_t*);
+
+    /**
+     * @brief Create splitter with given kernel
+     * @details If kernel is not supported by CPU then generic kernel will be used
+     * @param[in] kernel
+     */
+    explicit splitter_t(kernel_t kernel = best_kernel())
+        : m_kernel(is_supported(kernel) ? kernel : kernel_t::generic)
+    {
+        switch (m_kernel)
+        {
+#if defined(__x86_64__)
+            case kernel_t::sse2:   m_index = &index_sse2<false>;   m_index_crlf = &index_sse2<true>;   break;
+            case kernel_t::avx2:   m_index = &index_avx2<false>;   m_index_crlf = &index_avx2<true>;   break;
+            case kernel_t::avx512: m_index = &index_avx512<false>; m_index_crlf = &index_avx512<true>; break;
+#endif
+            default:               m_index = &index_generic<false>; m_index_crlf = &index_generic<true>; break;
+        }
+    }
+
+
+    /**
+     * @brief Get splitter for current CPU. Kernel is detected once on first call
+     */
+    static const splitter_t& instance()
+    {
+        static const splitter_t splitter;
+        return splitter;
+    }
+
+
+    /**
+     * @brief Check if CPU can run given kernel
+     */
+    static bool is_supported(kernel_t kernel)
+    {
+        switch (kernel)
+        {
+#if defined(__x86_64__)
+            case kernel_t::sse2:   return true;
+            case kernel_t::avx2:   return cpu_features_t::get().avx2;
+            case kernel_t::avx512: return cpu_features_t::get().avx512bw;
+#endif
+            case kernel_t::generic: return true;
+            default:                return false;
+        }
+    }
+
+
+    /**
+     * @brief Widest kernel supported by CPU
+     */
+    static kernel_t best_kernel()
+    {
+        for (auto kernel : {kernel_t::avx512, kernel_t::avx2, kernel_t::sse2})
+        {
+            if (is_supported(kernel))
+            {
+                return kernel;
+            }
+        }
+        return kernel_t::generic;
+    }
+
+
+    /**
+     * @brief Write offsets of all newline symbols of buffer in order
+     * @param[in] data Buffer
+     * @param[in] size Buffer size. Less than 2GB
+     * @param[out] offsets Must have space for one offset per byte of buffer
+     * @param[in] crlf Set CR flag of newline symbols which follow '\r'
+     * @return Number of offsets
+     */
+    size_t index(const char* data, size_t size, uint32_t* offsets, bool crlf) const
+    {
+        return (crlf ? m_index_crlf : m_index)(data, size, offsets);
+    }
+
+
+    /**
+     * @brief Kernel used by splitter
+     */
+    kernel_t kernel() const {return m_kernel;}
+
+
+    /**
+     * @brief Kernel name for logging
+     */
+    static const char* name(kernel_t kernel)
+    {
+        switch (kernel)
+        {
+            case kernel_t::sse2:   return "sse2";
+            case kernel_t::avx2:   return "avx2";
+            case kernel_t::avx512: return "avx512bw";
+            default:               return "memchr";
+        }
+    }
+
+private:
+    kernel_t m_kernel;
+    index_fn_t m_index;
+    index_fn_t m_index_crlf;
+};
+
+} // namespace split
+
+
+/**
+ * @brief Complete lines of buffer between begin and newline symbols of index
+ */
+struct lines_t
+{
+    const char* data;
+    const uint32_t* ends;
+    size_t count;
+
+    /** Offset of first line*/
+    uint32_t begin;
+
+    /**
+     * @brief Call func for each line without newline symbol (and '\r' of "\r\n")
+     */
+    template <class Func>
+    void for_each(Func&& func) const
+    {
+        auto begin = this->begin;
+        for (size_t i = 0; i < count; ++i)
+        {
+            auto end = ends[i] & ~split::CR;
+            func(std::string_view{data + begin, end - begin - (ends[i] >> 31)});
+            begin = end + 1;
+        }
+    }
+};
+
+
+/**
+ * @brief Newline symbols of buffer found in one pass
+ * @details Index is built for whole read buffer before lines are hashed, so search of lines isn't
+ * @details mixed with hashing and sending. Memory of index is kept for next buffers. Each thread
+ * @details has its own index (see local).
+ */
+class line_index_t
+{
+public:
+    /**
+     * @brief Index of calling thread
+     */
+    static line_index_t& local()
+    {
+        thread_local line_index_t index;
+        return index;
+    }
+
+
+    /**
+     * @brief Find newline symbols of buffer
+     * @param[in] buffer Buffer. Must be valid while index is used
+     * @param[in] crlf Lines end with "\r\n" or '\n'
+     * @return Number of newline symbols
+     */
+    size_t build(std::string_view buffer, bool crlf = false)
+    {
+        if (m_capacity < buffer.size())
+        {
+            m_capacity = std::max(buffer.size(), 2 * m_capacity);
+            m_ends.reset(new uint32_t[m_capacity]);
+        }
+        m_data = buffer.data();
+        m_size = buffer.size();
+        m_count = split::splitter_t::instance().index(m_data, m_size, m_ends.get(), crlf);
+        return m_count;
+    }
+
+
+    size_t count() const
+    {
+        return m_count;
+    }
+
+
+    /**
+     * @brief Offset of newline symbol i
+     */
+    uint32_t end(size_t i) const
+    {
+        return m_ends[i] & ~split::CR;
+    }
+
+
+    /**
+     * @brief Line i ends with "\r\n"
+     */
+    bool crlf(size_t i) const
+    {
+        return m_ends[i] & split::CR;
+    }
+
+
+    /**
+     * @brief Lines from line first up to the last complete one
+     */
+    lines_t lines(size_t first = 0) const
+    {
+        return {m_data, m_ends.get() + first, m_count - first, first ? end(first - 1) + 1 : 0};
+    }
+
+
+    /**
+     * @brief Data after the last newline symbol
+     */
+    std::string_view tail() const
+    {
+        size_t begin = m_count ? end(m_count - 1) + 1 : 0;
+        return {m_data + begin, m_size - begin};
+    }
+
+private:
+    std::unique_ptr<uint32_t[]> m_ends;
+    size_t m_capacity = 0;
+    size_t m_count = 0;
+    const char* m_data = nullptr;
+    size_t m_size = 0;
+};
+
+} // namespace net
@@ -1,65 +1,567 @@
 #include "hash_server.hpp"
+#include "algorithms.hpp"
+#include "stats_server.hpp"
+#include "file_hasher.hpp"
 
+#include <atomic>
+#include <chrono>
 #include <csignal>
+#include <getopt.h>
 #include <string.h>
 #include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
 
 namespace
 {
     void (*system_handler)(int);
-    net::hash_server_t* server_ptr = nullptr;
+
+    /** Kill functions of all running servers*/
+    std::vector<std::function<void()>> server_killers;
 
     void sighandler(int sig)
     {
         fprintf(stdout, "TCP server will be shutted down with signal %d: %s.\n", sig, strsignal(sig));
-        if(server_ptr)
+        for (auto& kill : server_killers)
         {
-            server_ptr->kill();
+            kill();
         }
 
         // if not succeed next time kill by system
         signal (SIGINT, system_handler);
     }
+
+
+    /** Listener given from command line as PORT[:ALGO[:PROTO]]*/
+    struct listener_t
+    {
+        int port;
+        std::string algo;
+        std::string protocol;
+    };
+
+
+    /**
+     * @brief Parse PORT[:ALGO[:PROTO]] argument
+     * @return false if port is wrong
+     */
+    bool parse_listener(const char* arg, listener_t& listener)
+    {
+        std::string_view str(arg);
+        auto colon = str.find(':');
+        auto algo = colon == std::string_view::npos ? std::string_view{} : str.substr(colon + 1);
+        auto proto = algo.find(':');
+
+        listener.port = std::atoi(std::string(str.substr(0, colon)).c_str());
+        listener.algo = algo.substr(0, proto).empty() ? net::processors::algo::md5::NAME : algo.substr(0, proto);
+        listener.protocol = proto == std::string_view::npos ? "text" : algo.substr(proto + 1);
+        return 0 != listener.port;
+    }
+
+
+    /** Type holder for passing protocol type to generic lambda*/
+    template <class Protocol>
+    struct protocol_tag_t
+    {
+        using type = Protocol;
+    };
+
+
+    /**
+     * @brief Call func with protocol_tag_t of protocol with given name: text, crlf, binary or auto
+     * @return false if protocol is unknown
+     */
+    template <class Func>
+    bool with_protocol(std::string_view name, Func&& func)
+    {
+        if      (name == "text")   func(protocol_tag_t<net::text_protocol_t>{});
+        else if (name == "crlf")   func(protocol_tag_t<net::crlf_protocol_t>{});
+        else if (name == "binary") func(protocol_tag_t<net::binary_protocol_t>{});
+        else if (name == "auto")   func(protocol_tag_t<net::auto_protocol_t>{});
+        else return false;
+
+        return true;
+    }
+
+
+    /**
+     * @brief Hash lines of file and write results to stdout. Kernels and counters go to stderr
+     * @param[in] line_numbers Result lines start with line number (see hex::line_number_t)
+     * @return Exit code of hash_server
+     */
+    int hash_file(const std::string& path, const std::string& algo, const net::file_options_t& options, bool line_numbers)
+    {
+        net::processors::print_kernels(stderr);
+        int result = 0;
+        bool known = net::processors::with_algorithm(algo, [&](auto tag)
+        {
+            if (!net::processors::is_available<typename decltype(tag)::type>())
+            {
+                fprintf(stderr, "Algorithm '%s' is not available in OpenSSL\n", algo.c_str());
+                result = -1;
+                return;
+            }
+
+            using processor_type = typename decltype(tag)::type;
+            try
+            {
+                auto start = std::chrono::steady_clock::now();
+                auto stats = line_numbers ? net::file_hasher_t<processor_type, net::hex::line_number_t>(options).run(path, STDOUT_FILENO)
+                                          : net::file_hasher_t<processor_type>(options).run(path, STDOUT_FILENO);
+                double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                fprintf(stderr, "Hashed %llu lines, %.1f MB of %s with %s in %.3f s (%.1f MB/s)\n",
+                        static_cast<unsigned long long>(stats.lines), stats.bytes / double(1 << 20), path.c_str(),
+                        algo.c_str(), sec, sec > 0 ? stats.bytes / double(1 << 20) / sec : 0.0);
+            }
+            catch(std::runtime_error& err)
+            {
+                fprintf(stderr, "Hash Server Exception: %s!\n", err.what());
+                result = -1;
+            }
+        });
+
+        if (!known)
+        {
+            fprintf(stderr, "Unknown algorithm '%s'\n", algo.c_str());
+            return -1;
+        }
+        return result;
+    }
+
+
+    /**
+     * @brief Create server of given type and add its kill and run functions
+     * @return Created server
+     */
+    template <class Server, class... PoolArgs>
+    std::shared_ptr<Server> add_server(size_t thread_num, int port, const net::listen_options_t& options,
+                                       std::vector<std::function<void()>>& runners, const PoolArgs&... pool_args)
+    {
+        auto server = std::make_shared<Server>(thread_num, pool_args...);
+        server_killers.push_back([server]{server->kill();});
+        runners.push_back([server, port, &options]{server->run(port, options);});
+        return server;
+    }
 }
 
 
 int main(int argc, char **argv)
 {
-    // Read port number from command line
-    char wrong_msg[] = "Port is not provided via command line parameters!\n\n\tUse: hash_server XXXX - where XXXX - port number\n";
+    // Read listeners from command line
+    std::string wrong_msg = "Port is not provided via command line parameters!\n\n"
+                            "\tUse: hash_server [OPTIONS] PORT[:ALGO[:PROTO]] [PORT[:ALGO[:PROTO]] ...]\n"
+                            "\t  or: hash_server --file PATH [--algo ALGO] [--crlf] [--line-numbers] [--hash-threads N] > RESULTS\n"
+                            "\tPORT - port number, ALGO - digest algorithm (md5 by default): " +
+                            net::processors::algorithm_names() + "\n"
+                            "\tPROTO - text (lines and hex results, default), crlf (text, lines may end with \\r\\n),\n"
+                            "\t        binary (length-prefixed records and raw digests) or auto (binary if connection\n"
+                            "\t        starts with preamble)\n"
+                            "\t--reuseport        - each worker thread accepts on its own SO_REUSEPORT socket\n"
+                            "\t--backlog N        - listen backlog (SOMAXCONN by default)\n"
+                            "\t--defer-accept SEC - accept connection only when data came (TCP_DEFER_ACCEPT)\n"
+                            "\t--backend NAME     - event loop: epoll (default) or uring. uring falls back to epoll\n"
+                            "\t                     if kernel doesn't support it\n"
+                            "\t--io-threads N     - event loop threads (CPUs of --cpus or 2 * CPU by default)\n"
+                            "\t--cpus LIST        - pin event loop threads to CPUs, e.g. 0-3,8 or nic:eth0 for CPUs of NIC IRQs (epoll)\n"
+                            "\t--per-core         - pin one event loop thread to each physical core (epoll)\n"
+                            "\t--incoming-cpu     - connection is handled by thread of CPU which received it (epoll, with --cpus)\n"
+                            "\t--hash-threads N   - hash lines by N separate threads, event loops only read and send (epoll)\n"
+                            "\t--pipeline-memory MB - memory for data given to hash threads (64 by default)\n"
+                            "\t--bulk-threshold KB - connection is hashed by hash threads after this many KB (256 by default)\n"
+                            "\t--placement NAME   - thread for new connection (epoll): " + net::placement_names() + "\n"
+                            "\t--rebalance        - threads with too many connections give idle ones to others (epoll)\n"
+                            "\t--idle-timeout SEC - close connection which sends no request for SEC seconds (epoll)\n"
+                            "\t--read-timeout SEC - close connection which doesn't finish line for SEC seconds (epoll)\n"
+                            "\t--write-timeout SEC - close connection which doesn't read results for SEC seconds (epoll)\n"
+                            "\t--min-threads N    - elastic pool: never retire event loop threads below N (1 by default, epoll)\n"
+                            "\t--max-threads N    - elastic pool: start event loop threads up to N when they are busy (epoll)\n"
+                            "\t--grow-above PCT   - elastic pool: add thread when threads are busy PCT% of time (75 by default)\n"
+                            "\t--shrink-below PCT - elastic pool: retire thread when threads are busy less than PCT% (25 by default)\n"
+                            "\t--grow-after SEC   - elastic pool: utilization stays above threshold SEC seconds to add (3 by default)\n"
+                            "\t--shrink-after SEC - elastic pool: utilization stays below threshold SEC seconds to retire (30 by default)\n"
+                            "\t--cache-mb MB      - keep results of repeated short lines in digest cache of MB per thread (epoll)\n"
+                            "\t--cache-line N     - the longest line kept in digest cache (64 by default)\n"
+                            "\t--stats-port PORT  - serve counters and latencies in Prometheus format on 127.0.0.1:PORT (epoll)\n"
+                            "\t--stats-socket PATH - serve the same stats on Unix socket PATH instead of port (epoll)\n"
+                            "\t--trace-file PATH  - write per-stage trace in Chrome format at exit (built with TRACE_STAGES)\n"
+                            "\t--file PATH        - don't listen, hash lines of file by N hash threads (one per CPU by default)\n"
+                            "\t                     and write results to stdout in order\n"
+                            "\t--algo ALGO        - digest algorithm of --file (md5 by default)\n"
+                            "\t--crlf             - lines of --file may end with \\r\\n as in crlf protocol\n"
+                            "\t--line-numbers     - results of --file start with line number and space\n";
 
-    if (argc != 2)
+    const option long_options[] =
     {
-      fprintf(stderr, "%s", wrong_msg);
-      return -1;
+        {"reuseport",    no_argument,       nullptr, 'r'},
+        {"backlog",      required_argument, nullptr, 'b'},
+        {"defer-accept", required_argument, nullptr, 'd'},
+        {"backend",      required_argument, nullptr, 'e'},
+        {"io-threads",   required_argument, nullptr, 'i'},
+        {"hash-threads", required_argument, nullptr, 'h'},
+        {"pipeline-memory", required_argument, nullptr, 'm'},
+        {"bulk-threshold",  required_argument, nullptr, 't'},
+        {"placement",       required_argument, nullptr, 'p'},
+        {"rebalance",       no_argument,       nullptr, 'l'},
+        {"idle-timeout",    required_argument, nullptr, 'I'},
+        {"read-timeout",    required_argument, nullptr, 'R'},
+        {"write-timeout",   required_argument, nullptr, 'W'},
+        {"cpus",            required_argument, nullptr, 'c'},
+        {"per-core",        no_argument,       nullptr, 'C'},
+        {"incoming-cpu",    no_argument,       nullptr, 'n'},
+        {"min-threads",     required_argument, nullptr, 'j'},
+        {"max-threads",     required_argument, nullptr, 'J'},
+        {"grow-above",      required_argument, nullptr, 'g'},
+        {"shrink-below",    required_argument, nullptr, 'k'},
+        {"grow-after",      required_argument, nullptr, 'G'},
+        {"shrink-after",    required_argument, nullptr, 'K'},
+        {"cache-mb",        required_argument, nullptr, 'x'},
+        {"cache-line",      required_argument, nullptr, 'X'},
+        {"stats-port",      required_argument, nullptr, 'S'},
+        {"stats-socket",    required_argument, nullptr, 'U'},
+        {"trace-file",      required_argument, nullptr, 'T'},
+        {"file",            required_argument, nullptr, 'f'},
+        {"algo",            required_argument, nullptr, 'a'},
+        {"crlf",            no_argument,       nullptr, 'L'},
+        {"line-numbers",    no_argument,       nullptr, 'N'},
+        {nullptr,        0,                 nullptr,  0 }
+    };
+
+    net::listen_options_t listen_options;
+    net::pipeline_options_t pipeline;
+    net::placement_options_t placement;
+    net::timeout_options_t timeouts;
+    net::affinity_options_t affinity;
+    net::elastic_options_t elastic;
+    net::cache_options_t cache;
+    std::string cpus;
+    bool per_core = false;
+    int stats_port = 0;
+    std::string stats_socket;
+    std::string trace_file;
+    std::string file;
+    std::string file_algo = net::processors::algo::md5::NAME;
+    net::file_options_t file_options;
+    bool line_numbers = false;
+    std::string backend = "epoll";
+    size_t io_threads = 0;
+    int opt;
+    while (-1 != (opt = getopt_long(argc, argv, "", long_options, nullptr)))
+    {
+        switch (opt)
+        {
+            case 'r': listen_options.reuse_port   = true;              break;
+            case 'b': listen_options.backlog      = std::atoi(optarg); break;
+            case 'd': listen_options.defer_accept = std::atoi(optarg); break;
+            case 'e': backend                     = optarg;            break;
+            case 'i': io_threads                  = std::atoi(optarg); break;
+            case 'h': pipeline.workers            = std::atoi(optarg); break;
+            case 'm': pipeline.memory             = std::atoll(optarg) << 20; break;
+            case 't': pipeline.bulk_threshold     = std::atoll(optarg) << 10; break;
+            case 'p': placement.policy            = optarg;            break;
+            case 'l': placement.rebalance         = true;              break;
+            case 'I': timeouts.idle  = std::chrono::seconds(std::atoi(optarg)); break;
+            case 'R': timeouts.read  = std::chrono::seconds(std::atoi(optarg)); break;
+            case 'W': timeouts.write = std::chrono::seconds(std::atoi(optarg)); break;
+            case 'c': cpus                        = optarg;            break;
+            case 'C': per_core                    = true;              break;
+            case 'n': affinity.incoming_cpu       = true;              break;
+            case 'j': elastic.min_threads         = std::atoi(optarg); break;
+            case 'J': elastic.max_threads         = std::atoi(optarg); break;
+            case 'g': elastic.grow_above          = std::atof(optarg) / 100; break;
+            case 'k': elastic.shrink_below        = std::atof(optarg) / 100; break;
+            case 'G': elastic.grow_periods        = std::atoi(optarg); break;
+            case 'K': elastic.shrink_periods      = std::atoi(optarg); break;
+            case 'x': cache.memory                = std::atof(optarg) * (1 << 20); break;
+            case 'X': cache.max_line              = std::atoi(optarg); break;
+            case 'S': stats_port                  = std::atoi(optarg); break;
+            case 'U': stats_socket                = optarg;            break;
+            case 'T': trace_file                  = optarg;            break;
+            case 'f': file                        = optarg;            break;
+            case 'a': file_algo                   = optarg;            break;
+            case 'L': file_options.crlf           = true;              break;
+            case 'N': line_numbers                = true;              break;
+            default:
+                fprintf(stderr, "%s", wrong_msg.c_str());
+                return -1;
+        }
     }
 
-    auto port = std::atoi(argv[1]);
+    if (backend != "epoll" && backend != "uring")
+    {
+        fprintf(stderr, "Unknown backend '%s'\n%s", backend.c_str(), wrong_msg.c_str());
+        return -1;
+    }
 
-    if(0 == port)
+    if (!net::make_placement(placement.policy))
     {
-        fprintf(stderr, "%s", wrong_msg);
+        fprintf(stderr, "Unknown placement '%s'\n%s", placement.policy.c_str(), wrong_msg.c_str());
         return -1;
     }
 
+    // Offline mode: no listeners, hash threads of pipeline hash the file
+    if (!file.empty())
+    {
+        file_options.threads = pipeline.workers;
+        return hash_file(file, file_algo, file_options, line_numbers);
+    }
+
+    if (optind >= argc)
+    {
+      fprintf(stderr, "%s", wrong_msg.c_str());
+      return -1;
+    }
+
+    std::vector<listener_t> listeners(argc - optind);
+    for (int i = optind; i < argc; ++i)
+    {
+        if (!parse_listener(argv[i], listeners[i - optind]))
+        {
+            fprintf(stderr, "%s", wrong_msg.c_str());
+            return -1;
+        }
+    }
+
+    // CPUs of event loop threads
+    if (!cpus.empty())
+    {
+        if (0 == cpus.compare(0, 4, "nic:"))
+        {
+            affinity.cpus = net::cpu_layout_t::irq_cpus(cpus.substr(4));
+        }
+        else if (!net::cpu_layout_t::parse_list(cpus, affinity.cpus))
+        {
+            affinity.cpus.clear();
+        }
+
+        if (affinity.cpus.empty())
+        {
+            fprintf(stderr, "Wrong CPU list '%s'\n%s", cpus.c_str(), wrong_msg.c_str());
+            return -1;
+        }
+    }
+    else if (per_core)
+    {
+        affinity.cpus = net::cpu_layout_t::physical_cores(net::cpu_layout_t::detect());
+    }
+
+    // Read number of CPU
+    size_t thread_num = io_threads ? io_threads : !affinity.cpus.empty() ? affinity.cpus.size()
+                                                : std::max(2u, 2*std::thread::hardware_concurrency());
+
+    net::processors::print_kernels(stdout);
+#ifndef HASH_SERVER_TRACE_STAGES
+    if (!trace_file.empty())
+    {
+        fprintf(stderr, "Stage tracing is not compiled in, rebuild with -DTRACE_STAGES=ON\n");
+    }
+#endif
+
+    bool use_uring = backend == "uring";
+    if (use_uring && !net::uring_t::is_supported())
+    {
+        fprintf(stderr, "io_uring is not supported by kernel, epoll is used\n");
+        use_uring = false;
+    }
+    fprintf(stdout, "Backend: %s\n", use_uring ? "io_uring" : "epoll");
+    if (pipeline.workers)
+    {
+        if (use_uring)
+        {
+            fprintf(stderr, "Hash threads are not used by io_uring backend\n");
+        }
+        else
+        {
+            fprintf(stdout, "I/O threads: %zu, hash threads: %zu, pipeline memory: %zu MB\n",
+                    thread_num, pipeline.workers, pipeline.memory >> 20);
+        }
+    }
+    if (use_uring && timeouts.enabled())
+    {
+        fprintf(stderr, "Timeouts are not used by io_uring backend\n");
+    }
+    if (elastic.enabled())
+    {
+        if (use_uring)
+        {
+            fprintf(stderr, "Elastic thread pool is not used by io_uring backend\n");
+        }
+        else
+        {
+            fprintf(stdout, "I/O threads: elastic from %zu to %zu, grow above %.0f%%, shrink below %.0f%%\n",
+                    std::max<size_t>(elastic.min_threads, 1), elastic.max_threads,
+                    elastic.grow_above * 100, elastic.shrink_below * 100);
+        }
+    }
+    if (cache.enabled())
+    {
+        if (use_uring)
+        {
+            fprintf(stderr, "Digest cache is not used by io_uring backend\n");
+        }
+        else
+        {
+            fprintf(stdout, "Digest cache: %.1f MB per I/O thread, lines up to %zu bytes\n",
+                    cache.memory / double(1 << 20), cache.max_line);
+        }
+    }
+    if (!affinity.cpus.empty())
+    {
+        if (use_uring)
+        {
+            fprintf(stderr, "CPU affinity is not used by io_uring backend\n");
+        }
+        else
+        {
+            fprintf(stdout, "I/O threads: %zu pinned to %zu CPUs%s\n", thread_num, affinity.cpus.size(),
+                    affinity.incoming_cpu ? ", connections follow incoming CPU" : "");
+        }
+    }
+
+    // Create server for each listener. Processor type is selected by algorithm
+    std::vector<std::function<void()>> runners;
+    std::vector<net::stats_server_t::collect_t> collectors;
+    for (auto& listener : listeners)
+    {
+        bool known_protocol = false;
+        bool available = true;
+        bool known = net::processors::with_algorithm(listener.algo, [&](auto tag)
+        {
+            // Processor without digest would give zeroes instead of results
+            available = net::processors::is_available<typename decltype(tag)::type>();
+            if (!available)
+            {
+                return;
+            }
+
+            known_protocol = with_protocol(listener.protocol, [&](auto protocol)
+            {
+                using manager_type = net::event_manager_t<typename decltype(tag)::type, true, typename decltype(protocol)::type>;
+                if (use_uring)
+                {
+                    add_server<net::server_t<net::tcp_soct_t, manager_type, net::uring_pool_t>>(thread_num, listener.port, listen_options, runners);
+                }
+                else
+                {
+                    auto server = add_server<net::server_t<net::tcp_soct_t, manager_type>>(thread_num, listener.port, listen_options, runners,
+                                                                                          pipeline, placement, timeouts, affinity, elastic, cache);
+                    auto labels = "port=\"" + std::to_string(listener.port) + "\"";
+                    collectors.push_back([server, labels](std::vector<net::stats_group_t>& groups)
+                    {
+                        groups.emplace_back();
+                        groups.back().labels = labels;
+                        server->pool().collect_stats(groups.back());
+                    });
+                }
+            });
+        });
+
+        if (!known)
+        {
+            fprintf(stderr, "Unknown algorithm '%s'\n%s", listener.algo.c_str(), wrong_msg.c_str());
+            return -1;
+        }
+        if (!available)
+        {
+            fprintf(stderr, "Algorithm '%s' is not available in OpenSSL\n", listener.algo.c_str());
+            return -1;
+        }
+        if (!known_protocol)
+        {
+            fprintf(stderr, "Unknown protocol '%s'\n%s", listener.protocol.c_str(), wrong_msg.c_str());
+            return -1;
+        }
+        fprintf(stdout, "Listen port %d with %s, %s protocol\n", listener.port, listener.algo.c_str(), listener.protocol.c_str());
+    }
+
+    // Stats of all servers are served by one endpoint
+    std::unique_ptr<net::stats_server_t> stats;
+    if (stats_port || !stats_socket.empty())
+    {
+        if (use_uring)
+        {
+            fprintf(stderr, "Stats are not collected by io_uring backend\n");
+        }
+        else
+        {
+            stats = std::make_unique<net::stats_server_t>([&collectors](std::vector<net::stats_group_t>& groups)
+            {
+                for (auto& collect : collectors)
+                {
+                    collect(groups);
+                }
+            });
+            try
+            {
+                if (stats_port)
+                {
+                    stats->start_tcp(stats_port);
+                    fprintf(stdout, "Stats on 127.0.0.1:%d\n", stats_port);
+                }
+                else
+                {
+                    stats->start_unix(stats_socket);
+                    fprintf(stdout, "Stats on %s\n", stats_socket.c_str());
+                }
+            }
+            catch(std::runtime_error& err)
+            {
+                fprintf(stderr, "Hash Server Exception: %s!\n", err.what());
+                return -1;
+            }
+        }
+    }
+
     // Reset system signalling and set it to sighandler function
     system_handler = signal (SIGINT, sighandler);
 
-    // Read number of CPU
-    auto thread_num = std::max(2u, 2*std::thread::hardware_concurrency());
+    // Start servers. Each one in its own thread, the last one in main thread
+    std::atomic_int result = 0;
+    auto run = [&result](const std::function<void()>& runner)
+    {
+        try
+        {
+            runner();
+        }
+        catch(std::runtime_error& err)
+        {
+            fprintf(stderr, "Hash Server Exception: %s!\n", err.what());
+            result = -1;
+
+            // Don't leave other listeners running alone
+            for (auto& kill : server_killers)
+            {
+                kill();
+            }
+        }
+    };
 
-    // Start server
-    try
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i + 1 < runners.size(); ++i)
     {
-        net::hash_server_t server(thread_num);
-        server_ptr = &server;
-        server.run(port);
-        server_ptr = nullptr;
+        threads.emplace_back(run, runners[i]);
     }
-    catch(std::runtime_error& err)
+    run(runners.back());
+
+    for (auto& thr : threads)
     {
-        fprintf(stderr, "Hash Server Exception: %s!\n", err.what());
-        return -1;
+        thr.join();
+    }
+
+#ifdef HASH_SERVER_TRACE_STAGES
+    // Servers are destroyed first, so event loop threads don't write trace while it's dumped
+    if (!trace_file.empty())
+    {
+        stats.reset();
+        collectors.clear();
+        runners.clear();
+        server_killers.clear();
+        if (!net::trace::recorder_t::instance().dump(trace_file))
+        {
+            fprintf(stderr, "Trace file %s cannot be written: %s\n", trace_file.c_str(), strerror(errno));
+        }
     }
-    return 0;
+#endif
+    return result;
 }
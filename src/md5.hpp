@@ -0,0 +1,183 @@
+/**
+ * @file md5.hpp
+ * @author Domnikov Ivan
+ * @brief Native MD5 compression function written once for any lane type.
+ *
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+namespace net
+{
+namespace processors
+{
+namespace md5
+{
+
+/** MD5 block size in bytes*/
+constexpr size_t BLOCK_SIZE = 64;
+
+/** MD5 digest size in bytes*/
+constexpr size_t DIGEST_SIZE = 16;
+
+/** MD5 initial state (RFC 1321)*/
+constexpr uint32_t IV[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+
+/** Per-step additive constants (RFC 1321)*/
+constexpr uint32_t K[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391};
+
+/** Per-step rotation amounts (RFC 1321)*/
+constexpr int S[64] = {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21};
+
+
+/**
+ * @brief Read little-endian 32 bit word from unaligned memory
+ */
+inline uint32_t load_le32(const unsigned char* src)
+{
+    uint32_t val;
+    std::memcpy(&val, src, sizeof(val));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    val = __builtin_bswap32(val);
+#endif
+    return val;
+}
+
+
+/**
+ * @brief Write 32 bit word as little-endian to unaligned memory
+ */
+inline void store_le32(unsigned char* dst, uint32_t val)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    val = __builtin_bswap32(val);
+#endif
+    std::memcpy(dst, &val, sizeof(val));
+}
+
+
+/**
+ * @brief Run 64 MD5 steps over one block and add result to state
+ * @details V is either uint32_t (one message) or GCC vector of uint32_t (one message per lane).
+ * @details Only operators available for both are used, so the same code is compiled to scalar,
+ * @details SSE, AVX2 or AVX-512 instructions depending on V and target of the caller.
+ * @param[in,out] state A, B, C, D words
+ * @param[in] block 16 message words. For vector V word i of each lane is in block[i]
+ */
+template <class V>
+__attribute__((always_inline)) inline void compress(V* state, const V* block)
+{
+    V a = state[0];
+    V b = state[1];
+    V c = state[2];
+    V d = state[3];
+
+#pragma GCC unroll 64
+    for (int i = 0; i < 64; ++i)
+    {
+        V f;
+        int g;
+        if (i < 16)
+        {
+            f = d ^ (b & (c ^ d));
+            g = i;
+        }
+        else if (i < 32)
+        {
+            f = c ^ (d & (b ^ c));
+            g = (5 * i + 1) & 15;
+        }
+        else if (i < 48)
+        {
+            f = b ^ c ^ d;
+            g = (3 * i + 5) & 15;
+        }
+        else
+        {
+            f = c ^ (b | ~d);
+            g = (7 * i) & 15;
+        }
+
+        f += a + K[i] + block[g];
+        a = d;
+        d = c;
+        c = b;
+        b += (f << S[i]) | (f >> (32 - S[i]));
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+}
+
+
+/**
+ * @brief Scalar compression function. Default for md5_t
+ * @details Any other compression function for md5_t must have the same static method.
+ */
+struct scalar_compress_t
+{
+    /**
+     * @brief Hash count consecutive blocks into state
+     * @param[in,out] state A, B, C, D words
+     * @param[in] blocks Pointer to count*BLOCK_SIZE bytes
+     * @param[in] count Number of blocks
+     */
+    static void blocks(uint32_t* state, const unsigned char* blocks, size_t count)
+    {
+        uint32_t words[16];
+        for (; count; --count, blocks += BLOCK_SIZE)
+        {
+            for (int i = 0; i < 16; ++i)
+            {
+                words[i] = load_le32(blocks + 4 * i);
+            }
+            compress(state, words);
+        }
+    }
+};
+
+
+/**
+ * @brief Write number of padding blocks for message tail into dst
+ * @details dst must have space for 2 blocks.
+ * @param[out] dst Padding blocks
+ * @param[in] tail Last incomplete block of message (less than BLOCK_SIZE bytes)
+ * @param[in] tail_len Size of tail
+ * @param[in] total_len Size of whole message in bytes
+ * @return Number of blocks written (1 or 2)
+ */
+inline size_t pad(unsigned char* dst, const unsigned char* tail, size_t tail_len, uint64_t total_len)
+{
+    size_t blocks = tail_len < BLOCK_SIZE - 8 ? 1 : 2;
+    if (tail_len)
+    {
+        std::memcpy(dst, tail, tail_len);
+    }
+    dst[tail_len] = 0x80;
+    std::memset(dst + tail_len + 1, 0, blocks * BLOCK_SIZE - tail_len - 1);
+
+    uint64_t bits = total_len << 3;
+    store_le32(dst + blocks * BLOCK_SIZE - 8, static_cast<uint32_t>(bits));
+    store_le32(dst + blocks * BLOCK_SIZE - 4, static_cast<uint32_t>(bits >> 32));
+    return blocks;
+}
+
+} // namespace md5
+} // namespace processors
+} // namespace net
@@ -0,0 +1,317 @@
+/**
+ * @file md5_mb.hpp
+ * @author Domnikov Ivan
+ * @brief Multi-buffer MD5 engine. Hashes several independent messages in SIMD lanes.
+ *
+ */
+#pragma once
+
+#include "md5.hpp"
+#include "cpu_features.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+namespace net
+{
+namespace processors
+{
+namespace md5
+{
+
+/** Digest of single message*/
+using digest_t = unsigned char[DIGEST_SIZE];
+
+/** Vector of LANES 32 bit words*/
+template <size_t LANES>
+struct lane_vec
+{
+    typedef uint32_t type __attribute__((vector_size(LANES * sizeof(uint32_t))));
+};
+
+
+/**
+ * @brief Hash count messages in LANES lanes in lockstep
+ * @details Each lane takes next message when its previous one is finished, so messages with
+ * @details different lengths do not stall each other. Lanes without messages hash dummy block.
+ * @details Function is always inlined into kernel wrappers which enable required instruction set.
+ * @param[in] msgs Messages to hash
+ * @param[in] count Number of messages
+ * @param[out] digests Result digest for each message
+ */
+template <size_t LANES>
+__attribute__((always_inline)) inline void hash_lanes(const std::string_view* msgs, size_t count, digest_t* digests)
+{
+    using vec_t = typename lane_vec<LANES>::type;
+
+    /** Message currently hashed by lane*/
+    struct lane_t
+    {
+        const unsigned char* data;
+        size_t full_blocks;
+        size_t pad_blocks;
+        size_t pad_pos;
+        size_t msg;
+        unsigned char pad[2 * BLOCK_SIZE];
+    };
+
+    constexpr size_t NO_MSG = SIZE_MAX;
+    static const unsigned char dummy[BLOCK_SIZE] = {};
+
+    lane_t lanes[LANES];
+    vec_t state[4];
+    vec_t block[16];
+    size_t next = 0;
+    size_t active = 0;
+
+    // Put next message into lane and reset lane state to IV
+    auto load = [&](size_t l)
+    {
+        lane_t& lane = lanes[l];
+        if (next == count)
+        {
+            lane.msg = NO_MSG;
+            return false;
+        }
+
+        auto data = reinterpret_cast<const unsigned char*>(msgs[next].data());
+        auto len = msgs[next].size();
+        lane.data = data;
+        lane.full_blocks = len / BLOCK_SIZE;
+        lane.pad_blocks = pad(lane.pad, data + len - len % BLOCK_SIZE, len % BLOCK_SIZE, len);
+        lane.pad_pos = 0;
+        lane.msg = next++;
+        for (int i = 0; i < 4; ++i)
+        {
+            state[i][l] = IV[i];
+        }
+        return true;
+    };
+
+    for (size_t l = 0; l < LANES; ++l)
+    {
+        active += load(l);
+    }
+
+    while (active)
+    {
+        // Take next block of each lane
+        const unsigned char* ptr[LANES];
+        for (size_t l = 0; l < LANES; ++l)
+        {
+            lane_t& lane = lanes[l];
+            if (lane.msg == NO_MSG)
+            {
+                ptr[l] = dummy;
+            }
+            else if (lane.full_blocks)
+            {
+                ptr[l] = lane.data;
+                lane.data += BLOCK_SIZE;
+                --lane.full_blocks;
+            }
+            else
+            {
+                ptr[l] = lane.pad + BLOCK_SIZE * lane.pad_pos++;
+            }
+        }
+
+        // Transpose: word i of every lane goes to block[i]
+        for (size_t i = 0; i < 16; ++i)
+        {
+            for (size_t l = 0; l < LANES; ++l)
+            {
+                block[i][l] = load_le32(ptr[l] + 4 * i);
+            }
+        }
+
+        compress(state, block);
+
+        // Collect finished messages and refill lanes
+        for (size_t l = 0; l < LANES; ++l)
+        {
+            lane_t& lane = lanes[l];
+            if (lane.msg == NO_MSG || lane.full_blocks || lane.pad_pos != lane.pad_blocks)
+            {
+                continue;
+            }
+
+            for (int i = 0; i < 4; ++i)
+            {
+                store_le32(digests[lane.msg] + 4 * i, state[i][l]);
+            }
+
+            if (!load(l))
+            {
+                --active;
+            }
+        }
+    }
+}
+
+
+/**
+ * @brief Generic 4 lane kernel. Uses SSE2 on x86-64 and whatever vector unit compiler has otherwise
+ */
+inline void hash_x4(const std::string_view* msgs, size_t count, digest_t* digests)
+{
+    hash_lanes<4>(msgs, count, digests);
+}
+
+#if defined(__x86_64__)
+/**
+ * @brief 4 lane SSE4.1 kernel
+ */
+__attribute__((target("sse4.1")))
+inline void hash_x4_sse41(const std::string_view* msgs, size_t count, digest_t* digests)
+{
+    hash_lanes<4>(msgs, count, digests);
+}
+
+
+/**
+ * @brief 8 lane AVX2 kernel
+ */
+__attribute__((target("avx2")))
+inline void hash_x8_avx2(const std::string_view* msgs, size_t count, digest_t* digests)
+{
+    hash_lanes<8>(msgs, count, digests);
+}
+
+
+/**
+ * @brief 16 lane AVX-512 kernel
+ */
+__attribute__((target("avx512f")))
+inline void hash_x16_avx512(const std::string_view* msgs, size_t count, digest_t* digests)
+{
+    hash_lanes<16>(msgs, count, digests);
+}
+#endif
+
+
+/**
+ * @brief Multi-buffer engine with kernel selected for current CPU
+ * @details Engine has no state except kernel, so one instance is shared by all event loop threads.
+ * @details Which messages are hashed together is decided by caller (see md5_mb_t).
+ */
+class mb_engine_t
+{
+public:
+    /** Available kernels*/
+    enum class kernel_t
+    {
+        generic_x4,
+        sse41_x4,
+        avx2_x8,
+        avx512_x16
+    };
+
+    /** Kernel function type*/
+    using hash_fn_t = void (*)(const std::string_view*, size_t, digest_t*);
+
+    /**
+     * @brief Create engine with given kernel
+     * @details If kernel is not supported by CPU then generic kernel will be used
+     * @param[in] kernel
+     */
+    explicit mb_engine_t(kernel_t kernel = best_kernel())
+        : m_kernel(is_supported(kernel) ? kernel : kernel_t::generic_x4)
+    {
+        switch (m_kernel)
+        {
+#if defined(__x86_64__)
+            case kernel_t::sse41_x4:   m_hash = &hash_x4_sse41;   break;
+            case kernel_t::avx2_x8:    m_hash = &hash_x8_avx2;    break;
+            case kernel_t::avx512_x16: m_hash = &hash_x16_avx512; break;
+#endif
+            default:                   m_hash = &hash_x4;         break;
+        }
+    }
+
+
+    /**
+     * @brief Get engine for current CPU. Kernel is detected once on first call
+     */
+    static const mb_engine_t& instance()
+    {
+        static const mb_engine_t engine;
+        return engine;
+    }
+
+
+    /**
+     * @brief Check if CPU can run given kernel
+     */
+    static bool is_supported(kernel_t kernel)
+    {
+        switch (kernel)
+        {
+#if defined(__x86_64__)
+            case kernel_t::sse41_x4:   return cpu_features_t::get().sse41;
+            case kernel_t::avx2_x8:    return cpu_features_t::get().avx2;
+            case kernel_t::avx512_x16: return cpu_features_t::get().avx512f;
+#endif
+            case kernel_t::generic_x4: return true;
+            default:                   return false;
+        }
+    }
+
+
+    /**
+     * @brief Widest kernel supported by CPU
+     */
+    static kernel_t best_kernel()
+    {
+        for (auto kernel : {kernel_t::avx512_x16, kernel_t::avx2_x8, kernel_t::sse41_x4})
+        {
+            if (is_supported(kernel))
+            {
+                return kernel;
+            }
+        }
+        return kernel_t::generic_x4;
+    }
+
+
+    /**
+     * @brief Hash messages. Digests are written in the same order as messages
+     * @param[in] msgs Messages to hash
+     * @param[in] count Number of messages
+     * @param[out] digests Must have space for count digests
+     */
+    void hash(const std::string_view* msgs, size_t count, digest_t* digests) const
+    {
+        m_hash(msgs, count, digests);
+    }
+
+
+    /**
+     * @brief Kernel used by engine
+     */
+    kernel_t kernel() const {return m_kernel;}
+
+
+    /**
+     * @brief Kernel name for logging
+     */
+    static const char* name(kernel_t kernel)
+    {
+        switch (kernel)
+        {
+            case kernel_t::sse41_x4:   return "sse4.1 x4";
+            case kernel_t::avx2_x8:    return "avx2 x8";
+            case kernel_t::avx512_x16: return "avx512 x16";
+            default:                   return "generic x4";
+        }
+    }
+
+private:
+    kernel_t m_kernel;
+    hash_fn_t m_hash;
+};
+
+} // namespace md5
+} // namespace processors
+} // namespace net
@@ -0,0 +1,237 @@
+/**
+ * @file placement.hpp
+ * @author Domnikov Ivan
+ * @brief Policies which select event loop thread for new connection.
+ *
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace net
+{
+
+/**
+ * @brief Load of one event loop thread
+ * @details Counters are changed by event loop thread (and by thread which places connection to it)
+ * @details and read by placement policies from any thread. Each thread has its own cache line.
+ */
+struct alignas(64) thread_load_t
+{
+    /** Connections owned by thread*/
+    std::atomic_size_t connections{0};
+
+    /** Bytes of work queued in connections: results not sent, data given to hash workers and
+     *  data of connections which used their read budget (see event_manager_t::in_flight)*/
+    std::atomic_size_t bytes{0};
+
+    /** Nanoseconds thread spent out of epoll_wait. Utilization is its growth per time*/
+    std::atomic<uint64_t> busy_ns{0};
+};
+
+
+/**
+ * @brief Options of connection placement
+ */
+struct placement_options_t
+{
+    /** Policy name. See placement_names*/
+    std::string policy = "round-robin";
+
+    /** Overloaded threads give connections to other threads when they are idle*/
+    bool rebalance = false;
+};
+
+
+/**
+ * @brief Options of elastic thread pool
+ * @details Pool adds thread when average utilization of threads stays above grow_above for
+ * @details grow_periods periods and retires one when it stays below shrink_below for shrink_periods.
+ * @details Distance between thresholds and number of periods keep pool from resizing back and forth.
+ */
+struct elastic_options_t
+{
+    /** Thread limits. Pool is elastic if max_threads is more than min_threads*/
+    size_t min_threads = 0;
+    size_t max_threads = 0;
+
+    /** Part of time threads are out of epoll_wait*/
+    double grow_above = 0.75;
+    double shrink_below = 0.25;
+
+    std::chrono::milliseconds period{1000};
+    unsigned grow_periods = 3;
+    unsigned shrink_periods = 30;
+
+    bool enabled() const
+    {
+        return max_threads > min_threads;
+    }
+};
+
+
+/**
+ * @brief Interface of placement policy
+ * @details select can be called by several threads at once.
+ */
+class placement_t
+{
+public:
+    virtual ~placement_t() = default;
+
+    /**
+     * @brief Select thread for connection
+     * @param[in] loads Loads of all threads
+     * @param[in] count Number of threads. Must be more than 0
+     * @return Thread index
+     */
+    virtual size_t select(const thread_load_t* loads, size_t count) = 0;
+};
+
+
+/**
+ * @brief Threads one by one regardless of their load
+ */
+class round_robin_placement_t final : public placement_t
+{
+public:
+    constexpr static std::string_view NAME = "round-robin";
+
+    size_t select(const thread_load_t*, size_t count) override
+    {
+        return m_counter.fetch_add(1, std::memory_order_relaxed) % count;
+    }
+
+private:
+    std::atomic_size_t m_counter{0};
+};
+
+
+/**
+ * @brief Thread with least connections
+ */
+class least_connections_placement_t final : public placement_t
+{
+public:
+    constexpr static std::string_view NAME = "least-conn";
+
+    size_t select(const thread_load_t* loads, size_t count) override
+    {
+        size_t best = 0;
+        for (size_t i = 1; i < count; ++i)
+        {
+            if (loads[i].connections.load(std::memory_order_relaxed) < loads[best].connections.load(std::memory_order_relaxed))
+            {
+                best = i;
+            }
+        }
+        return best;
+    }
+};
+
+
+/**
+ * @brief Thread with least bytes in flight. Connections decide between equal threads
+ */
+class least_bytes_placement_t final : public placement_t
+{
+public:
+    constexpr static std::string_view NAME = "least-bytes";
+
+    size_t select(const thread_load_t* loads, size_t count) override
+    {
+        size_t best = 0;
+        auto best_bytes = loads[0].bytes.load(std::memory_order_relaxed);
+        for (size_t i = 1; i < count; ++i)
+        {
+            auto bytes = loads[i].bytes.load(std::memory_order_relaxed);
+            if (bytes < best_bytes || (bytes == best_bytes &&
+                loads[i].connections.load(std::memory_order_relaxed) < loads[best].connections.load(std::memory_order_relaxed)))
+            {
+                best = i;
+                best_bytes = bytes;
+            }
+        }
+        return best;
+    }
+};
+
+
+/**
+ * @brief Less loaded of two random threads (power of two choices)
+ * @details Load is bytes in flight plus CONNECTION_WEIGHT per connection, so thread with many
+ * @details idle connections is not always chosen before busy one with few connections.
+ */
+class two_choices_placement_t final : public placement_t
+{
+public:
+    constexpr static std::string_view NAME = "p2c";
+
+    /** Weight of one connection in bytes*/
+    constexpr static size_t CONNECTION_WEIGHT = 4096;
+
+    size_t select(const thread_load_t* loads, size_t count) override
+    {
+        if (count < 2)
+        {
+            return 0;
+        }
+
+        // xorshift. Each calling thread has its own state
+        thread_local uint64_t state = 0x9E3779B97F4A7C15ull ^ reinterpret_cast<uintptr_t>(&state);
+        auto next = [&]
+        {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            return state;
+        };
+
+        size_t first = next() % count;
+        size_t second = next() % (count - 1);
+        if (second >= first)
+        {
+            ++second;
+        }
+        return load(loads[second]) < load(loads[first]) ? second : first;
+    }
+
+private:
+    static size_t load(const thread_load_t& load)
+    {
+        return load.bytes.load(std::memory_order_relaxed) +
+               load.connections.load(std::memory_order_relaxed) * CONNECTION_WEIGHT;
+    }
+};
+
+
+/**
+ * @brief Create placement policy by name
+ * @return nullptr if name is unknown
+ */
+inline std::unique_ptr<placement_t> make_placement(std::string_view name)
+{
+    if (name == round_robin_placement_t::NAME)       return std::make_unique<round_robin_placement_t>();
+    if (name == least_connections_placement_t::NAME) return std::make_unique<least_connections_placement_t>();
+    if (name == least_bytes_placement_t::NAME)       return std::make_unique<least_bytes_placement_t>();
+    if (name == two_choices_placement_t::NAME)       return std::make_unique<two_choices_placement_t>();
+    return nullptr;
+}
+
+
+/**
+ * @brief Names of placement policies separated by comma
+ */
+inline std::string placement_names()
+{
+    return std::string(round_robin_placement_t::NAME) + ", " + std::string(least_connections_placement_t::NAME) + ", " +
+           std::string(least_bytes_placement_t::NAME) + ", " + std::string(two_choices_placement_t::NAME);
+}
+
+} // namespace net
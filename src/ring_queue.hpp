@@ -0,0 +1,206 @@
+/**
+ * @file ring_queue.hpp
+ * @author Domnikov Ivan
+ * @brief Bounded lock-free queues for passing work between threads.
+ *
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+namespace net
+{
+
+/** Cache line size. Indices of producer and consumer are kept on different lines*/
+constexpr size_t QUEUE_CACHE_LINE = 64;
+
+
+/**
+ * @brief Round up to power of 2
+ */
+inline size_t queue_capacity(size_t size)
+{
+    size_t capacity = 2;
+    while (capacity < size)
+    {
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+
+/**
+ * @brief Single producer single consumer ring
+ * @details Each side keeps copy of other side index and reads the shared one only when the copy
+ * @details says that ring is full (producer) or empty (consumer).
+ */
+template <class T>
+class spsc_ring_t
+{
+public:
+    /**
+     * @param[in] size Minimum capacity. Rounded up to power of 2
+     */
+    explicit spsc_ring_t(size_t size)
+        :m_mask(queue_capacity(size) - 1), m_cells(new T[m_mask + 1]) {}
+
+    // rule of five - delete all copy/move methods
+    spsc_ring_t(const spsc_ring_t& ) = delete;
+    spsc_ring_t(      spsc_ring_t&&) = delete;
+    spsc_ring_t& operator=(const spsc_ring_t& ) = delete;
+    spsc_ring_t& operator=(      spsc_ring_t&&) = delete;
+
+
+    /**
+     * @brief Called by producer only
+     * @return false if ring is full
+     */
+    bool push(const T& value)
+    {
+        auto tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head_cache > m_mask)
+        {
+            m_head_cache = m_head.load(std::memory_order_acquire);
+            if (tail - m_head_cache > m_mask)
+            {
+                return false;
+            }
+        }
+        m_cells[tail & m_mask] = value;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+
+    /**
+     * @brief Called by consumer only
+     * @return false if ring is empty
+     */
+    bool pop(T& value)
+    {
+        auto head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail_cache)
+        {
+            m_tail_cache = m_tail.load(std::memory_order_acquire);
+            if (head == m_tail_cache)
+            {
+                return false;
+            }
+        }
+        value = m_cells[head & m_mask];
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    const size_t m_mask;
+    std::unique_ptr<T[]> m_cells;
+
+    /** Consumer side*/
+    alignas(QUEUE_CACHE_LINE) std::atomic<size_t> m_head{0};
+    size_t m_tail_cache = 0;
+
+    /** Producer side*/
+    alignas(QUEUE_CACHE_LINE) std::atomic<size_t> m_tail{0};
+    size_t m_head_cache = 0;
+};
+
+
+/**
+ * @brief Multiple producers single consumer ring
+ * @details Each cell has sequence number which tells if it's free for producer with given position
+ * @details or filled for consumer. Producers take positions by compare exchange on tail.
+ */
+template <class T>
+class mpsc_ring_t
+{
+public:
+    /**
+     * @param[in] size Minimum capacity. Rounded up to power of 2
+     */
+    explicit mpsc_ring_t(size_t size)
+        :m_mask(queue_capacity(size) - 1), m_cells(new cell_t[m_mask + 1])
+    {
+        for (size_t i = 0; i <= m_mask; ++i)
+        {
+            m_cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // rule of five - delete all copy/move methods
+    mpsc_ring_t(const mpsc_ring_t& ) = delete;
+    mpsc_ring_t(      mpsc_ring_t&&) = delete;
+    mpsc_ring_t& operator=(const mpsc_ring_t& ) = delete;
+    mpsc_ring_t& operator=(      mpsc_ring_t&&) = delete;
+
+
+    /**
+     * @brief Can be called by any thread
+     * @return false if ring is full
+     */
+    bool push(const T& value)
+    {
+        auto pos = m_tail.load(std::memory_order_relaxed);
+        while (true)
+        {
+            auto& cell = m_cells[pos & m_mask];
+            auto seq = cell.seq.load(std::memory_order_acquire);
+            auto diff = static_cast<std::ptrdiff_t>(seq - pos);
+            if (0 == diff)
+            {
+                if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    cell.value = value;
+                    cell.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+
+    /**
+     * @brief Called by consumer only
+     * @return false if ring is empty or next value is not written yet
+     */
+    bool pop(T& value)
+    {
+        auto& cell = m_cells[m_head & m_mask];
+        if (cell.seq.load(std::memory_order_acquire) != m_head + 1)
+        {
+            return false;
+        }
+        value = cell.value;
+        cell.seq.store(m_head + m_mask + 1, std::memory_order_release);
+        ++m_head;
+        return true;
+    }
+
+private:
+    struct cell_t
+    {
+        std::atomic<size_t> seq;
+        T value;
+    };
+
+    const size_t m_mask;
+    std::unique_ptr<cell_t[]> m_cells;
+
+    /** Consumer side*/
+    alignas(QUEUE_CACHE_LINE) size_t m_head = 0;
+
+    /** Producers side*/
+    alignas(QUEUE_CACHE_LINE) std::atomic<size_t> m_tail{0};
+};
+
+} // namespace net
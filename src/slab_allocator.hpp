@@ -0,0 +1,334 @@
+/**
+ * @file slab_allocator.hpp
+ * @author Domnikov Ivan
+ * @brief Per-thread slab allocator for fixed size objects (connections).
+ *
+ */
+#pragma once
+
+#include "cpu_layout.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace net
+{
+
+/**
+ * @brief Slab allocator for objects of size SIZE
+ * @details Each thread which allocates gets its own slab. Slab takes memory by CHUNK_SIZE chunks
+ * @details aligned to chunk size, so owner slab of any slot is found from slot address.
+ * @details Slots are cache line aligned. Freed slot goes back to owner slab: to its local free
+ * @details list if it's freed by owner thread, otherwise to lock-free remote list which owner
+ * @details takes all at once when local list is empty.
+ * @details Slab of thread which exits is orphaned and adopted by the next thread without slab, with
+ * @details its free slots, chunks and remote list, so threads which come and go don't leak chunks.
+ * @details All memory is released by destructor. Objects must be destroyed before it.
+ * @details Allocator of NUMA node prefers memory of that node for its chunks, whatever thread allocates.
+ */
+template <size_t SIZE>
+class slab_allocator_t
+{
+public:
+    /** Cache line size*/
+    constexpr static size_t CACHE_LINE = 64;
+
+    /** Slot size. Object size rounded up to cache line*/
+    constexpr static size_t SLOT_SIZE = (SIZE + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+
+    /** Memory taken from system at once. Chunk is aligned to its size*/
+    constexpr static size_t CHUNK_SIZE = 64 * 1024;
+
+    static_assert(SLOT_SIZE + CACHE_LINE <= CHUNK_SIZE, "Object is too big for slab");
+
+    /**
+     * @brief Counters of all slabs
+     */
+    struct stats_t
+    {
+        /** Slots given by allocate*/
+        size_t allocations = 0;
+
+        /** Allocations served by previously freed slot*/
+        size_t reuses = 0;
+
+        /** Slots freed by not owner thread*/
+        size_t remote_frees = 0;
+
+        /** Chunks taken from system*/
+        size_t chunks = 0;
+
+        /** Slots allocated and not freed*/
+        size_t in_use = 0;
+    };
+
+    /**
+     * @param[in] node NUMA node of chunks. -1 - memory of allocating thread node
+     */
+    explicit slab_allocator_t(int node = -1) : m_id(next_id()), m_node(node) {}
+
+    ~slab_allocator_t()
+    {
+        for (auto& slab : m_slabs)
+        {
+            for (auto chunk : slab->chunks)
+            {
+                std::free(chunk);
+            }
+        }
+    }
+
+    // rule of five - delete all copy/move methods
+    slab_allocator_t(const slab_allocator_t& ) = delete;
+    slab_allocator_t(      slab_allocator_t&&) = delete;
+    slab_allocator_t& operator=(const slab_allocator_t& ) = delete;
+    slab_allocator_t& operator=(      slab_allocator_t&&) = delete;
+
+
+    /**
+     * @brief Get slot from slab of current thread
+     * @return Pointer to SLOT_SIZE bytes aligned to cache line
+     * @throws std::bad_alloc if system has no memory
+     */
+    void* allocate()
+    {
+        auto& slab = thread_slab();
+
+        if (!slab.local_free)
+        {
+            // Take everything freed by other threads
+            slab.local_free = slab.remote_free.exchange(nullptr, std::memory_order_acquire);
+        }
+
+        slot_t* slot = slab.local_free;
+        if (slot)
+        {
+            slab.local_free = slot->next;
+            slab.reuses.fetch_add(1, std::memory_order_relaxed);
+        }
+        else
+        {
+            slot = slab.bump();
+        }
+
+        slab.allocations.fetch_add(1, std::memory_order_relaxed);
+        return slot;
+    }
+
+
+    /**
+     * @brief Return slot to its owner slab. Can be called from any thread
+     * @param[in] ptr Pointer given by allocate of any slab_allocator_t<SIZE>
+     */
+    static void deallocate(void* ptr)
+    {
+        auto slot = static_cast<slot_t*>(ptr);
+        auto slab = owner(ptr);
+
+        if (slab->thread.load(std::memory_order_acquire) == &thread_slabs)
+        {
+            slot->next = slab->local_free;
+            slab->local_free = slot;
+        }
+        else
+        {
+            slot->next = slab->remote_free.load(std::memory_order_relaxed);
+            while (!slab->remote_free.compare_exchange_weak(slot->next, slot, std::memory_order_release,
+                                                                              std::memory_order_relaxed)){}
+            slab->remote_frees.fetch_add(1, std::memory_order_relaxed);
+        }
+        slab->frees.fetch_add(1, std::memory_order_relaxed);
+    }
+
+
+    /**
+     * @brief Sum of counters of all slabs
+     */
+    stats_t stats() const
+    {
+        stats_t result;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& slab : m_slabs)
+        {
+            result.allocations  += slab->allocations.load(std::memory_order_relaxed);
+            result.reuses       += slab->reuses.load(std::memory_order_relaxed);
+            result.remote_frees += slab->remote_frees.load(std::memory_order_relaxed);
+            result.chunks       += slab->chunk_count.load(std::memory_order_relaxed);
+            result.in_use       += slab->allocations.load(std::memory_order_relaxed) -
+                                   slab->frees.load(std::memory_order_relaxed);
+        }
+        return result;
+    }
+
+private:
+    /** Free slot*/
+    struct slot_t
+    {
+        slot_t* next;
+    };
+
+    /** Slab of one thread. Only owner thread touches local_free and bump pointers*/
+    struct alignas(CACHE_LINE) slab_t
+    {
+        /** Identifies owner thread (see thread_slabs). nullptr - orphaned slab*/
+        std::atomic<const void*> thread{nullptr};
+
+        /** NUMA node of chunks. -1 - not bound*/
+        int node = -1;
+
+        slot_t* local_free = nullptr;
+        char* bump_pos = nullptr;
+        char* bump_end = nullptr;
+        std::vector<void*> chunks;
+
+        std::atomic<size_t> allocations{0};
+        std::atomic<size_t> reuses{0};
+        std::atomic<size_t> chunk_count{0};
+
+        /** Written by other threads. Kept on its own cache line*/
+        alignas(CACHE_LINE) std::atomic<slot_t*> remote_free{nullptr};
+        std::atomic<size_t> remote_frees{0};
+        std::atomic<size_t> frees{0};
+
+        /**
+         * @brief Take never used slot. New chunk is taken when current one is full
+         */
+        slot_t* bump()
+        {
+            if (bump_pos == bump_end)
+            {
+                auto chunk = static_cast<char*>(std::aligned_alloc(CHUNK_SIZE, CHUNK_SIZE));
+                if (!chunk)
+                {
+                    throw std::bad_alloc();
+                }
+                if (node >= 0)
+                {
+                    cpu_layout_t::bind_memory(chunk, CHUNK_SIZE, node);
+                }
+                chunks.push_back(chunk);
+                chunk_count.fetch_add(1, std::memory_order_relaxed);
+
+                // First cache line of chunk keeps owner slab
+                *reinterpret_cast<slab_t**>(chunk) = this;
+                bump_pos = chunk + CACHE_LINE;
+                bump_end = bump_pos + (CHUNK_SIZE - CACHE_LINE) / SLOT_SIZE * SLOT_SIZE;
+            }
+
+            auto slot = reinterpret_cast<slot_t*>(bump_pos);
+            bump_pos += SLOT_SIZE;
+            return slot;
+        }
+    };
+
+
+    /**
+     * @brief Owner slab of slot
+     */
+    static slab_t* owner(void* ptr)
+    {
+        auto chunk = reinterpret_cast<uintptr_t>(ptr) & ~(CHUNK_SIZE - 1);
+        return *reinterpret_cast<slab_t**>(chunk);
+    }
+
+
+    /**
+     * @brief Slab of current thread. Taken with first allocation of thread
+     * @details Orphaned slab is adopted if allocator has one, otherwise new slab is created.
+     * @details Thread keeps slabs of all allocators it used. Allocators are told apart by
+     * @details unique id, so slab of destroyed allocator is never found again.
+     */
+    slab_t& thread_slab()
+    {
+        auto& slabs = thread_slabs;
+        for (auto& owned : slabs.owned)
+        {
+            if (owned.id == m_id)
+            {
+                return *owned.slab;
+            }
+        }
+
+        std::shared_ptr<slab_t> slab;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (auto& orphan : m_slabs)
+            {
+                // Acquire: free lists and bump pointers of exited owner are seen
+                if (!orphan->thread.load(std::memory_order_acquire))
+                {
+                    slab = orphan;
+                    break;
+                }
+            }
+            if (!slab)
+            {
+                slab = std::make_shared<slab_t>();
+                slab->node = m_node;
+                m_slabs.push_back(slab);
+            }
+            slab->thread.store(&slabs, std::memory_order_relaxed);
+        }
+        slabs.owned.push_back({m_id, slab.get(), slab});
+        return *slab;
+    }
+
+
+    /**
+     * @brief Unique id for each allocator
+     */
+    static uint64_t next_id()
+    {
+        static std::atomic<uint64_t> counter{0};
+        return ++counter;
+    }
+
+    /**
+     * @brief Slabs owned by thread
+     * @details Exiting thread orphans its slabs of allocators which still exist. Slots freed after
+     * @details that, even by the same thread, go to remote list of slab.
+     */
+    struct thread_slabs_t
+    {
+        struct owned_t
+        {
+            uint64_t id;
+            slab_t* slab;
+            std::weak_ptr<slab_t> alive;
+        };
+        std::vector<owned_t> owned;
+
+        ~thread_slabs_t()
+        {
+            for (auto& slab : owned)
+            {
+                if (auto alive = slab.alive.lock())
+                {
+                    // Release: adopter sees everything this thread did with slab
+                    alive->thread.store(nullptr, std::memory_order_release);
+                }
+            }
+        }
+    };
+
+    /** Address of this variable is different in each living thread and identifies slab owner*/
+    static inline thread_local thread_slabs_t thread_slabs;
+
+    /** Id of this allocator*/
+    const uint64_t m_id;
+
+    /** NUMA node of chunks*/
+    const int m_node;
+
+    /** All slabs. Guarded by m_mutex. Threads keep weak pointers to orphan their slabs at exit*/
+    std::vector<std::shared_ptr<slab_t>> m_slabs;
+    mutable std::mutex m_mutex;
+};
+
+} // namespace net
@@ -0,0 +1,370 @@
+/**
+ * @file stats.hpp
+ * @author Domnikov Ivan
+ * @brief Counters and latency histograms of event loop threads and their Prometheus text format.
+ *
+ */
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace net
+{
+
+/**
+ * @brief Counters of event loop thread
+ */
+enum counter_t : size_t
+{
+    connections_opened,
+    connections_closed,
+    bytes_received,
+    bytes_sent,
+    lines_hashed,
+    read_calls,
+    send_calls,
+    epoll_waits,
+    eagains,
+    cache_hits,
+    cache_misses,
+    cache_evictions,
+    cache_saved_ns,
+    counter_count
+};
+
+
+/**
+ * @brief Prometheus names and descriptions of counters in order of counter_t
+ */
+inline constexpr std::array<std::pair<const char*, const char*>, counter_count> counter_names =
+{{
+    {"hash_server_connections_opened_total", "Connections given to event loop thread"},
+    {"hash_server_connections_closed_total", "Connections closed by event loop thread"},
+    {"hash_server_received_bytes_total",     "Bytes read from clients"},
+    {"hash_server_sent_bytes_total",         "Bytes of results sent to clients"},
+    {"hash_server_lines_hashed_total",       "Lines hashed and sent"},
+    {"hash_server_read_calls_total",         "read system calls"},
+    {"hash_server_send_calls_total",         "send system calls"},
+    {"hash_server_epoll_waits_total",        "epoll_wait system calls"},
+    {"hash_server_eagains_total",            "read and send calls which returned EAGAIN"},
+    {"hash_server_cache_hits_total",         "Lines whose results were taken from digest cache"},
+    {"hash_server_cache_misses_total",       "Lines short enough for digest cache which were hashed"},
+    {"hash_server_cache_evictions_total",    "Results replaced in digest cache"},
+    {"hash_server_cache_saved_nanoseconds_total", "Estimated hashing time saved by digest cache"}
+}};
+
+
+/**
+ * @brief Counters of one connection since they were taken last time
+ * @details Connection counts without atomics. Event loop adds them to counters of its thread
+ * @details after connection is processed (see thread_stats_t::add).
+ */
+struct io_counters_t
+{
+    uint64_t bytes_received = 0;
+    uint64_t bytes_sent = 0;
+    uint64_t lines = 0;
+    uint64_t reads = 0;
+    uint64_t sends = 0;
+    uint64_t eagains = 0;
+};
+
+
+struct histogram_snapshot_t;
+
+
+/**
+ * @brief Histogram of nanoseconds with constant relative error (HDR-style)
+ * @details Each power of two is split into SUB_BUCKETS linear buckets, so value is known with
+ * @details 1/SUB_BUCKETS precision from 1 ns to hundreds of years. Buckets are written by one
+ * @details thread without locked instructions and read by any thread.
+ */
+class latency_histogram_t
+{
+public:
+    constexpr static unsigned SUB_BITS = 4;
+    constexpr static size_t SUB_BUCKETS = size_t(1) << SUB_BITS;
+    constexpr static size_t BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+    /**
+     * @brief Add count values. Called by owner thread only
+     */
+    void record(uint64_t value, uint64_t count = 1)
+    {
+        add(m_buckets[index_of(value)], count);
+        add(m_count, count);
+        add(m_sum, value * count);
+    }
+
+
+    void record(std::chrono::steady_clock::duration duration, uint64_t count = 1)
+    {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+        record(ns > 0 ? static_cast<uint64_t>(ns) : 0, count);
+    }
+
+
+    /**
+     * @brief Bucket of value
+     */
+    static size_t index_of(uint64_t value)
+    {
+        if (value < SUB_BUCKETS)
+        {
+            return value;
+        }
+        unsigned shift = 63 - __builtin_clzll(value) - SUB_BITS;
+        return (shift + 1) * SUB_BUCKETS + ((value >> shift) & (SUB_BUCKETS - 1));
+    }
+
+
+    /**
+     * @brief The least value of bucket
+     */
+    static uint64_t lower_bound(size_t index)
+    {
+        if (index < SUB_BUCKETS)
+        {
+            return index;
+        }
+        unsigned shift = index / SUB_BUCKETS - 1;
+        return (SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+    }
+
+    /**
+     * @brief Add buckets to snapshot. Called by any thread
+     */
+    void add_to(histogram_snapshot_t& snapshot) const;
+
+private:
+    /** Increment of counter which has one writer*/
+    static void add(std::atomic<uint64_t>& counter, uint64_t value)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    std::array<std::atomic<uint64_t>, BUCKETS> m_buckets{};
+    std::atomic<uint64_t> m_count{0};
+    std::atomic<uint64_t> m_sum{0};
+};
+
+
+/**
+ * @brief Copy of latency_histogram_t, e.g. sum of histograms of all threads
+ */
+struct histogram_snapshot_t
+{
+    std::array<uint64_t, latency_histogram_t::BUCKETS> buckets{};
+    uint64_t count = 0;
+    uint64_t sum = 0;
+
+    /**
+     * @brief Value which q part of values doesn't exceed. Upper bound of its bucket
+     * @param[in] q Quantile from 0 to 1
+     */
+    uint64_t quantile(double q) const
+    {
+        if (!count)
+        {
+            return 0;
+        }
+        auto rank = static_cast<uint64_t>(q * count);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < buckets.size(); ++i)
+        {
+            seen += buckets[i];
+            if (seen > rank || seen == count)
+            {
+                return i + 1 < buckets.size() ? latency_histogram_t::lower_bound(i + 1) - 1 : UINT64_MAX;
+            }
+        }
+        return UINT64_MAX;
+    }
+};
+
+
+inline void latency_histogram_t::add_to(histogram_snapshot_t& snapshot) const
+{
+    for (size_t i = 0; i < BUCKETS; ++i)
+    {
+        snapshot.buckets[i] += m_buckets[i].load(std::memory_order_relaxed);
+    }
+    snapshot.count += m_count.load(std::memory_order_relaxed);
+    snapshot.sum   += m_sum.load(std::memory_order_relaxed);
+}
+
+
+/**
+ * @brief Counters and histograms of one event loop thread
+ * @details Written by owner thread with relaxed stores (connections_opened also by threads which
+ * @details place connections) and read by stats endpoint at any time.
+ */
+struct alignas(64) thread_stats_t
+{
+    std::array<std::atomic<uint64_t>, counter_count> counters{};
+
+    /** From read of data to send of results of its lines. One value per line*/
+    latency_histogram_t line_latency;
+
+    /** Time of event loop iteration out of epoll_wait*/
+    latency_histogram_t loop_time;
+
+    /**
+     * @brief Increment counter of owner thread
+     */
+    void add(counter_t counter, uint64_t value)
+    {
+        counters[counter].store(counters[counter].load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+
+    /**
+     * @brief Add counters of connection and reset them
+     */
+    void add(io_counters_t& io)
+    {
+        add(bytes_received, io.bytes_received);
+        add(bytes_sent,     io.bytes_sent);
+        add(lines_hashed,   io.lines);
+        add(read_calls,     io.reads);
+        add(send_calls,     io.sends);
+        add(eagains,        io.eagains);
+        io = {};
+    }
+};
+
+
+/**
+ * @brief Value of pool which is not kept by threads, e.g. open connections
+ */
+struct pool_metric_t
+{
+    const char* name;
+    const char* help;
+    const char* type;
+    uint64_t value;
+};
+
+
+/**
+ * @brief Stats of one pool
+ */
+struct stats_group_t
+{
+    /** Labels of all samples of pool, e.g. port="8080"*/
+    std::string labels;
+    std::vector<const thread_stats_t*> threads;
+    std::vector<pool_metric_t> metrics;
+};
+
+
+/**
+ * @brief Append stats in Prometheus text format
+ * @details Counters are given per thread, histograms are summed over threads of pool and given
+ * @details as summaries in seconds.
+ */
+inline void write_prometheus(const std::vector<stats_group_t>& groups, std::string& out)
+{
+    char line[256];
+    auto header = [&](const char* name, const char* help, const char* type)
+    {
+        snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+        out += line;
+    };
+    auto sample = [&](const char* name, const std::string& labels, const char* extra, const char* value)
+    {
+        auto all = labels.empty() || !*extra ? labels + extra : labels + "," + extra;
+        if (all.empty())
+        {
+            snprintf(line, sizeof(line), "%s %s\n", name, value);
+        }
+        else
+        {
+            snprintf(line, sizeof(line), "%s{%s} %s\n", name, all.c_str(), value);
+        }
+        out += line;
+    };
+    auto number = [](uint64_t value)
+    {
+        return std::to_string(value);
+    };
+    auto seconds = [](uint64_t ns)
+    {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.9f", ns / 1e9);
+        return std::string(buf);
+    };
+
+    for (size_t i = 0; i < counter_count; ++i)
+    {
+        header(counter_names[i].first, counter_names[i].second, "counter");
+        for (auto& group : groups)
+        {
+            for (size_t id = 0; id < group.threads.size(); ++id)
+            {
+                auto thread = "thread=\"" + std::to_string(id) + "\"";
+                sample(counter_names[i].first, group.labels, thread.c_str(),
+                       number(group.threads[id]->counters[i].load(std::memory_order_relaxed)).c_str());
+            }
+        }
+    }
+
+    if (!groups.empty())
+    {
+        for (size_t i = 0; i < groups.front().metrics.size(); ++i)
+        {
+            auto& metric = groups.front().metrics[i];
+            header(metric.name, metric.help, metric.type);
+            for (auto& group : groups)
+            {
+                if (i < group.metrics.size())
+                {
+                    sample(metric.name, group.labels, "", number(group.metrics[i].value).c_str());
+                }
+            }
+        }
+    }
+
+    const std::pair<const char*, latency_histogram_t thread_stats_t::*> histograms[] =
+    {
+        {"hash_server_line_latency_seconds", &thread_stats_t::line_latency},
+        {"hash_server_loop_iteration_seconds", &thread_stats_t::loop_time}
+    };
+    const char* help[] =
+    {
+        "Time from read of data to send of results of its lines",
+        "Time of event loop iteration out of epoll_wait"
+    };
+    for (size_t h = 0; h < std::size(histograms); ++h)
+    {
+        auto name = histograms[h].first;
+        header(name, help[h], "summary");
+        for (auto& group : groups)
+        {
+            histogram_snapshot_t snapshot;
+            for (auto thread : group.threads)
+            {
+                (thread->*histograms[h].second).add_to(snapshot);
+            }
+            for (auto q : {"0.5", "0.9", "0.99", "0.999"})
+            {
+                auto quantile = std::string("quantile=\"") + q + "\"";
+                sample(name, group.labels, quantile.c_str(), seconds(snapshot.quantile(std::atof(q))).c_str());
+            }
+            sample((std::string(name) + "_sum").c_str(), group.labels, "", seconds(snapshot.sum).c_str());
+            sample((std::string(name) + "_count").c_str(), group.labels, "", number(snapshot.count).c_str());
+        }
+    }
+}
+
+} // namespace net
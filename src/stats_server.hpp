@@ -0,0 +1,244 @@
+/**
+ * @file stats_server.hpp
+ * @author Domnikov Ivan
+ * @brief Admin endpoint which gives stats of servers in Prometheus text format.
+ *
+ */
+#pragma once
+
+#include "fd_holder.hpp"
+#include "stats.hpp"
+
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace net
+{
+
+/**
+ * @brief HTTP endpoint on loopback port or Unix socket for Prometheus scraper
+ * @details Each request gets stats collected at that moment, whatever its path is. Requests are
+ * @details served one by one by own thread, so event loop threads never serve them.
+ */
+class stats_server_t
+{
+public:
+    /** Function which adds stats group of each pool*/
+    using collect_t = std::function<void(std::vector<stats_group_t>&)>;
+
+    explicit stats_server_t(collect_t collect)
+        :m_collect(std::move(collect)), m_stop_fd(eventfd(0, EFD_CLOEXEC))
+    {
+        if (m_stop_fd == nullptr)
+        {
+            throw std::runtime_error(std::string("Stats eventfd error[") + strerror(errno) + "]");
+        }
+    }
+
+    ~stats_server_t()
+    {
+        stop();
+    }
+
+    // rule of five - delete all copy/move methods. Thread uses this object
+    stats_server_t(const stats_server_t& ) = delete;
+    stats_server_t(      stats_server_t&&) = delete;
+    stats_server_t& operator=(const stats_server_t& ) = delete;
+    stats_server_t& operator=(      stats_server_t&&) = delete;
+
+
+    /**
+     * @brief Listen port of 127.0.0.1 and start serving
+     * @details Function will throw an exception if socket can't be created
+     */
+    void start_tcp(uint16_t port)
+    {
+        m_listen_fd.reset(socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0));
+        if (m_listen_fd == nullptr)
+        {
+            throw std::runtime_error("Stats socket cannot be created!");
+        }
+
+        int enable = 1;
+        setsockopt(m_listen_fd.get(), SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        start(reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    }
+
+
+    /**
+     * @brief Listen Unix socket and start serving. File of socket is replaced
+     * @details Function will throw an exception if socket can't be created
+     */
+    void start_unix(const std::string& path)
+    {
+        sockaddr_un addr{};
+        if (path.size() >= sizeof(addr.sun_path))
+        {
+            throw std::runtime_error("Stats socket path is too long!");
+        }
+
+        m_listen_fd.reset(socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+        if (m_listen_fd == nullptr)
+        {
+            throw std::runtime_error("Stats socket cannot be created!");
+        }
+
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, path.c_str(), path.size());
+        unlink(path.c_str());
+        m_path = path;
+        start(reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    }
+
+
+    /**
+     * @brief Stop serving thread. Can be called from other thread than start
+     */
+    void stop()
+    {
+        uint64_t one = 1;
+        if (m_thread.joinable())
+        {
+            if (-1 == write(m_stop_fd.get(), &one, sizeof(one)))
+            {
+                fprintf(stderr, "Stats stop notification failure!: %s\n", strerror(errno));
+            }
+            m_thread.join();
+        }
+        if (!m_path.empty())
+        {
+            unlink(m_path.c_str());
+            m_path.clear();
+        }
+    }
+
+
+    /**
+     * @brief Stats of all groups in Prometheus text format
+     */
+    std::string report() const
+    {
+        std::vector<stats_group_t> groups;
+        m_collect(groups);
+        std::string body;
+        write_prometheus(groups, body);
+        return body;
+    }
+
+private:
+    void start(const sockaddr* addr, socklen_t len)
+    {
+        if (-1 == bind(m_listen_fd.get(), addr, len))
+        {
+            throw std::runtime_error(std::string("Stats socket binding error[") + strerror(errno) + "]");
+        }
+        if (-1 == listen(m_listen_fd.get(), 16))
+        {
+            throw std::runtime_error(std::string("Stats socket start listen error[") + strerror(errno) + "]");
+        }
+        m_thread = std::thread([this]{run();});
+    }
+
+
+    /**
+     * @brief Accept and serve requests until stop
+     */
+    void run()
+    {
+        pollfd fds[2] = {{m_listen_fd.get(), POLLIN, 0}, {m_stop_fd.get(), POLLIN, 0}};
+        while (true)
+        {
+            if (-1 == poll(fds, 2, -1))
+            {
+                if (EINTR == errno)
+                {
+                    continue;
+                }
+                perror("[E] stats poll failed\n");
+                return;
+            }
+            if (fds[1].revents)
+            {
+                return;
+            }
+
+            int fd = accept4(m_listen_fd.get(), NULL, NULL, SOCK_CLOEXEC);
+            if (-1 != fd)
+            {
+                std::unique_ptr<fd_holder_t, fd_deleter_t> client(fd);
+                serve(fd);
+            }
+        }
+    }
+
+
+    /**
+     * @brief Read request head and send report
+     * @details Client which doesn't send request in a second gets nothing.
+     */
+    void serve(int fd)
+    {
+        timeval timeout{1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        std::string request;
+        char buf[1024];
+        while (request.find("\r\n\r\n") == std::string::npos && request.find("\n\n") == std::string::npos &&
+               request.size() < 8192)
+        {
+            auto count = read(fd, buf, sizeof(buf));
+            if (count <= 0)
+            {
+                return;
+            }
+            request.append(buf, count);
+        }
+
+        auto body = report();
+        auto response = "HTTP/1.0 200 OK\r\n"
+                        "Content-Type: text/plain; version=0.0.4\r\n"
+                        "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                        "Connection: close\r\n\r\n" + body;
+        for (size_t sent = 0; sent < response.size();)
+        {
+            auto count = send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+            if (count <= 0)
+            {
+                return;
+            }
+            sent += count;
+        }
+    }
+
+
+    collect_t m_collect;
+    std::unique_ptr<fd_holder_t, fd_deleter_t> m_listen_fd;
+    std::unique_ptr<fd_holder_t, fd_deleter_t> m_stop_fd;
+
+    /** File of Unix socket. Removed when server stops*/
+    std::string m_path;
+    std::thread m_thread;
+};
+
+} // namespace net
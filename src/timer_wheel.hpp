@@ -0,0 +1,334 @@
+/**
+ * @file timer_wheel.hpp
+ * @author Domnikov Ivan
+ * @brief Hierarchical timer wheel for connection deadlines of event loop thread.
+ *
+ */
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace net
+{
+
+/**
+ * @brief Kind of connection deadline
+ * @details idle  - connection waits for next request
+ * @details read  - client sent part of line and waits with the rest
+ * @details write - client doesn't read results
+ */
+enum class timeout_kind_t : uint8_t
+{
+    none,
+    idle,
+    read,
+    write
+};
+
+
+/**
+ * @brief Connection timeouts. Zero timeout is disabled
+ */
+struct timeout_options_t
+{
+    std::chrono::milliseconds idle{0};
+    std::chrono::milliseconds read{0};
+    std::chrono::milliseconds write{0};
+
+    bool enabled() const
+    {
+        return idle.count() || read.count() || write.count();
+    }
+
+    std::chrono::milliseconds of(timeout_kind_t kind) const
+    {
+        switch (kind)
+        {
+            case timeout_kind_t::idle:  return idle;
+            case timeout_kind_t::read:  return read;
+            case timeout_kind_t::write: return write;
+            default:                    return std::chrono::milliseconds{0};
+        }
+    }
+};
+
+
+/**
+ * @brief Timer of timer_wheel_t. Kept inside of object which owns it, so wheel never allocates
+ */
+struct timer_node_t
+{
+    timer_node_t* prev = nullptr;
+    timer_node_t* next = nullptr;
+
+    /** Tick when timer expires*/
+    uint64_t expires = 0;
+
+    /** Object of timer. Wheel doesn't use it*/
+    void* owner = nullptr;
+
+    bool is_linked() const
+    {
+        return next != nullptr;
+    }
+};
+
+
+/**
+ * @brief Hierarchical timer wheel
+ * @details LEVELS wheels of SLOTS slots. Slot of level 0 is one tick, slot of level N is
+ * @details SLOTS^N ticks. Timer is put to the lowest level which covers its delay. When level 0
+ * @details turns around slot of next level is moved to lower levels (cascade). So schedule and
+ * @details cancel are O(1) and each timer is moved at most LEVELS-1 times.
+ * @details Timers longer than SLOTS^LEVELS ticks expire after SLOTS^LEVELS ticks.
+ * @details Wheel is used by one thread only.
+ */
+class timer_wheel_t
+{
+public:
+    using clock_t = std::chrono::steady_clock;
+
+    constexpr static unsigned SLOT_BITS = 6;
+    constexpr static size_t SLOTS = size_t(1) << SLOT_BITS;
+    constexpr static size_t LEVELS = 4;
+
+    /**
+     * @param[in] tick Resolution of timers
+     */
+    explicit timer_wheel_t(std::chrono::milliseconds tick = std::chrono::milliseconds{10})
+        :m_tick(tick), m_start(clock_t::now())
+    {
+        for (auto& level : m_slots)
+        {
+            for (auto& slot : level)
+            {
+                slot.prev = slot.next = &slot;
+            }
+        }
+    }
+
+    // rule of five - delete all copy/move methods. Slots point to themselves
+    timer_wheel_t(const timer_wheel_t& ) = delete;
+    timer_wheel_t(      timer_wheel_t&&) = delete;
+    timer_wheel_t& operator=(const timer_wheel_t& ) = delete;
+    timer_wheel_t& operator=(      timer_wheel_t&&) = delete;
+
+
+    /**
+     * @brief Start timer or move it if it's started already
+     * @details Deadline is rounded up to ticks. Passed deadline expires with next advance.
+     */
+    void schedule(timer_node_t& node, clock_t::time_point deadline)
+    {
+        cancel(node);
+        auto elapsed = deadline > m_start ? deadline - m_start : clock_t::duration{0};
+        auto expires = static_cast<uint64_t>((elapsed + m_tick - clock_t::duration{1}) / m_tick);
+        insert(node, std::max(m_now + 1, expires));
+        ++m_count;
+    }
+
+
+    /**
+     * @brief Stop timer if it's started
+     */
+    void cancel(timer_node_t& node)
+    {
+        if (node.is_linked())
+        {
+            unlink(node);
+            --m_count;
+        }
+    }
+
+
+    /**
+     * @brief Expire timers up to now
+     * @details Timer is stopped before callback is called, so callback can start it again.
+     * @param[in] now Current time
+     * @param[in] expire Callback called with each expired timer
+     */
+    template <class Callback>
+    void advance(clock_t::time_point now, Callback&& expire)
+    {
+        auto target = ticks(now);
+        if (!m_count)
+        {
+            m_now = std::max(m_now, target);
+            return;
+        }
+
+        while (m_now < target && m_count)
+        {
+            ++m_now;
+            cascade();
+
+            // Slot is taken whole, timers scheduled by callback go to other slots
+            timer_node_t expired;
+            take(m_slots[0][m_now & (SLOTS - 1)], expired);
+            while (expired.next != &expired)
+            {
+                auto& node = *expired.next;
+                unlink(node);
+                --m_count;
+                expire(node);
+            }
+        }
+        m_now = std::max(m_now, target);
+    }
+
+
+    /**
+     * @brief Milliseconds to wait before next advance. Timers never expire later than that
+     * @details Wait can be shorter than the nearest timer: timer of higher level is waited until
+     * @details beginning of its slot.
+     * @param[in] now Current time
+     * @return -1 if there are no timers
+     */
+    int next_timeout(clock_t::time_point now) const
+    {
+        if (!m_count)
+        {
+            return -1;
+        }
+
+        uint64_t nearest = UINT64_MAX;
+        for (size_t level = 0; level < LEVELS; ++level)
+        {
+            auto shift = level * SLOT_BITS;
+            auto index = m_now >> shift;
+            for (size_t i = 1; i <= SLOTS; ++i)
+            {
+                auto& slot = m_slots[level][(index + i) & (SLOTS - 1)];
+                if (slot.next != &slot)
+                {
+                    nearest = std::min(nearest, (index + i) << shift);
+                    break;
+                }
+            }
+        }
+
+        auto wait = m_start + m_tick * nearest - now;
+        auto ms = std::chrono::ceil<std::chrono::milliseconds>(wait).count();
+        return ms > 0 ? static_cast<int>(std::min<int64_t>(ms, INT32_MAX)) : 0;
+    }
+
+
+    /**
+     * @brief Number of started timers
+     */
+    size_t size() const
+    {
+        return m_count;
+    }
+
+private:
+    uint64_t ticks(clock_t::time_point now) const
+    {
+        return now > m_start ? static_cast<uint64_t>((now - m_start) / m_tick) : 0;
+    }
+
+
+    /**
+     * @brief Put timer to slot which covers its expiry
+     * @details Cascaded timer which expires at current tick goes to slot which is expired next.
+     */
+    void insert(timer_node_t& node, uint64_t expires)
+    {
+        constexpr uint64_t max_delay = (uint64_t(1) << (SLOT_BITS * LEVELS)) - 1;
+        if (expires < m_now)
+        {
+            expires = m_now + 1;
+        }
+        else if (expires - m_now > max_delay)
+        {
+            expires = m_now + max_delay;
+        }
+        node.expires = expires;
+
+        size_t level = 0;
+        while (level + 1 < LEVELS && expires - m_now >= (uint64_t(1) << (SLOT_BITS * (level + 1))))
+        {
+            ++level;
+        }
+
+        auto& slot = m_slots[level][(expires >> (SLOT_BITS * level)) & (SLOTS - 1)];
+        node.prev = slot.prev;
+        node.next = &slot;
+        slot.prev->next = &node;
+        slot.prev = &node;
+    }
+
+
+    /**
+     * @brief Move timers of higher levels which expire within next turn of lower level
+     * @details Called after m_now is moved. Level is cascaded when all lower levels turned around.
+     */
+    void cascade()
+    {
+        for (size_t level = 1; level < LEVELS; ++level)
+        {
+            auto shift = SLOT_BITS * level;
+            if (m_now & ((uint64_t(1) << shift) - 1))
+            {
+                return;
+            }
+
+            timer_node_t moved;
+            take(m_slots[level][(m_now >> shift) & (SLOTS - 1)], moved);
+            while (moved.next != &moved)
+            {
+                auto& node = *moved.next;
+                unlink(node);
+                insert(node, node.expires);
+            }
+        }
+    }
+
+
+    /**
+     * @brief Move all timers of slot to empty list dst
+     */
+    static void take(timer_node_t& slot, timer_node_t& dst)
+    {
+        if (slot.next == &slot)
+        {
+            dst.prev = dst.next = &dst;
+            return;
+        }
+        dst.next = slot.next;
+        dst.prev = slot.prev;
+        dst.next->prev = &dst;
+        dst.prev->next = &dst;
+        slot.prev = slot.next = &slot;
+    }
+
+
+    static void unlink(timer_node_t& node)
+    {
+        node.prev->next = node.next;
+        node.next->prev = node.prev;
+        node.prev = node.next = nullptr;
+    }
+
+
+    /** Duration of one tick*/
+    const std::chrono::milliseconds m_tick;
+
+    /** Time of tick 0*/
+    const clock_t::time_point m_start;
+
+    /** Last tick which was advanced*/
+    uint64_t m_now = 0;
+
+    /** Number of started timers*/
+    size_t m_count = 0;
+
+    /** Slot heads. Empty slot points to itself*/
+    std::array<std::array<timer_node_t, SLOTS>, LEVELS> m_slots;
+};
+
+} // namespace net
@@ -0,0 +1,264 @@
+/**
+ * @file trace.hpp
+ * @author Domnikov Ivan
+ * @brief USDT probes and optional per-stage tracing of hot path.
+ *
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * USDT probes of provider hash_server. Probe is a nop instruction until tracer attaches to it
+ * (e.g. bpftrace -e 'usdt:./hash_server:hash_server:read { @[arg1] = count(); }'), so they are
+ * always compiled in when sys/sdt.h is available.
+ */
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>) && !defined(HASH_SERVER_NO_USDT)
+#include <sys/sdt.h>
+#define HASH_SERVER_USDT 1
+#endif
+#endif
+
+#ifdef HASH_SERVER_USDT
+#define HASH_SERVER_PROBE0(name)       DTRACE_PROBE(hash_server, name)
+#define HASH_SERVER_PROBE1(name, a)    DTRACE_PROBE1(hash_server, name, a)
+#define HASH_SERVER_PROBE2(name, a, b) DTRACE_PROBE2(hash_server, name, a, b)
+#else
+#define HASH_SERVER_PROBE0(name)
+#define HASH_SERVER_PROBE1(name, a)
+#define HASH_SERVER_PROBE2(name, a, b)
+#endif
+
+
+#ifdef HASH_SERVER_TRACE_STAGES
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#endif
+
+namespace net::trace
+{
+
+/**
+ * @brief Stages of hot path
+ */
+enum stage_t : uint8_t
+{
+    accept,
+    epoll_wait,
+    read,
+    parse,
+    digest,
+    send,
+    stage_count
+};
+
+inline constexpr const char* stage_names[stage_count] = {"accept", "epoll_wait", "read", "parse", "digest", "send"};
+
+
+#ifdef HASH_SERVER_TRACE_STAGES
+
+/**
+ * @brief Stage of one thread from begin to end. Nanoseconds of steady clock
+ */
+struct event_t
+{
+    uint64_t begin;
+    uint64_t end;
+    stage_t stage;
+};
+
+
+/**
+ * @brief The last CAPACITY stages of one thread
+ * @details Ring is written by its thread only and read by dump after threads are stopped.
+ */
+class thread_ring_t
+{
+public:
+    constexpr static size_t CAPACITY = size_t(1) << 16;
+
+    explicit thread_ring_t(size_t tid) :m_tid(tid), m_events(CAPACITY) {}
+
+    void push(const event_t& event)
+    {
+        m_events[m_count++ & (CAPACITY - 1)] = event;
+    }
+
+    /**
+     * @brief Call function for each kept event from the oldest one
+     */
+    template <class Function>
+    void for_each(Function&& function) const
+    {
+        auto first = m_count > CAPACITY ? m_count - CAPACITY : 0;
+        for (auto i = first; i < m_count; ++i)
+        {
+            function(m_events[i & (CAPACITY - 1)]);
+        }
+    }
+
+    size_t tid() const
+    {
+        return m_tid;
+    }
+
+private:
+    size_t m_tid;
+    size_t m_count = 0;
+    std::vector<event_t> m_events;
+};
+
+
+/**
+ * @brief Rings of all threads which traced something
+ * @details Thread gets its ring with the first event. Rings live until process exit, so events of
+ * @details stopped threads are dumped too.
+ */
+class recorder_t
+{
+public:
+    static recorder_t& instance()
+    {
+        static recorder_t recorder;
+        return recorder;
+    }
+
+
+    static uint64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+
+    /**
+     * @brief Add event to ring of calling thread
+     * @details errno of traced system call is kept for caller.
+     */
+    void record(stage_t stage, uint64_t begin, uint64_t end)
+    {
+        thread_local thread_ring_t* ring = nullptr;
+        if (!ring)
+        {
+            auto error = errno;
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_rings.push_back(std::make_unique<thread_ring_t>(m_rings.size()));
+            ring = m_rings.back().get();
+            errno = error;
+        }
+        ring->push({begin, end, stage});
+    }
+
+
+    /**
+     * @brief Write events in Chrome trace format (chrome://tracing, Perfetto)
+     * @details Must be called when traced threads are stopped.
+     */
+    void write_json(std::string& out)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        uint64_t start = UINT64_MAX;
+        for (auto& ring : m_rings)
+        {
+            ring->for_each([&](const event_t& event){start = std::min(start, event.begin);});
+        }
+
+        out += "{\"traceEvents\":[";
+        bool first = true;
+        char line[160];
+        for (auto& ring : m_rings)
+        {
+            ring->for_each([&](const event_t& event)
+            {
+                snprintf(line, sizeof(line), "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f}",
+                         first ? "" : ",", stage_names[event.stage], ring->tid(),
+                         (event.begin - start) / 1e3, (event.end - event.begin) / 1e3);
+                out += line;
+                first = false;
+            });
+        }
+        out += "\n],\"displayTimeUnit\":\"ns\"}\n";
+    }
+
+
+    /**
+     * @brief Write events to file
+     * @return false if file can't be written
+     */
+    bool dump(const std::string& path)
+    {
+        std::string json;
+        write_json(json);
+        auto file = fopen(path.c_str(), "w");
+        if (!file)
+        {
+            return false;
+        }
+        bool result = json.size() == fwrite(json.data(), 1, json.size(), file);
+        return 0 == fclose(file) && result;
+    }
+
+private:
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<thread_ring_t>> m_rings;
+};
+
+
+/**
+ * @brief Record stage from construction to destruction
+ */
+class scope_t
+{
+public:
+    explicit scope_t(stage_t stage) :m_stage(stage), m_begin(recorder_t::now()) {}
+
+    ~scope_t()
+    {
+        recorder_t::instance().record(m_stage, m_begin, recorder_t::now());
+    }
+
+    scope_t(const scope_t&) = delete;
+    scope_t& operator=(const scope_t&) = delete;
+
+private:
+    stage_t m_stage;
+    uint64_t m_begin;
+};
+
+
+/**
+ * @brief Record moment of stage, e.g. connection accepted by blocking accept
+ */
+inline void mark(stage_t stage)
+{
+    auto now = recorder_t::now();
+    recorder_t::instance().record(stage, now, now);
+}
+
+#endif
+
+} // namespace net::trace
+
+
+/**
+ * Stage tracing is compiled in with HASH_SERVER_TRACE_STAGES only (cmake -DTRACE_STAGES=ON)
+ */
+#ifdef HASH_SERVER_TRACE_STAGES
+#define HASH_SERVER_TRACE_CONCAT_(a, b) a##b
+#define HASH_SERVER_TRACE_CONCAT(a, b) HASH_SERVER_TRACE_CONCAT_(a, b)
+#define HASH_SERVER_TRACE_SCOPE(stage) net::trace::scope_t HASH_SERVER_TRACE_CONCAT(trace_scope_, __LINE__)(net::trace::stage)
+#define HASH_SERVER_TRACE_MARK(stage)  net::trace::mark(net::trace::stage)
+#else
+#define HASH_SERVER_TRACE_SCOPE(stage)
+#define HASH_SERVER_TRACE_MARK(stage)
+#endif
@@ -0,0 +1,341 @@
+/**
+ * @file uring.hpp
+ * @author Domnikov Ivan
+ * @brief Minimal io_uring wrapper on raw system calls.
+ *
+ */
+#pragma once
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+namespace net
+{
+
+/**
+ * @brief Submission and completion rings of one io_uring instance
+ * @details Ring is used by one thread only. Submission queue entries are taken with get_sqe and given
+ * @details to kernel all together by submit_and_wait, so many operations cost one system call.
+ * @details Ring can have one group of provided buffers (setup_buffers). Kernel picks free buffer for
+ * @details received data itself and it must be given back with recycle when data is processed.
+ * @details Ring and buffers mapping requires kernel 5.19+, multishot recv 6.0+ (see is_supported).
+ */
+class uring_t final
+{
+public:
+    /**
+     * @brief Create ring
+     * @details Function will throw an exception if creating is failed
+     * @param[in] entries Submission queue size. Completion queue is 4 times bigger for multishot operations
+     * @param[in] flags IORING_SETUP_* flags. If kernel doesn't know them ring is created without them
+     */
+    explicit uring_t(unsigned entries, unsigned flags = 0)
+    {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        params.flags = flags | IORING_SETUP_CQSIZE;
+        params.cq_entries = entries * 4;
+
+        m_fd = syscall(__NR_io_uring_setup, entries, &params);
+        if (-1 == m_fd && EINVAL == errno && flags)
+        {
+            memset(&params, 0, sizeof(params));
+            params.flags = IORING_SETUP_CQSIZE;
+            params.cq_entries = entries * 4;
+            m_fd = syscall(__NR_io_uring_setup, entries, &params);
+        }
+        if (-1 == m_fd)
+        {
+            throw std::runtime_error(std::string("io_uring setup error[") + strerror(errno) + "]");
+        }
+
+        if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP))
+        {
+            close(m_fd);
+            throw std::runtime_error("io_uring is too old");
+        }
+
+        // Submission and completion rings share one mapping
+        m_ring_size = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                               params.cq_off.cqes   + params.cq_entries * sizeof(io_uring_cqe));
+        m_ring = mmap(nullptr, m_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+        m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        m_sqes = static_cast<io_uring_sqe*>(mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE,
+                                                 MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES));
+        if (MAP_FAILED == m_ring || MAP_FAILED == m_sqes)
+        {
+            auto err = errno;
+            release();
+            throw std::runtime_error(std::string("io_uring mmap error[") + strerror(err) + "]");
+        }
+
+        auto ring = static_cast<char*>(m_ring);
+        m_sq_head  = reinterpret_cast<unsigned*>(ring + params.sq_off.head);
+        m_sq_tail  = reinterpret_cast<unsigned*>(ring + params.sq_off.tail);
+        m_sq_mask  = *reinterpret_cast<unsigned*>(ring + params.sq_off.ring_mask);
+        m_sq_size  = params.sq_entries;
+        m_cq_head  = reinterpret_cast<unsigned*>(ring + params.cq_off.head);
+        m_cq_tail  = reinterpret_cast<unsigned*>(ring + params.cq_off.tail);
+        m_cq_mask  = *reinterpret_cast<unsigned*>(ring + params.cq_off.ring_mask);
+        m_cqes     = reinterpret_cast<io_uring_cqe*>(ring + params.cq_off.cqes);
+
+        // Submission queue entries are always taken in order
+        auto array = reinterpret_cast<unsigned*>(ring + params.sq_off.array);
+        for (unsigned i = 0; i < params.sq_entries; ++i)
+        {
+            array[i] = i;
+        }
+        m_sq_local_tail = *m_sq_tail;
+    }
+
+    ~uring_t()
+    {
+        release();
+    }
+
+    // rule of five - delete all copy/move methods
+    uring_t(const uring_t& ) = delete;
+    uring_t(      uring_t&&) = delete;
+    uring_t& operator=(const uring_t& ) = delete;
+    uring_t& operator=(      uring_t&&) = delete;
+
+
+    /**
+     * @brief Check once if kernel has everything used by uring_pool_t
+     * @details Operations are checked by IORING_REGISTER_PROBE and provided buffer ring by registering it.
+     * @details Multishot recv can't be probed, so kernel version is checked for it.
+     */
+    static bool is_supported()
+    {
+        static const bool supported = probe();
+        return supported;
+    }
+
+
+    /**
+     * @brief Get empty submission queue entry
+     * @details If queue is full then queued entries are submitted first
+     * @return Zeroed entry. It's submitted with next submit_and_wait
+     */
+    io_uring_sqe* get_sqe()
+    {
+        if (m_sq_local_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) >= m_sq_size)
+        {
+            submit_and_wait(0);
+        }
+
+        auto sqe = &m_sqes[m_sq_local_tail & m_sq_mask];
+        memset(sqe, 0, sizeof(*sqe));
+        ++m_sq_local_tail;
+        return sqe;
+    }
+
+
+    /**
+     * @brief Submit queued entries and wait for completions
+     * @param[in] wait_nr Number of completions to wait for
+     * @return Number of submitted entries or -1 in case of error except EINTR
+     */
+    int submit_and_wait(unsigned wait_nr)
+    {
+        auto to_submit = m_sq_local_tail - *m_sq_tail;
+        __atomic_store_n(m_sq_tail, m_sq_local_tail, __ATOMIC_RELEASE);
+
+        int result;
+        while (-1 == (result = syscall(__NR_io_uring_enter, m_fd, to_submit, wait_nr,
+                                       wait_nr ? IORING_ENTER_GETEVENTS : 0, nullptr, 0)))
+        {
+            if (EINTR != errno)
+            {
+                return -1;
+            }
+            to_submit = 0;
+        }
+        return result;
+    }
+
+
+    /**
+     * @brief Call func for each available completion and mark them as seen
+     * @param func Callable with parameter const io_uring_cqe&
+     * @return Number of completions
+     */
+    template <class Func>
+    unsigned for_each_cqe(Func&& func)
+    {
+        auto head = *m_cq_head;
+        auto tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+        for (auto i = head; i != tail; ++i)
+        {
+            func(m_cqes[i & m_cq_mask]);
+        }
+        __atomic_store_n(m_cq_head, tail, __ATOMIC_RELEASE);
+        return tail - head;
+    }
+
+
+    /**
+     * @brief Register group of provided buffers
+     * @details Function will throw an exception if registration is failed
+     * @param[in] group Buffer group id for IOSQE_BUFFER_SELECT operations
+     * @param[in] count Number of buffers. Power of 2
+     * @param[in] size Size of each buffer
+     */
+    void setup_buffers(uint16_t group, unsigned count, unsigned size)
+    {
+        m_buf_ring_size = count * sizeof(io_uring_buf);
+        auto ring = mmap(nullptr, m_buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (MAP_FAILED == ring)
+        {
+            throw std::runtime_error(std::string("io_uring buffer ring error[") + strerror(errno) + "]");
+        }
+        m_buf_ring = static_cast<io_uring_buf_ring*>(ring);
+
+        io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = reinterpret_cast<uint64_t>(m_buf_ring);
+        reg.ring_entries = count;
+        reg.bgid = group;
+        if (-1 == syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PBUF_RING, &reg, 1))
+        {
+            throw std::runtime_error(std::string("io_uring buffer registration error[") + strerror(errno) + "]");
+        }
+
+        constexpr size_t page = 4096;
+        m_buffers.reset(static_cast<char*>(std::aligned_alloc(page, (count * size + page - 1) / page * page)));
+        if (!m_buffers)
+        {
+            throw std::bad_alloc();
+        }
+        m_buf_size = size;
+        m_buf_mask = count - 1;
+        for (unsigned bid = 0; bid < count; ++bid)
+        {
+            recycle(bid);
+        }
+    }
+
+
+    /**
+     * @brief Provided buffer by id from completion (cqe.flags >> IORING_CQE_BUFFER_SHIFT)
+     */
+    char* buffer(uint16_t bid)
+    {
+        return m_buffers.get() + static_cast<size_t>(bid) * m_buf_size;
+    }
+
+
+    /**
+     * @brief Give provided buffer back to kernel
+     */
+    void recycle(uint16_t bid)
+    {
+        // Not m_buf_ring->bufs: in C++ empty struct of __DECLARE_FLEX_ARRAY moves it by 8 bytes
+        auto& buf = reinterpret_cast<io_uring_buf*>(m_buf_ring)[m_buf_tail & m_buf_mask];
+        buf.addr = reinterpret_cast<uint64_t>(buffer(bid));
+        buf.len = m_buf_size;
+        buf.bid = bid;
+        __atomic_store_n(&m_buf_ring->tail, ++m_buf_tail, __ATOMIC_RELEASE);
+    }
+
+private:
+    static bool probe()
+    {
+        // Multishot recv came with 6.0
+        utsname name;
+        int major = 0, minor = 0;
+        if (-1 == uname(&name) || 2 != sscanf(name.release, "%d.%d", &major, &minor) || major < 6)
+        {
+            return false;
+        }
+
+        try
+        {
+            uring_t ring(8);
+
+            constexpr unsigned ops_len = 256;
+            auto probe = static_cast<io_uring_probe*>(calloc(1, sizeof(io_uring_probe) + ops_len * sizeof(io_uring_probe_op)));
+            std::unique_ptr<io_uring_probe, decltype(&free)> holder(probe, &free);
+            if (-1 == syscall(__NR_io_uring_register, ring.m_fd, IORING_REGISTER_PROBE, probe, ops_len))
+            {
+                return false;
+            }
+
+            for (auto op : {IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_READ, IORING_OP_ASYNC_CANCEL})
+            {
+                if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+                {
+                    return false;
+                }
+            }
+
+            ring.setup_buffers(0, 2, 64);
+        }
+        catch (std::exception&)
+        {
+            return false;
+        }
+        return true;
+    }
+
+    void release()
+    {
+        if (m_buf_ring)
+        {
+            munmap(m_buf_ring, m_buf_ring_size);
+        }
+        if (m_sqes && MAP_FAILED != m_sqes)
+        {
+            munmap(m_sqes, m_sqes_size);
+        }
+        if (m_ring && MAP_FAILED != m_ring)
+        {
+            munmap(m_ring, m_ring_size);
+        }
+        close(m_fd);
+    }
+
+    /** Ring file descriptor*/
+    int m_fd = -1;
+
+    /** Mapped rings*/
+    void*         m_ring = nullptr;
+    size_t        m_ring_size = 0;
+    io_uring_sqe* m_sqes = nullptr;
+    size_t        m_sqes_size = 0;
+
+    /** Submission queue. Entries up to m_sq_local_tail are given to kernel by submit_and_wait*/
+    unsigned* m_sq_head = nullptr;
+    unsigned* m_sq_tail = nullptr;
+    unsigned  m_sq_mask = 0;
+    unsigned  m_sq_size = 0;
+    unsigned  m_sq_local_tail = 0;
+
+    /** Completion queue*/
+    unsigned*     m_cq_head = nullptr;
+    unsigned*     m_cq_tail = nullptr;
+    unsigned      m_cq_mask = 0;
+    io_uring_cqe* m_cqes = nullptr;
+
+    /** Provided buffers*/
+    io_uring_buf_ring* m_buf_ring = nullptr;
+    size_t             m_buf_ring_size = 0;
+    uint16_t           m_buf_tail = 0;
+    unsigned           m_buf_mask = 0;
+    unsigned           m_buf_size = 0;
+    std::unique_ptr<char, decltype(&free)> m_buffers{nullptr, &free};
+};
+
+} // namespace net
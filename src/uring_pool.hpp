@@ -0,0 +1,563 @@
+/**
+ * @file uring_pool.hpp
+ * @author Domnikov Ivan
+ * @brief File with uring_pool_t class. io_uring alternative of connection_pool_t.
+ *
+ */
+#pragma once
+
+#include "slab_allocator.hpp"
+#include "uring.hpp"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace net
+{
+
+/**
+* @brief uring_pool_t class
+* @details Same interface as connection_pool_t but each thread runs io_uring instead of epoll.
+* @details Listener is accepted by multishot accept and each connection receives by multishot recv
+* @details into provided buffers of thread, so there's no system call per accept or per read.
+* @details Results of all completions are sent together: one send entry per connection and all
+* @details entries are submitted with next wait by single system call.
+* @details Connection which has more than HIGH_WATER bytes of results not sent stops receiving
+* @details until they drop below LOW_WATER.
+* @details Connections given by add_connection are passed to thread through mutex protected list
+* @details and eventfd which thread always reads by ring. The same eventfd wakes thread to stop.
+* @details event_manager is manager for single connection. See event_manager_t for details
+* @details must have following methods:
+* @code static epoll_event create_event(int fd, allocator_t& allocator)
+* @code static void delete_event(epoll_event* event, allocator_t& allocator)
+* @code void process_received(std::string_view)
+* @code void take_output(std::vector<char>&)
+* @code size_t pending_output()
+*/
+template <class event_manager>
+class uring_pool_t
+{
+public:
+    /** Allocator of connection objects*/
+    using allocator_t = slab_allocator_t<sizeof(event_manager)>;
+
+    /**
+    * @brief uring_pool_t constructor.
+    * @details Creates vector of threads with size thread_num. Each thread creates its own ring.
+    * @param[in] Number of threads.
+    */
+    uring_pool_t(size_t thread_num)
+        :m_run(true)
+    {
+        for (size_t i = 0; i < thread_num; i++)
+        {
+            auto wake_fd = eventfd(0, EFD_CLOEXEC);
+            if (-1 == wake_fd)
+            {
+                fprintf(stderr, "[E] thread pool[%ld] eventfd failed\n", i);
+                continue;
+            }
+            m_pool.push_back(std::make_unique<thread_data_t>(wake_fd));
+        }
+
+        for (auto& data : m_pool)
+        {
+            data->thr = std::thread([this, &data = *data]{event_loop(data);});
+        }
+    }
+
+
+
+    /**
+    * @brief uring_pool_t destructor
+    * @details Stop threads if they were not stopped yet
+    */
+    virtual ~uring_pool_t()
+    {
+        if (m_run)
+        {
+            stop();
+        }
+    }
+
+
+
+    /**
+    * @brief Stop event pool and destroy all threads
+    * @details After this method there's no way to start it again. Need to create new uring_pool
+    */
+    void stop()
+    {
+        m_run = false;
+        for (auto& data : m_pool)
+        {
+            wake(*data);
+        }
+        for (auto& data : m_pool)
+        {
+            data->thr.join();
+            close(data->wake_fd);
+        }
+    }
+
+
+    /**
+    * @brief Function to add new connection to event loop
+    * @details Threads are selected round-robin by counter of pool. Connection is created by thread itself.
+    * @param[in] New file descriptor to open
+    * @return Returns 0 in case of success, -1 in case of error
+    */
+    int add_connection(int fd) const
+    {
+        auto& data = *m_pool[m_next.fetch_add(1, std::memory_order_relaxed) % m_pool.size()];
+        {
+            std::lock_guard<std::mutex> lock(data.mutex);
+            data.incoming.push_back(fd);
+        }
+        return wake(data);
+    }
+
+
+    /**
+    * @brief Let thread accept connections from its own listening socket by multishot accept
+    * @details Socket is owned by caller. After it's shutdown thread stops accepting.
+    * @param[in] thread_id Thread index
+    * @param[in] listen_fd Listening socket
+    * @return Returns 0 in case of success, -1 in case of error
+    */
+    int add_listener(size_t thread_id, int listen_fd)
+    {
+        auto& data = *m_pool.at(thread_id);
+        data.listen_fd = listen_fd;
+        return wake(data);
+    }
+
+
+    /**
+    * @brief Number of threads
+    */
+    size_t size() const
+    {
+        return m_pool.size();
+    }
+
+
+    /**
+    * @brief Counters of connection objects allocator
+    */
+    typename allocator_t::stats_t slab_stats() const
+    {
+        return m_slab.stats();
+    }
+
+
+private:
+
+    /** Submission queue size of each ring*/
+    constexpr static unsigned ring_entries = 256;
+
+    /** Provided buffers of each thread. Memory of thread is buf_count*buf_size*/
+    constexpr static unsigned buf_count = 64;
+    constexpr static unsigned buf_size  = 16 * 1024;
+    constexpr static uint16_t buf_group = 0;
+
+    /** Operation kind is kept in low bits of completion user_data. Connections are cache line aligned*/
+    enum op_t : uint64_t
+    {
+        op_wake   = 0,
+        op_accept = 1,
+        op_recv   = 2,
+        op_send   = 3,
+        op_cancel = 4,
+        op_mask   = 7
+    };
+
+    /** thread data. eventfd, connections given by other threads, own listening socket and thread object*/
+    struct thread_data_t
+    {
+        thread_data_t(int fd) : wake_fd(fd) {}
+
+        int wake_fd;
+        std::mutex mutex;
+        std::vector<int> incoming;
+        std::atomic_int listen_fd{-1};
+        std::thread thr;
+    };
+
+    /** State of connection owned by ring thread*/
+    struct connection_t
+    {
+        event_manager* manager;
+        int fd;
+
+        /** Results which are being sent. New results are kept by manager until this is sent*/
+        std::vector<char> sending;
+        size_t sent = 0;
+
+        bool recv_armed    = false;
+        bool send_inflight = false;
+        bool paused        = false;
+        bool eof           = false;
+        bool error         = false;
+
+        /** Connection is in list of connections to check after completions*/
+        bool dirty         = false;
+    };
+
+    using conn_allocator_t = slab_allocator_t<sizeof(connection_t)>;
+
+
+    /**
+    * @brief State of one thread. Lives on thread stack
+    */
+    struct loop_t
+    {
+        uring_t& ring;
+        thread_data_t& data;
+        uint64_t wake_value = 0;
+        int listen_fd = -1;
+        std::vector<connection_t*> dirty;
+    };
+
+
+    /**
+    * @brief Thread function. Waits completions and handles them until pool is stopped
+    */
+    void event_loop(thread_data_t& data)
+    {
+        std::unique_ptr<uring_t> ring;
+        try
+        {
+            ring = std::make_unique<uring_t>(ring_entries, IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN);
+            ring->setup_buffers(buf_group, buf_count, buf_size);
+        }
+        catch (std::exception& err)
+        {
+            fprintf(stderr, "[E] thread pool io_uring failed: %s\n", err.what());
+            return;
+        }
+
+        loop_t loop{*ring, data};
+        arm_wake(loop);
+
+        while (m_run)
+        {
+            if (-1 == ring->submit_and_wait(1))
+            {
+                perror("[E] io_uring_enter failed\n");
+                return;
+            }
+
+            ring->for_each_cqe([&](const io_uring_cqe& cqe){handle_cqe(loop, cqe);});
+
+            // Sends of all connections go with next submit_and_wait
+            for (auto conn : loop.dirty)
+            {
+                conn->dirty = false;
+                update(loop, conn);
+            }
+            loop.dirty.clear();
+        }
+    }
+
+
+    /**
+    * @brief Dispatch completion by operation kind
+    */
+    void handle_cqe(loop_t& loop, const io_uring_cqe& cqe)
+    {
+        auto op = static_cast<op_t>(cqe.user_data & op_mask);
+        auto conn = reinterpret_cast<connection_t*>(cqe.user_data & ~uint64_t(op_mask));
+        switch (op)
+        {
+            case op_wake:   on_wake  (loop);            break;
+            case op_accept: on_accept(loop, cqe);       break;
+            case op_recv:   on_recv  (loop, conn, cqe); break;
+            case op_send:   on_send  (loop, conn, cqe); break;
+            default:                                    break;
+        }
+    }
+
+
+    /**
+    * @brief Take connections given by add_connection and listener given by add_listener
+    */
+    void on_wake(loop_t& loop)
+    {
+        std::vector<int> incoming;
+        {
+            std::lock_guard<std::mutex> lock(loop.data.mutex);
+            incoming.swap(loop.data.incoming);
+        }
+        for (auto fd : incoming)
+        {
+            // Ring waits for readiness itself. Send to non-blocking socket would fail with EAGAIN
+            auto flags = fcntl(fd, F_GETFL);
+            if (flags & O_NONBLOCK)
+            {
+                fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+            }
+            add(loop, fd);
+        }
+
+        if (loop.data.listen_fd != loop.listen_fd)
+        {
+            loop.listen_fd = loop.data.listen_fd;
+            arm_accept(loop);
+        }
+
+        if (m_run)
+        {
+            arm_wake(loop);
+        }
+    }
+
+
+    void on_accept(loop_t& loop, const io_uring_cqe& cqe)
+    {
+        if (cqe.res >= 0)
+        {
+            add(loop, cqe.res);
+        }
+        else if (-EINVAL == cqe.res || -EBADF == cqe.res || -ENOTSOCK == cqe.res || -ECANCELED == cqe.res)
+        {
+            // Server shutdown
+            loop.listen_fd = -1;
+            return;
+        }
+        else if (-EMFILE == cqe.res || -ENFILE == cqe.res || -ENOBUFS == cqe.res || -ENOMEM == cqe.res)
+        {
+            fprintf(stderr, "Connection accept error: %s\n", strerror(-cqe.res));
+        }
+
+        // Multishot accept was finished by kernel
+        if (!(cqe.flags & IORING_CQE_F_MORE) && -1 != loop.listen_fd)
+        {
+            arm_accept(loop);
+        }
+    }
+
+
+    void on_recv(loop_t& loop, connection_t* conn, const io_uring_cqe& cqe)
+    {
+        if (!(cqe.flags & IORING_CQE_F_MORE))
+        {
+            conn->recv_armed = false;
+        }
+
+        if (cqe.res > 0)
+        {
+            uint16_t bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+            if (!conn->error)
+            {
+                conn->manager->process_received({loop.ring.buffer(bid), static_cast<size_t>(cqe.res)});
+            }
+            loop.ring.recycle(bid);
+        }
+        else if (0 == cqe.res)
+        {
+            conn->eof = true;
+        }
+        else if (-ENOBUFS != cqe.res && -ECANCELED != cqe.res)
+        {
+            // Connection is broken (reset by peer etc.)
+            conn->error = true;
+        }
+
+        mark_dirty(loop, conn);
+    }
+
+
+    void on_send(loop_t& loop, connection_t* conn, const io_uring_cqe& cqe)
+    {
+        conn->send_inflight = false;
+        if (cqe.res < 0)
+        {
+            conn->error = true;
+        }
+        else
+        {
+            conn->sent += cqe.res;
+        }
+        mark_dirty(loop, conn);
+    }
+
+
+    /**
+    * @brief Check connection after completions: send results, pause or resume receiving and close
+    * @details Connection is deleted when it's finished and kernel has no operations with it.
+    */
+    void update(loop_t& loop, connection_t* conn)
+    {
+        if (!conn->error && !conn->send_inflight)
+        {
+            if (conn->sent == conn->sending.size())
+            {
+                conn->sent = 0;
+                conn->manager->take_output(conn->sending);
+            }
+
+            if (conn->sent < conn->sending.size())
+            {
+                submit_send(loop, conn);
+            }
+            else if (conn->sending.capacity())
+            {
+                // Everything is sent. Connection keeps no output memory
+                std::vector<char>().swap(conn->sending);
+            }
+        }
+
+        auto pending = conn->sending.size() - conn->sent + conn->manager->pending_output();
+        bool finished = conn->error || (conn->eof && !pending);
+
+        if (finished || (!conn->paused && pending > event_manager::HIGH_WATER))
+        {
+            // Stop receiving. Data already received is still processed
+            conn->paused = !finished;
+            if (conn->recv_armed)
+            {
+                cancel(loop, conn);
+            }
+        }
+        else if (conn->paused && pending < event_manager::LOW_WATER)
+        {
+            conn->paused = false;
+        }
+
+        if (!conn->recv_armed && !conn->paused && !conn->eof && !finished)
+        {
+            arm_recv(loop, conn);
+        }
+
+        if (finished && !conn->recv_armed && !conn->send_inflight)
+        {
+            epoll_event event;
+            event.data.ptr = conn->manager;
+            event_manager::delete_event(event, m_slab);
+            conn->~connection_t();
+            m_conn_slab.deallocate(conn);
+        }
+    }
+
+
+    /**
+    * @brief Create connection for new descriptor and start receiving
+    */
+    void add(loop_t& loop, int fd)
+    {
+        auto event = event_manager::create_event(fd, m_slab);
+        auto conn = new (m_conn_slab.allocate()) connection_t{static_cast<event_manager*>(event.data.ptr), fd};
+        arm_recv(loop, conn);
+    }
+
+
+    void mark_dirty(loop_t& loop, connection_t* conn)
+    {
+        if (!conn->dirty)
+        {
+            conn->dirty = true;
+            loop.dirty.push_back(conn);
+        }
+    }
+
+
+    void arm_wake(loop_t& loop)
+    {
+        auto sqe = loop.ring.get_sqe();
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = loop.data.wake_fd;
+        sqe->addr = reinterpret_cast<uint64_t>(&loop.wake_value);
+        sqe->len = sizeof(loop.wake_value);
+        sqe->user_data = op_wake;
+    }
+
+
+    void arm_accept(loop_t& loop)
+    {
+        auto sqe = loop.ring.get_sqe();
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->fd = loop.listen_fd;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_CLOEXEC;
+        sqe->user_data = op_accept;
+    }
+
+
+    void arm_recv(loop_t& loop, connection_t* conn)
+    {
+        auto sqe = loop.ring.get_sqe();
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = conn->fd;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = buf_group;
+        sqe->user_data = reinterpret_cast<uint64_t>(conn) | op_recv;
+        conn->recv_armed = true;
+    }
+
+
+    void submit_send(loop_t& loop, connection_t* conn)
+    {
+        auto sqe = loop.ring.get_sqe();
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = conn->fd;
+        sqe->addr = reinterpret_cast<uint64_t>(conn->sending.data() + conn->sent);
+        sqe->len = conn->sending.size() - conn->sent;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        sqe->user_data = reinterpret_cast<uint64_t>(conn) | op_send;
+        conn->send_inflight = true;
+    }
+
+
+    void cancel(loop_t& loop, connection_t* conn)
+    {
+        auto sqe = loop.ring.get_sqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = reinterpret_cast<uint64_t>(conn) | op_recv;
+        sqe->user_data = op_cancel;
+    }
+
+
+    /**
+    * @brief Wake up thread by its eventfd
+    * @return Returns 0 in case of success, -1 in case of error
+    */
+    static int wake(thread_data_t& data)
+    {
+        uint64_t one = 1;
+        return write(data.wake_fd, &one, sizeof(one)) == sizeof(one) ? 0 : -1;
+    }
+
+
+
+    /** Connection objects allocator*/
+    mutable allocator_t m_slab;
+
+    /** Connection states allocator*/
+    conn_allocator_t m_conn_slab;
+
+    /** Thread pool*/
+    std::vector<std::unique_ptr<thread_data_t>> m_pool;
+
+    /** Thread of next connection given by add_connection, round-robin*/
+    mutable std::atomic_size_t m_next{0};
+
+    /** Run flag. setup to true when object created and to false when object is destroying*/
+    std::atomic_bool m_run;
+};
+
+} // namespace net
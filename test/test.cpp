@@ -2,9 +2,26 @@
 #include "../src/hash_calc.hpp"
 #include "../src/event_manager.hpp"
 #include "../src/hash_server.hpp"
+#include "../src/algorithms.hpp"
+#include "../src/slab_allocator.hpp"
+#include "../src/ring_queue.hpp"
+#include "../src/timer_wheel.hpp"
+#include "../src/stats_server.hpp"
+#include "../src/digest_cache.hpp"
+#include "../src/frame_parser.hpp"
+#include "../src/line_index.hpp"
+#include "../src/hex_format.hpp"
+#include "../src/file_hasher.hpp"
+#include "../src/trace.hpp"
 
 #include <gtest/gtest.h>
 #include <fcntl.h>
+#include <arpa/inet.h>
+
+#include <functional>
+#include <random>
+#include <set>
+#include <thread>
 
 class hash_calc_test : public ::testing::Test 
 {
@@ -17,17 +34,206 @@ class hash_calc_test : public ::testing::Test
         {
             public:
                 test_event_manager_t(int fd):event_manager_t(fd){}
-                bool test_read_data  ()                       {return read_data  (      );}
-                bool test_parse_lines(std::string_view buffer){return parse_lines(buffer);}
-                bool test_write_data (std::string_view buffer){return write_data (buffer);}
+                bool test_read_data  ()                       {size_t budget = READ_BUDGET; return read_data(*m_buffers, budget);}
+                bool test_parse_lines(std::string_view buffer){return parse_lines(buffer, m_buffers->out);}
+                bool test_write_data (std::string_view buffer){return write_data (buffer             );}
+
+            private:
+                std::unique_ptr<buffers_t> m_buffers = std::make_unique<buffers_t>();
+        };
+
+
+        template <class Processor, bool IS_TCP = false, class Protocol = net::text_protocol_t>
+        class processor_event_manager_t: public net::event_manager_t<Processor, IS_TCP, Protocol>
+        {
+            public:
+                using buffers_t = typename net::event_manager_t<Processor, IS_TCP, Protocol>::buffers_t;
+
+                processor_event_manager_t(int fd):net::event_manager_t<Processor, IS_TCP, Protocol>(fd){}
+                bool test_parse_lines(std::string_view buffer){return this->parse_lines(buffer, m_buffers->out);}
+                bool test_process_data  ()                    {return this->process_data  (*m_buffers);}
+                bool test_process_output()                    {return this->process_output(*m_buffers);}
+
+            private:
+                std::unique_ptr<buffers_t> m_buffers = std::make_unique<buffers_t>();
+        };
+
+        /** Random lines of different length joined with newline symbol*/
+        static std::string random_lines(size_t count, size_t max_len)
+        {
+            std::mt19937 gen(42);
+            std::string result;
+            for (size_t i = 0; i < count; ++i)
+            {
+                auto len = gen() % (max_len + 1);
+                for (size_t j = 0; j < len; ++j)
+                {
+                    result += static_cast<char>('!' + gen() % 90);
+                }
+                result += '\n';
+            }
+            return result;
+        }
+
+        /** Hex result in case of this build (see net::hex::UPPERCASE)*/
+        static std::string hex_case(std::string hex)
+        {
+            if (!net::hex::UPPERCASE)
+            {
+                std::transform(hex.begin(), hex.end(), hex.begin(), [](unsigned char c){return std::tolower(c);});
+            }
+            return hex;
+        }
+
+        /** Hashes of lines calculated one by one by hash_t*/
+        static std::string reference_hashes(std::string_view lines)
+        {
+            std::string result;
+            net::processors::hash_t hash;
+            while (!lines.empty())
+            {
+                auto pos = lines.find('\n');
+                hash.process(lines.substr(0, pos));
+                result += hash.get_result();
+                lines.remove_prefix(pos + 1);
+            }
+            return result;
+        }
+
+        /**
+         * @brief Records of binary protocol in frames
+         * @details Records are taken by groups of random size. Group of one record is sent as
+         * @details record frame, others as batch frame.
+         */
+        static std::string encode_frames(const std::vector<std::string>& records)
+        {
+            std::mt19937 gen(7);
+            std::string result;
+            auto put_u32 = [&](uint32_t value)
+            {
+                for (int i = 0; i < 4; ++i)
+                {
+                    result += static_cast<char>(value >> 8 * i);
+                }
+            };
+
+            for (size_t pos = 0; pos < records.size();)
+            {
+                size_t count = std::min<size_t>(1 + gen() % 100, records.size() - pos);
+                if (1 == count)
+                {
+                    result += '\x01';
+                    put_u32(records[pos].size());
+                    result += records[pos++];
+                    continue;
+                }
+
+                result += '\x02';
+                put_u32(count);
+                for (size_t end = pos + count; pos < end; ++pos)
+                {
+                    for (auto len = records[pos].size(); ; len >>= 7)
+                    {
+                        result += static_cast<char>((len & 0x7F) | (len > 0x7F ? 0x80 : 0));
+                        if (len <= 0x7F)
+                        {
+                            break;
+                        }
+                    }
+                    result += records[pos];
+                }
+            }
+            return result;
+        }
+
+        /** Raw MD5 digests of records calculated one by one by hash_t*/
+        static std::string reference_digests(const std::vector<std::string>& records)
+        {
+            std::string result;
+            net::processors::hash_t hash;
+            for (auto& record : records)
+            {
+                hash.process(record);
+                result += hash.get_digest();
+            }
+            return result;
+        }
+
+        /**
+         * @brief Joins thread if test returns by failed assertion before it
+         * @details stop makes thread finish, e.g. kills server which thread runs
+         */
+        struct thread_guard_t
+        {
+            std::thread& thr;
+            std::function<void()> stop;
+
+            ~thread_guard_t()
+            {
+                if (thr.joinable())
+                {
+                    stop();
+                    thr.join();
+                }
+            }
         };
 
+        /** Read everything available from non-blocking pipe*/
+        static std::string read_all(int fd)
+        {
+            std::string result;
+            char buf[4096];
+            int count;
+            while ((count = read(fd, buf, sizeof(buf))) > 0)
+            {
+                result.append(buf, count);
+            }
+            return result;
+        }
+
+        /**
+         * @brief Send data to server on localhost and read all results
+         * @details Server is started by another thread, so connection is retried for a second
+         */
+        static std::string request(uint16_t port, std::string_view data)
+        {
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(port);
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+            int fd = socket(AF_INET, SOCK_STREAM, 0);
+            for (int attempts = 100; -1 == connect(fd, (sockaddr*)&addr, sizeof(addr)) && --attempts;)
+            {
+                close(fd);
+                fd = socket(AF_INET, SOCK_STREAM, 0);
+                usleep(10000);
+            }
+
+            // Results are read while sending, so server is never blocked by client
+            std::string result;
+            std::thread reader([&]{result = read_all(fd);});
+            for (size_t sent = 0; sent < data.size();)
+            {
+                auto count = write(fd, data.data() + sent, data.size() - sent);
+                if (count <= 0)
+                {
+                    break;
+                }
+                sent += count;
+            }
+            shutdown(fd, SHUT_WR);
+            reader.join();
+            close(fd);
+            return result;
+        }
 
         class fake_socket_t
         {
         public:
             void kill(){}
-            void create(uint16_t ){server_counter = 0;}
+            void create(uint16_t, const net::listen_options_t& = {}){server_counter = 0;}
+            int  get_fd() const {return -1;}
             bool wait_new(int& fd)
             {
                 usleep(100);
@@ -47,7 +253,7 @@ class hash_calc_test : public ::testing::Test
         };
 
         std::string test_str = "1111111";
-        std::string etalon   = "7FA8282AD93047A4D6FE6111C93B308A\n";
+        std::string etalon   = hex_case("7FA8282AD93047A4D6FE6111C93B308A\n");
 
         constexpr static int max_counter = 10;
         static int server_counter;
@@ -76,6 +282,242 @@ TEST_F(hash_calc_test, hash_manual)
 }
 
 
+TEST_F(hash_calc_test, md5_mb_kernels)
+{
+    using engine_t = net::processors::md5::mb_engine_t;
+
+    auto text = random_lines(200, 300);
+    auto etalon_all = reference_hashes(text);
+
+    std::vector<std::string_view> lines;
+    std::string_view rest = text;
+    while (!rest.empty())
+    {
+        auto pos = rest.find('\n');
+        lines.push_back(rest.substr(0, pos));
+        rest.remove_prefix(pos + 1);
+    }
+
+    for (auto kernel : {engine_t::kernel_t::generic_x4, engine_t::kernel_t::sse41_x4,
+                        engine_t::kernel_t::avx2_x8,    engine_t::kernel_t::avx512_x16})
+    {
+        if (!engine_t::is_supported(kernel))
+        {
+            continue;
+        }
+
+        engine_t engine(kernel);
+        std::vector<net::processors::md5::digest_t> digests(lines.size());
+        engine.hash(lines.data(), lines.size(), digests.data());
+
+        std::string result;
+        char hex[2 * net::processors::md5::DIGEST_SIZE];
+        for (auto& digest : digests)
+        {
+            net::processors::to_hex(digest, sizeof(digest), hex);
+            result.append(hex, sizeof(hex));
+            result += '\n';
+        }
+        ASSERT_EQ(result, etalon_all) << "Kernel " << static_cast<int>(kernel) << " hash mismatch";
+    }
+}
+
+
+TEST_F(hash_calc_test, md5_mb_event_split_buffers)
+{
+    int pipefd[2];
+
+    ASSERT_EQ(pipe(pipefd), 0) << "Test pipe cannot be created ["<<strerror(errno)<<"]";
+    int retval = fcntl( pipefd[0], F_SETFL, fcntl(pipefd[0], F_GETFL) | O_NONBLOCK);
+    ASSERT_EQ(retval, 0) << "Cannot make nonblocking pipe";
+
+    auto text = random_lines(300, 150);
+    auto etalon_all = reference_hashes(text);
+
+    processor_event_manager_t<net::processors::md5_mb_t> manager(pipefd[1]);
+
+    // Split into pieces of different size so lines continue between buffers
+    std::string result;
+    size_t pos = 0;
+    for (size_t piece = 1; pos < text.size(); piece = piece * 3 % 1021)
+    {
+        auto len = std::min(piece, text.size() - pos);
+        ASSERT_TRUE(manager.test_parse_lines({text.data() + pos, len})) << "Writing to buffer failure";
+        pos += len;
+        result += read_all(pipefd[0]);
+    }
+
+    ASSERT_EQ(result, etalon_all) << "Received hashes don't match";
+
+    close(pipefd[0]);
+    close(pipefd[1]);
+}
+
+
+TEST_F(hash_calc_test, md5_native_matches_evp)
+{
+    auto text = random_lines(300, 300);
+    auto etalon_all = reference_hashes(text);
+
+    // Feed each line in two parts to cross block boundaries at different offsets
+    std::string result;
+    net::processors::md5_t<> hash;
+    std::string_view rest = text;
+    for (size_t i = 0; !rest.empty(); ++i)
+    {
+        auto line = rest.substr(0, rest.find('\n'));
+        auto split = std::min(line.size(), i % 130);
+        hash.process(line.substr(0, split));
+        hash.process(line.substr(split));
+        result += hash.get_result();
+        rest.remove_prefix(line.size() + 1);
+    }
+
+    ASSERT_EQ(result, etalon_all) << "Native MD5 doesn't match EVP";
+}
+
+
+TEST_F(hash_calc_test, md5_native_event_read_multi_line)
+{
+    int pipefd[2];
+
+    ASSERT_EQ(pipe(pipefd), 0) << "Test pipe cannot be created ["<<strerror(errno)<<"]";
+    int retval = fcntl( pipefd[0], F_SETFL, fcntl(pipefd[0], F_GETFL) | O_NONBLOCK);
+    ASSERT_EQ(retval, 0) << "Cannot make nonblocking pipe";
+
+    processor_event_manager_t<net::processors::md5_t<>> manager(pipefd[1]);
+
+    ASSERT_TRUE(manager.test_parse_lines(test_str + "\n" + test_str)) << "Writing to buffer failure";
+    ASSERT_TRUE(manager.test_parse_lines("\n")) << "Writing to buffer failure";
+
+    ASSERT_EQ(read_all(pipefd[0]), etalon + etalon) << "Received hashes don't match";
+
+    close(pipefd[0]);
+    close(pipefd[1]);
+}
+
+
+TEST_F(hash_calc_test, evp_algorithms)
+{
+    auto check = [this](auto hash, const std::string& expected)
+    {
+        hash.process(test_str);
+        ASSERT_EQ(hash.get_result(), hex_case(expected) + "\n") << "Hash calculation test failed";
+        ASSERT_EQ(decltype(hash)::RESULT_LEN, expected.size() + 1) << "Wrong result length";
+    };
+
+    check(net::processors::evp_hash_t<net::processors::algo::sha1>(),
+          "2EA6201A068C5FA0EEA5D81A3863321A87F8D533");
+    check(net::processors::evp_hash_t<net::processors::algo::sha256>(),
+          "2558A34D4D20964CA1D272AB26CCCE9511D880579593CD4C9E01AB91ED00F325");
+    check(net::processors::evp_hash_t<net::processors::algo::blake2s256>(),
+          "604258B7448D6DB9E53E2043F133E33A50748F75A4C5AB3D25A5AC06155C133D");
+}
+
+
+TEST_F(hash_calc_test, algorithm_by_name)
+{
+    size_t result_len = 0;
+    auto get_len = [&](auto tag){result_len = decltype(tag)::type::RESULT_LEN;};
+
+    ASSERT_TRUE(net::processors::with_algorithm("md5", get_len)) << "md5 must be available";
+    ASSERT_EQ(result_len, etalon.size());
+
+    ASSERT_TRUE(net::processors::with_algorithm("sha256", get_len)) << "sha256 must be available";
+    ASSERT_EQ(result_len, 65);
+
+    ASSERT_FALSE(net::processors::with_algorithm("crc32", get_len)) << "Unknown algorithm accepted";
+}
+
+
+namespace
+{
+    /** Algorithm which OpenSSL doesn't provide, as BLAKE2S-256 under FIPS provider*/
+    struct missing_algo_t
+    {
+        constexpr static const char* NAME = "missing";
+        constexpr static size_t DIGEST_SIZE = 16;
+        static const EVP_MD* md() {return net::processors::algo::fetch_md("NO-SUCH-DIGEST");}
+    };
+}
+
+
+TEST_F(hash_calc_test, evp_missing_digest)
+{
+    using missing_t = net::processors::evp_hash_t<missing_algo_t>;
+    ASSERT_FALSE(net::processors::is_available<missing_t>()) << "Missing digest must be detected";
+    ASSERT_TRUE(net::processors::is_available<net::processors::hash_t>());
+    ASSERT_TRUE(net::processors::is_available<net::processors::md5_mb_t>());
+
+    // Processor doesn't touch uninitialized context and gives zero digest instead of garbage
+    missing_t hash;
+    hash.process(test_str);
+    ASSERT_EQ(hash.get_result(), std::string(32, '0') + "\n");
+
+    std::string_view lines[] = {"a", "", test_str};
+    std::string out(3 * missing_t::RESULT_LEN, 'x');
+    hash.process_batch(lines, 3, out.data());
+    for (size_t i = 0; i < 3; ++i)
+    {
+        ASSERT_EQ(out.substr(i * missing_t::RESULT_LEN, missing_t::RESULT_LEN), std::string(32, '0') + "\n");
+    }
+}
+
+
+TEST_F(hash_calc_test, event_slow_reader_backpressure)
+{
+    int sv[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0) << "Test socket pair cannot be created ["<<strerror(errno)<<"]";
+    for (auto fd : sv)
+    {
+        ASSERT_EQ(fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK), 0) << "Cannot make nonblocking socket";
+    }
+    int sndbuf = 4096;
+    setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+    auto text = random_lines(6000, 20);
+    auto etalon_all = reference_hashes(text);
+
+    processor_event_manager_t<net::processors::md5_mb_t, true> manager(sv[0]);
+
+    // Client sends everything but reads results slowly
+    std::string received;
+    size_t sent = 0;
+    bool paused = false;
+    char buf[1000];
+    for (int i = 0; i < 100000 && !manager.is_eof(); ++i)
+    {
+        if (sent < text.size())
+        {
+            auto count = write(sv[1], text.data() + sent, std::min<size_t>(4096, text.size() - sent));
+            sent += std::max<ssize_t>(count, 0);
+            if (sent == text.size())
+            {
+                shutdown(sv[1], SHUT_WR);
+            }
+        }
+
+        manager.test_process_data();
+        paused |= manager.is_paused();
+
+        auto count = read(sv[1], buf, sizeof(buf));
+        if (count > 0)
+        {
+            received.append(buf, count);
+        }
+        manager.test_process_output();
+    }
+    received += read_all(sv[1]);
+
+    ASSERT_TRUE(paused) << "Reading wasn't paused for slow reader";
+    ASSERT_TRUE(manager.is_eof()) << "Connection must be finished after all results are sent";
+    ASSERT_EQ(received, etalon_all) << "Results were lost";
+
+    close(sv[0]);
+    close(sv[1]);
+}
+
+
 TEST_F(hash_calc_test, event_create_delete)
 {
     const int test_fd = 111;
@@ -182,6 +624,160 @@ TEST_F(hash_calc_test, connection_pool_test)
 }
 
 
+
+TEST_F(hash_calc_test, event_read_budget)
+{
+    int sv[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0) << "Test socket pair cannot be created ["<<strerror(errno)<<"]";
+    for (auto fd : sv)
+    {
+        int size = 4 << 20;
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+        ASSERT_EQ(fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK), 0) << "Cannot make nonblocking socket";
+    }
+
+    using manager_t = processor_event_manager_t<net::processors::md5_mb_t, true>;
+    auto text = random_lines(1000, 2000);
+    ASSERT_GT(text.size(), 2 * manager_t::READ_BUDGET);
+
+    size_t sent = 0;
+    while (sent < text.size())
+    {
+        auto count = write(sv[1], text.data() + sent, text.size() - sent);
+        ASSERT_GT(count, 0) << "Socket buffer is too small for test";
+        sent += count;
+    }
+    shutdown(sv[1], SHUT_WR);
+
+    // Bulk data is read by budgets. Connection stays ready while data remains
+    manager_t manager(sv[0]);
+    size_t calls = 0;
+    while (manager.test_process_data())
+    {
+        ASSERT_TRUE(manager.is_ready());
+        ASSERT_FALSE(manager.is_eof());
+        ++calls;
+    }
+    ASSERT_GE(calls, text.size() / manager_t::READ_BUDGET) << "Read budget wasn't applied";
+    ASSERT_FALSE(manager.is_ready());
+    ASSERT_TRUE(manager.is_eof());
+
+    ASSERT_EQ(read_all(sv[1]), reference_hashes(text)) << "Results were lost";
+    close(sv[1]);
+}
+
+TEST_F(hash_calc_test, slab_allocator_reuse)
+{
+    using slab_t = net::slab_allocator_t<100>;
+    slab_t slab;
+
+    ASSERT_EQ(slab_t::SLOT_SIZE, 128) << "Slot must be rounded to cache line";
+
+    std::vector<void*> slots;
+    for (int i = 0; i < 1000; ++i)
+    {
+        slots.push_back(slab.allocate());
+        ASSERT_EQ(reinterpret_cast<uintptr_t>(slots.back()) % slab_t::CACHE_LINE, 0) << "Slot is not aligned";
+    }
+    ASSERT_EQ(std::set<void*>(slots.begin(), slots.end()).size(), slots.size()) << "Slot given twice";
+
+    // Half is freed by owner thread and half by other thread
+    for (size_t i = 0; i < slots.size() / 2; ++i)
+    {
+        slab_t::deallocate(slots[i]);
+    }
+    std::thread([&]{
+        for (size_t i = slots.size() / 2; i < slots.size(); ++i)
+        {
+            slab_t::deallocate(slots[i]);
+        }
+    }).join();
+
+    auto stats = slab.stats();
+    ASSERT_EQ(stats.in_use, 0);
+    ASSERT_EQ(stats.remote_frees, slots.size() / 2);
+
+    // Both local and remote freed slots are reused, no new chunks taken
+    auto chunks = stats.chunks;
+    for (size_t i = 0; i < slots.size(); ++i)
+    {
+        slab.allocate();
+    }
+    stats = slab.stats();
+    ASSERT_EQ(stats.reuses, slots.size()) << "Freed slots are not reused";
+    ASSERT_EQ(stats.chunks, chunks) << "New chunks taken while free slots exist";
+}
+
+
+TEST_F(hash_calc_test, slab_allocator_orphan)
+{
+    using slab_t = net::slab_allocator_t<100>;
+    slab_t slab;
+    constexpr size_t count = 1000;
+
+    // Threads come and go as event loop threads of elastic pool. Each one frees part of its
+    // slots itself, the rest is freed by other thread after it exited
+    std::vector<void*> slots;
+    size_t chunks = 0;
+    for (int round = 0; round < 4; ++round)
+    {
+        std::thread([&]{
+            for (size_t i = 0; i < count; ++i)
+            {
+                slots.push_back(slab.allocate());
+            }
+            for (size_t i = 0; i < count / 2; ++i)
+            {
+                slab_t::deallocate(slots.back());
+                slots.pop_back();
+            }
+        }).join();
+
+        for (auto slot : slots)
+        {
+            slab_t::deallocate(slot);
+        }
+        slots.clear();
+
+        auto stats = slab.stats();
+        ASSERT_EQ(stats.in_use, 0);
+        if (round)
+        {
+            ASSERT_EQ(stats.reuses, round * count) << "Orphaned slab is not adopted with its free slots";
+            ASSERT_EQ(stats.chunks, chunks) << "Chunks taken again after thread exit";
+        }
+        chunks = stats.chunks;
+    }
+
+    // Thread which adopted slab of exited one frees its slots locally
+    std::thread([&]{
+        auto remote_frees = slab.stats().remote_frees;
+        slab_t::deallocate(slab.allocate());
+        ASSERT_EQ(slab.stats().remote_frees, remote_frees) << "Adopted slab is not owned by thread";
+    }).join();
+}
+
+
+TEST_F(hash_calc_test, connection_pool_slab)
+{
+    int pipefd[2];
+
+    ASSERT_EQ(pipe(pipefd), 0) << "Test pipe cannot be created ["<<strerror(errno)<<"]";
+
+    net::connection_pool_t<net::hash_ev_manager_t> pool(2);
+    ASSERT_EQ(pool.add_connection(pipefd[0]), 0) << "Add new connection to connection_pool failed";
+    ASSERT_EQ(pool.slab_stats().in_use, 1) << "Connection is not allocated from slab";
+
+    // Closing write side gives EOF, event loop deletes connection
+    close(pipefd[1]);
+    for (int i = 0; i < 100 && pool.slab_stats().in_use; ++i)
+    {
+        usleep(10000);
+    }
+    ASSERT_EQ(pool.slab_stats().in_use, 0) << "Connection is not returned to slab";
+}
+
+
 TEST_F(hash_calc_test, server_test)
 {
     net::server_t<fake_socket_t, net::hash_ev_manager_t> server(1);
@@ -192,3 +788,1263 @@ TEST_F(hash_calc_test, server_test)
     ASSERT_EQ(server_counter, max_counter) << "Server Created";
 }
 
+
+
+TEST_F(hash_calc_test, server_reuse_port)
+{
+    constexpr uint16_t port = 55123;
+    net::hash_server_t server(4);
+
+    net::listen_options_t options;
+    options.reuse_port = true;
+    options.backlog    = 128;
+    std::thread thr([&]{server.run(port, options);});
+    thread_guard_t guard{thr, [&]{server.kill();}};
+
+    // Several connections are spread between listeners of all threads
+    for (int i = 0; i < 8; ++i)
+    {
+        ASSERT_EQ(request(port, test_str + "\n"), etalon);
+    }
+
+    server.kill();
+    thr.join();
+}
+
+
+TEST_F(hash_calc_test, server_uring_backend)
+{
+    if (!net::uring_t::is_supported())
+    {
+        GTEST_SKIP() << "io_uring is not supported by kernel";
+    }
+
+    constexpr uint16_t port = 55124;
+    net::server_t<net::tcp_soct_t, net::hash_ev_manager_t, net::uring_pool_t> server(2);
+    std::thread thr([&]{server.run(port);});
+    thread_guard_t guard{thr, [&]{server.kill();}};
+
+    // Big upload goes through many provided buffers and pauses receiving while results wait
+    auto text = random_lines(20000, 100);
+    ASSERT_EQ(request(port, text), reference_hashes(text));
+    ASSERT_EQ(request(port, test_str + "\n\n" + test_str), etalon + hex_case("D41D8CD98F00B204E9800998ECF8427E\n"));
+
+    server.kill();
+    thr.join();
+}
+
+
+TEST_F(hash_calc_test, ring_queues)
+{
+    constexpr size_t count = 200000;
+
+    // Values come out in order and ring is full at its capacity
+    net::spsc_ring_t<size_t> spsc(5);
+    for (size_t i = 0; i < 8; ++i)
+    {
+        ASSERT_TRUE(spsc.push(i));
+    }
+    ASSERT_FALSE(spsc.push(8)) << "Capacity must be rounded to power of 2";
+    size_t value = 0;
+    for (size_t i = 0; i < 8; ++i)
+    {
+        ASSERT_TRUE(spsc.pop(value));
+        ASSERT_EQ(value, i);
+    }
+    ASSERT_FALSE(spsc.pop(value));
+
+    std::thread producer([&]{
+        for (size_t i = 0; i < count; ++i)
+        {
+            while (!spsc.push(i))
+            {
+                std::this_thread::yield();
+            }
+        }
+    });
+    // Producer is joined before order is asserted, so it isn't left waiting for full ring
+    bool ordered = true;
+    for (size_t i = 0; i < count; ++i)
+    {
+        while (!spsc.pop(value))
+        {
+            std::this_thread::yield();
+        }
+        ordered = ordered && value == i;
+    }
+    producer.join();
+    ASSERT_TRUE(ordered) << "SPSC ring lost order";
+
+    // Each producer's values keep their order
+    constexpr size_t producers = 4;
+    net::mpsc_ring_t<size_t> mpsc(64);
+    std::vector<std::thread> threads;
+    for (size_t p = 0; p < producers; ++p)
+    {
+        threads.emplace_back([&, p]{
+            for (size_t i = 0; i < count; ++i)
+            {
+                while (!mpsc.push(p * count + i))
+                {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    std::vector<size_t> next(producers, 0);
+    for (size_t i = 0; i < producers * count; ++i)
+    {
+        while (!mpsc.pop(value))
+        {
+            std::this_thread::yield();
+        }
+        ordered = ordered && value % count == next[value / count]++;
+    }
+    for (auto& thr : threads)
+    {
+        thr.join();
+    }
+    ASSERT_TRUE(ordered) << "MPSC ring lost order";
+    ASSERT_FALSE(mpsc.pop(value));
+}
+
+
+TEST_F(hash_calc_test, server_hash_pipeline)
+{
+    constexpr uint16_t port = 55125;
+
+    // The smallest memory budget makes connections wait for jobs
+    net::pipeline_options_t pipeline;
+    pipeline.workers = 3;
+    pipeline.memory = 0;
+    net::server_t<net::tcp_soct_t, net::hash_ev_manager_t> server(2, pipeline);
+    std::thread thr([&]{server.run(port);});
+    thread_guard_t guard{thr, [&]{server.kill();}};
+
+    auto text = random_lines(20000, 300);
+    std::vector<std::string> results(4);
+    std::vector<std::thread> clients;
+    for (auto& result : results)
+    {
+        clients.emplace_back([&]{result = request(port, text);});
+    }
+    for (auto& client : clients)
+    {
+        client.join();
+    }
+    for (auto& result : results)
+    {
+        ASSERT_EQ(result, reference_hashes(text)) << "Results of pipeline are lost or reordered";
+    }
+    ASSERT_EQ(request(port, test_str + "\n\n" + test_str), etalon + hex_case("D41D8CD98F00B204E9800998ECF8427E\n"));
+
+    server.kill();
+    thr.join();
+}
+
+
+TEST_F(hash_calc_test, server_bulk_upload)
+{
+    constexpr uint16_t port = 55126;
+
+    // Connection switches to workers in the middle of upload
+    net::pipeline_options_t pipeline;
+    pipeline.workers = 4;
+    pipeline.bulk_threshold = 100 * 1024;
+    net::server_t<net::tcp_soct_t, net::hash_ev_manager_t> server(1, pipeline);
+    std::thread thr([&]{server.run(port);});
+    thread_guard_t guard{thr, [&]{server.kill();}};
+
+    // Long lines are continued through many reads and jobs
+    auto text = random_lines(5000, 60) + random_lines(50, 300000) + random_lines(20000, 200);
+    ASSERT_EQ(request(port, text), reference_hashes(text)) << "Results of bulk upload are lost or reordered";
+    ASSERT_EQ(request(port, test_str + "\n"), etalon) << "Short request is not hashed";
+
+    server.kill();
+    thr.join();
+}
+
+
+TEST_F(hash_calc_test, placement_policies)
+{
+    net::thread_load_t loads[4];
+    size_t connections[] = {3, 1, 2, 5};
+    size_t bytes[]       = {10, 50, 0, 0};
+    for (size_t i = 0; i < 4; ++i)
+    {
+        loads[i].connections = connections[i];
+        loads[i].bytes = bytes[i];
+    }
+
+    auto round_robin = net::make_placement("round-robin");
+    for (size_t i = 0; i < 8; ++i)
+    {
+        ASSERT_EQ(round_robin->select(loads, 4), i % 4);
+    }
+    ASSERT_EQ(net::make_placement("least-conn")->select(loads, 4), 1);
+    ASSERT_EQ(net::make_placement("least-bytes")->select(loads, 4), 2) << "Equal bytes must be decided by connections";
+
+    // Of two threads the less loaded one is always chosen
+    auto two_choices = net::make_placement("p2c");
+    for (int i = 0; i < 100; ++i)
+    {
+        ASSERT_EQ(two_choices->select(loads + 2, 2), 0);
+    }
+    ASSERT_EQ(net::make_placement("random"), nullptr);
+}
+
+
+TEST_F(hash_calc_test, connection_pool_rebalance)
+{
+    constexpr uint16_t port = 55127;
+    constexpr size_t clients_num = 8;
+
+    net::placement_options_t placement;
+    placement.rebalance = true;
+    net::connection_pool_t<net::hash_ev_manager_t> pool(2, {}, placement);
+
+    // All connections are accepted by the first thread
+    net::tcp_soct_t listener;
+    net::listen_options_t options;
+    options.reuse_port = true;
+    listener.create(port, options);
+    ASSERT_EQ(pool.add_listener(0, listener.get_fd()), 0);
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    std::vector<int> clients;
+    for (size_t i = 0; i < clients_num; ++i)
+    {
+        clients.push_back(socket(AF_INET, SOCK_STREAM, 0));
+        ASSERT_EQ(connect(clients.back(), (sockaddr*)&addr, sizeof(addr)), 0);
+    }
+
+    // Connections are moved when they become idle after request
+    auto requests = [&]
+    {
+        for (auto fd : clients)
+        {
+            auto line = test_str + "\n";
+            ASSERT_EQ(write(fd, line.data(), line.size()), static_cast<ssize_t>(line.size()));
+            std::string result(etalon.size(), 0);
+            ASSERT_EQ(recv(fd, result.data(), result.size(), MSG_WAITALL), static_cast<ssize_t>(result.size()));
+            ASSERT_EQ(result, etalon);
+        }
+    };
+    requests();
+    ASSERT_EQ(pool.load(0).connections, clients_num);
+    ASSERT_EQ(pool.load(1).connections, 0);
+
+    for (int i = 0; i < 30 && pool.load(1).connections < clients_num / 2; ++i)
+    {
+        usleep(100000);
+        requests();
+    }
+    ASSERT_EQ(pool.load(0).connections, clients_num / 2) << "Connections were not rebalanced";
+    ASSERT_EQ(pool.load(1).connections, clients_num / 2);
+
+    // Moved connections still work and are deleted by their new thread
+    requests();
+    for (auto fd : clients)
+    {
+        close(fd);
+    }
+    for (int i = 0; i < 100 && pool.slab_stats().in_use; ++i)
+    {
+        usleep(10000);
+    }
+    ASSERT_EQ(pool.load(0).connections + pool.load(1).connections, 0);
+    listener.kill();
+}
+
+
+TEST_F(hash_calc_test, timer_wheel)
+{
+    using namespace std::chrono;
+    net::timer_wheel_t wheel(milliseconds{10});
+    auto start = net::timer_wheel_t::clock_t::now();
+    ASSERT_EQ(wheel.next_timeout(start), -1);
+
+    // Delays of all levels, some of them cancelled or moved
+    std::vector<milliseconds> delays = {10ms, 50ms, 640ms, 700ms, 5s, 41s, 50s, 12min};
+    std::vector<net::timer_node_t> nodes(delays.size());
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        nodes[i].owner = &nodes[i];
+        wheel.schedule(nodes[i], start + delays[i]);
+    }
+    wheel.cancel(nodes[1]);
+    wheel.schedule(nodes[2], start + 900ms);
+    delays[2] = 900ms;
+    ASSERT_EQ(wheel.size(), nodes.size() - 1);
+
+    // Each timer expires once, not earlier than its delay and not later than next tick
+    std::vector<milliseconds> expired(nodes.size(), milliseconds{-1});
+    auto now = start;
+    while (wheel.size())
+    {
+        auto wait = wheel.next_timeout(now);
+        ASSERT_GE(wait, 0);
+        now += milliseconds{std::max(wait, 1)};
+        wheel.advance(now, [&](net::timer_node_t& node)
+        {
+            auto i = &node - nodes.data();
+            ASSERT_EQ(expired[i].count(), -1) << "Timer " << i << " expired twice";
+            expired[i] = duration_cast<milliseconds>(now - start);
+        });
+    }
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        if (i == 1)
+        {
+            ASSERT_EQ(expired[i].count(), -1) << "Cancelled timer expired";
+            continue;
+        }
+        ASSERT_GE(expired[i], delays[i] - 10ms) << "Timer " << i;
+        ASSERT_LE(expired[i], delays[i] + 20ms) << "Timer " << i;
+    }
+}
+
+
+TEST_F(hash_calc_test, connection_pool_timeouts)
+{
+    using namespace std::chrono;
+    constexpr uint16_t port = 55129;
+
+    net::timeout_options_t timeouts;
+    timeouts.idle  = 300ms;
+    timeouts.read  = 200ms;
+    timeouts.write = 200ms;
+    auto pool = std::make_unique<net::connection_pool_t<net::hash_ev_manager_t>>(1, net::pipeline_options_t{}, net::placement_options_t{}, timeouts);
+
+    net::tcp_soct_t listener;
+    net::listen_options_t options;
+    options.reuse_port = true;
+    listener.create(port, options);
+    ASSERT_EQ(pool->add_listener(0, listener.get_fd()), 0);
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    auto connect_client = [&]
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        EXPECT_EQ(connect(fd, (sockaddr*)&addr, sizeof(addr)), 0);
+        return fd;
+    };
+
+    // Returns time until server closed connection
+    auto wait_close = [](int fd)
+    {
+        auto start = steady_clock::now();
+        char buf[4096];
+        while (read(fd, buf, sizeof(buf)) > 0);
+        return duration_cast<milliseconds>(steady_clock::now() - start);
+    };
+
+    // Requests move idle deadline
+    int idle = connect_client();
+    auto start = steady_clock::now();
+    for (int i = 0; i < 4; ++i)
+    {
+        usleep(150000);
+        auto line = test_str + "\n";
+        ASSERT_EQ(write(idle, line.data(), line.size()), static_cast<ssize_t>(line.size()));
+        std::string result(etalon.size(), 0);
+        ASSERT_EQ(recv(idle, result.data(), result.size(), MSG_WAITALL), static_cast<ssize_t>(result.size()));
+        ASSERT_EQ(result, etalon);
+    }
+    wait_close(idle);
+    ASSERT_GE(steady_clock::now() - start, 900ms) << "Active connection was closed";
+    close(idle);
+
+    // Client which started line and stopped
+    int slow = connect_client();
+    ASSERT_EQ(write(slow, "abc", 3), 3);
+    auto closed = wait_close(slow);
+    ASSERT_GE(closed, 150ms);
+    ASSERT_LT(closed, 1000ms);
+    close(slow);
+
+    // Client which doesn't read results
+    int stuck = connect_client();
+    int small = 4096;
+    setsockopt(stuck, SOL_SOCKET, SO_RCVBUF, &small, sizeof(small));
+    auto text = random_lines(100000, 100);
+    auto writer = std::thread([&]{for (size_t sent = 0; sent < text.size();)
+    {
+        auto count = send(stuck, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+        if (count <= 0)
+        {
+            break;
+        }
+        sent += count;
+    }});
+    usleep(1500000);
+    writer.join();
+    ASSERT_EQ(pool->slab_stats().in_use, 0) << "Connection which doesn't read results wasn't closed";
+    close(stuck);
+
+    // Threads sleep without timeout and are woken to stop
+    start = steady_clock::now();
+    pool.reset();
+    ASSERT_LT(steady_clock::now() - start, 200ms);
+    listener.kill();
+}
+
+
+TEST_F(hash_calc_test, cpu_layout)
+{
+    std::vector<int> cpus;
+    ASSERT_TRUE(net::cpu_layout_t::parse_list("0-3,8, 10-11", cpus));
+    ASSERT_EQ(cpus, (std::vector<int>{0, 1, 2, 3, 8, 10, 11}));
+    ASSERT_FALSE(net::cpu_layout_t::parse_list("3-1", cpus));
+    ASSERT_FALSE(net::cpu_layout_t::parse_list("a", cpus));
+    ASSERT_FALSE(net::cpu_layout_t::parse_list("", cpus));
+
+    // Each online CPU is known and each core has one CPU in physical_cores
+    auto topology = net::cpu_layout_t::detect();
+    ASSERT_EQ(topology.size(), static_cast<size_t>(sysconf(_SC_NPROCESSORS_ONLN)));
+    auto cores = net::cpu_layout_t::physical_cores(topology);
+    ASSERT_FALSE(cores.empty());
+    ASSERT_LE(cores.size(), topology.size());
+
+    // Pinned threads serve connections and their objects come from allocator of their node
+    constexpr uint16_t port = 55130;
+    net::affinity_options_t affinity;
+    affinity.cpus = {topology.front().cpu};
+    affinity.incoming_cpu = true;
+    net::connection_pool_t<net::hash_ev_manager_t> pool(2, {}, {}, {}, affinity);
+    ASSERT_EQ(pool.cpu(0), topology.front().cpu);
+    ASSERT_EQ(pool.cpu(1), topology.front().cpu);
+
+    net::tcp_soct_t listener;
+    listener.create(port);
+    auto text = random_lines(1000, 100);
+    std::string result;
+    std::thread client([&]{result = request(port, text);});
+    thread_guard_t client_guard{client, [&]{listener.kill();}};
+    int fd;
+    ASSERT_TRUE(listener.wait_new(fd));
+    ASSERT_EQ(pool.add_connection(fd), 0);
+    client.join();
+    ASSERT_EQ(result, reference_hashes(text));
+    ASSERT_EQ(pool.load(0).connections + pool.load(1).connections, 0);
+    ASSERT_EQ(pool.slab_stats().allocations, 1);
+    listener.kill();
+}
+
+
+TEST_F(hash_calc_test, connection_pool_elastic)
+{
+    constexpr uint16_t port = 55131;
+    constexpr size_t clients_num = 4;
+
+    // Thresholds are never reached, pool is resized by test only
+    net::elastic_options_t elastic;
+    elastic.min_threads = 1;
+    elastic.max_threads = 2;
+    elastic.grow_above = 2;
+    elastic.shrink_below = -1;
+    net::connection_pool_t<net::hash_ev_manager_t> pool(1, {}, {}, {}, {}, elastic);
+    ASSERT_EQ(pool.size(), 1);
+    ASSERT_EQ(pool.max_size(), 2);
+    ASSERT_TRUE(pool.add_thread());
+    ASSERT_FALSE(pool.add_thread());
+    ASSERT_EQ(pool.size(), 2);
+
+    net::tcp_soct_t listener;
+    listener.create(port);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    // Round robin gives connections to both threads
+    std::vector<int> clients;
+    for (size_t i = 0; i < clients_num; ++i)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        ASSERT_EQ(connect(fd, (sockaddr*)&addr, sizeof(addr)), 0);
+        int server_fd;
+        ASSERT_TRUE(listener.wait_new(server_fd));
+        ASSERT_EQ(pool.add_connection(server_fd), 0);
+        clients.push_back(fd);
+    }
+
+    auto check_clients = [&]
+    {
+        auto line = test_str + "\n";
+        for (auto fd : clients)
+        {
+            ASSERT_EQ(write(fd, line.data(), line.size()), static_cast<ssize_t>(line.size()));
+            std::string result(etalon.size(), 0);
+            ASSERT_EQ(recv(fd, result.data(), result.size(), MSG_WAITALL), static_cast<ssize_t>(result.size()));
+            ASSERT_EQ(result, etalon);
+        }
+    };
+    check_clients();
+    ASSERT_EQ(pool.load(0).connections, 2);
+    ASSERT_EQ(pool.load(1).connections, 2);
+
+    // Retired thread moves its idle connections to the running one
+    ASSERT_TRUE(pool.retire_thread());
+    ASSERT_FALSE(pool.retire_thread());
+    ASSERT_EQ(pool.size(), 1);
+    for (int i = 0; i < 100 && pool.load(1).connections; ++i)
+    {
+        usleep(10000);
+    }
+    ASSERT_EQ(pool.load(1).connections, 0);
+    ASSERT_EQ(pool.load(0).connections, clients_num);
+    check_clients();
+
+    // Stopped thread is started again and takes connections given by others
+    ASSERT_TRUE(pool.add_thread());
+    for (int i = 0; i < 100 && !pool.load(1).connections; ++i)
+    {
+        check_clients();
+        usleep(10000);
+    }
+    ASSERT_GT(pool.load(1).connections, 0);
+    check_clients();
+
+    for (auto fd : clients)
+    {
+        close(fd);
+    }
+    for (int i = 0; i < 100 && pool.slab_stats().in_use; ++i)
+    {
+        usleep(10000);
+    }
+    ASSERT_EQ(pool.slab_stats().in_use, 0);
+    listener.kill();
+}
+
+
+TEST_F(hash_calc_test, connection_pool_elastic_load)
+{
+    constexpr uint16_t port = 55137;
+
+    net::elastic_options_t elastic;
+    elastic.min_threads = 1;
+    elastic.max_threads = 2;
+    elastic.grow_above = 2;
+    elastic.shrink_below = -1;
+    net::connection_pool_t<net::hash_ev_manager_t> pool(2, {}, {}, {}, {}, elastic);
+
+    net::tcp_soct_t listener;
+    listener.create(port);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    // The second connection goes to thread 1. Its client doesn't read results
+    std::vector<int> clients;
+    for (size_t i = 0; i < 2; ++i)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        int rcvbuf = 4096;
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        ASSERT_EQ(connect(fd, (sockaddr*)&addr, sizeof(addr)), 0);
+        int server_fd;
+        ASSERT_TRUE(listener.wait_new(server_fd));
+        ASSERT_EQ(pool.add_connection(server_fd), 0);
+        clients.push_back(fd);
+    }
+    ASSERT_EQ(pool.load(1).connections, 1);
+    auto text = random_lines(400000, 20);
+    auto etalon_all = reference_hashes(text);
+    // Server stops reading when results are not taken, so lines are sent by other thread
+    std::thread writer([&]{ASSERT_EQ(write(clients[1], text.data(), text.size()), static_cast<ssize_t>(text.size()));});
+    thread_guard_t guard{writer, [&]{shutdown(clients[1], SHUT_RDWR);}};
+    for (int i = 0; i < 100 && !pool.load(1).bytes; ++i)
+    {
+        usleep(10000);
+    }
+    ASSERT_GT(pool.load(1).bytes, 0) << "Results must wait for slow reader";
+
+    // Connection with unsent results moves with its bytes in flight
+    ASSERT_TRUE(pool.retire_thread());
+    for (int i = 0; i < 100 && pool.load(1).connections; ++i)
+    {
+        usleep(10000);
+    }
+    ASSERT_EQ(pool.load(1).connections, 0);
+    ASSERT_EQ(pool.load(1).bytes, 0) << "Retired thread keeps load of moved connection";
+    ASSERT_GT(pool.load(0).bytes, 0);
+    ASSERT_LE(pool.load(0).bytes, etalon_all.size() + net::hash_ev_manager_t::READ_BUDGET);
+
+    std::string result(etalon_all.size(), 0);
+    ASSERT_EQ(recv(clients[1], result.data(), result.size(), MSG_WAITALL), static_cast<ssize_t>(result.size()));
+    writer.join();
+    ASSERT_EQ(result, etalon_all);
+    for (int i = 0; i < 100 && pool.load(0).bytes; ++i)
+    {
+        usleep(10000);
+    }
+    ASSERT_EQ(pool.load(0).bytes, 0) << "Load must return to 0 when results are sent";
+
+    for (auto fd : clients)
+    {
+        close(fd);
+    }
+    for (int i = 0; i < 100 && pool.slab_stats().in_use; ++i)
+    {
+        usleep(10000);
+    }
+    listener.kill();
+}
+
+
+TEST_F(hash_calc_test, latency_histogram)
+{
+    // Each value is in bucket which bounds it with 1/16 precision
+    for (uint64_t value : std::vector<uint64_t>{0, 1, 15, 16, 17, 1000, 123456789, uint64_t(1) << 40, UINT64_MAX})
+    {
+        auto index = net::latency_histogram_t::index_of(value);
+        ASSERT_LT(index, net::latency_histogram_t::BUCKETS);
+        auto lower = net::latency_histogram_t::lower_bound(index);
+        ASSERT_LE(lower, value);
+        ASSERT_LE(value - lower, lower / net::latency_histogram_t::SUB_BUCKETS);
+        ASSERT_EQ(net::latency_histogram_t::index_of(lower), index);
+    }
+
+    net::latency_histogram_t first;
+    net::latency_histogram_t second;
+    for (uint64_t i = 1; i <= 900; ++i)
+    {
+        first.record(i * 1000);
+    }
+    second.record(1000000, 100);
+
+    net::histogram_snapshot_t snapshot;
+    first.add_to(snapshot);
+    second.add_to(snapshot);
+    ASSERT_EQ(snapshot.count, 1000);
+    ASSERT_NEAR(double(snapshot.quantile(0.5)), 500000.0, 500000.0 / 16);
+    ASSERT_NEAR(double(snapshot.quantile(0.99)), 1000000.0, 1000000.0 / 16);
+    ASSERT_EQ(snapshot.sum, 900 * 901 / 2 * 1000 + 100000000ull);
+}
+
+
+TEST_F(hash_calc_test, stats_endpoint)
+{
+    constexpr uint16_t port = 55132;
+    constexpr uint16_t stats_port = 55133;
+    net::connection_pool_t<net::hash_ev_manager_t> pool(1);
+
+    net::tcp_soct_t listener;
+    listener.create(port);
+    auto text = random_lines(1000, 100);
+    std::string result;
+    std::thread client([&]{result = request(port, text);});
+    thread_guard_t client_guard{client, [&]{listener.kill();}};
+    int fd;
+    ASSERT_TRUE(listener.wait_new(fd));
+    ASSERT_EQ(pool.add_connection(fd), 0);
+    client.join();
+    ASSERT_EQ(result, reference_hashes(text));
+    for (int i = 0; i < 100 && pool.load(0).connections; ++i)
+    {
+        usleep(10000);
+    }
+
+    // Connection counters are added to thread when it's processed
+    auto& stats = pool.stats(0);
+    ASSERT_EQ(stats.counters[net::connections_opened], 1);
+    ASSERT_EQ(stats.counters[net::connections_closed], 1);
+    ASSERT_EQ(stats.counters[net::bytes_received], text.size());
+    ASSERT_EQ(stats.counters[net::bytes_sent], result.size());
+    ASSERT_EQ(stats.counters[net::lines_hashed], 1000);
+    ASSERT_GT(stats.counters[net::read_calls], 0);
+
+    net::stats_server_t server([&](std::vector<net::stats_group_t>& groups)
+    {
+        groups.emplace_back();
+        groups.back().labels = "port=\"55132\"";
+        pool.collect_stats(groups.back());
+    });
+    server.start_tcp(stats_port);
+
+    auto response = request(stats_port, "GET /metrics HTTP/1.0\r\n\r\n");
+    ASSERT_EQ(response.rfind("HTTP/1.0 200 OK\r\n", 0), 0);
+    ASSERT_NE(response.find("hash_server_lines_hashed_total{port=\"55132\",thread=\"0\"} 1000\n"), std::string::npos);
+    ASSERT_NE(response.find("hash_server_line_latency_seconds_count{port=\"55132\"} 1000\n"), std::string::npos);
+    ASSERT_NE(response.find("# TYPE hash_server_loop_iteration_seconds summary\n"), std::string::npos);
+    ASSERT_NE(response.find("hash_server_connections{port=\"55132\"} 0\n"), std::string::npos);
+    server.stop();
+    listener.kill();
+}
+
+
+
+TEST_F(hash_calc_test, digest_cache)
+{
+    constexpr size_t len = net::processors::hash_t::RESULT_LEN;
+    using cache_t = net::digest_cache_t<len>;
+
+    // The smallest cache has one set
+    net::cache_options_t options;
+    options.memory = 1;
+    options.max_line = 16;
+    cache_t cache(options);
+    ASSERT_EQ(cache.capacity(), cache_t::WAYS);
+
+    auto result_of = [&](const std::string& line)
+    {
+        net::processors::hash_t hash;
+        hash.process(line);
+        return std::string(hash.get_result());
+    };
+
+    char dst[len];
+    ASSERT_FALSE(cache.find("line", dst));
+    cache.insert("line", result_of("line").data());
+    ASSERT_TRUE(cache.find("line", dst));
+    ASSERT_EQ(std::string(dst, len), result_of("line"));
+    ASSERT_FALSE(cache.find("lin", dst));
+    ASSERT_FALSE(cache.find("line2", dst));
+
+    // Long line is not kept
+    std::string long_line(17, 'x');
+    cache.insert(long_line, result_of(long_line).data());
+    ASSERT_FALSE(cache.find(long_line, dst));
+
+    // Referenced line gets second chance, others are replaced in order
+    for (size_t i = 1; i < cache_t::WAYS; ++i)
+    {
+        cache.insert("line" + std::to_string(i), result_of("line" + std::to_string(i)).data());
+    }
+    ASSERT_TRUE(cache.find("line", dst));
+    cache.insert("new", result_of("new").data());
+    ASSERT_TRUE(cache.find("line", dst));
+    ASSERT_TRUE(cache.find("new", dst));
+    ASSERT_FALSE(cache.find("line1", dst));
+    ASSERT_EQ(std::string(dst, len), result_of("new"));
+}
+
+
+TEST_F(hash_calc_test, digest_cache_lines)
+{
+    // Lines of few kinds, some of them are too long for cache
+    std::mt19937 gen(7);
+    auto kinds = random_lines(50, 100);
+    std::vector<std::string_view> lines;
+    for (size_t pos = 0; pos < kinds.size(); pos = kinds.find('\n', pos) + 1)
+    {
+        lines.emplace_back(kinds.data() + pos, kinds.find('\n', pos) - pos + 1);
+    }
+    net::cache_options_t options;
+    options.memory = 1 << 20;
+    options.max_line = 50;
+
+    std::string text;
+    size_t short_lines = 0;
+    for (size_t i = 0; i < 5000; ++i)
+    {
+        auto line = lines[gen() % lines.size()];
+        text += line;
+        short_lines += line.size() - 1 <= options.max_line;
+    }
+
+    auto check = [&](auto processor)
+    {
+        net::thread_stats_t stats;
+        net::digest_cache_t<decltype(processor)::RESULT_LEN> cache(options, &stats);
+        std::vector<char> out;
+        net::hash_lines(processor, text, out, cache);
+        ASSERT_EQ(std::string(out.begin(), out.end()), reference_hashes(text));
+
+        auto hits = stats.counters[net::cache_hits].load();
+        auto misses = stats.counters[net::cache_misses].load();
+        // Each short kind is hashed once, or a few times if it repeats in batch before it's cached
+        ASSERT_EQ(hits + misses, short_lines);
+        ASSERT_LE(misses, 3 * lines.size());
+        ASSERT_GT(stats.counters[net::cache_saved_ns].load(), 0);
+    };
+    check(net::processors::md5_mb_t{});
+    check(net::processors::hash_t{});
+}
+
+
+TEST_F(hash_calc_test, connection_pool_cache)
+{
+    constexpr uint16_t port = 55135;
+    net::cache_options_t cache;
+    cache.memory = 1 << 20;
+    net::connection_pool_t<net::hash_ev_manager_t> pool(1, {}, {}, {}, {}, {}, cache);
+
+    net::tcp_soct_t listener;
+    listener.create(port);
+    std::string text;
+    for (size_t i = 0; i < 1000; ++i)
+    {
+        text += "heartbeat " + std::to_string(i % 10) + "\n";
+    }
+    text += "\n" + test_str + "\n";
+
+    std::string result;
+    std::thread client([&]{result = request(port, text);});
+    thread_guard_t client_guard{client, [&]{listener.kill();}};
+    int fd;
+    ASSERT_TRUE(listener.wait_new(fd));
+    ASSERT_EQ(pool.add_connection(fd), 0);
+    client.join();
+    ASSERT_EQ(result, reference_hashes(text));
+    for (int i = 0; i < 100 && pool.load(0).connections; ++i)
+    {
+        usleep(10000);
+    }
+
+    auto& stats = pool.stats(0);
+    ASSERT_EQ(stats.counters[net::lines_hashed], 1002);
+    ASSERT_GE(stats.counters[net::cache_hits], 900);
+
+    net::stats_group_t group;
+    pool.collect_stats(group);
+    auto bytes = std::find_if(group.metrics.begin(), group.metrics.end(),
+                              [](auto& metric){return std::string(metric.name) == "hash_server_cache_bytes";});
+    ASSERT_NE(bytes, group.metrics.end());
+    ASSERT_GT(bytes->value, 0);
+    ASSERT_LE(bytes->value, cache.memory + cache.memory / 8);
+    listener.kill();
+}
+
+#ifdef HASH_SERVER_TRACE_STAGES
+TEST_F(hash_calc_test, trace_stages)
+{
+    constexpr uint16_t port = 55134;
+    {
+        net::connection_pool_t<net::hash_ev_manager_t> pool(1);
+        net::tcp_soct_t listener;
+        listener.create(port);
+        auto text = random_lines(1000, 100);
+        std::string result;
+        std::thread client([&]{result = request(port, text);});
+        thread_guard_t client_guard{client, [&]{listener.kill();}};
+        int fd;
+        ASSERT_TRUE(listener.wait_new(fd));
+        ASSERT_EQ(pool.add_connection(fd), 0);
+        client.join();
+        ASSERT_EQ(result, reference_hashes(text));
+        listener.kill();
+    }
+
+    // Each stage of connection is in trace of its thread
+    std::string json;
+    net::trace::recorder_t::instance().write_json(json);
+    ASSERT_EQ(json.rfind("{\"traceEvents\":[", 0), 0);
+    for (auto stage : net::trace::stage_names)
+    {
+        ASSERT_NE(json.find(std::string("\"name\":\"") + stage + "\""), std::string::npos) << stage;
+    }
+}
+#endif
+
+
+TEST_F(hash_calc_test, frame_parser)
+{
+    std::mt19937 gen(42);
+    std::vector<std::string> records;
+    for (size_t i = 0; i < 2000; ++i)
+    {
+        // Mostly short records, some of them empty, and a few longer than read buffer
+        auto len = i % 500 == 7 ? 70000 + gen() % 1000 : gen() % 200;
+        std::string record;
+        for (size_t j = 0; j < len; ++j)
+        {
+            record += static_cast<char>(gen());
+        }
+        records.push_back(std::move(record));
+    }
+    auto frames = encode_frames(records);
+    auto etalon_all = reference_digests(records);
+
+    auto check = [&](auto processor, std::string_view preamble)
+    {
+        using processor_t = decltype(processor);
+        net::frame_parser_t<processor_t> parser(!preamble.empty());
+        auto data = std::string(preamble) + frames;
+
+        // Frames are split into pieces of different size, so headers, lengths and records cross them
+        std::vector<char> out;
+        size_t pos = 0;
+        for (size_t piece = 1; pos < data.size(); piece = piece * 3 % 1021 + (piece > 500 ? 65536 : 0))
+        {
+            auto len = std::min(piece, data.size() - pos);
+            ASSERT_TRUE(parser.collect(processor, {data.data() + pos, len}, out).empty());
+            pos += len;
+        }
+        ASSERT_FALSE(parser.is_text());
+        ASSERT_FALSE(parser.failed());
+        ASSERT_FALSE(parser.is_open());
+        ASSERT_EQ(std::string(out.begin(), out.end()), etalon_all) << "Received digests don't match";
+    };
+    check(net::processors::md5_mb_t{}, {});
+    check(net::processors::md5_t<>{}, {});
+    check(net::processors::hash_t{}, {});
+    check(net::processors::md5_mb_t{}, net::frame_parser_t<net::processors::md5_mb_t>::MAGIC);
+}
+
+
+TEST_F(hash_calc_test, frame_parser_errors)
+{
+    using parser_t = net::frame_parser_t<net::processors::md5_mb_t>;
+    net::processors::md5_mb_t processor;
+    std::vector<char> out;
+
+    // Digest of record before unknown frame is given, the rest is ignored
+    auto data = encode_frames({test_str}) + "\x07garbage";
+    parser_t parser;
+    ASSERT_TRUE(parser.collect(processor, data, out).empty());
+    ASSERT_TRUE(parser.failed());
+    ASSERT_EQ(std::string(out.begin(), out.end()), reference_digests({test_str}));
+    ASSERT_TRUE(parser.collect(processor, encode_frames({test_str}), out).empty());
+    ASSERT_EQ(out.size(), net::processors::md5_mb_t::DIGEST_LEN);
+
+    // Length of record longer than 5 bytes of varint
+    parser_t varint;
+    out.clear();
+    varint.collect(processor, std::string("\x02\x01\0\0\0\x80\x80\x80\x80\x80\x01", 11), out);
+    ASSERT_TRUE(varint.failed());
+    ASSERT_TRUE(out.empty());
+
+    // Header and record which aren't finished keep connection open
+    parser_t open;
+    open.collect(processor, std::string("\x01\x03\0", 3), out);
+    ASSERT_TRUE(open.is_open());
+    open.collect(processor, std::string("\0\0ab", 4), out);
+    ASSERT_TRUE(open.is_open());
+    open.collect(processor, "c", out);
+    ASSERT_FALSE(open.is_open());
+    ASSERT_EQ(std::string(out.begin(), out.end()), reference_digests({"abc"}));
+
+    // Connection without preamble is text. Matched part of preamble is given back
+    parser_t text(true);
+    out.clear();
+    ASSERT_EQ(text.collect(processor, std::string("\0H", 2), out), "");
+    ASSERT_TRUE(text.is_open());
+    ASSERT_EQ(text.collect(processor, "ello\n", out), "ello\n");
+    ASSERT_TRUE(text.is_text());
+    ASSERT_EQ(text.preamble(), std::string("\0H", 2));
+    ASSERT_TRUE(out.empty());
+
+    parser_t line(true);
+    ASSERT_EQ(line.collect(processor, test_str + "\n", out), test_str + "\n");
+    ASSERT_TRUE(line.is_text());
+    ASSERT_TRUE(line.preamble().empty());
+}
+
+
+TEST_F(hash_calc_test, connection_pool_binary)
+{
+    constexpr uint16_t port = 55136;
+    using manager_t = net::event_manager_t<net::processors::md5_mb_t, true, net::auto_protocol_t>;
+    net::connection_pool_t<manager_t> pool(2);
+    net::tcp_soct_t listener;
+    listener.create(port);
+
+    std::vector<std::string> records;
+    auto text = random_lines(3000, 100);
+    for (std::string_view lines = text; !lines.empty();)
+    {
+        auto pos = lines.find('\n');
+        records.emplace_back(lines.substr(0, pos));
+        lines.remove_prefix(pos + 1);
+    }
+
+    // Listener negotiates protocol: one client sends preamble and frames, other one sends lines
+    std::string binary, lines;
+    std::thread binary_client([&]{binary = request(port, std::string(net::frame_parser_t<net::processors::md5_mb_t>::MAGIC) + encode_frames(records));});
+    thread_guard_t binary_client_guard{binary_client, [&]{listener.kill();}};
+    int fd;
+    ASSERT_TRUE(listener.wait_new(fd));
+    ASSERT_EQ(pool.add_connection(fd), 0);
+    binary_client.join();
+
+    std::thread text_client([&]{lines = request(port, text);});
+    thread_guard_t text_client_guard{text_client, [&]{listener.kill();}};
+    ASSERT_TRUE(listener.wait_new(fd));
+    ASSERT_EQ(pool.add_connection(fd), 0);
+    text_client.join();
+
+    ASSERT_EQ(binary, reference_digests(records));
+    ASSERT_EQ(lines, reference_hashes(text));
+
+    // Connection is closed after protocol error, results of previous records are sent
+    std::string broken;
+    std::thread broken_client([&]{broken = request(port, std::string(net::frame_parser_t<net::processors::md5_mb_t>::MAGIC) + encode_frames({test_str}) + "\xFF");});
+    thread_guard_t broken_client_guard{broken_client, [&]{listener.kill();}};
+    ASSERT_TRUE(listener.wait_new(fd));
+    ASSERT_EQ(pool.add_connection(fd), 0);
+    broken_client.join();
+    ASSERT_EQ(broken, reference_digests({test_str}));
+    listener.kill();
+}
+
+
+TEST_F(hash_calc_test, line_index_kernels)
+{
+    using splitter_t = net::split::splitter_t;
+    std::mt19937 gen(42);
+    for (size_t iteration = 0; iteration < 500; ++iteration)
+    {
+        // Dense and sparse newlines, '\r' before some of them. Buffer starts at any alignment
+        std::string data(1 + gen() % 3000, 'a');
+        auto density = 2 + gen() % 100;
+        for (auto& symbol : data)
+        {
+            auto value = gen() % density;
+            symbol = 0 == value ? '\n' : 1 == value ? '\r' : static_cast<char>('!' + gen() % 90);
+        }
+        auto offset = gen() % std::min<size_t>(64, data.size());
+        std::string_view buffer(data.data() + offset, data.size() - offset);
+
+        for (bool crlf : {false, true})
+        {
+            std::vector<uint32_t> expected;
+            for (size_t i = 0; i < buffer.size(); ++i)
+            {
+                if ('\n' == buffer[i])
+                {
+                    expected.push_back(i | (crlf && i && '\r' == buffer[i - 1] ? net::split::CR : 0));
+                }
+            }
+
+            for (auto kernel : {splitter_t::kernel_t::generic, splitter_t::kernel_t::sse2, splitter_t::kernel_t::avx2, splitter_t::kernel_t::avx512})
+            {
+                if (!splitter_t::is_supported(kernel))
+                {
+                    continue;
+                }
+                std::vector<uint32_t> offsets(buffer.size());
+                offsets.resize(splitter_t(kernel).index(buffer.data(), buffer.size(), offsets.data(), crlf));
+                ASSERT_EQ(offsets, expected) << splitter_t::name(kernel) << (crlf ? " crlf" : "");
+            }
+        }
+    }
+
+    // Lines of index don't include newline symbols and '\r' before them
+    net::line_index_t index;
+    std::string text = "one\r\ntwo\n\r\nthr\ree\r\nrest\r";
+    ASSERT_EQ(index.build(text, true), 4);
+    std::vector<std::string> lines;
+    index.lines(1).for_each([&](std::string_view line){lines.emplace_back(line);});
+    ASSERT_EQ(lines, (std::vector<std::string>{"two", "", "thr\ree"}));
+    ASSERT_EQ(index.tail(), "rest\r");
+}
+
+
+TEST_F(hash_calc_test, event_crlf_split_buffers)
+{
+    // Lines end with "\r\n" or "\n", some of them have '\r' inside or at their end
+    auto lines = random_lines(2000, 150);
+    std::string text;
+    std::mt19937 gen(1);
+    for (auto symbol : lines)
+    {
+        if ('\n' == symbol && gen() % 2)
+        {
+            text += '\r';
+        }
+        else if ('\n' != symbol && 0 == gen() % 50)
+        {
+            text += '\r';
+            if (0 == gen() % 3)
+            {
+                text += '\r';
+            }
+        }
+        text += symbol;
+    }
+    std::string expected_text;
+    for (size_t i = 0; i < text.size(); ++i)
+    {
+        if ('\r' != text[i] || i + 1 == text.size() || '\n' != text[i + 1])
+        {
+            expected_text += text[i];
+        }
+    }
+    auto etalon_all = reference_hashes(expected_text);
+
+    auto check = [&](auto tag)
+    {
+        int pipefd[2];
+        ASSERT_EQ(pipe(pipefd), 0) << "Test pipe cannot be created ["<<strerror(errno)<<"]";
+        ASSERT_EQ(fcntl(pipefd[0], F_SETFL, fcntl(pipefd[0], F_GETFL) | O_NONBLOCK), 0);
+        processor_event_manager_t<typename decltype(tag)::type, false, net::crlf_protocol_t> manager(pipefd[1]);
+
+        // Pieces split "\r\n" between buffers
+        std::string result;
+        size_t pos = 0;
+        for (size_t piece = 1; pos < text.size(); piece = piece * 3 % 1021)
+        {
+            auto len = std::min(piece, text.size() - pos);
+            ASSERT_TRUE(manager.test_parse_lines({text.data() + pos, len}));
+            pos += len;
+            result += read_all(pipefd[0]);
+        }
+        ASSERT_EQ(result, etalon_all) << "Received hashes don't match";
+        close(pipefd[0]);
+    };
+    check(net::processors::processor_tag_t<net::processors::md5_mb_t>{});
+    check(net::processors::processor_tag_t<net::processors::hash_t>{});
+}
+
+
+TEST_F(hash_calc_test, hex_formatter)
+{
+    std::mt19937 gen(42);
+    std::vector<unsigned char> digests(100 * 64);
+    for (auto& byte : digests)
+    {
+        byte = gen();
+    }
+
+    auto check = [&](auto upper)
+    {
+        constexpr bool UPPER = decltype(upper)::value;
+        using formatter_t = net::hex::formatter_t<UPPER>;
+        for (size_t len : {8, 16, 20, 32, 64})
+        {
+            for (size_t count : {0, 1, 2, 3, 31, 64, 100})
+            {
+                std::string expected;
+                char hex[3];
+                for (size_t i = 0; i < count * len; ++i)
+                {
+                    snprintf(hex, sizeof(hex), UPPER ? "%02X" : "%02x", digests[i]);
+                    expected += hex;
+                    if (0 == (i + 1) % len)
+                    {
+                        expected += '\n';
+                    }
+                }
+
+                for (auto kernel : {formatter_t::kernel_t::scalar, formatter_t::kernel_t::sse2, formatter_t::kernel_t::avx2})
+                {
+                    if (!formatter_t::is_supported(kernel))
+                    {
+                        continue;
+                    }
+                    std::string out(count * (2 * len + 1), '\0');
+                    auto end = formatter_t(kernel).lines(digests.data(), count, len, out.data());
+                    ASSERT_EQ(end, out.data() + out.size());
+                    ASSERT_EQ(out, expected) << formatter_t::name(kernel) << " len " << len << " count " << count;
+                }
+            }
+        }
+
+        // Line numbers count from 1
+        net::hex::line_number_t numbers;
+        std::string out(3 * net::hex::line_number_t::MAX_LEN, '\0');
+        auto end = out.data();
+        for (int i = 0; i < 3; ++i)
+        {
+            end = numbers.write(end);
+        }
+        out.resize(end - out.data());
+        ASSERT_EQ(out, "1 2 3 ");
+
+        // The longest number fills MAX_LEN exactly and nothing is written after it
+        numbers.number = UINT64_MAX - 1;
+        std::string prefix(net::hex::line_number_t::MAX_LEN + 1, '#');
+        ASSERT_EQ(numbers.write(prefix.data()), prefix.data() + net::hex::line_number_t::MAX_LEN);
+        ASSERT_EQ(prefix, std::to_string(UINT64_MAX) + " #");
+    };
+    check(std::true_type{});
+    check(std::false_type{});
+}
+
+
+TEST_F(hash_calc_test, file_hasher)
+{
+    // Short lines, empty lines, lines much longer than chunk and the last line without newline
+    auto text = random_lines(3000, 300) + std::string(5000, 'x') + "\n\n" + random_lines(500, 20) + std::string(70000, 'y') + "\n";
+    auto expected = reference_hashes(text);
+    net::processors::hash_t hash;
+    hash.process("last line");
+    expected += hash.get_result();
+    text += "last line";
+
+    char path[] = "/tmp/hash_server_test_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_NE(fd, -1) << "Test file cannot be created ["<<strerror(errno)<<"]";
+    ASSERT_EQ(write(fd, text.data(), text.size()), static_cast<ssize_t>(text.size()));
+    close(fd);
+
+    auto check = [&](auto tag, const net::file_options_t& options)
+    {
+        FILE* out = tmpfile();
+        ASSERT_NE(out, nullptr);
+        auto stats = net::file_hasher_t<typename decltype(tag)::type>(options).run(path, fileno(out));
+        ASSERT_EQ(stats.bytes, text.size());
+        ASSERT_EQ(stats.lines * net::processors::hash_t::RESULT_LEN, expected.size());
+
+        std::string result(expected.size() + 1, '\0');
+        rewind(out);
+        result.resize(fread(result.data(), 1, result.size(), out));
+        fclose(out);
+        ASSERT_EQ(result, expected) << "threads " << options.threads << " chunk " << options.chunk;
+    };
+
+    for (size_t threads : {1, 3, 8})
+    {
+        for (size_t chunk : {64, 1000, 1 << 20})
+        {
+            check(net::processors::processor_tag_t<net::processors::md5_mb_t>{}, {threads, chunk});
+            check(net::processors::processor_tag_t<net::processors::hash_t>{}, {threads, chunk});
+        }
+    }
+
+    // Lines with "\r\n" give the same results with crlf option
+    std::string crlf_text;
+    for (auto symbol : text)
+    {
+        crlf_text += '\n' == symbol ? "\r\n" : std::string(1, symbol);
+    }
+    fd = open(path, O_WRONLY | O_TRUNC);
+    ASSERT_EQ(write(fd, crlf_text.data(), crlf_text.size()), static_cast<ssize_t>(crlf_text.size()));
+    close(fd);
+    text = crlf_text;
+    check(net::processors::processor_tag_t<net::processors::md5_mb_t>{}, {4, 64, true});
+    check(net::processors::processor_tag_t<net::processors::md5_mb_t>{}, {4, 4096, true});
+
+    // Lines many times longer than chunk: chunks inside them have no lines and give no results
+    text = std::string(300000, 'z') + "\n" + std::string(100, 'w') + "\n" + std::string(200000, 'v');
+    expected.clear();
+    for (auto line : {std::string(300000, 'z'), std::string(100, 'w'), std::string(200000, 'v')})
+    {
+        hash.process(line);
+        expected += hash.get_result();
+    }
+    fd = open(path, O_WRONLY | O_TRUNC);
+    ASSERT_EQ(write(fd, text.data(), text.size()), static_cast<ssize_t>(text.size()));
+    close(fd);
+    for (size_t chunk : {64, 4096, 100001})
+    {
+        check(net::processors::processor_tag_t<net::processors::md5_mb_t>{}, {3, chunk});
+    }
+
+    // Line numbers continue over chunks
+    {
+        FILE* out = tmpfile();
+        ASSERT_NE(out, nullptr);
+        net::file_hasher_t<net::processors::md5_mb_t, net::hex::line_number_t>({3, 64}).run(path, fileno(out));
+        std::string result(4 * expected.size(), '\0');
+        rewind(out);
+        result.resize(fread(result.data(), 1, result.size(), out));
+        fclose(out);
+        ASSERT_EQ(result, "1 " + expected.substr(0, 33) + "2 " + expected.substr(33, 33) + "3 " + expected.substr(66));
+    }
+
+    // Missing file
+    unlink(path);
+    ASSERT_THROW(net::file_hasher_t<net::processors::hash_t>().run(path, STDOUT_FILENO), std::runtime_error);
+}